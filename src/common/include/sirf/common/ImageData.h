@@ -83,7 +83,7 @@ namespace sirf {
 			return n;
 		}
 
-        void fill(const ImageData& im)
+        virtual void fill(const ImageData& im)
         {
             Iterator_const& src = im.begin();
             Iterator& dst = this->begin();
@@ -18,11 +18,18 @@ limitations under the License.
 
 */
 
+#include <algorithm>
 #include <cstring>
 #include <math.h>
 #include <sstream>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "sirf/Gadgetron/FourierEncoding.h"
+#include "sirf/Gadgetron/gadgetron_fftw.h"
 #include "sirf/iUtilities/LocalisedException.h"
 
 using namespace sirf;
@@ -50,6 +57,133 @@ void sirf::FourierEncoding::match_img_header_to_acquisition(CFImage& img, const
 
 }
 
+void sirf::FourierEncoding::forward_subset(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img) const
+{
+    sirf::AcquisitionsView subset(ac, idx); // forward writes into ac via the view
+    this->forward(subset, img);
+}
+
+void sirf::FourierEncoding::backward_subset(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx) const
+{
+    sirf::AcquisitionsView subset(ac, idx);
+    this->backward(img, subset);
+}
+
+void sirf::FourierEncoding::forward_sense(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const
+{
+    check_csm_dimensions_(img, csm);
+    size_t const vol = img.getNumberOfDataElements();
+    unsigned int const nc = csm.getNumberOfChannels();
+
+    CFImage coil_img(csm);
+    coil_img.setHead(img.getHead());
+    coil_img.setNumberOfChannels(nc);
+    const complex_float_t* u = img.getDataPtr();
+    const complex_float_t* s = csm.getDataPtr();
+    complex_float_t* v = coil_img.getDataPtr();
+    for (unsigned int c = 0; c < nc; c++)
+        for (size_t i = 0; i < vol; i++)
+            v[c*vol + i] = u[i] * s[c*vol + i];
+
+    this->forward_subset(ac, idx, coil_img);
+}
+
+void sirf::FourierEncoding::backward_sense(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& csm) const
+{
+    CFImage coil_img;
+    this->backward_subset(coil_img, ac, idx);
+
+    unsigned int const nx = coil_img.getMatrixSizeX();
+    unsigned int const ny = coil_img.getMatrixSizeY();
+    unsigned int const nz = coil_img.getMatrixSizeZ();
+    unsigned int const nc = coil_img.getNumberOfChannels();
+    if (csm.getMatrixSizeX() != nx || csm.getMatrixSizeY() != ny || csm.getMatrixSizeZ() != nz || csm.getNumberOfChannels() != nc)
+        throw LocalisedException("The data dimensions of the image don't match the sensitivity maps.", __FILE__, __LINE__);
+
+    img.resize(nx, ny, nz, 1);
+    img.setHead(coil_img.getHead());
+    img.setNumberOfChannels(1);
+    size_t const vol = (size_t)nx*ny*nz;
+    const complex_float_t* s = csm.getDataPtr();
+    const complex_float_t* v = coil_img.getDataPtr();
+    complex_float_t* u = img.getDataPtr();
+    std::fill(u, u + vol, complex_float_t(0));
+    for (unsigned int c = 0; c < nc; c++)
+        for (size_t i = 0; i < vol; i++)
+            u[i] += std::conj(s[c*vol + i]) * v[c*vol + i];
+}
+
+void sirf::FourierEncoding::check_csm_dimensions_(const CFImage& img, const CFImage& csm) const
+{
+    if (img.getNumberOfChannels() != 1)
+        throw LocalisedException("The source image has more than one channel.", __FILE__, __LINE__);
+    if (csm.getMatrixSizeX() != img.getMatrixSizeX() || csm.getMatrixSizeY() != img.getMatrixSizeY() || csm.getMatrixSizeZ() != img.getMatrixSizeZ())
+        throw LocalisedException("The data dimensions of the image don't match the sensitivity maps.", __FILE__, __LINE__);
+}
+
+// number of coil images transformed together by the fused SENSE transforms
+static unsigned int channel_block_size_(unsigned int nc)
+{
+#ifdef _OPENMP
+    if (omp_in_parallel())
+        return 1;
+#endif
+    return std::max(1u, std::min(nc, (unsigned int)sirf::FFTWPlanner::num_threads()));
+}
+
+static KSpaceSubset::SetType all_acquisitions_(const MRAcquisitionData& ac)
+{
+    KSpaceSubset::SetType idx(ac.number());
+    for (int i = 0; i < idx.size(); i++)
+        idx[i] = i;
+    return idx;
+}
+
+void sirf::FourierEncoding::normal_sense(CFImage& img_out, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const
+{
+    AcquisitionsVector subset;
+    ac.get_subset(subset, idx);
+    KSpaceSubset::SetType const all = all_acquisitions_(subset);
+    this->forward_sense(subset, all, img, csm);
+    this->backward_sense(img_out, subset, all, csm);
+}
+
+void sirf::FourierEncoding::forward_sense_batch(MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& img, const std::vector<const CFImage*>& csm) const
+{
+    int const num_img = img.size();
+    std::string err;
+#pragma omp parallel for schedule(dynamic) if(num_img > 1 && thread_safe())
+    for (int i = 0; i < num_img; i++) {
+        try {
+            this->forward_sense(ac, *idx[i], *img[i], *csm[i]);
+        }
+        catch (const std::exception& e) {
+#pragma omp critical(FourierEncoding_forward_sense_batch)
+            err = e.what();
+        }
+    }
+    if (!err.empty())
+        throw LocalisedException(err.c_str(), __FILE__, __LINE__);
+}
+
+void sirf::FourierEncoding::backward_sense_batch(const std::vector<CFImage*>& img, const MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& csm) const
+{
+    int const num_img = img.size();
+    std::string err;
+#pragma omp parallel for schedule(dynamic) if(num_img > 1 && thread_safe())
+    for (int i = 0; i < num_img; i++) {
+        try {
+            this->backward_sense(*img[i], ac, *idx[i], *csm[i]);
+        }
+        catch (const std::exception& e) {
+#pragma omp critical(FourierEncoding_backward_sense_batch)
+            err = e.what();
+        }
+    }
+    if (!err.empty())
+        throw LocalisedException(err.c_str(), __FILE__, __LINE__);
+}
+
 /*
 The next two methods:
 
@@ -90,13 +224,26 @@ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
 IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
-namespace ISMRMRD {
-    void fft3c(NDArray<complex_float_t>& a);
-    void ifft3c(NDArray<complex_float_t>& a);
+void sirf::CartesianFourierEncoding::forward(MRAcquisitionData& ac, const CFImage& img) const
+{
+    this->forward_(ac, all_acquisitions_(ac), img, 0);
 }
 
-void sirf::CartesianFourierEncoding::forward(MRAcquisitionData& ac, const CFImage& img) const
+void sirf::CartesianFourierEncoding::forward_subset(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img) const
+{
+    this->forward_(ac, idx, img, 0);
+}
+
+void sirf::CartesianFourierEncoding::forward_sense(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const
+{
+    check_csm_dimensions_(img, csm);
+    this->forward_(ac, idx, img, &csm);
+}
+
+void sirf::CartesianFourierEncoding::forward_(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage* csm) const
 {
+    if (idx.empty())
+        return;
 
     std::string par;
     ISMRMRD::IsmrmrdHeader header;
@@ -108,11 +255,9 @@ void sirf::CartesianFourierEncoding::forward(MRAcquisitionData& ac, const CFImag
 
     ISMRMRD::Encoding e = header.encoding[0];
 
-    ISMRMRD::Acquisition acq;
-    ac.get_acquisition(0, acq);
-
+    const ISMRMRD::AcquisitionHeader& acq_hdr = ac.acquisition_header(idx[0]);
 
-    unsigned int readout = acq.number_of_samples();
+    unsigned int readout = acq_hdr.number_of_samples;
     unsigned int ny_k_space = e.encodedSpace.matrixSize.y;
     unsigned int nz_k_space = e.encodedSpace.matrixSize.z;
 
@@ -127,45 +272,84 @@ void sirf::CartesianFourierEncoding::forward(MRAcquisitionData& ac, const CFImag
     unsigned int nx = img.getMatrixSizeX();
     unsigned int ny = img.getMatrixSizeY();
     unsigned int nz = img.getMatrixSizeZ();
-    unsigned int nc = img.getNumberOfChannels();
+    unsigned int nc = csm ? csm->getNumberOfChannels() : img.getNumberOfChannels();
 
-    if(nx != readout || ny_k_space!= ny || nz_k_space != nz || nc != acq.active_channels())
+    if(nx != readout || ny_k_space!= ny || nz_k_space != nz || nc != acq_hdr.active_channels)
         throw LocalisedException("K-space dimensions and image dimensions don't match.",   __FILE__, __LINE__);
 
+    std::vector<int> ky(idx.size()), kz(idx.size());
+    for(size_t i =0; i<idx.size(); ++i)
+    {
+        const ISMRMRD::AcquisitionHeader& hdr = ac.acquisition_header(idx[i]);
+        if(hdr.number_of_samples != nx || hdr.active_channels != nc)
+            throw LocalisedException("K-space dimensions and image dimensions don't match.",   __FILE__, __LINE__);
 
-    std::vector<size_t> dims;
-    dims.push_back(nx);
-    dims.push_back(ny);
-    dims.push_back(nz);
-    dims.push_back(nc);
-
-    ISMRMRD::NDArray<complex_float_t> ci(dims);
-    memset(ci.getDataPtr(), 0, ci.getDataSize());
-    std::memcpy(ci.getDataPtr(), img.getDataPtr(), img.getDataSize());
+        ky[i] = ny/2 - ky_lim.center + hdr.idx.kspace_encode_step_1;
+        kz[i] = nz/2 - kz_lim.center + hdr.idx.kspace_encode_step_2;
+    }
 
-    ISMRMRD::fft3c(ci);
+    // channels are transformed in blocks: a block of coil images is created
+    // in the FFT buffer (multiplying by the coil maps if given), transformed,
+    // and its sampled lines copied into the acquisitions
+    size_t const vol = (size_t)nx*ny*nz;
+    unsigned int const block = channel_block_size_(nc);
+    const complex_float_t* u = img.getDataPtr();
 
-    for(size_t i =0; i<ac.items(); ++i)
+    for(unsigned int c0 = 0; c0 < nc; c0 += block)
     {
-        ac.get_acquisition(i, acq);
-        acq.resize(nx, nc); // no trajectory information is set
-
-        int ky = ny/2 - ky_lim.center + acq.idx().kspace_encode_step_1;
-        int kz = nz/2 - kz_lim.center + acq.idx().kspace_encode_step_2;
-
-        for (unsigned int c = 0; c < nc; c++) {
-            for (unsigned int s = 0; s < nx; s++) {
-                acq.data(s, c) = ci(s, ky, kz, c);
+        unsigned int const nb = std::min(block, nc - c0);
+
+        std::vector<size_t> dims;
+        dims.push_back(nx);
+        dims.push_back(ny);
+        dims.push_back(nz);
+        dims.push_back(nb);
+
+        ISMRMRD::NDArray<complex_float_t> ci(dims);
+        complex_float_t* v = ci.getDataPtr();
+        if(csm) {
+            const complex_float_t* s = csm->getDataPtr() + c0*vol;
+            for (unsigned int c = 0; c < nb; c++)
+                for (size_t i = 0; i < vol; i++)
+                    v[c*vol + i] = u[i] * s[c*vol + i];
+        }
+        else
+            std::memcpy(v, u + c0*vol, ci.getDataSize());
+
+        ISMRMRD::fft3c(ci);
+
+        for(size_t i =0; i<idx.size(); ++i)
+        {
+            DataSpan<complex_float_t> span = ac.acquisition_data(idx[i]);
+            complex_float_t* data = span.data();
+            for (unsigned int c = 0; c < nb; c++) {
+                for (unsigned int s = 0; s < nx; s++) {
+                    data[(c0 + c)*nx + s] = ci(s, ky[i], kz[i], c);
+                }
             }
         }
-        ac.set_acquisition(i, acq);
     }
 }
 
 void sirf::CartesianFourierEncoding::backward(CFImage& img, const MRAcquisitionData& ac) const
 {
+    this->backward_(img, ac, all_acquisitions_(ac), 0);
+}
+
+void sirf::CartesianFourierEncoding::backward_subset(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx) const
+{
+    this->backward_(img, ac, idx, 0);
+}
 
-    if(ac.items()<1)
+void sirf::CartesianFourierEncoding::backward_sense(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& csm) const
+{
+    this->backward_(img, ac, idx, &csm);
+}
+
+void sirf::CartesianFourierEncoding::backward_(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage* csm) const
+{
+
+    if(idx.size()<1)
         LocalisedException("No acquisitions in vector. Trying to backward transform empty vector.", __FUNCTION__, __LINE__);
 
     ISMRMRD::IsmrmrdHeader header = ac.acquisitions_info().get_IsmrmrdHeader();
@@ -175,12 +359,10 @@ void sirf::CartesianFourierEncoding::backward(CFImage& img, const MRAcquisitionD
 
     ISMRMRD::Encoding e = header.encoding[0];
 
-    ISMRMRD::Acquisition acq;
+    const ISMRMRD::AcquisitionHeader& acq_hdr = ac.acquisition_header(idx[0]);
 
-    ac.get_acquisition(0, acq);
-
-    unsigned int readout = acq.number_of_samples();
-    unsigned int nc = acq.active_channels();
+    unsigned int readout = acq_hdr.number_of_samples;
+    unsigned int nc = acq_hdr.active_channels;
 
     unsigned int ny = e.encodedSpace.matrixSize.y;
     unsigned int nz = e.encodedSpace.matrixSize.z;
@@ -190,12 +372,14 @@ void sirf::CartesianFourierEncoding::backward(CFImage& img, const MRAcquisitionD
     if(nx_img != readout)
         throw LocalisedException("Number of readout points and reconstructed image dimension in readout direction are assumed the same.",   __FILE__, __LINE__);
 
-    std::vector<size_t> dims;
+    unsigned int ny_img = e.reconSpace.matrixSize.y;
+    unsigned int nz_img = e.reconSpace.matrixSize.z;
+
+    if( ny!=ny_img || nz!=nz_img)
+        throw LocalisedException("Phase and slice encoding are not consistent between reconstructed image and k-space.", __FILE__, __LINE__);
 
-    dims.push_back(readout);
-    dims.push_back(ny);
-    dims.push_back(nz);
-    dims.push_back(nc);
+    if(csm && (csm->getMatrixSizeX() != readout || csm->getMatrixSizeY() != ny || csm->getMatrixSizeZ() != nz || csm->getNumberOfChannels() != nc))
+        throw LocalisedException("The data dimensions of the image don't match the sensitivity maps.",   __FILE__, __LINE__);
 
     ISMRMRD::Limit ky_lim, kz_lim(0,0,0);
 
@@ -203,36 +387,588 @@ void sirf::CartesianFourierEncoding::backward(CFImage& img, const MRAcquisitionD
     if(e.encodingLimits.kspace_encoding_step_2.is_present())
         kz_lim = e.encodingLimits.kspace_encoding_step_2.get();
 
-    ISMRMRD::NDArray<complex_float_t> ci(dims);
-    memset(ci.getDataPtr(), 0, ci.getDataSize());
-    
-    for (int a=0; a < ac.number(); a++) {
-        ac.get_acquisition(a, acq);
-        int y = ny/2 - ky_lim.center + acq.idx().kspace_encode_step_1 ;
-        int z = nz/2 - kz_lim.center + acq.idx().kspace_encode_step_2;
-    
-        for (unsigned int c = 0; c < nc; c++) {
-            for (unsigned int s = 0; s < readout; s++) {
-                ci(s, y, z, c) += acq.data(s, c);
+    std::vector<int> ky(idx.size()), kz(idx.size());
+    for (int a=0; a < idx.size(); a++) {
+        const ISMRMRD::AcquisitionHeader& hdr = ac.acquisition_header(idx[a]);
+        if(hdr.number_of_samples != readout || hdr.active_channels != nc)
+            throw LocalisedException("Acquisitions of different shapes cannot be transformed together.", __FILE__, __LINE__);
+        ky[a] = ny/2 - ky_lim.center + hdr.idx.kspace_encode_step_1;
+        kz[a] = nz/2 - kz_lim.center + hdr.idx.kspace_encode_step_2;
+    }
+
+    size_t const vol = (size_t)readout*ny*nz;
+    img.resize(nx_img, ny_img, nz_img, csm ? 1 : nc);
+    complex_float_t* u = img.getDataPtr();
+    if(csm)
+        std::fill(u, u + vol, complex_float_t(0));
+
+    // channels are transformed in blocks: the sampled lines of a block are
+    // placed in the FFT buffer and transformed, and the coil images either
+    // copied to img or, if coil maps are given, combined into it
+    unsigned int const block = channel_block_size_(nc);
+
+    for(unsigned int c0 = 0; c0 < nc; c0 += block)
+    {
+        unsigned int const nb = std::min(block, nc - c0);
+
+        std::vector<size_t> dims;
+        dims.push_back(readout);
+        dims.push_back(ny);
+        dims.push_back(nz);
+        dims.push_back(nb);
+
+        ISMRMRD::NDArray<complex_float_t> ci(dims);
+        std::fill(ci.begin(), ci.end(), complex_float_t(0));
+
+        for (int a=0; a < idx.size(); a++) {
+            DataSpan<const complex_float_t> span = ac.acquisition_data(idx[a]);
+            const complex_float_t* data = span.data();
+            for (unsigned int c = 0; c < nb; c++) {
+                for (unsigned int s = 0; s < readout; s++) {
+                    ci(s, ky[a], kz[a], c) += data[(c0 + c)*readout + s];
+                }
             }
         }
+
+        // now if image and kspace have different dimension then you need to interpolate or pad with zeros here
+        ISMRMRD::ifft3c(ci);
+
+        const complex_float_t* v = ci.getDataPtr();
+        if(csm) {
+            const complex_float_t* s = csm->getDataPtr() + c0*vol;
+            for (unsigned int c = 0; c < nb; c++)
+                for (size_t i = 0; i < vol; i++)
+                    u[i] += std::conj(s[c*vol + i]) * v[c*vol + i];
+        }
+        else
+            std::memcpy(u + c0*vol, v, ci.getDataSize());
     }
 
-    // now if image and kspace have different dimension then you need to interpolate or pad with zeros here
-    ISMRMRD::ifft3c(ci);
+    // set the header correctly of the image
+    ISMRMRD::Acquisition acq;
+    ac.get_acquisition(idx.back(), acq);
+    this->match_img_header_to_acquisition(img, acq);
 
-    unsigned int ny_img = e.reconSpace.matrixSize.y;
-    unsigned int nz_img = e.reconSpace.matrixSize.z;
+}
 
-    if( ny!=ny_img || nz!=nz_img)
+void sirf::CartesianFourierEncoding::normal_sense(CFImage& img_out, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const
+{
+    check_csm_dimensions_(img, csm);
+
+    ISMRMRD::IsmrmrdHeader header = ac.acquisitions_info().get_IsmrmrdHeader();
+    ISMRMRD::Encoding e = header.encoding[0];
+
+    unsigned int nx = img.getMatrixSizeX();
+    unsigned int ny = img.getMatrixSizeY();
+    unsigned int nz = img.getMatrixSizeZ();
+    unsigned int nc = csm.getNumberOfChannels();
+
+    if(e.encodedSpace.matrixSize.y != ny || e.encodedSpace.matrixSize.z != nz)
+        throw LocalisedException("K-space dimensions and image dimensions don't match.",   __FILE__, __LINE__);
+
+    ISMRMRD::Limit ky_lim, kz_lim(0,0,0);
+
+    ky_lim = e.encodingLimits.kspace_encoding_step_1.get();
+    if(e.encodingLimits.kspace_encoding_step_2.is_present())
+        kz_lim = e.encodingLimits.kspace_encoding_step_2.get();
+
+    // the sampling mask is built from the headers only: backward adds up
+    // repeated lines, hence each line is weighted by its number of acquisitions
+    std::vector<float> mask((size_t)ny*nz, 0.f);
+    for(size_t i =0; i<idx.size(); ++i)
+    {
+        const ISMRMRD::AcquisitionHeader& hdr = ac.acquisition_header(idx[i]);
+        if(hdr.number_of_samples != nx || hdr.active_channels != nc)
+            throw LocalisedException("K-space dimensions and image dimensions don't match.",   __FILE__, __LINE__);
+
+        int const ky = ny/2 - ky_lim.center + hdr.idx.kspace_encode_step_1;
+        int const kz = nz/2 - kz_lim.center + hdr.idx.kspace_encode_step_2;
+        if(ky < 0 || ky >= (int)ny || kz < 0 || kz >= (int)nz)
+            throw LocalisedException("K-space line outside the encoded space.",   __FILE__, __LINE__);
+        mask[ky + (size_t)ny*kz] += 1.f;
+    }
+
+    // channels are transformed in blocks, as in forward_ and backward_
+    size_t const vol = (size_t)nx*ny*nz;
+    unsigned int const block = channel_block_size_(nc);
+    const complex_float_t* u = img.getDataPtr();
+    std::vector<complex_float_t> sum(vol, complex_float_t(0));
+
+    for(unsigned int c0 = 0; c0 < nc; c0 += block)
+    {
+        unsigned int const nb = std::min(block, nc - c0);
+
+        std::vector<size_t> dims;
+        dims.push_back(nx);
+        dims.push_back(ny);
+        dims.push_back(nz);
+        dims.push_back(nb);
+
+        ISMRMRD::NDArray<complex_float_t> ci(dims);
+        complex_float_t* v = ci.getDataPtr();
+        const complex_float_t* s = csm.getDataPtr() + c0*vol;
+        for (unsigned int c = 0; c < nb; c++)
+            for (size_t i = 0; i < vol; i++)
+                v[c*vol + i] = u[i] * s[c*vol + i];
+
+        ISMRMRD::fft3c(ci);
+
+        for (unsigned int c = 0; c < nb; c++)
+            for (size_t j = 0; j < (size_t)ny*nz; j++) {
+                float const w = mask[j];
+                complex_float_t* line = v + c*vol + j*nx;
+                if (w == 0.f)
+                    std::fill(line, line + nx, complex_float_t(0));
+                else if (w != 1.f)
+                    for (unsigned int i = 0; i < nx; i++)
+                        line[i] *= w;
+            }
+
+        ISMRMRD::ifft3c(ci);
+
+        for (unsigned int c = 0; c < nb; c++)
+            for (size_t i = 0; i < vol; i++)
+                sum[i] += std::conj(s[c*vol + i]) * v[c*vol + i];
+    }
+
+    img_out = img;
+    std::copy(sum.begin(), sum.end(), img_out.getDataPtr());
+}
+
+namespace {
+
+    // k-space geometry shared by the pruned forward and backward transforms
+    struct CartesianSampling {
+        unsigned int nx, ny, nz, nc;
+        std::vector<int> ky, kz; // matrix positions of the acquired lines
+        std::vector<int> planes; // acquired partitions
+    };
+
+    ISMRMRD::Encoding encoding_(const MRAcquisitionData& ac)
+    {
+        ISMRMRD::IsmrmrdHeader header = ac.acquisitions_info().get_IsmrmrdHeader();
+        if (header.encoding.size() > 1)
+            throw LocalisedException("Currently only one encoding is supported per rawdata file.", __FILE__, __LINE__);
+        return header.encoding[0];
+    }
+
+    void cartesian_sampling_(CartesianSampling& s, const ISMRMRD::Encoding& e,
+        const MRAcquisitionData& ac, const KSpaceSubset::SetType& acqs)
+    {
+        ISMRMRD::Limit ky_lim, kz_lim(0,0,0);
+        ky_lim = e.encodingLimits.kspace_encoding_step_1.get();
+        if (e.encodingLimits.kspace_encoding_step_2.is_present())
+            kz_lim = e.encodingLimits.kspace_encoding_step_2.get();
+
+        unsigned int n = acqs.size();
+        s.ky.resize(n);
+        s.kz.resize(n);
+        std::vector<char> sampled(s.nz, 0);
+        for (unsigned int a = 0; a < n; a++) {
+            const ISMRMRD::EncodingCounters& idx = ac.acquisition_header(acqs[a]).idx;
+            int y = s.ny/2 - ky_lim.center + idx.kspace_encode_step_1;
+            int z = s.nz/2 - kz_lim.center + idx.kspace_encode_step_2;
+            if (y < 0 || y >= (int)s.ny || z < 0 || z >= (int)s.nz)
+                throw LocalisedException("Acquisition outside of the encoded k-space.", __FILE__, __LINE__);
+            s.ky[a] = y;
+            s.kz[a] = z;
+            sampled[z] = 1;
+        }
+        s.planes.clear();
+        for (int z = 0; z < (int)s.nz; z++)
+            if (sampled[z])
+                s.planes.push_back(z);
+    }
+
+    // whether the coil maps of a batch all have the same shape
+    bool same_shape_(const std::vector<const CFImage*>& csm)
+    {
+        for (size_t i = 1; i < csm.size(); i++)
+            if (csm[i]->getMatrixSizeX() != csm[0]->getMatrixSizeX()
+                || csm[i]->getMatrixSizeY() != csm[0]->getMatrixSizeY()
+                || csm[i]->getMatrixSizeZ() != csm[0]->getMatrixSizeZ()
+                || csm[i]->getNumberOfChannels() != csm[0]->getNumberOfChannels())
+                return false;
+        return true;
+    }
+
+}
+
+void sirf::CartesianFourierEncoding::forward_sense_batch(MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& img, const std::vector<const CFImage*>& csm) const
+{
+    int const num_img = img.size();
+    for (int i = 0; i < num_img; i++)
+        check_csm_dimensions_(*img[i], *csm[i]);
+    if (num_img < 2 || !same_shape_(csm)) {
+        FourierEncoding::forward_sense_batch(ac, idx, img, csm);
+        return;
+    }
+
+    ISMRMRD::Encoding e = encoding_(ac);
+
+    CartesianSampling s0;
+    s0.nx = csm[0]->getMatrixSizeX();
+    s0.ny = csm[0]->getMatrixSizeY();
+    s0.nz = csm[0]->getMatrixSizeZ();
+    s0.nc = csm[0]->getNumberOfChannels();
+    const unsigned int nx = s0.nx;
+    const unsigned int ny = s0.ny;
+    const unsigned int nz = s0.nz;
+    const unsigned int nc = s0.nc;
+
+    if (e.encodedSpace.matrixSize.y != ny || e.encodedSpace.matrixSize.z != nz)
+        throw LocalisedException("K-space dimensions and image dimensions don't match.", __FILE__, __LINE__);
+
+    std::vector<CartesianSampling> s(num_img, s0);
+    for (int i = 0; i < num_img; i++) {
+        const KSpaceSubset::SetType& acqs = *idx[i];
+        cartesian_sampling_(s[i], e, ac, acqs);
+        for (size_t a = 0; a < acqs.size(); a++) {
+            const ISMRMRD::AcquisitionHeader& h = ac.acquisition_header(acqs[a]);
+            if (h.number_of_samples != nx || h.active_channels != nc)
+                throw LocalisedException("K-space dimensions and image dimensions don't match.", __FILE__, __LINE__);
+        }
+    }
+
+    // the coil images of all images in the batch are transformed in blocks:
+    // each block is created in the FFT buffer, transformed by one call to
+    // fft3c, and its sampled lines copied into the acquisitions
+    size_t const vol = (size_t)nx*ny*nz;
+    unsigned int const num_vol = num_img*nc;
+    unsigned int const block = channel_block_size_(num_vol);
+
+    for (unsigned int v0 = 0; v0 < num_vol; v0 += block) {
+        int const nb = std::min(block, num_vol - v0);
+
+        std::vector<size_t> dims;
+        dims.push_back(nx);
+        dims.push_back(ny);
+        dims.push_back(nz);
+        dims.push_back(nb);
+
+        ISMRMRD::NDArray<complex_float_t> ci(dims);
+        complex_float_t* v = ci.getDataPtr();
+#pragma omp parallel for schedule(static) if(nb > 1)
+        for (int b = 0; b < nb; b++) {
+            unsigned int const i = (v0 + b) / nc;
+            unsigned int const c = (v0 + b) % nc;
+            const complex_float_t* u = img[i]->getDataPtr();
+            const complex_float_t* w = csm[i]->getDataPtr() + c*vol;
+            complex_float_t* t = v + b*vol;
+            for (size_t j = 0; j < vol; j++)
+                t[j] = u[j] * w[j];
+        }
+
+        ISMRMRD::fft3c(ci);
+
+#pragma omp parallel for schedule(static) if(nb > 1)
+        for (int b = 0; b < nb; b++) {
+            unsigned int const i = (v0 + b) / nc;
+            unsigned int const c = (v0 + b) % nc;
+            const KSpaceSubset::SetType& acqs = *idx[i];
+            const complex_float_t* t = v + b*vol;
+            for (size_t a = 0; a < acqs.size(); a++) {
+                DataSpan<complex_float_t> span = ac.acquisition_data(acqs[a]);
+                const complex_float_t* line = t + ((size_t)s[i].kz[a]*ny + s[i].ky[a])*nx;
+                std::copy(line, line + nx, span.data() + c*nx);
+            }
+        }
+    }
+}
+
+void sirf::CartesianFourierEncoding::backward_sense_batch(const std::vector<CFImage*>& img, const MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& csm) const
+{
+    int const num_img = img.size();
+    if (num_img < 2 || !same_shape_(csm)) {
+        FourierEncoding::backward_sense_batch(img, ac, idx, csm);
+        return;
+    }
+    for (int i = 0; i < num_img; i++)
+        if (idx[i]->empty())
+            throw LocalisedException("No acquisitions in vector. Trying to backward transform empty vector.", __FILE__, __LINE__);
+
+    ISMRMRD::Encoding e = encoding_(ac);
+
+    const ISMRMRD::AcquisitionHeader& h = ac.acquisition_header((*idx[0])[0]);
+
+    CartesianSampling s0;
+    s0.nx = h.number_of_samples;
+    s0.nc = h.active_channels;
+    s0.ny = e.encodedSpace.matrixSize.y;
+    s0.nz = e.encodedSpace.matrixSize.z;
+    const unsigned int nx = s0.nx;
+    const unsigned int ny = s0.ny;
+    const unsigned int nz = s0.nz;
+    const unsigned int nc = s0.nc;
+
+    if (e.reconSpace.matrixSize.x != nx)
+        throw LocalisedException("Number of readout points and reconstructed image dimension in readout direction are assumed the same.", __FILE__, __LINE__);
+    if (e.reconSpace.matrixSize.y != ny || e.reconSpace.matrixSize.z != nz)
         throw LocalisedException("Phase and slice encoding are not consistent between reconstructed image and k-space.", __FILE__, __LINE__);
+    if (csm[0]->getMatrixSizeX() != nx || csm[0]->getMatrixSizeY() != ny || csm[0]->getMatrixSizeZ() != nz || csm[0]->getNumberOfChannels() != nc)
+        throw LocalisedException("The data dimensions of the image don't match the sensitivity maps.", __FILE__, __LINE__);
+
+    std::vector<CartesianSampling> s(num_img, s0);
+    for (int i = 0; i < num_img; i++) {
+        const KSpaceSubset::SetType& acqs = *idx[i];
+        cartesian_sampling_(s[i], e, ac, acqs);
+        for (size_t a = 0; a < acqs.size(); a++) {
+            const ISMRMRD::AcquisitionHeader& ha = ac.acquisition_header(acqs[a]);
+            if (ha.number_of_samples != nx || ha.active_channels != nc)
+                throw LocalisedException("Acquisitions of different shapes cannot be transformed together.", __FILE__, __LINE__);
+        }
+    }
 
-    img.resize(nx_img, ny_img, nz_img, nc);
-    std::memcpy(img.getDataPtr(), ci.getDataPtr(), ci.getDataSize());
+    size_t const vol = (size_t)nx*ny*nz;
+    for (int i = 0; i < num_img; i++) {
+        img[i]->resize(nx, ny, nz, 1);
+        std::fill(img[i]->getDataPtr(), img[i]->getDataPtr() + vol, complex_float_t(0));
+    }
 
-    // set the header correctly of the image
-    this->match_img_header_to_acquisition(img, acq);
+    // the coil images of all images in the batch are transformed in blocks:
+    // the sampled lines of a block are placed in the FFT buffer, transformed
+    // by one call to ifft3c, and combined into the images
+    unsigned int const num_vol = num_img*nc;
+    unsigned int const block = channel_block_size_(num_vol);
+
+    for (unsigned int v0 = 0; v0 < num_vol; v0 += block) {
+        int const nb = std::min(block, num_vol - v0);
+
+        std::vector<size_t> dims;
+        dims.push_back(nx);
+        dims.push_back(ny);
+        dims.push_back(nz);
+        dims.push_back(nb);
+
+        ISMRMRD::NDArray<complex_float_t> ci(dims);
+        complex_float_t* v = ci.getDataPtr();
+        std::fill(v, v + ci.getNumberOfElements(), complex_float_t(0));
+#pragma omp parallel for schedule(static) if(nb > 1)
+        for (int b = 0; b < nb; b++) {
+            unsigned int const i = (v0 + b) / nc;
+            unsigned int const c = (v0 + b) % nc;
+            const KSpaceSubset::SetType& acqs = *idx[i];
+            complex_float_t* t = v + b*vol;
+            for (size_t a = 0; a < acqs.size(); a++) {
+                DataSpan<const complex_float_t> span = ac.acquisition_data(acqs[a]);
+                const complex_float_t* data = span.data() + c*nx;
+                complex_float_t* line = t + ((size_t)s[i].kz[a]*ny + s[i].ky[a])*nx;
+                for (unsigned int x = 0; x < nx; x++)
+                    line[x] += data[x];
+            }
+        }
 
+        ISMRMRD::ifft3c(ci);
+
+        // volumes of the same image go to the same output, hence the voxels
+        // rather than the volumes are shared between the threads
+#pragma omp parallel for schedule(static) if(nb > 1)
+        for (long long j = 0; j < (long long)vol; j++) {
+            for (int b = 0; b < nb; b++) {
+                unsigned int const i = (v0 + b) / nc;
+                unsigned int const c = (v0 + b) % nc;
+                img[i]->getDataPtr()[j] += std::conj(csm[i]->getDataPtr()[c*vol + j]) * v[b*vol + j];
+            }
+        }
+    }
+
+    // set the headers of the images
+    for (int i = 0; i < num_img; i++) {
+        ISMRMRD::Acquisition acq;
+        ac.get_acquisition(idx[i]->back(), acq);
+        this->match_img_header_to_acquisition(*img[i], acq);
+    }
 }
 
+void sirf::PrunedCartesianFourierEncoding::forward_(MRAcquisitionData& ac, const KSpaceSubset::SetType& acqs, const CFImage& img, const CFImage* csm) const
+{
+    if (acqs.empty())
+        return;
+
+    ISMRMRD::Encoding e = encoding_(ac);
+
+    CartesianSampling s;
+    s.nx = img.getMatrixSizeX();
+    s.ny = img.getMatrixSizeY();
+    s.nz = img.getMatrixSizeZ();
+    s.nc = csm ? csm->getNumberOfChannels() : img.getNumberOfChannels();
+
+    if (e.encodedSpace.matrixSize.y != s.ny || e.encodedSpace.matrixSize.z != s.nz)
+        throw LocalisedException("K-space dimensions and image dimensions don't match.", __FILE__, __LINE__);
+
+    cartesian_sampling_(s, e, ac, acqs);
+    const unsigned int nx = s.nx;
+    const unsigned int ny = s.ny;
+    const unsigned int nz = s.nz;
+    const unsigned int nc = s.nc;
+    const int n = acqs.size();
+    for (int a = 0; a < n; a++) {
+        const ISMRMRD::AcquisitionHeader& h = ac.acquisition_header(acqs[a]);
+        if (h.number_of_samples != nx || h.active_channels != nc)
+            throw LocalisedException("K-space dimensions and image dimensions don't match.", __FILE__, __LINE__);
+    }
 
+    std::vector<complex_float_t> prex, postx, prey, posty, prez, postz;
+    sirf::centred_fft_factors(nx, true, prex, postx);
+    sirf::centred_fft_factors(ny, true, prey, posty);
+    sirf::centred_fft_factors(nz, true, prez, postz);
+    const float scale = float(1.0 / std::sqrt(float(nx*ny*nz)));
+    const size_t nxy = (size_t)nx*ny;
+    const size_t vol = nxy*nz;
+    const complex_float_t* src = img.getDataPtr();
+
+    // partition and phase transforms, coil by coil (coil images being
+    // created from the coil maps if given), gathered into the acquisitions
+#pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < (int)nc; c++) {
+        std::vector<complex_float_t> buff(vol);
+        complex_float_t* b = &buff[0];
+        const complex_float_t* u = csm ? src : src + c*vol;
+        const complex_float_t* w = csm ? csm->getDataPtr() + c*vol : 0;
+        for (unsigned int z = 0; z < nz; z++)
+            for (unsigned int y = 0; y < ny; y++) {
+                complex_float_t f = prey[y] * prez[z];
+                size_t i = y*nx + z*nxy;
+                if (w)
+                    for (unsigned int x = 0; x < nx; x++)
+                        b[i + x] = u[i + x] * w[i + x] * prex[x] * f;
+                else
+                    for (unsigned int x = 0; x < nx; x++)
+                        b[i + x] = u[i + x] * prex[x] * f;
+            }
+        if (nz > 1)
+            sirf::fft1(b, nz, (int)nxy, (int)nxy, 1, true);
+        for (int z : s.planes)
+            sirf::fft1(b + z*nxy, ny, nx, nx, 1, true);
+        for (int a = 0; a < n; a++) {
+            int y = s.ky[a];
+            int z = s.kz[a];
+            complex_float_t f = posty[y] * postz[z] * scale;
+            const complex_float_t* line = b + y*nx + z*nxy;
+            DataSpan<complex_float_t> span = ac.acquisition_data(acqs[a]);
+            complex_float_t* d = span.data() + c*nx;
+            for (unsigned int x = 0; x < nx; x++)
+                d[x] = line[x] * f;
+        }
+    }
+
+    // readout transforms of the acquired lines
+#pragma omp parallel for schedule(static)
+    for (int a = 0; a < n; a++) {
+        DataSpan<complex_float_t> span = ac.acquisition_data(acqs[a]);
+        complex_float_t* d = span.data();
+        sirf::fft1(d, nx, 1, nc, nx, true);
+        for (unsigned int c = 0; c < nc; c++, d += nx)
+            for (unsigned int x = 0; x < nx; x++)
+                d[x] *= postx[x];
+    }
+}
+
+void sirf::PrunedCartesianFourierEncoding::backward_(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& acqs, const CFImage* csm) const
+{
+    if (acqs.empty())
+        throw LocalisedException("No acquisitions in vector. Trying to backward transform empty vector.", __FILE__, __LINE__);
+
+    ISMRMRD::Encoding e = encoding_(ac);
+
+    const ISMRMRD::AcquisitionHeader& h = ac.acquisition_header(acqs[0]);
+
+    CartesianSampling s;
+    s.nx = h.number_of_samples;
+    s.nc = h.active_channels;
+    s.ny = e.encodedSpace.matrixSize.y;
+    s.nz = e.encodedSpace.matrixSize.z;
+
+    if (e.reconSpace.matrixSize.x != s.nx)
+        throw LocalisedException("Number of readout points and reconstructed image dimension in readout direction are assumed the same.", __FILE__, __LINE__);
+    if (e.reconSpace.matrixSize.y != s.ny || e.reconSpace.matrixSize.z != s.nz)
+        throw LocalisedException("Phase and slice encoding are not consistent between reconstructed image and k-space.", __FILE__, __LINE__);
+    if (csm && (csm->getMatrixSizeX() != s.nx || csm->getMatrixSizeY() != s.ny || csm->getMatrixSizeZ() != s.nz || csm->getNumberOfChannels() != s.nc))
+        throw LocalisedException("The data dimensions of the image don't match the sensitivity maps.", __FILE__, __LINE__);
+
+    cartesian_sampling_(s, e, ac, acqs);
+    const unsigned int nx = s.nx;
+    const unsigned int ny = s.ny;
+    const unsigned int nz = s.nz;
+    const unsigned int nc = s.nc;
+    const int n = acqs.size();
+    for (int a = 0; a < n; a++) {
+        const ISMRMRD::AcquisitionHeader& ha = ac.acquisition_header(acqs[a]);
+        if (ha.number_of_samples != nx || ha.active_channels != nc)
+            throw LocalisedException("Acquisitions of different shapes cannot be transformed together.", __FILE__, __LINE__);
+    }
+
+    std::vector<complex_float_t> prex, postx, prey, posty, prez, postz;
+    sirf::centred_fft_factors(nx, false, prex, postx);
+    sirf::centred_fft_factors(ny, false, prey, posty);
+    sirf::centred_fft_factors(nz, false, prez, postz);
+    const float scale = float(1.0 / std::sqrt(float(nx*ny*nz)));
+    const size_t nxy = (size_t)nx*ny;
+    const size_t vol = nxy*nz;
+    const size_t line_size = (size_t)nx*nc;
+
+    // readout transforms of the acquired lines
+    std::vector<complex_float_t> lines(n*line_size);
+#pragma omp parallel for schedule(static)
+    for (int a = 0; a < n; a++) {
+        DataSpan<const complex_float_t> span = ac.acquisition_data(acqs[a]);
+        const complex_float_t* d = span.data();
+        complex_float_t* l = &lines[0] + a*line_size;
+        for (unsigned int c = 0; c < nc; c++)
+            for (unsigned int x = 0; x < nx; x++)
+                l[c*nx + x] = d[c*nx + x] * prex[x];
+        sirf::fft1(l, nx, 1, nc, nx, false);
+    }
+
+    img.resize(nx, ny, nz, csm ? 1 : nc);
+    complex_float_t* dst = img.getDataPtr();
+    if (csm)
+        std::fill(dst, dst + vol, complex_float_t(0));
+
+    // scatter into the image, then phase transforms of the acquired
+    // partitions and partition transforms, coil by coil; if coil maps are
+    // given, blocks of coil images are transformed in separate buffers and
+    // then combined into the image in coil order
+    unsigned int const block = csm ? channel_block_size_(nc) : nc;
+    std::vector<complex_float_t> coil_buff(csm ? block*vol : 0);
+    for (unsigned int c0 = 0; c0 < nc; c0 += block) {
+        unsigned int const nb = std::min(block, nc - c0);
+#pragma omp parallel for schedule(dynamic)
+        for (int c = c0; c < (int)(c0 + nb); c++) {
+            complex_float_t* b = csm ? &coil_buff[0] + (c - c0)*vol : dst + c*vol;
+            std::fill(b, b + vol, complex_float_t(0));
+            for (int a = 0; a < n; a++) {
+                int y = s.ky[a];
+                int z = s.kz[a];
+                complex_float_t f = prey[y] * prez[z];
+                const complex_float_t* l = &lines[0] + a*line_size + c*nx;
+                complex_float_t* t = b + y*nx + z*nxy;
+                for (unsigned int x = 0; x < nx; x++)
+                    t[x] += l[x] * f;
+            }
+            for (int z : s.planes)
+                sirf::fft1(b + z*nxy, ny, nx, nx, 1, false);
+            if (nz > 1)
+                sirf::fft1(b, nz, (int)nxy, (int)nxy, 1, false);
+            for (unsigned int z = 0; z < nz; z++)
+                for (unsigned int y = 0; y < ny; y++) {
+                    complex_float_t f = posty[y] * postz[z] * scale;
+                    complex_float_t* t = b + y*nx + z*nxy;
+                    for (unsigned int x = 0; x < nx; x++)
+                        t[x] *= postx[x] * f;
+                }
+        }
+        if (csm) {
+            const complex_float_t* w = csm->getDataPtr() + c0*vol;
+            const complex_float_t* b = &coil_buff[0];
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < (int)vol; i++)
+                for (unsigned int c = 0; c < nb; c++)
+                    dst[i] += std::conj(w[c*vol + i]) * b[c*vol + i];
+        }
+    }
+
+    ISMRMRD::Acquisition acq;
+    ac.get_acquisition(acqs.back(), acq);
+    this->match_img_header_to_acquisition(img, acq);
+}
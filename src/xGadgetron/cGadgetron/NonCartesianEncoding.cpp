@@ -59,26 +59,129 @@ IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 \author Johannes Mayer
 */
 
+#include <algorithm>
 #include <cstring>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "sirf/Gadgetron/NonCartesianEncoding.h"
 #include "sirf/Gadgetron/TrajectoryPreparation.h"
+#include "sirf/Gadgetron/gadgetron_fftw.h"
 
 using namespace sirf;
 using namespace ISMRMRD;
 
+// number of threads sharing num_tasks independent 2D transforms
+static int nufft_threads_(size_t num_tasks)
+{
+#ifdef _OPENMP
+    if (omp_in_parallel())
+        return 1;
+#endif
+    return (int)std::max((size_t)1, std::min(num_tasks, (size_t)sirf::FFTWPlanner::num_threads()));
+}
+
+static int thread_num_()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+ToeplitzKernel2D::ToeplitzKernel2D(const std::vector<size_t>& img_dims, const TrajectoryArrayType& traj) :
+    ny_(img_dims[0]), nz_(img_dims[1])
+{
+    size_t const my = 2*ny_;
+    size_t const mz = 2*nz_;
+
+    // the point spread function, its centre (the zero offset) at (ny, nz)
+    CFGThoNDArr ones(traj.get_number_of_elements());
+    ones.fill(complex_float_t(1.f, 0.f));
+    CFGThoNDArr psf;
+    Gridder2D(std::vector<size_t>{my, mz}, traj).ifft(psf, ones);
+
+    // N^H N applied to a unit impulse peaks at the central value of the
+    // point spread function, which fixes the normalisation of the gridding
+    CFGThoNDArr impulse(img_dims);
+    impulse.fill(complex_float_t(0.f, 0.f));
+    impulse(ny_/2, nz_/2) = complex_float_t(1.f, 0.f);
+    Gridder2D nufft(img_dims, traj);
+    CFGThoNDArr kdata;
+    CFGThoNDArr response;
+    nufft.fft(kdata, impulse);
+    nufft.ifft(response, kdata);
+    complex_float_t const scale = response(ny_/2, nz_/2) / (psf(ny_, nz_) * float(my*mz));
+
+    // circular convolution with the point spread function on the padded grid
+    kernel_.resize(my*mz);
+    for(size_t iz=0; iz<mz; ++iz)
+    for(size_t iy=0; iy<my; ++iy)
+        kernel_[iy + my*iz] = scale * psf((iy + ny_) % my, (iz + nz_) % mz);
+
+    sirf::fft1(kernel_.data(), my, 1, mz, my, true);
+    sirf::fft1(kernel_.data(), mz, my, my, 1, true);
+}
+
+void ToeplitzKernel2D::apply(const complex_float_t* in, complex_float_t* out, size_t nx, complex_float_t scale) const
+{
+    size_t const my = 2*ny_;
+    size_t const mz = 2*nz_;
+    size_t const plane = nx*my;
+
+    std::vector<complex_float_t> padded(plane*mz, complex_float_t(0.f, 0.f));
+    for(size_t iz=0; iz<nz_; ++iz)
+    for(size_t iy=0; iy<ny_; ++iy)
+        std::copy(in + nx*(iy + ny_*iz), in + nx*(iy + 1 + ny_*iz), &padded[nx*(iy + my*iz)]);
+
+    // the y transforms of the zero padding planes are skipped
+    for(size_t iz=0; iz<nz_; ++iz)
+        sirf::fft1(&padded[iz*plane], my, nx, nx, 1, true);
+    sirf::fft1(padded.data(), mz, plane, plane, 1, true);
+
+    for(size_t j=0; j<my*mz; ++j)
+    {
+        complex_float_t const k = kernel_[j];
+        complex_float_t* p = &padded[j*nx];
+        for(size_t ix=0; ix<nx; ++ix)
+            p[ix] *= k;
+    }
+
+    // only the planes inside the image are transformed back along y
+    sirf::fft1(padded.data(), mz, plane, plane, 1, false);
+    for(size_t iz=0; iz<nz_; ++iz)
+        sirf::fft1(&padded[iz*plane], my, nx, nx, 1, false);
+
+    for(size_t iz=0; iz<nz_; ++iz)
+    for(size_t iy=0; iy<ny_; ++iy)
+    {
+        const complex_float_t* p = &padded[nx*(iy + my*iz)];
+        complex_float_t* q = out + nx*(iy + ny_*iz);
+        for(size_t ix=0; ix<nx; ++ix)
+            q[ix] = scale * p[ix];
+    }
+}
+
 Gridder2D::TrajectoryArrayType RPEFourierEncoding::get_trajectory(const MRAcquisitionData& ac) const
 {
-    sirf::GRPETrajectoryPrep tp;
-    TrajectoryPreparation3D::TrajPointSet sirftraj = tp.get_trajectory(ac);
+    if(ac.number() <= 0)
+        throw std::runtime_error("Please pass a non-empty container.");
 
-    Gridder2D::TrajectoryArrayType traj(sirftraj.size());
-    traj.fill(Gadgetron::floatd2(0.f, 0.f));
+    // the readout is Cartesian, hence only the phase encoding coordinates
+    // of the first sample of each acquisition are used; they are read in
+    // place, with no copies of the acquisitions
+    Gridder2D::TrajectoryArrayType traj(ac.number());
 
-    for(int ik=0; ik<traj.get_number_of_elements(); ++ik)
+    for(int ia=0; ia<ac.number(); ++ia)
     {
-        traj.at(ik)[0] = sirftraj[ik][1];
-        traj.at(ik)[1] = sirftraj[ik][2];
+        if(ac.acquisition_header(ia).trajectory_dimensions != 3)
+            throw std::runtime_error("Please give Acquisition with a 3D RPE trajectory if you want to use it here.");
+        DataSpan<const float> acq_traj = ac.acquisition_traj(ia);
+        traj.at(ia)[0] = acq_traj[1];
+        traj.at(ia)[1] = acq_traj[2];
     }
 
     return traj;
@@ -98,14 +201,15 @@ void RPEFourierEncoding::backward(CFImage& img, const MRAcquisitionData& ac) con
 
     CFGThoNDArr kspace_data(kdata_dims);
 
+    // the samples of each channel are contiguous in both arrays
     for(int ia=0; ia<ac.number(); ++ia)
     {
-        ISMRMRD::Acquisition acq;
-        ac.get_acquisition(ia, acq);
+        DataSpan<const complex_float_t> acq_data = ac.acquisition_data(ia);
+        const ISMRMRD::AcquisitionHeader& acq_hdr = ac.acquisition_header(ia);
+        size_t const ns = acq_hdr.number_of_samples;
 
-        for(int is=0; is<acq.number_of_samples(); ++is)
-            for(int ic=0; ic<acq.active_channels(); ++ic)
-                kspace_data(is, ia, ic) =  acq.data(is,ic);
+        for(int ic=0; ic<acq_hdr.active_channels; ++ic)
+            std::copy(acq_data.begin() + ic*ns, acq_data.begin() + (ic + 1)*ns, &kspace_data(0, ia, ic));
     }
 
     Gadgetron::hoNDFFT< float >::instance()->ifft1c(kspace_data);
@@ -115,25 +219,30 @@ void RPEFourierEncoding::backward(CFImage& img, const MRAcquisitionData& ac) con
 
     Gridder2D::TrajectoryArrayType traj = this->get_trajectory(ac);
 
-    Gridder2D nufft(img_slice_dims, traj);
-
     img.resize(rec_space.matrixSize.x, rec_space.matrixSize.y, rec_space.matrixSize.z, kspace_dims[3]);
 
     float const fft_normalisation_factor = sqrt(float(rec_space.matrixSize.x));
 
-    for(size_t ichannel=0; ichannel<kspace_dims[3]; ++ichannel)
+    // the slices of all channels are independent 2D problems
+    int const num_slices = kspace_dims[0]*kspace_dims[3];
+    int const num_threads = nufft_threads_(num_slices);
+    std::vector<std::shared_ptr<const Gridder2D> > nuffts = gridders_.get(img_slice_dims, traj, num_threads);
+
+#pragma omp parallel num_threads(num_threads)
     {
-        for(size_t islice=0;islice<kspace_dims[0]; ++islice)
+        const Gridder2D& nufft = *nuffts[thread_num_()];
+        CFGThoNDArr k_slice_data_sausage(kdata_dims[1]);
+        CFGThoNDArr imgdata_slice;
+
+#pragma omp for schedule(dynamic)
+        for(int i=0; i<num_slices; ++i)
         {
-            CFGThoNDArr k_slice_data_sausage(kdata_dims[1]);
-            k_slice_data_sausage.fill(complex_float_t(0,0));
+            size_t const ichannel = i / kspace_dims[0];
+            size_t const islice = i % kspace_dims[0];
 
             for(int ik=0;ik<kdata_dims[1];++ik)
-            {
                 k_slice_data_sausage.at(ik) = kspace_data(islice,ik,ichannel);
-            }
 
-            CFGThoNDArr imgdata_slice;
             nufft.ifft(imgdata_slice, k_slice_data_sausage);
 
             for(size_t iz=0; iz<rec_space.matrixSize.z; ++iz)
@@ -169,62 +278,149 @@ void RPEFourierEncoding::forward(MRAcquisitionData& ac, const CFImage& img) cons
     size_t const num_kdata_pts = traj.get_number_of_elements();
 
     std::vector < size_t > img_slice_dims{img_dims[1], img_dims[2]};
-    Gridder2D nufft(img_slice_dims, traj);
 
     std::vector< size_t> output_dims{img_dims[0], num_kdata_pts, img_dims[3]};
     CFGThoNDArr kdata(output_dims);
 
-    for(size_t ichannel=0; ichannel<img_dims[3]; ++ichannel)
-    for(size_t islice=0;islice<img_dims[0]; ++islice)
-    {
+    // the slices of all channels are independent 2D problems
+    int const num_slices = img_dims[0]*img_dims[3];
+    int const num_threads = nufft_threads_(num_slices);
+    std::vector<std::shared_ptr<const Gridder2D> > nuffts = gridders_.get(img_slice_dims, traj, num_threads);
 
+#pragma omp parallel num_threads(num_threads)
+    {
+        const Gridder2D& nufft = *nuffts[thread_num_()];
         CFGThoNDArr img_slice(img_slice_dims);
+        CFGThoNDArr k_slice_data_sausage;
 
-        for(int ny=0; ny<img_dims[1]; ++ny)
-        for(int nz=0; nz<img_dims[2]; ++nz)
-             img_slice(ny,nz)= img_data(islice,ny,nz,ichannel);
+#pragma omp for schedule(dynamic)
+        for(int i=0; i<num_slices; ++i)
+        {
+            size_t const ichannel = i / img_dims[0];
+            size_t const islice = i % img_dims[0];
 
-        CFGThoNDArr k_slice_data_sausage;
-        nufft.fft(k_slice_data_sausage, img_slice);
+            for(int ny=0; ny<img_dims[1]; ++ny)
+            for(int nz=0; nz<img_dims[2]; ++nz)
+                 img_slice(ny,nz)= img_data(islice,ny,nz,ichannel);
+
+            nufft.fft(k_slice_data_sausage, img_slice);
 
-        for( int ik=0; ik<num_kdata_pts; ++ik)
-            kdata(islice, ik, ichannel) = k_slice_data_sausage.at(ik);
+            for( int ik=0; ik<num_kdata_pts; ++ik)
+                kdata(islice, ik, ichannel) = k_slice_data_sausage.at(ik);
+        }
     }
 
     Gadgetron::hoNDFFT< float >::instance()->fft1c(kdata);
 
-    ISMRMRD::Acquisition acq;
-    ac.get_acquisition(0, acq);
+    const ISMRMRD::AcquisitionHeader& acq_hdr = ac.acquisition_header(0);
 
-    ASSERT( acq.number_of_samples() == img_dims[0],"NUMBER OF SAMPLES OF RAWDATA DONT MATCH IMAGES SLICES");
-    ASSERT( acq.active_channels() == img_dims[3],"NUMBER OF CHANNELS OF RAWDATA DONT MATCH IMAGES CHANNELS");
+    ASSERT( acq_hdr.number_of_samples == img_dims[0],"NUMBER OF SAMPLES OF RAWDATA DONT MATCH IMAGES SLICES");
+    ASSERT( acq_hdr.active_channels == img_dims[3],"NUMBER OF CHANNELS OF RAWDATA DONT MATCH IMAGES CHANNELS");
 
-    float const fft_normalisation_factor = sqrt((float)acq.number_of_samples());
+    size_t const ns = img_dims[0];
+    float const fft_normalisation_factor = sqrt((float)ns);
 
+    // the samples of each channel are contiguous in both arrays
     for(int ia=0; ia<num_kdata_pts; ++ia)
     {
-        ac.get_acquisition(ia, acq);
+        DataSpan<complex_float_t> acq_data = ac.acquisition_data(ia);
 
-        for(int is=0; is<acq.number_of_samples(); ++is)
-            for(int ic=0; ic<acq.active_channels(); ++ic)
-                acq.data(is,ic) = fft_normalisation_factor * kdata(is, ia, ic);
+        for(int ic=0; ic<img_dims[3]; ++ic)
+        {
+            const complex_float_t* k = &kdata(0, ia, ic);
+            complex_float_t* d = acq_data.begin() + ic*ns;
+            for(size_t is=0; is<ns; ++is)
+                d[is] = fft_normalisation_factor * k[is];
+        }
+    }
+}
+
+void RPEFourierEncoding::normal_sense(CFImage& img_out, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const
+{
+    ASSERT( ac.get_trajectory_type() == ISMRMRD::TrajectoryType::OTHER, "Give a MRAcquisitionData reference with the trajectory type OTHER.");
+    check_csm_dimensions_(img, csm);
+
+    size_t const nx = img.getMatrixSizeX();
+    size_t const ny = img.getMatrixSizeY();
+    size_t const nz = img.getMatrixSizeZ();
+    int const nc = csm.getNumberOfChannels();
+    size_t const vol = nx*ny*nz;
+
+    AcquisitionsView subset(ac, idx);
+    ASSERT( subset.number() > 0, "Give a non-empty subset if you want to use the rpe normal operator.");
+    ASSERT( subset.acquisition_header(0).number_of_samples == nx, "NUMBER OF SAMPLES OF RAWDATA DONT MATCH IMAGES SLICES");
+
+    Gridder2D::TrajectoryArrayType traj = this->get_trajectory(subset);
+    std::vector<size_t> img_slice_dims{ny, nz};
+    std::shared_ptr<const ToeplitzKernel2D> sptr_kernel = toeplitz_kernels_.get(img_slice_dims, traj);
+
+    // the readouts are fully sampled, hence the readout transforms of
+    // forward and backward multiply each slice by the same factor
+    CFGThoNDArr readout(nx);
+    readout.fill(complex_float_t(0.f, 0.f));
+    readout(nx/2) = complex_float_t(1.f, 0.f);
+    Gadgetron::hoNDFFT< float >::instance()->fft1c(readout);
+    Gadgetron::hoNDFFT< float >::instance()->ifft1c(readout);
+    complex_float_t const readout_factor = float(nx) * readout(nx/2);
+
+    // the coil channels are processed concurrently, each thread adding
+    // its channels to its own part of sum
+    int const num_threads = nufft_threads_(nc);
+    std::vector<complex_float_t> sum(num_threads*vol, complex_float_t(0.f, 0.f));
+    const complex_float_t* u = img.getDataPtr();
+
+#pragma omp parallel num_threads(num_threads)
+    {
+        complex_float_t* w = &sum[thread_num_()*vol];
+        std::vector<complex_float_t> coil_img(vol);
 
-        ac.set_acquisition(ia, acq);
+#pragma omp for schedule(static)
+        for(int c=0; c<nc; ++c)
+        {
+            const complex_float_t* s = csm.getDataPtr() + c*vol;
+            for(size_t i=0; i<vol; ++i)
+                coil_img[i] = u[i] * s[i];
+            sptr_kernel->apply(coil_img.data(), coil_img.data(), nx, readout_factor);
+            for(size_t i=0; i<vol; ++i)
+                w[i] += std::conj(s[i]) * coil_img[i];
+        }
     }
+
+    for(int t=1; t<num_threads; ++t)
+        for(size_t i=0; i<vol; ++i)
+            sum[i] += sum[t*vol + i];
+
+    img_out = img;
+    std::copy(sum.begin(), sum.begin() + vol, img_out.getDataPtr());
 }
 
 Gridder2D::TrajectoryArrayType NonCartesian2DEncoding::get_trajectory(const MRAcquisitionData& ac) const
 {
-    sirf::Radial2DTrajprep tp;
-    TrajectoryPreparation2D::TrajPointSet sirftraj = tp.get_trajectory(ac);
+    if(ac.number() <= 0)
+        throw std::runtime_error("Please pass a non-empty container.");
 
-    Gridder2D::TrajectoryArrayType traj(sirftraj.size());
-    traj.fill(Gadgetron::floatd2(0.f, 0.f));
+    // the trajectories are read in place, with no copies of the acquisitions
+    size_t num_pts = 0;
+    for(int ia=0; ia<ac.number(); ++ia)
+    {
+        const ISMRMRD::AcquisitionHeader& acq_hdr = ac.acquisition_header(ia);
+        if(acq_hdr.trajectory_dimensions != 2)
+            throw std::runtime_error("Please give an Acquisition with a 2D noncartesian trajectory if you want to use it here.");
+        num_pts += acq_hdr.number_of_samples;
+    }
 
-    for(int ik=0; ik<traj.get_number_of_elements(); ++ik)
+    Gridder2D::TrajectoryArrayType traj(num_pts);
+
+    size_t ik = 0;
+    for(int ia=0; ia<ac.number(); ++ia)
     {
-        traj.at(ik)[0] = sirftraj[ik][0];
-        traj.at(ik)[1] = sirftraj[ik][1];
+        DataSpan<const float> acq_traj = ac.acquisition_traj(ia);
+        size_t const ns = ac.acquisition_header(ia).number_of_samples;
+        for(size_t is=0; is<ns; ++is, ++ik)
+        {
+            traj.at(ik)[0] = acq_traj[2*is];
+            traj.at(ik)[1] = acq_traj[2*is + 1];
+        }
     }
 
     return traj;
@@ -281,16 +477,18 @@ void NonCartesian2DEncoding::forward(MRAcquisitionData& ac, const CFImage& img)
 
     std::vector < size_t > img_slice_dims{Nx, Ny};
 
+    // the slices may have different trajectories, each needs its gridder
+    gridders_.reserve(NSlice);
+
 //    #pragma omp parallel
     for(size_t islice=0; islice < NSlice; ++islice)
     {
         std::vector<int> index_acqs_for_this_slice = ac.get_slice_encoding_index(islice);            
-        std::unique_ptr<MRAcquisitionData> uptr_slice_subset = ac.clone();
-        uptr_slice_subset->empty();
-        ac.get_subset(*uptr_slice_subset, index_acqs_for_this_slice);
+        // the k-space data are written into ac via the view
+        AcquisitionsView slice_subset(ac, index_acqs_for_this_slice);
 
-        Gridder2D::TrajectoryArrayType traj = this->get_trajectory(*uptr_slice_subset);
-        Gridder2D nufft(img_slice_dims, traj);
+        Gridder2D::TrajectoryArrayType traj = this->get_trajectory(slice_subset);
+        std::shared_ptr<const Gridder2D> sptr_nufft = gridders_.get(img_slice_dims, traj);
         const size_t num_kdata_pts = traj.get_number_of_elements();
 
         const std::vector< size_t> output_dims{num_kdata_pts,NChannel};
@@ -305,7 +503,7 @@ void NonCartesian2DEncoding::forward(MRAcquisitionData& ac, const CFImage& img)
                 img_slice(nx,ny)= img_data(islice,nx,ny,ichannel);
 
             CFGThoNDArr k_slice_data_sausage;
-            nufft.fft(k_slice_data_sausage, img_slice);
+            sptr_nufft->fft(k_slice_data_sausage, img_slice);
             
             for( int ik=0; ik<num_kdata_pts; ++ik)
                 kdata(ik, ichannel) = k_slice_data_sausage.at(ik);
@@ -313,9 +511,9 @@ void NonCartesian2DEncoding::forward(MRAcquisitionData& ac, const CFImage& img)
 
         ISMRMRD::Acquisition acq;
 
-        for(int ia=0; ia<uptr_slice_subset->number(); ++ia)
+        for(int ia=0; ia<slice_subset.number(); ++ia)
         {
-            uptr_slice_subset->get_acquisition(ia, acq);
+            slice_subset.get_acquisition(ia, acq);
 
             for(int is=0; is<acq.number_of_samples(); ++is)
             for(int ic=0; ic<acq.active_channels(); ++ic)
@@ -323,9 +521,8 @@ void NonCartesian2DEncoding::forward(MRAcquisitionData& ac, const CFImage& img)
                 const size_t access_idx = acq.number_of_samples()*ia + is;
                 acq.data(is,ic) = fft_normalisation_factor * kdata(access_idx, ic);
             }
-            uptr_slice_subset->set_acquisition(ia, acq);
+            slice_subset.set_acquisition(ia, acq);
         }
-        ac.set_subset(*uptr_slice_subset, index_acqs_for_this_slice);
     }
 }
 
@@ -355,27 +552,26 @@ void NonCartesian2DEncoding::backward(CFImage& img, const MRAcquisitionData& ac)
     
     float const fft_normalisation_factor = sqrt(float(NSlice));
 
-    auto uptr_slice_subset = ac.clone();
-
     std::vector<size_t> img_dimensions{NSlice,Nx,Ny,NChannel};
     CFGThoNDArr img_data(img_dimensions);
 
+    // the slices may have different trajectories, each needs its gridder
+    gridders_.reserve(NSlice);
+
     for(size_t islice=0; islice<NSlice; ++islice)
     {
-        uptr_slice_subset->empty();
+        std::vector<int> slice_subset_indices = ac.get_slice_encoding_index(islice);
+        AcquisitionsView slice_subset(ac, slice_subset_indices);
 
-        std::vector<int> slice_subset_indices = get_slice_encoding_subset_indices(ac, islice);
-        ac.get_subset(*uptr_slice_subset, slice_subset_indices);
-
-        Gridder2D::TrajectoryArrayType traj = this->get_trajectory(*uptr_slice_subset);
+        Gridder2D::TrajectoryArrayType traj = this->get_trajectory(slice_subset);
         const size_t num_kdata_pts = traj.get_number_of_elements();
         std::vector<size_t> const kdata_dims{num_kdata_pts, NChannel};
         CFGThoNDArr kspace_data(kdata_dims);
         
-        for(int ia=0; ia<uptr_slice_subset->number(); ++ia)
+        for(int ia=0; ia<slice_subset.number(); ++ia)
         {
             ISMRMRD::Acquisition acq;
-            uptr_slice_subset->get_acquisition(ia, acq);
+            slice_subset.get_acquisition(ia, acq);
 
             for(int nc=0; nc<acq.active_channels(); ++nc)
             for(int ns=0; ns<acq.number_of_samples(); ++ns)
@@ -386,7 +582,7 @@ void NonCartesian2DEncoding::backward(CFImage& img, const MRAcquisitionData& ac)
         }
        
         std::vector < size_t > img_slice_dims{Nx, Ny};
-        Gridder2D nufft(img_slice_dims, traj);
+        std::shared_ptr<const Gridder2D> sptr_nufft = gridders_.get(img_slice_dims, traj);
 
         for(size_t ichannel=0; ichannel<NChannel; ++ichannel)
         {
@@ -399,7 +595,7 @@ void NonCartesian2DEncoding::backward(CFImage& img, const MRAcquisitionData& ac)
             }
 
             CFGThoNDArr imgdata_slice;
-            nufft.ifft(imgdata_slice, k_slice_data_sausage);
+            sptr_nufft->ifft(imgdata_slice, k_slice_data_sausage);
 
             for(size_t iy=0; iy<Ny; ++iy)
             for(size_t ix=0; ix<Nx; ++ix)
@@ -33,6 +33,7 @@ limitations under the License.
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
 #include "sirf/Gadgetron/gadgetron_client.h"
+#include "sirf/Gadgetron/gadgetron_fftw.h"
 //#include "iutilities.h" // causes problems with Matlab (cf. the same message below)
 #include "sirf/Gadgetron/cgadgetron_p.h"
 #include "sirf/Gadgetron/gadgetron_x.h"
@@ -180,6 +181,8 @@ cGT_parameter(void* ptr, const char* obj, const char* name)
 	try {
 		if (sirf::iequals(obj, "image"))
 			return cGT_imageParameter(ptr, name);
+		if (sirf::iequals(obj, "images"))
+			return cGT_imagesParameter(ptr, name);
 		if (sirf::iequals(obj, "acquisition"))
 			return cGT_acquisitionParameter(ptr, name);
 		if (sirf::iequals(obj, "acquisitions"))
@@ -325,6 +328,8 @@ cGT_setCSParameter(void* ptr, const char* par, const void* val)
 	//csms.set_csm_smoothness(intDataFromHandle(val)); // causes problems with Matlab
 	else if (sirf::iequals(par, "conv_kernel_size"))
 		csms.set_csm_conv_kernel_size(dataFromHandle<int>(val));
+	else if (sirf::iequals(par, "conv_kernel_size_z"))
+		csms.set_csm_conv_kernel_size_z(dataFromHandle<int>(val));
 	else
 		return unknownObject("parameter", par, __FILE__, __LINE__);
 	return new DataHandle;
@@ -447,6 +452,11 @@ cGT_setAcquisitionModelParameter
 			getObjectSptrFromHandle<CoilSensitivitiesVector>(handle, sptr_csc);
 			am.set_csm(sptr_csc);
 		}
+		else if (sirf::iequals(name, "cartesian_encoding")) {
+			CAST_PTR(DataHandle, handle, ptr);
+			MRAcquisitionModel& am = objectFromHandle<MRAcquisitionModel>(h_am);
+			am.set_cartesian_encoding(charDataFromDataHandle(handle));
+		}
 		else
 			return unknownObject("parameter", name, __FILE__, __LINE__);
 		return (void*)new DataHandle;
@@ -531,6 +541,76 @@ cGT_AcquisitionModelBackward(void* ptr_am, const void* ptr_acqs)
 	CATCH;
 }
 
+extern "C"
+void*
+cGT_AcquisitionModelNormal(void* ptr_am, const void* ptr_imgs)
+{
+	try {
+		CAST_PTR(DataHandle, h_am, ptr_am);
+		CAST_PTR(DataHandle, h_imgs, ptr_imgs);
+		MRAcquisitionModel& am = objectFromHandle<MRAcquisitionModel>(h_am);
+		GadgetronImageData& imgs = objectFromHandle<GadgetronImageData>(h_imgs);
+		shared_ptr<GadgetronImageData> sptr_imgs = am.normal(imgs);
+		return newObjectHandle<GadgetronImageData>(sptr_imgs);
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_setFFTWPlannerRigour(const char* rigour)
+{
+	try {
+		FFTWPlanner::set_rigour(rigour);
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_FFTWPlannerRigour()
+{
+	return charDataHandleFromCharData(FFTWPlanner::rigour().c_str());
+}
+
+extern "C"
+void*
+cGT_importFFTWWisdom(const char* file)
+{
+	try {
+		FFTWPlanner::import_wisdom(file);
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_exportFFTWWisdom(const char* file)
+{
+	try {
+		FFTWPlanner::export_wisdom(file);
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_setFFTThreads(int threads)
+{
+	FFTWPlanner::set_num_threads(threads);
+	return (void*)new DataHandle;
+}
+
+extern "C"
+void*
+cGT_FFTThreads()
+{
+	return dataHandle<int>(FFTWPlanner::num_threads());
+}
+
 extern "C"
 void*
 cGT_sortAcquisitions(void* ptr_acqs)
@@ -577,8 +657,9 @@ cGT_ISMRMRDAcquisitionsFromFile(const char* file, int all, size_t ptr)
 		else
 			mask.set(ignored);
 		std::cout << mask.bits_string() << '\n';
-		shared_ptr<MRAcquisitionData>
-			acquisitions(new AcquisitionsVector);
+		shared_ptr<MRAcquisitionData> acquisitions
+			(MRAcquisitionData::storage_template()->same_acquisitions_container
+			(AcquisitionsInfo()));
 		IgnoreMask copy = acquisitions->ignore_mask();
 		acquisitions->set_ignore_mask(mask);
 		acquisitions->read(file, all);
@@ -593,14 +674,41 @@ void*
 cGT_ISMRMRDAcquisitionsFile(const char* file)
 {
 	try {
-		shared_ptr<MRAcquisitionData> 
-			acquisitions(new AcquisitionsVector);
+		shared_ptr<MRAcquisitionData> acquisitions
+			(MRAcquisitionData::storage_template()->same_acquisitions_container
+			(AcquisitionsInfo()));
 		acquisitions->read(file);
 		return newObjectHandle<MRAcquisitionData>(acquisitions);
 	}
 	CATCH;
 }
 
+extern "C"
+void*
+cGT_setAcquisitionDataStorageScheme(const char* scheme)
+{
+	try {
+		if (sirf::iequals(scheme, "array"))
+			AcquisitionsArray::set_as_template();
+		else if (sirf::iequals(scheme, "file"))
+			AcquisitionsFile::set_as_template();
+		else if (sirf::iequals(scheme, "memory") || sirf::iequals(scheme, "default"))
+			AcquisitionsVector::set_as_template();
+		else
+			return unknownObject("storage scheme", scheme, __FILE__, __LINE__);
+		return (void*)new DataHandle;
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_getAcquisitionDataStorageScheme()
+{
+	return charDataHandleFromCharData
+		(MRAcquisitionData::storage_scheme().c_str());
+}
+
 extern "C"
 void*
 cGT_processAcquisitions(void* ptr_proc, void* ptr_input)
@@ -654,6 +762,21 @@ cGT_getAcquisitionsSubset(void* ptr_acqs, size_t const ptr_idx, size_t const num
     CATCH;
 }
 
+extern "C"
+void*
+cGT_getAcquisitionsView(void* ptr_acqs, size_t const ptr_idx, size_t const num_elem_subset)
+{
+	try {
+		shared_ptr<MRAcquisitionData> sptr_ad;
+		getObjectSptrFromHandle<MRAcquisitionData>(ptr_acqs, sptr_ad);
+		int* idx = (int*)ptr_idx;
+		std::vector<int> vec_idx(idx, idx + num_elem_subset);
+		shared_ptr<MRAcquisitionData> sptr_view(new AcquisitionsView(sptr_ad, vec_idx));
+		return newObjectHandle<MRAcquisitionData>(sptr_view);
+	}
+	CATCH;
+}
+
 extern "C"
 void*
 cGT_cloneAcquisitions(void* ptr_input)
@@ -876,6 +999,8 @@ cGT_acquisitionsParameter(void* ptr_acqs, const char* name)
 			return dataHandle((int)acqs.sorted());
 		if (sirf::iequals(name, "info"))
 			return charDataHandleFromCharData(acqs.acquisitions_info().c_str());
+		if (sirf::iequals(name, "address"))
+			return dataHandle<size_t>(acqs.address());
 		return parameterNotFound(name, __FILE__, __LINE__);
 	}
 	CATCH;
@@ -1393,6 +1518,34 @@ cGT_setImageDataFromCmplxArray(void* ptr_imgs, size_t ptr_z)
 	CATCH;
 }
 
+extern "C"
+void*
+cGT_imagesParameter(void* ptr_imgs, const char* name)
+{
+	try {
+		CAST_PTR(DataHandle, h_imgs, ptr_imgs);
+		GadgetronImagesVector& imgs =
+			objectFromHandle<GadgetronImagesVector>(h_imgs);
+		if (sirf::iequals(name, "address"))
+			return dataHandle<size_t>(imgs.address());
+		return parameterNotFound(name, __FILE__, __LINE__);
+	}
+	CATCH;
+}
+
+extern "C"
+void*
+cGT_makeImagesContiguous(void* ptr_imgs)
+{
+	try {
+		CAST_PTR(DataHandle, h_imgs, ptr_imgs);
+		GadgetronImagesVector& imgs =
+			objectFromHandle<GadgetronImagesVector>(h_imgs);
+		return dataHandle<int>(imgs.make_contiguous());
+	}
+	CATCH;
+}
+
 extern "C"
 void*
 cGT_realImageData(void* ptr_imgs, const char* way)
@@ -30,9 +30,13 @@ limitations under the License.
 \author SyneRBI
 */
 #include <algorithm> 
+#include <atomic>
 #include <cmath>
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <iomanip>
+#include <numeric>
 #include <sstream>
 
 #include <ismrmrd/ismrmrd.h>
@@ -43,12 +47,14 @@ limitations under the License.
 #include "sirf/iUtilities/LocalisedException.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
+#include "sirf/Gadgetron/gadgetron_kernels.h"
 #include "sirf/Gadgetron/gadgetron_x.h"
 
 using namespace gadgetron;
 using namespace sirf;
 
 shared_ptr<MRAcquisitionData> MRAcquisitionData::acqs_templ_;
+std::string MRAcquisitionData::storage_scheme_;
 
 static std::string get_date_time_string()
 {
@@ -67,9 +73,286 @@ static std::string get_date_time_string()
     return str.str();
 }
 
+static size_t acquisition_data_size(const ISMRMRD::AcquisitionHeader& head)
+{
+	return (size_t)head.active_channels * head.number_of_samples;
+}
+
+static size_t acquisition_traj_size(const ISMRMRD::AcquisitionHeader& head)
+{
+	return (size_t)head.trajectory_dimensions * head.number_of_samples;
+}
+
+namespace {
+
+// in-memory layout of the records of the ISMRMRD acquisitions dataset
+struct HDF5Acquisition {
+	ISMRMRD::AcquisitionHeader head;
+	hvl_t traj;
+	hvl_t data;
+};
+
+// HDF5 types of the above, members matched by name with the file types
+// of ISMRMRD (see ismrmrd/dataset.c)
+hid_t hdf5_encoding_counters_type()
+{
+	typedef ISMRMRD::ISMRMRD_EncodingCounters EC;
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(EC));
+	H5Tinsert(type, "kspace_encode_step_1", HOFFSET(EC, kspace_encode_step_1), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "kspace_encode_step_2", HOFFSET(EC, kspace_encode_step_2), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "average", HOFFSET(EC, average), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "slice", HOFFSET(EC, slice), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "contrast", HOFFSET(EC, contrast), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "phase", HOFFSET(EC, phase), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "repetition", HOFFSET(EC, repetition), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "set", HOFFSET(EC, set), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "segment", HOFFSET(EC, segment), H5T_NATIVE_UINT16);
+	hsize_t nu = ISMRMRD::ISMRMRD_Constants::ISMRMRD_USER_INTS;
+	hid_t user = H5Tarray_create2(H5T_NATIVE_UINT16, 1, &nu);
+	H5Tinsert(type, "user", HOFFSET(EC, user), user);
+	H5Tclose(user);
+	return type;
+}
+
+void hdf5_insert_array(hid_t type, const char* name, size_t offset,
+	hid_t base, hsize_t n)
+{
+	hid_t array = H5Tarray_create2(base, 1, &n);
+	H5Tinsert(type, name, offset, array);
+	H5Tclose(array);
+}
+
+hid_t hdf5_acquisition_header_type()
+{
+	typedef ISMRMRD::ISMRMRD_AcquisitionHeader AH;
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(AH));
+	H5Tinsert(type, "version", HOFFSET(AH, version), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "flags", HOFFSET(AH, flags), H5T_NATIVE_UINT64);
+	H5Tinsert(type, "measurement_uid", HOFFSET(AH, measurement_uid), H5T_NATIVE_UINT32);
+	H5Tinsert(type, "scan_counter", HOFFSET(AH, scan_counter), H5T_NATIVE_UINT32);
+	H5Tinsert(type, "acquisition_time_stamp", HOFFSET(AH, acquisition_time_stamp), H5T_NATIVE_UINT32);
+	hdf5_insert_array(type, "physiology_time_stamp", HOFFSET(AH, physiology_time_stamp),
+		H5T_NATIVE_UINT32, ISMRMRD::ISMRMRD_Constants::ISMRMRD_PHYS_STAMPS);
+	H5Tinsert(type, "number_of_samples", HOFFSET(AH, number_of_samples), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "available_channels", HOFFSET(AH, available_channels), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "active_channels", HOFFSET(AH, active_channels), H5T_NATIVE_UINT16);
+	hdf5_insert_array(type, "channel_mask", HOFFSET(AH, channel_mask),
+		H5T_NATIVE_UINT64, ISMRMRD::ISMRMRD_Constants::ISMRMRD_CHANNEL_MASKS);
+	H5Tinsert(type, "discard_pre", HOFFSET(AH, discard_pre), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "discard_post", HOFFSET(AH, discard_post), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "center_sample", HOFFSET(AH, center_sample), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "encoding_space_ref", HOFFSET(AH, encoding_space_ref), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "trajectory_dimensions", HOFFSET(AH, trajectory_dimensions), H5T_NATIVE_UINT16);
+	H5Tinsert(type, "sample_time_us", HOFFSET(AH, sample_time_us), H5T_NATIVE_FLOAT);
+	hdf5_insert_array(type, "position", HOFFSET(AH, position), H5T_NATIVE_FLOAT, 3);
+	hdf5_insert_array(type, "read_dir", HOFFSET(AH, read_dir), H5T_NATIVE_FLOAT, 3);
+	hdf5_insert_array(type, "phase_dir", HOFFSET(AH, phase_dir), H5T_NATIVE_FLOAT, 3);
+	hdf5_insert_array(type, "slice_dir", HOFFSET(AH, slice_dir), H5T_NATIVE_FLOAT, 3);
+	hdf5_insert_array(type, "patient_table_position", HOFFSET(AH, patient_table_position),
+		H5T_NATIVE_FLOAT, 3);
+	hid_t idx = hdf5_encoding_counters_type();
+	H5Tinsert(type, "idx", HOFFSET(AH, idx), idx);
+	H5Tclose(idx);
+	hdf5_insert_array(type, "user_int", HOFFSET(AH, user_int),
+		H5T_NATIVE_INT32, ISMRMRD::ISMRMRD_Constants::ISMRMRD_USER_INTS);
+	hdf5_insert_array(type, "user_float", HOFFSET(AH, user_float),
+		H5T_NATIVE_FLOAT, ISMRMRD::ISMRMRD_Constants::ISMRMRD_USER_FLOATS);
+	return type;
+}
+
+hid_t hdf5_acquisition_type()
+{
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(HDF5Acquisition));
+	hid_t head = hdf5_acquisition_header_type();
+	hid_t vlen = H5Tvlen_create(H5T_NATIVE_FLOAT);
+	H5Tinsert(type, "head", HOFFSET(HDF5Acquisition, head), head);
+	H5Tinsert(type, "traj", HOFFSET(HDF5Acquisition, traj), vlen);
+	H5Tinsert(type, "data", HOFFSET(HDF5Acquisition, data), vlen);
+	H5Tclose(vlen);
+	H5Tclose(head);
+	return type;
+}
+
+/*
+Reads the acquisitions dataset of an ISMRMRD file in blocks of records
+(hyperslabs). HDF5 calls are made under the global SIRF mutex, and the
+variable-length parts of a block are released before the block buffer is
+reused.
+*/
+class HDF5AcquisitionsReader {
+public:
+	HDF5AcquisitionsReader() :
+		file_(-1), dataset_(-1), filespace_(-1), type_(-1), size_(0) {}
+	~HDF5AcquisitionsReader()
+	{
+		Mutex mtx;
+		std::lock_guard<std::mutex> lock(mtx());
+		for (int i = 0; i < 2; i++)
+			release_(buffer_[i]);
+		if (type_ >= 0)
+			H5Tclose(type_);
+		if (filespace_ >= 0)
+			H5Sclose(filespace_);
+		if (dataset_ >= 0)
+			H5Dclose(dataset_);
+		if (file_ >= 0)
+			H5Fclose(file_);
+	}
+	// returns false if the acquisitions dataset cannot be opened
+	bool open(const std::string& filename, const std::string& groupname)
+	{
+		Mutex mtx;
+		std::lock_guard<std::mutex> lock(mtx());
+		std::string path = "/" + groupname + "/data";
+		H5E_BEGIN_TRY {
+			file_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+			if (file_ >= 0)
+				dataset_ = H5Dopen2(file_, path.c_str(), H5P_DEFAULT);
+		} H5E_END_TRY;
+		if (dataset_ < 0)
+			return false;
+		filespace_ = H5Dget_space(dataset_);
+		hsize_t dims[1] = { 0 };
+		if (H5Sget_simple_extent_ndims(filespace_) != 1)
+			return false;
+		H5Sget_simple_extent_dims(filespace_, dims, 0);
+		size_ = dims[0];
+		type_ = hdf5_acquisition_type();
+		return true;
+	}
+	size_t size() const { return size_; }
+	// reads records first to first + n - 1 into buffer b (0 or 1)
+	std::vector<HDF5Acquisition>& read(int b, size_t first, size_t n)
+	{
+		Mutex mtx;
+		std::lock_guard<std::mutex> lock(mtx());
+		std::vector<HDF5Acquisition>& buffer = buffer_[b];
+		release_(buffer);
+		buffer.resize(n);
+		hsize_t offset[1] = { first };
+		hsize_t count[1] = { n };
+		hid_t memspace = H5Screate_simple(1, count, 0);
+		H5Sselect_hyperslab(filespace_, H5S_SELECT_SET, offset, 0, count, 0);
+		herr_t status = H5Dread(dataset_, type_, memspace, filespace_,
+			H5P_DEFAULT, buffer.data());
+		H5Sclose(memspace);
+		if (status < 0) {
+			buffer.clear();
+			THROW("failed to read acquisitions from the HDF5 file");
+		}
+		return buffer;
+	}
+private:
+	hid_t file_;
+	hid_t dataset_;
+	hid_t filespace_;
+	hid_t type_;
+	size_t size_;
+	std::vector<HDF5Acquisition> buffer_[2];
+
+	// frees the variable-length trajectories and samples of the buffer
+	// (the caller must hold the mutex)
+	void release_(std::vector<HDF5Acquisition>& buffer)
+	{
+		if (buffer.empty())
+			return;
+		hsize_t dims[1] = { buffer.size() };
+		hid_t memspace = H5Screate_simple(1, dims, 0);
+#if H5_VERSION_GE(1, 12, 0)
+		H5Treclaim(type_, memspace, H5P_DEFAULT, buffer.data());
+#else
+		H5Dvlen_reclaim(type_, memspace, H5P_DEFAULT, buffer.data());
+#endif
+		H5Sclose(memspace);
+		buffer.clear();
+	}
+};
+
+
+/*
+Writes records to the acquisitions dataset of an ISMRMRD file: creates
+a chunked, extendible dataset and appends blocks of records to it.
+HDF5 calls are made under the global SIRF mutex.
+*/
+class HDF5AcquisitionsWriter {
+public:
+	HDF5AcquisitionsWriter() : file_(-1), dataset_(-1), type_(-1), size_(0) {}
+	~HDF5AcquisitionsWriter()
+	{
+		Mutex mtx;
+		std::lock_guard<std::mutex> lock(mtx());
+		if (type_ >= 0)
+			H5Tclose(type_);
+		if (dataset_ >= 0)
+			H5Dclose(dataset_);
+		if (file_ >= 0)
+			H5Fclose(file_);
+	}
+	// returns false if the acquisitions dataset cannot be created
+	bool open(const std::string& filename, const std::string& groupname)
+	{
+		Mutex mtx;
+		std::lock_guard<std::mutex> lock(mtx());
+		std::string path = "/" + groupname + "/data";
+		hsize_t dims[1] = { 0 };
+		hsize_t maxdims[1] = { H5S_UNLIMITED };
+		hsize_t chunk[1] = { 256 };
+		type_ = hdf5_acquisition_type();
+		hid_t space = H5Screate_simple(1, dims, maxdims);
+		hid_t props = H5Pcreate(H5P_DATASET_CREATE);
+		H5Pset_chunk(props, 1, chunk);
+		H5E_BEGIN_TRY {
+			file_ = H5Fopen(filename.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+			if (file_ >= 0)
+				dataset_ = H5Dcreate2(file_, path.c_str(), type_, space,
+					H5P_DEFAULT, props, H5P_DEFAULT);
+		} H5E_END_TRY;
+		H5Pclose(props);
+		H5Sclose(space);
+		return dataset_ >= 0;
+	}
+	void append(const std::vector<HDF5Acquisition>& records)
+	{
+		Mutex mtx;
+		std::lock_guard<std::mutex> lock(mtx());
+		hsize_t offset[1] = { size_ };
+		hsize_t count[1] = { records.size() };
+		hsize_t dims[1] = { size_ + records.size() };
+		if (H5Dset_extent(dataset_, dims) < 0)
+			THROW("failed to extend the acquisitions dataset");
+		hid_t filespace = H5Dget_space(dataset_);
+		hid_t memspace = H5Screate_simple(1, count, 0);
+		H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, 0, count, 0);
+		herr_t status = H5Dwrite(dataset_, type_, memspace, filespace,
+			H5P_DEFAULT, records.data());
+		H5Sclose(memspace);
+		H5Sclose(filespace);
+		if (status < 0)
+			THROW("failed to write acquisitions to the HDF5 file");
+		size_ += records.size();
+	}
+private:
+	hid_t file_;
+	hid_t dataset_;
+	hid_t type_;
+	size_t size_;
+};
+
+// a block of acquisitions prepared for writing: the samples are referenced
+// in place, the trajectories are copied
+struct HDF5AcquisitionsBlock {
+	std::vector<HDF5Acquisition> records;
+	std::vector<DataSpan<const complex_float_t> > data;
+	std::vector<std::vector<float> > traj;
+};
+}
+
 void 
 MRAcquisitionData::write(const std::string &filename) const
 {
+	// approximate size in bytes of a block of acquisitions written at once
+	size_t const block_bytes = 64 * 1024 * 1024;
+
 	Mutex mtx;
     std::ifstream file;
     mtx.lock();
@@ -86,6 +369,62 @@ MRAcquisitionData::write(const std::string &filename) const
 	dataset->writeHeader(acqs_info_.c_str());
 	mtx.unlock();
 	int n = number();
+
+	HDF5AcquisitionsWriter writer;
+	mtx.lock();
+	dataset.reset();
+	mtx.unlock();
+	if (writer.open(filename, "dataset")) {
+		HDF5AcquisitionsBlock blocks[2];
+		// each block is written on a background thread while the next one
+		// is being prepared
+		std::future<void> pending;
+		for (int first = 0, b = 0; first < n; b = 1 - b) {
+			int last = first;
+			for (size_t bytes = 0; last < n && bytes < block_bytes; last++) {
+				const ISMRMRD::AcquisitionHeader& head = acquisition_header(last);
+				bytes += sizeof(HDF5Acquisition) + sizeof(complex_float_t)*
+					acquisition_data_size(head) + sizeof(float)*acquisition_traj_size(head);
+			}
+			HDF5AcquisitionsBlock& block = blocks[b];
+			int nb = last - first;
+			block.records.resize(nb);
+			block.data.resize(nb);
+			block.traj.resize(nb);
+#pragma omp parallel for schedule(dynamic, 64)
+			for (int i = 0; i < nb; i++) {
+				HDF5Acquisition& rec = block.records[i];
+				rec.head = acquisition_header(first + i);
+				DataSpan<const complex_float_t>& data = block.data[i];
+				data = acquisition_data(first + i);
+				rec.data.len = 2 * data.size();
+				rec.data.p = (void*)data.begin();
+				std::vector<float>& traj = block.traj[i];
+				traj.clear();
+				if (rec.head.trajectory_dimensions > 0) {
+					ISMRMRD::Acquisition acq;
+					get_acquisition(first + i, acq);
+					traj.assign(acq.getTrajPtr(),
+						acq.getTrajPtr() + acquisition_traj_size(rec.head));
+				}
+				rec.traj.len = traj.size();
+				rec.traj.p = traj.empty() ? 0 : traj.data();
+			}
+			if (pending.valid())
+				pending.get();
+			pending = std::async(std::launch::async, [&writer, &block]() {
+				writer.append(block.records);
+			});
+			first = last;
+		}
+		if (pending.valid())
+			pending.get();
+		return;
+	}
+
+	mtx.lock();
+	dataset.reset(new ISMRMRD::Dataset(filename.c_str(), "/dataset", false));
+	mtx.unlock();
 	ISMRMRD::Acquisition a;
 	for (int i = 0; i < n; i++) {
 		get_acquisition(i, a);
@@ -95,21 +434,49 @@ MRAcquisitionData::write(const std::string &filename) const
 	}
 }
 
+// returns the size in bytes of the samples of the largest acquisition
+// allowed by the encoded spaces and receiver channels in the header
+// (0 if the header does not specify them)
+static size_t
+max_acquisition_bytes(const AcquisitionsInfo& info)
+{
+	size_t samples = 0;
+	size_t channels = 0;
+	try {
+		ISMRMRD::IsmrmrdHeader header = info.get_IsmrmrdHeader();
+		for (size_t e = 0; e < header.encoding.size(); e++)
+			samples = std::max(samples,
+				(size_t)header.encoding[e].encodedSpace.matrixSize.x);
+		if (header.acquisitionSystemInformation.is_present() &&
+			header.acquisitionSystemInformation().receiverChannels.is_present())
+			channels = header.acquisitionSystemInformation().receiverChannels();
+	}
+	catch (...) {
+		return 0;
+	}
+	return samples * channels * sizeof(complex_float_t);
+}
+
 void
 MRAcquisitionData::read(const std::string& filename_ismrmrd_with_ext, int all)
 {
 	bool const verbose = true;
+	// approximate size in bytes of a block of acquisitions read at once
+	size_t const block_bytes = 128 * 1024 * 1024;
 
 	if( verbose )
 		std::cout<< "Started reading acquisitions from " << filename_ismrmrd_with_ext << std::endl;
 	try
 	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 		Mutex mtx;
 		mtx.lock();
-		ISMRMRD::Dataset d(filename_ismrmrd_with_ext.c_str(),"dataset", false);
-		d.readHeader(this->acqs_info_);
-		ISMRMRD::IsmrmrdHeader hdr = acqs_info_.get_IsmrmrdHeader();
-		uint32_t num_acquis = d.getNumberOfAcquisitions();
+		uint32_t num_acquis = 0;
+		{
+			ISMRMRD::Dataset d(filename_ismrmrd_with_ext.c_str(),"dataset", false);
+			d.readHeader(this->acqs_info_);
+			num_acquis = d.getNumberOfAcquisitions();
+		}
 		mtx.unlock();
 
 		std::stringstream str;
@@ -136,27 +503,103 @@ MRAcquisitionData::read(const std::string& filename_ismrmrd_with_ext, int all)
 			}
 		}
 
-		for( uint32_t i_acqu=0; i_acqu<num_acquis; i_acqu++)
-		{
-			if( verbose )
-			{
-				if( i_acqu%( num_acquis/10 ) == 0 )
-					std::cout << std::ceil(float(i_acqu) / num_acquis * 100)
+		IgnoreMask ignore_mask = this->ignore_mask();
+		size_t bytes = 0;
+		HDF5AcquisitionsReader reader;
+		if (num_acquis > 0 && reader.open(filename_ismrmrd_with_ext, "dataset")) {
+			size_t na = reader.size();
+			// the block length is first estimated from the largest encoded
+			// readout in the header (if the header does not specify it, from
+			// a single acquisition), then capped by the largest acquisition
+			// read so far and allowed to grow at most twofold per block
+			size_t max_bytes = max_acquisition_bytes(this->acqs_info_);
+			size_t acq_bytes = sizeof(HDF5Acquisition) + max_bytes;
+			size_t block = max_bytes ?
+				std::max((size_t)1, block_bytes / acq_bytes) : 1;
+			std::vector<ISMRMRD::AcquisitionHeader> heads;
+			std::vector<const complex_float_t*> data;
+			std::vector<const float*> traj;
+			// the next block is read while the current one is stored
+			std::future<std::vector<HDF5Acquisition>*> next =
+				std::async(std::launch::async, [&reader, block, na]() {
+				return &reader.read(0, 0, std::min(block, na));
+			});
+			for (size_t first = 0, b = 0; first < na; b = 1 - b) {
+				std::vector<HDF5Acquisition>& records = *next.get();
+				for (size_t r = 0; r < records.size(); r++) {
+					const HDF5Acquisition& rec = records[r];
+					acq_bytes = std::max(acq_bytes, sizeof(HDF5Acquisition) +
+						(rec.data.len + rec.traj.len) * sizeof(float));
+				}
+				block = std::max((size_t)1, std::min(2 * block,
+					block_bytes / acq_bytes));
+				size_t next_first = first + records.size();
+				if (next_first < na)
+					next = std::async(std::launch::async,
+						[&reader, block, na, b, next_first]() {
+						return &reader.read(1 - (int)b, next_first,
+							std::min(block, na - next_first));
+					});
+				if (verbose)
+					std::cout << std::ceil(float(first) / na * 100)
 					<< "%.." << std::flush;
+				heads.clear();
+				data.clear();
+				traj.clear();
+				for (size_t r = 0; r < records.size(); r++) {
+					const HDF5Acquisition& rec = records[r];
+					const ISMRMRD::AcquisitionHeader& head = rec.head;
+					if (rec.data.len != 2 * acquisition_data_size(head) ||
+						rec.traj.len != acquisition_traj_size(head))
+						THROW("inconsistent acquisition header in the HDF5 file");
+					bytes += sizeof(head) + (rec.data.len + rec.traj.len) * sizeof(float);
+					if (!all && ignore_mask.ignored(head.flags))
+						continue;
+					heads.push_back(head);
+					data.push_back((const complex_float_t*)rec.data.p);
+					traj.push_back((const float*)rec.traj.p);
+				}
+				this->append_acquisitions(heads.size(), heads.data(),
+					data.data(), traj.data());
+				first = next_first;
 			}
-
-			ISMRMRD::Acquisition acq;
+		}
+		else {
 			mtx.lock();
-			d.readAcquisition( i_acqu, acq);
+			ISMRMRD::Dataset d(filename_ismrmrd_with_ext.c_str(), "dataset", false);
 			mtx.unlock();
-
-			IgnoreMask ignore_mask = this->ignore_mask();
-			if (all || !ignore_mask.ignored(acq.flags()))
-				this->append_acquisition(acq);
+			for (uint32_t i_acqu = 0; i_acqu < num_acquis; i_acqu++)
+			{
+				if (verbose)
+				{
+					if (i_acqu % (num_acquis / 10 + 1) == 0)
+						std::cout << std::ceil(float(i_acqu) / num_acquis * 100)
+						<< "%.." << std::flush;
+				}
+
+				ISMRMRD::Acquisition acq;
+				mtx.lock();
+				d.readAcquisition(i_acqu, acq);
+				mtx.unlock();
+
+				bytes += sizeof(acq.getHead()) + acq.getDataSize() + acq.getTrajSize();
+				if (all || !ignore_mask.ignored(acq.flags()))
+					this->append_acquisition(acq);
+			}
 		}
 		this->sort_by_time();
-		if( verbose )
-			std::cout<< "\nFinished reading acquisitions from " << filename_ismrmrd_with_ext << std::endl;
+		if( verbose ) {
+			double t = std::chrono::duration<double>
+				(std::chrono::steady_clock::now() - start).count();
+			double mb = bytes / (1024.0 * 1024.0);
+			std::stringstream report;
+			report << num_acquis << " acquisitions, " << std::fixed
+				<< std::setprecision(1) << mb << " MB in " << std::setprecision(2)
+				<< t << " s (" << std::setprecision(1) << (t > 0 ? mb / t : 0.0)
+				<< " MB/s)";
+			std::cout << "\nFinished reading acquisitions from " << filename_ismrmrd_with_ext
+				<< ": " << report.str() << std::endl;
+		}
 	}
 	catch( std::runtime_error& e)
 	{
@@ -166,6 +609,26 @@ MRAcquisitionData::read(const std::string& filename_ismrmrd_with_ext, int all)
 	}
 }
 
+void
+MRAcquisitionData::append_acquisitions(size_t n,
+	const ISMRMRD::AcquisitionHeader* heads,
+	const complex_float_t* const* data, const float* const* traj)
+{
+	std::vector<ISMRMRD::Acquisition> acqs(n);
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < (int)n; i++) {
+		ISMRMRD::Acquisition& acq = acqs[i];
+		acq.setHead(heads[i]);
+		std::copy(data[i], data[i] + acquisition_data_size(heads[i]),
+			acq.getDataPtr());
+		size_t nt = acquisition_traj_size(heads[i]);
+		if (nt)
+			std::copy(traj[i], traj[i] + nt, acq.getTrajPtr());
+	}
+	for (size_t i = 0; i < n; i++)
+		append_acquisition(acqs[i]);
+}
+
 bool
 MRAcquisitionData::undersampled() const
 {
@@ -175,6 +638,61 @@ MRAcquisitionData::undersampled() const
 		e.parallelImaging().accelerationFactor.kspace_encoding_step_1 > 1;
 }
 
+void
+AcquisitionsHeaderIndex::resize(size_t n)
+{
+	time_stamp.resize(n);
+	flags.resize(n);
+	number_of_samples.resize(n);
+	active_channels.resize(n);
+	trajectory_dimensions.resize(n);
+	idx.resize(n);
+}
+
+void
+AcquisitionsHeaderIndex::set(size_t i, const ISMRMRD::AcquisitionHeader& head)
+{
+	time_stamp[i] = head.acquisition_time_stamp;
+	flags[i] = head.flags;
+	number_of_samples[i] = head.number_of_samples;
+	active_channels[i] = head.active_channels;
+	trajectory_dimensions[i] = head.trajectory_dimensions;
+	idx[i] = head.idx;
+}
+
+AcquisitionsHeaderIndex
+AcquisitionsHeaderIndex::permuted(const std::vector<int>& order) const
+{
+	size_t n = order.size();
+	AcquisitionsHeaderIndex index(n);
+	for (size_t i = 0; i < n; i++) {
+		int j = order[i];
+		index.time_stamp[i] = time_stamp[j];
+		index.flags[i] = flags[j];
+		index.number_of_samples[i] = number_of_samples[j];
+		index.active_channels[i] = active_channels[j];
+		index.trajectory_dimensions[i] = trajectory_dimensions[j];
+		index.idx[i] = idx[j];
+	}
+	return index;
+}
+
+shared_ptr<const AcquisitionsHeaderIndex>
+MRAcquisitionData::header_index() const
+{
+	shared_ptr<const AcquisitionsHeaderIndex> sptr_index = header_index_.get();
+	if (sptr_index)
+		return sptr_index;
+	int na = number();
+	AcquisitionsHeaderIndex* ptr_index = new AcquisitionsHeaderIndex(na);
+	sptr_index.reset(ptr_index);
+#pragma omp parallel for
+	for (int i = 0; i < na; i++)
+		ptr_index->set(i, acquisition_header(i));
+	header_index_.set(sptr_index);
+	return sptr_index;
+}
+
 int 
 MRAcquisitionData::get_acquisitions_dimensions(size_t ptr_dim) const
 {
@@ -183,21 +701,22 @@ MRAcquisitionData::get_acquisitions_dimensions(size_t ptr_dim) const
 
     int* dim = (int*)ptr_dim;
 
-    ISMRMRD::Acquisition acq;
+    shared_ptr<const AcquisitionsHeaderIndex> sptr_index = header_index();
+    const AcquisitionsHeaderIndex& hi = *sptr_index;
     int ns = 0;
     int nc = 0;
     int num_acq = 0;
     for (int i = 0; i < na; ++i)
     {
-        if (!get_acquisition(i, acq))
+        if (hi.ignored(i, ignore_mask_))
             continue;
         if (num_acq == 0) {
-            ns = acq.number_of_samples();
-            nc = acq.active_channels();
+            ns = hi.number_of_samples[i];
+            nc = hi.active_channels[i];
         }
         else {
-            ASSERT(acq.number_of_samples() == ns, "One of your acquisitions has a different number of samples. Please make sure the dimensions are consistent.");
-            ASSERT(acq.active_channels() == nc, "One of your acquisitions has a different number of active channels. Please make sure the dimensions are consistent.");
+            ASSERT(hi.number_of_samples[i] == ns, "One of your acquisitions has a different number of samples. Please make sure the dimensions are consistent.");
+            ASSERT(hi.active_channels[i] == nc, "One of your acquisitions has a different number of active channels. Please make sure the dimensions are consistent.");
         }
         num_acq++;
     }
@@ -216,16 +735,17 @@ uint16_t MRAcquisitionData::get_trajectory_dimensions(void) const
     int na = number();
     ASSERT(na > 0, "You are asking for dimensions on an empty acquisition container. Please don't...");
 
-    ISMRMRD::Acquisition acq;
+    shared_ptr<const AcquisitionsHeaderIndex> sptr_index = header_index();
+    const AcquisitionsHeaderIndex& hi = *sptr_index;
     uint16_t traj_dims;
     int num_acq = 0;
     for (int i = 0; i < na; ++i)
     {
-        if (!get_acquisition(i, acq))
+        if (hi.ignored(i, ignore_mask_))
             continue;
         if (num_acq == 0)
-            traj_dims = acq.trajectory_dimensions();
-        else if (acq.trajectory_dimensions() != traj_dims)
+            traj_dims = hi.trajectory_dimensions[i];
+        else if (hi.trajectory_dimensions[i] != traj_dims)
             throw LocalisedException("Not every acquisition in your container has the same trajectory dimension." , __FILE__, __LINE__);
         num_acq++;
     }
@@ -238,22 +758,23 @@ void MRAcquisitionData::get_kspace_dimensions(std::vector<size_t>& dims) const
     int na = number();
     ASSERT(na > 0, "You are asking for dimensions on an empty acquisition container. Please don't...");
 
-    ISMRMRD::Acquisition acq;
+    shared_ptr<const AcquisitionsHeaderIndex> sptr_index = header_index();
+    const AcquisitionsHeaderIndex& hi = *sptr_index;
     int nro;
     int nc;
     int num_acq = 0;
     for (int i = 0; i < na; ++i)
     {
-        if (!get_acquisition(i, acq))
+        if (hi.ignored(i, ignore_mask_))
             continue;
         if (num_acq == 0) {
-            nro = acq.number_of_samples();
-            nc = acq.active_channels();
+            nro = hi.number_of_samples[i];
+            nc = hi.active_channels[i];
         }
         else {
-            if (acq.active_channels() != nc)
+            if (hi.active_channels[i] != nc)
                 throw std::runtime_error("The number of channels is not consistent within this container.");
-            if (acq.number_of_samples() != nro)
+            if (hi.number_of_samples[i] != nro)
                 throw std::runtime_error("The number of readout points is not consistent within this container.");
         }
         num_acq++;
@@ -277,31 +798,21 @@ void MRAcquisitionData::get_kspace_dimensions(std::vector<size_t>& dims) const
 void
 MRAcquisitionData::get_data(complex_float_t* z, int a)
 {
-	ISMRMRD::Acquisition acq;
+	// read-only access to the samples
+	const MRAcquisitionData& self = *this;
 	unsigned int na = number();
 	if (a >= 0 && a < na) {
-		get_acquisition(a, acq);
-		unsigned int nc = acq.active_channels();
-		unsigned int ns = acq.number_of_samples();
-		for (unsigned int c = 0, i = 0; c < nc; c++) {
-			for (unsigned int s = 0; s < ns; s++, i++) {
-				z[i] = acq.data(s, c);
-			}
-		}
+		DataSpan<const complex_float_t> data = self.acquisition_data(a);
+		std::copy(data.begin(), data.end(), z);
 		return;
 	}
-	for (unsigned int a = 0, i = 0; a < na; a++) {
-		if (!get_acquisition(a, acq)) {
+	for (unsigned int a = 0; a < na; a++) {
+		if (ignored(a)) {
 			std::cout << "ignoring acquisition " << a << '\n';
 			continue;
 		}
-		unsigned int nc = acq.active_channels();
-		unsigned int ns = acq.number_of_samples();
-		for (unsigned int c = 0; c < nc; c++) {
-			for (unsigned int s = 0; s < ns; s++, i++) {
-				z[i] = acq.data(s, c);
-			}
-		}
+		DataSpan<const complex_float_t> data = self.acquisition_data(a);
+		z = std::copy(data.begin(), data.end(), z);
 	}
 }
 
@@ -321,20 +832,136 @@ MRAcquisitionData::set_user_floats(float const * const z, int const idx)
     }
 }
 
+// elementwise kernels operating on acquisition samples in place,
+// shared by the ISMRMRD::Acquisition-based and container-based algebra
+
+static DataSpan<const complex_float_t>
+data_span_(const ISMRMRD::Acquisition& acq)
+{
+	return DataSpan<const complex_float_t>
+		(acq.getDataPtr(), acq.getNumberOfDataElements());
+}
+
+static DataSpan<complex_float_t>
+data_span_(ISMRMRD::Acquisition& acq)
+{
+	return DataSpan<complex_float_t>
+		(acq.getDataPtr(), acq.getNumberOfDataElements());
+}
+
+// z = a*x + b*y
+static void
+axpby_(complex_float_t a, DataSpan<const complex_float_t> x,
+	complex_float_t b, DataSpan<const complex_float_t> y,
+	DataSpan<complex_float_t> z)
+{
+	size_t n = std::min(std::min(x.size(), y.size()), z.size());
+	kernels::axpby(n, a, x.data(), b, y.data(), z.data());
+}
+
+// z = a*x + b*y with a, b arrays
+static void
+xapyb_(DataSpan<const complex_float_t> x, DataSpan<const complex_float_t> a,
+	DataSpan<const complex_float_t> y, DataSpan<const complex_float_t> b,
+	DataSpan<complex_float_t> z)
+{
+	size_t n = std::min(std::min(x.size(), y.size()), z.size());
+	n = std::min(n, std::min(a.size(), b.size()));
+	kernels::xapyb(n, x.data(), a.data(), y.data(), b.data(), z.data());
+}
+
+// z = a*x + b*y with a scalar, b array
+static void
+xapyb_(DataSpan<const complex_float_t> x, complex_float_t a,
+	DataSpan<const complex_float_t> y, DataSpan<const complex_float_t> b,
+	DataSpan<complex_float_t> z)
+{
+	size_t n = std::min(std::min(x.size(), y.size()), z.size());
+	n = std::min(n, b.size());
+	kernels::xapyb(n, x.data(), a, y.data(), b.data(), z.data());
+}
+
+// z = f(x, y), f being a functor from sirf::kernels or a function pointer
+template<class F>
+static void
+binary_op_(DataSpan<const complex_float_t> x, DataSpan<const complex_float_t> y,
+	DataSpan<complex_float_t> z, F f)
+{
+	size_t n = std::min(std::min(x.size(), y.size()), z.size());
+	kernels::binary(n, x.data(), y.data(), z.data(), f);
+}
+
+// z = f(x, y) with y scalar
+template<class F>
+static void
+semibinary_op_(DataSpan<const complex_float_t> x, complex_float_t y,
+	DataSpan<complex_float_t> z, F f)
+{
+	size_t n = std::min(x.size(), z.size());
+	kernels::semibinary(n, x.data(), y, z.data(), f);
+}
+
+// z = f(x)
+template<class F>
+static void
+unary_op_(DataSpan<const complex_float_t> x, DataSpan<complex_float_t> z, F f)
+{
+	size_t n = std::min(x.size(), z.size());
+	kernels::unary(n, x.data(), z.data(), f);
+}
+
+static complex_float_t
+dot_(DataSpan<const complex_float_t> a, DataSpan<const complex_float_t> b)
+{
+	return kernels::cdot(std::min(a.size(), b.size()), a.data(), b.data());
+}
+
+// squared 2-norm
+static float
+norm2_(DataSpan<const complex_float_t> a)
+{
+	return kernels::norm2(a.size(), a.data());
+}
+
+static complex_float_t
+sum_(DataSpan<const complex_float_t> a)
+{
+	complex_float_t z = 0;
+	for (size_t i = 0; i < a.size(); i++)
+		z += a[i];
+	return z;
+}
+
+// updates z with the element of a with the largest real part
+static void
+max_(DataSpan<const complex_float_t> a, complex_float_t& z, bool& init)
+{
+	for (size_t i = 0; i < a.size(); i++) {
+		if (init || std::real(a[i]) > std::real(z)) {
+			z = a[i];
+			init = false;
+		}
+	}
+}
+
+// updates z with the element of a with the smallest real part
+static void
+min_(DataSpan<const complex_float_t> a, complex_float_t& z, bool& init)
+{
+	for (size_t i = 0; i < a.size(); i++) {
+		if (init || std::real(a[i]) < std::real(z)) {
+			z = a[i];
+			init = false;
+		}
+	}
+}
+
 void 
 MRAcquisitionData::axpby
 (complex_float_t a, const ISMRMRD::Acquisition& acq_x,
 	complex_float_t b, ISMRMRD::Acquisition& acq_y)
 {
-	const complex_float_t* px;
-	complex_float_t* py;
-	for (px = acq_x.data_begin(), py = acq_y.data_begin();
-		px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-		if (b == complex_float_t(0.0))
-			*py = a * (*px);
-		else
-			*py = a * (*px) + b * (*py);
-	}
+	axpby_(a, data_span_(acq_x), b, data_span_(acq_y), data_span_(acq_y));
 }
 
 void 
@@ -350,17 +977,8 @@ MRAcquisitionData::xapyb
 (const ISMRMRD::Acquisition& acq_x, const ISMRMRD::Acquisition& acq_a,
 	ISMRMRD::Acquisition& acq_y, const ISMRMRD::Acquisition& acq_b)
 {
-	const complex_float_t* px;
-	const complex_float_t* pa;
-	complex_float_t* py;
-	const complex_float_t* pb;
-	for (px = acq_x.data_begin(), pa = acq_a.data_begin(),
-		py = acq_y.data_begin(), pb = acq_b.data_begin();
-		px != acq_x.data_end() && pa != acq_a.data_end(),
-		py != acq_y.data_end() && pb != acq_b.data_end();
-		px++, pa++, py++, pb++) {
-		*py = (*pa) * (*px) + (*pb) * (*py);
-	}
+	xapyb_(data_span_(acq_x), data_span_(acq_a),
+		data_span_(acq_y), data_span_(acq_b), data_span_(acq_y));
 }
 
 void
@@ -368,16 +986,8 @@ MRAcquisitionData::xapyb
 (const ISMRMRD::Acquisition& acq_x, complex_float_t a,
     ISMRMRD::Acquisition& acq_y, const ISMRMRD::Acquisition& acq_b)
 {
-    const complex_float_t* px;
-    complex_float_t* py;
-    const complex_float_t* pb;
-    for (px = acq_x.data_begin(),
-        py = acq_y.data_begin(), pb = acq_b.data_begin();
-        px != acq_x.data_end() &&
-        py != acq_y.data_end() && pb != acq_b.data_end();
-        px++, py++, pb++) {
-        *py = a * (*px) + (*pb) * (*py);
-    }
+	xapyb_(data_span_(acq_x), a,
+		data_span_(acq_y), data_span_(acq_b), data_span_(acq_y));
 }
 
 void
@@ -385,12 +995,7 @@ MRAcquisitionData::binary_op
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y, 
     complex_float_t (*f)(complex_float_t, complex_float_t))
 {
-    const complex_float_t* px;
-    complex_float_t* py;
-    for (px = acq_x.data_begin(), py = acq_y.data_begin();
-        px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-        *py = f(*px, *py);
-    }
+	binary_op_(data_span_(acq_x), data_span_(acq_y), data_span_(acq_y), f);
 }
 
 void
@@ -398,12 +1003,7 @@ MRAcquisitionData::semibinary_op
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y, complex_float_t y,
     complex_float_t(*f)(complex_float_t, complex_float_t))
 {
-    const complex_float_t* px;
-    complex_float_t* py;
-    for (px = acq_x.data_begin(), py = acq_y.data_begin();
-        px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-        *py = f(*px, y);
-    }
+	semibinary_op_(data_span_(acq_x), y, data_span_(acq_y), f);
 }
 
 void
@@ -411,284 +1011,278 @@ MRAcquisitionData::unary_op
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y,
     complex_float_t(*f)(complex_float_t))
 {
-    const complex_float_t* px;
-    complex_float_t* py;
-    for (px = acq_x.data_begin(), py = acq_y.data_begin();
-        px != acq_x.data_end() && py != acq_y.data_end(); px++, py++) {
-        *py = f(*px);
-    }
+	unary_op_(data_span_(acq_x), data_span_(acq_y), f);
 }
 
 void
 MRAcquisitionData::multiply
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::binary_op(acq_x, acq_y, DataContainer::product<complex_float_t>);
+    binary_op_(data_span_(acq_x), data_span_(acq_y), data_span_(acq_y), kernels::Product());
 }
 
 void
 MRAcquisitionData::multiply
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y, complex_float_t y)
 {
-    MRAcquisitionData::semibinary_op(acq_x, acq_y, y, DataContainer::product<complex_float_t>);
+    semibinary_op_(data_span_(acq_x), y, data_span_(acq_y), kernels::Product());
 }
 
 void
 MRAcquisitionData::add
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y, complex_float_t y)
 {
-    MRAcquisitionData::semibinary_op(acq_x, acq_y, y, DataContainer::sum<complex_float_t>);
+    semibinary_op_(data_span_(acq_x), y, data_span_(acq_y), kernels::Sum());
 }
 
 void
 MRAcquisitionData::divide
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::binary_op(acq_x, acq_y, DataContainer::ratio<complex_float_t>);
+    binary_op_(data_span_(acq_x), data_span_(acq_y), data_span_(acq_y), kernels::Ratio());
 }
 
 void
 MRAcquisitionData::maximum
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::binary_op(acq_x, acq_y, DataContainer::maxreal<complex_float_t>);
+    binary_op_(data_span_(acq_x), data_span_(acq_y), data_span_(acq_y), kernels::MaxReal());
 }
 
 void
 MRAcquisitionData::maximum
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y, complex_float_t y)
 {
-    MRAcquisitionData::semibinary_op(acq_x, acq_y, y, DataContainer::maxreal<complex_float_t>);
+    semibinary_op_(data_span_(acq_x), y, data_span_(acq_y), kernels::MaxReal());
 }
 
 void
 MRAcquisitionData::minimum
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::binary_op(acq_x, acq_y, DataContainer::minreal<complex_float_t>);
+    binary_op_(data_span_(acq_x), data_span_(acq_y), data_span_(acq_y), kernels::MinReal());
 }
 
 void
 MRAcquisitionData::minimum
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y, complex_float_t y)
 {
-    MRAcquisitionData::semibinary_op(acq_x, acq_y, y, DataContainer::minreal<complex_float_t>);
+    semibinary_op_(data_span_(acq_x), y, data_span_(acq_y), kernels::MinReal());
 }
 
 void
 MRAcquisitionData::power
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::binary_op(acq_x, acq_y, DataContainer::power);
+    binary_op_(data_span_(acq_x), data_span_(acq_y), data_span_(acq_y), kernels::Power());
 }
 
 void
 MRAcquisitionData::power
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y, complex_float_t y)
 {
-    MRAcquisitionData::semibinary_op(acq_x, acq_y, y, DataContainer::power);
+    semibinary_op_(data_span_(acq_x), y, data_span_(acq_y), kernels::Power());
 }
 
 void
 MRAcquisitionData::exp
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::unary_op(acq_x, acq_y, DataContainer::exp);
+    unary_op_(data_span_(acq_x), data_span_(acq_y), kernels::Exp());
 }
 
 void
 MRAcquisitionData::log
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::unary_op(acq_x, acq_y, DataContainer::log);
+    unary_op_(data_span_(acq_x), data_span_(acq_y), kernels::Log());
 }
 
 void
 MRAcquisitionData::sqrt
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::unary_op(acq_x, acq_y, DataContainer::sqrt);
+    unary_op_(data_span_(acq_x), data_span_(acq_y), kernels::Sqrt());
 }
 
 void
 MRAcquisitionData::sign
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::unary_op(acq_x, acq_y, DataContainer::sign);
+    unary_op_(data_span_(acq_x), data_span_(acq_y), kernels::Sign());
 }
 
 void
 MRAcquisitionData::abs
 (const ISMRMRD::Acquisition& acq_x, ISMRMRD::Acquisition& acq_y)
 {
-    MRAcquisitionData::unary_op(acq_x, acq_y, DataContainer::abs);
+    unary_op_(data_span_(acq_x), data_span_(acq_y), kernels::Abs());
 }
 
 complex_float_t
 MRAcquisitionData::dot
 (const ISMRMRD::Acquisition& acq_a, const ISMRMRD::Acquisition& acq_b)
 {
-	const complex_float_t* pa;
-	const complex_float_t* pb;
-	complex_float_t z = 0;
-	for (pa = acq_a.data_begin(), pb = acq_b.data_begin();
-		pa != acq_a.data_end() && pb != acq_b.data_end(); pa++, pb++) {
-		z += std::conj(*pb) * (*pa);
-	}
-	return z;
+	return dot_(data_span_(acq_a), data_span_(acq_b));
 }
 
 float 
 MRAcquisitionData::norm(const ISMRMRD::Acquisition& acq_a)
 {
-	const complex_float_t* pa;
-	float r = 0;
-	for (pa = acq_a.data_begin(); pa != acq_a.data_end(); pa++) {
-		complex_float_t z = std::conj(*pa) * (*pa);
-		r += z.real();
-	}
-	r = std::sqrt(r);
-	return r;
+	return std::sqrt(norm2_(data_span_(acq_a)));
 }
 
 complex_float_t
 MRAcquisitionData::sum(const ISMRMRD::Acquisition& acq_a)
 {
-    const complex_float_t* pa;
-    complex_float_t z = 0;
-    for (pa = acq_a.data_begin(); pa != acq_a.data_end(); pa++)
-        z += *pa;
-    return z;
+	return sum_(data_span_(acq_a));
 }
 
 complex_float_t
 MRAcquisitionData::max(const ISMRMRD::Acquisition& acq_a)
 {
-    const complex_float_t* pa;
-    complex_float_t z = 0;
-    bool init = true;
-    for (pa = acq_a.data_begin(); pa != acq_a.data_end(); pa++) {
-        complex_float_t zi = *pa;
-        float r = std::real(z);
-        float ri = std::real(zi);
-        if (init || ri > r) {
-            z = zi;
-            init = false;
-        }
-    }
-    return z;
+	complex_float_t z = 0;
+	bool init = true;
+	max_(data_span_(acq_a), z, init);
+	return z;
 }
 
 complex_float_t
 MRAcquisitionData::min(const ISMRMRD::Acquisition& acq_a)
 {
-    const complex_float_t* pa;
-    complex_float_t z = 0;
-    bool init = true;
-    for (pa = acq_a.data_begin(); pa != acq_a.data_end(); pa++) {
-        complex_float_t zi = *pa;
-        float r = std::real(z);
-        float ri = std::real(zi);
-        if (init || ri < r) {
-            z = zi;
-            init = false;
-        }
-    }
-    return z;
+	complex_float_t z = 0;
+	bool init = true;
+	min_(data_span_(acq_a), z, init);
+	return z;
+}
+
+std::vector<int>
+MRAcquisitionData::acquisitions_not_ignored() const
+{
+	int n = number();
+	std::vector<int> num;
+	num.reserve(n);
+	for (int i = 0; i < n; i++)
+		if (!ignored(i))
+			num.push_back(i);
+	return num;
+}
+
+std::vector<int>
+MRAcquisitionData::output_acquisitions_
+(const MRAcquisitionData& src, const std::vector<int>& src_num, size_t& n)
+{
+	std::vector<int> num;
+	if (number() > 0) {
+		num = acquisitions_not_ignored();
+		n = std::min(n, num.size());
+		// the sorting of this container can only be trusted if it is the
+		// one of src, e.g. if this container is a copy of src
+		if (!sptr_sorting_ || sptr_sorting_ != src.sptr_sorting_)
+			organise_kspace();
+		set_sorted(true);
+		return num;
+	}
+	ISMRMRD::Acquisition acq;
+	for (size_t i = 0; i < n; i++) {
+		src.get_acquisition(src_num[i], acq);
+		append_acquisition(acq);
+		num.push_back(i);
+	}
+	// src_num are in ascending order, hence all acquisitions of src have
+	// been copied in their order if there are as many as in src
+	if (n == src.number() && src.sptr_sorting_)
+		sptr_sorting_ = src.sptr_sorting_;
+	else
+		organise_kspace();
+	set_sorted(true);
+	return num;
 }
 
 void
 MRAcquisitionData::dot(const DataContainer& dc, void* ptr) const
 {
 	SIRF_DYNAMIC_CAST(const MRAcquisitionData, other, dc);
-	int n = number();
-	int m = other.number();
+	std::vector<int> ia = acquisitions_not_ignored();
+	std::vector<int> ib = other.acquisitions_not_ignored();
+	int n = std::min(ia.size(), ib.size());
+	// per-acquisition partial results are added up in a fixed order,
+	// so that the result does not depend on the number of threads
+	std::vector<complex_float_t> zi(n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++)
+		zi[i] = dot_(acquisition_data(ia[i]), other.acquisition_data(ib[i]));
 	complex_float_t z = 0;
-	ISMRMRD::Acquisition a;
-	ISMRMRD::Acquisition b;
-	for (int i = 0, j = 0; i < n && j < m;) {
-		if (!get_acquisition(i, a)) {
-			i++;
-			continue;
-		}
-		if (!other.get_acquisition(j, b)) {
-			j++;
-			continue;
-		}
-		z += MRAcquisitionData::dot(a, b);
-		i++;
-		j++;
-	}
-    complex_float_t* ptr_z = static_cast<complex_float_t*>(ptr);
-    *ptr_z = z;
+	for (int i = 0; i < n; i++)
+		z += zi[i];
+	complex_float_t* ptr_z = static_cast<complex_float_t*>(ptr);
+	*ptr_z = z;
 }
 
 void
 MRAcquisitionData::sum(void* ptr) const
 {
-    int n = number();
-    complex_float_t z = 0;
-    ISMRMRD::Acquisition a;
-    for (int i = 0; i < n;) {
-        if (!get_acquisition(i, a)) {
-            i++;
-            continue;
-        }
-        z += MRAcquisitionData::sum(a);
-        i++;
-    }
-    complex_float_t* ptr_z = static_cast<complex_float_t*>(ptr);
-    *ptr_z = z;
+	std::vector<int> ia = acquisitions_not_ignored();
+	int n = ia.size();
+	std::vector<complex_float_t> zi(n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++)
+		zi[i] = sum_(acquisition_data(ia[i]));
+	complex_float_t z = 0;
+	for (int i = 0; i < n; i++)
+		z += zi[i];
+	complex_float_t* ptr_z = static_cast<complex_float_t*>(ptr);
+	*ptr_z = z;
 }
 
 void
 MRAcquisitionData::max(void* ptr) const
 {
-    int n = number();
-    complex_float_t z = 0;
-    ISMRMRD::Acquisition a;
-    bool init = true;
-    for (int i = 0; i < n;) {
-        if (!get_acquisition(i, a)) {
-            i++;
-            continue;
-        }
-        complex_float_t zi = MRAcquisitionData::max(a);
-        float r = std::real(z);
-        float ri = std::real(zi);
-        if (init || ri > r) {
-            z = zi;
-            init = false;
-        }
-        i++;
-    }
-    complex_float_t* ptr_z = static_cast<complex_float_t*>(ptr);
-    *ptr_z = z;
+	std::vector<int> ia = acquisitions_not_ignored();
+	int n = ia.size();
+	// combining per-acquisition results in order picks the same element
+	// as the serial loop would
+	std::vector<complex_float_t> zi(n);
+	std::vector<char> empty(n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++) {
+		bool init = true;
+		max_(acquisition_data(ia[i]), zi[i], init);
+		empty[i] = init;
+	}
+	complex_float_t z = 0;
+	bool init = true;
+	for (int i = 0; i < n; i++) {
+		if (!empty[i])
+			max_(DataSpan<const complex_float_t>(&zi[i], 1), z, init);
+	}
+	complex_float_t* ptr_z = static_cast<complex_float_t*>(ptr);
+	*ptr_z = z;
 }
 
 void
 MRAcquisitionData::min(void* ptr) const
 {
-    int n = number();
-    complex_float_t z = 0;
-    ISMRMRD::Acquisition a;
-    bool init = true;
-    for (int i = 0; i < n;) {
-        if (!get_acquisition(i, a)) {
-            i++;
-            continue;
-        }
-        complex_float_t zi = MRAcquisitionData::min(a);
-        float r = std::real(z);
-        float ri = std::real(zi);
-        if (init || ri < r) {
-            z = zi;
-            init = false;
-        }
-        i++;
-    }
-    complex_float_t* ptr_z = static_cast<complex_float_t*>(ptr);
-    *ptr_z = z;
+	std::vector<int> ia = acquisitions_not_ignored();
+	int n = ia.size();
+	// combining per-acquisition results in order picks the same element
+	// as the serial loop would
+	std::vector<complex_float_t> zi(n);
+	std::vector<char> empty(n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++) {
+		bool init = true;
+		min_(acquisition_data(ia[i]), zi[i], init);
+		empty[i] = init;
+	}
+	complex_float_t z = 0;
+	bool init = true;
+	for (int i = 0; i < n; i++) {
+		if (!empty[i])
+			min_(DataSpan<const complex_float_t>(&zi[i], 1), z, init);
+	}
+	complex_float_t* ptr_z = static_cast<complex_float_t*>(ptr);
+	*ptr_z = z;
 }
 
 void
@@ -696,47 +1290,20 @@ MRAcquisitionData::axpby(
     const void* ptr_a, const DataContainer& a_x,
     const void* ptr_b, const DataContainer& a_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-    if (!x.sorted() || !y.sorted())
-        THROW("a*x + b*y cannot be applied to unsorted x or y");
-    complex_float_t a = *static_cast<const complex_float_t*>(ptr_a);
-    complex_float_t b = *static_cast<const complex_float_t*>(ptr_b);
-    int nx = x.number();
-    int ny = y.number();
-    ISMRMRD::Acquisition ax;
-    ISMRMRD::Acquisition ay;
-    ISMRMRD::Acquisition acq;
-    bool isempty = (number() < 1);
-    for (int ix = 0, iy = 0, k = 0; ix < nx && iy < ny;) {
-        if (!x.get_acquisition(ix, ax)) {
-            std::cout << ix << " ignored (ax)\n";
-            ix++;
-            continue;
-        }
-        if (!y.get_acquisition(iy, ay)) {
-            std::cout << iy << " ignored (ay)\n";
-            iy++;
-            continue;
-        }
-        if (!isempty) {
-            if (!get_acquisition(k, acq)) {
-                std::cout << k << " ignored (acq)\n";
-                k++;
-                continue;
-            }
-        }
-        MRAcquisitionData::axpby(a, ax, b, ay);
-        if (isempty)
-            append_acquisition(ay);
-        else
-            set_acquisition(k, ay);
-        ix++;
-        iy++;
-        k++;
-    }
-    this->set_sorted(true);
-    this->organise_kspace();
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
+	if (!x.sorted() || !y.sorted())
+		THROW("a*x + b*y cannot be applied to unsorted x or y");
+	complex_float_t a = *static_cast<const complex_float_t*>(ptr_a);
+	complex_float_t b = *static_cast<const complex_float_t*>(ptr_b);
+	std::vector<int> ix = x.acquisitions_not_ignored();
+	std::vector<int> iy = y.acquisitions_not_ignored();
+	size_t n = std::min(ix.size(), iy.size());
+	std::vector<int> k = output_acquisitions_(y, iy, n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)n; i++)
+		axpby_(a, x.acquisition_data(ix[i]), b, y.acquisition_data(iy[i]),
+			acquisition_data(k[i]));
 }
 
 void
@@ -744,64 +1311,24 @@ MRAcquisitionData::xapyb(
     const DataContainer& a_x, const DataContainer& a_a,
     const DataContainer& a_y, const DataContainer& a_b)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, a, a_a);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, b, a_b);
-    if (!x.sorted() || !y.sorted() || !a.sorted() || !b.sorted())
-        THROW("x*a + y*b cannot be applied to unsorted a, b, x or y");
-    int nx = x.number();
-    int ny = y.number();
-    int na = a.number();
-    int nb = b.number();
-    ISMRMRD::Acquisition ax;
-    ISMRMRD::Acquisition ay;
-    ISMRMRD::Acquisition aa;
-    ISMRMRD::Acquisition ab;
-    ISMRMRD::Acquisition acq;
-    bool isempty = (number() < 1);
-    for (int ix = 0, iy = 0, ia = 0, ib = 0, k = 0;
-        ix < nx && iy < ny && ia < na && ib < nb;) {
-        if (!x.get_acquisition(ix, ax)) {
-            std::cout << ix << " ignored (ax)\n";
-            ix++;
-            continue;
-        }
-        if (!y.get_acquisition(iy, ay)) {
-            std::cout << iy << " ignored (ay)\n";
-            iy++;
-            continue;
-        }
-        if (!a.get_acquisition(ia, aa)) {
-            std::cout << ia << " ignored (aa)\n";
-            ia++;
-            continue;
-        }
-        if (!b.get_acquisition(ib, ab)) {
-            std::cout << ib << " ignored (ab)\n";
-            ib++;
-            continue;
-        }
-        if (!isempty) {
-            if (!get_acquisition(k, acq)) {
-                std::cout << k << " ignored (acq)\n";
-                k++;
-                continue;
-            }
-        }
-        MRAcquisitionData::xapyb(ax, aa, ay, ab);
-        if (isempty)
-            append_acquisition(ay);
-        else
-            set_acquisition(k, ay);
-        ix++;
-        iy++;
-        ia++;
-        ib++;
-        k++;
-    }
-    this->set_sorted(true);
-    this->organise_kspace();
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, a, a_a);
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, b, a_b);
+	if (!x.sorted() || !y.sorted() || !a.sorted() || !b.sorted())
+		THROW("x*a + y*b cannot be applied to unsorted a, b, x or y");
+	std::vector<int> ix = x.acquisitions_not_ignored();
+	std::vector<int> iy = y.acquisitions_not_ignored();
+	std::vector<int> ia = a.acquisitions_not_ignored();
+	std::vector<int> ib = b.acquisitions_not_ignored();
+	size_t n = std::min(std::min(ix.size(), iy.size()),
+		std::min(ia.size(), ib.size()));
+	std::vector<int> k = output_acquisitions_(y, iy, n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)n; i++)
+		xapyb_(x.acquisition_data(ix[i]), a.acquisition_data(ia[i]),
+			y.acquisition_data(iy[i]), b.acquisition_data(ib[i]),
+			acquisition_data(k[i]));
 }
 
 void
@@ -809,311 +1336,202 @@ MRAcquisitionData::xapyb(
     const DataContainer& a_x, const void* ptr_a,
     const DataContainer& a_y, const DataContainer& a_b)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, b, a_b);
-    if (!x.sorted() || !y.sorted() || !b.sorted())
-        THROW("x*a + y*b cannot be applied to unsorted a, b, x or y");
-    complex_float_t a = *static_cast<const complex_float_t*>(ptr_a);
-    int nx = x.number();
-    int ny = y.number();
-    int nb = b.number();
-    ISMRMRD::Acquisition ax;
-    ISMRMRD::Acquisition ay;
-    ISMRMRD::Acquisition ab;
-    ISMRMRD::Acquisition acq;
-    bool isempty = (number() < 1);
-    for (int ix = 0, iy = 0, ib = 0, k = 0;
-        ix < nx && iy < ny && ib < nb;) {
-        if (!x.get_acquisition(ix, ax)) {
-            std::cout << ix << " ignored (ax)\n";
-            ix++;
-            continue;
-        }
-        if (!y.get_acquisition(iy, ay)) {
-            std::cout << iy << " ignored (ay)\n";
-            iy++;
-            continue;
-        }
-        if (!b.get_acquisition(ib, ab)) {
-            std::cout << ib << " ignored (ab)\n";
-            ib++;
-            continue;
-        }
-        if (!isempty) {
-            if (!get_acquisition(k, acq)) {
-                std::cout << k << " ignored (acq)\n";
-                k++;
-                continue;
-            }
-        }
-        MRAcquisitionData::xapyb(ax, a, ay, ab);
-        if (isempty)
-            append_acquisition(ay);
-        else
-            set_acquisition(k, ay);
-        ix++;
-        iy++;
-        ib++;
-        k++;
-    }
-    this->set_sorted(true);
-    this->organise_kspace();
-}
-
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, b, a_b);
+	if (!x.sorted() || !y.sorted() || !b.sorted())
+		THROW("x*a + y*b cannot be applied to unsorted a, b, x or y");
+	complex_float_t a = *static_cast<const complex_float_t*>(ptr_a);
+	std::vector<int> ix = x.acquisitions_not_ignored();
+	std::vector<int> iy = y.acquisitions_not_ignored();
+	std::vector<int> ib = b.acquisitions_not_ignored();
+	size_t n = std::min(std::min(ix.size(), iy.size()), ib.size());
+	std::vector<int> k = output_acquisitions_(y, iy, n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)n; i++)
+		xapyb_(x.acquisition_data(ix[i]), a,
+			y.acquisition_data(iy[i]), b.acquisition_data(ib[i]),
+			acquisition_data(k[i]));
+}
+
+template<class F>
 void
-MRAcquisitionData::multiply(const DataContainer& a_x, const DataContainer& a_y)
+MRAcquisitionData::apply_binary_(
+    const DataContainer& a_x, const DataContainer& a_y, F f)
 {
 	SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
 	SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-	binary_op(x, y, MRAcquisitionData::multiply);
+	if (!x.sorted() || !y.sorted())
+		THROW("binary algebraic operations cannot be applied to unsorted data");
+	std::vector<int> ix = x.acquisitions_not_ignored();
+	std::vector<int> iy = y.acquisitions_not_ignored();
+	size_t n = std::min(ix.size(), iy.size());
+	std::vector<int> k = output_acquisitions_(y, iy, n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)n; i++)
+		binary_op_(x.acquisition_data(ix[i]), y.acquisition_data(iy[i]),
+			acquisition_data(k[i]), f);
+}
+
+template<class F>
+void
+MRAcquisitionData::apply_semibinary_(const DataContainer& a_x, complex_float_t y, F f)
+{
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
+	if (!x.sorted())
+		THROW("binary algebraic operations cannot be applied to unsorted data");
+	std::vector<int> ix = x.acquisitions_not_ignored();
+	size_t n = ix.size();
+	std::vector<int> k = output_acquisitions_(x, ix, n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)n; i++)
+		semibinary_op_(x.acquisition_data(ix[i]), y, acquisition_data(k[i]), f);
+}
+
+template<class F>
+void
+MRAcquisitionData::apply_unary_(const DataContainer& a_x, F f)
+{
+	SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
+	if (!x.sorted())
+		THROW("unary algebraic operations cannot be applied to unsorted data");
+	std::vector<int> ix = x.acquisitions_not_ignored();
+	size_t n = ix.size();
+	std::vector<int> k = output_acquisitions_(x, ix, n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)n; i++)
+		unary_op_(x.acquisition_data(ix[i]), acquisition_data(k[i]), f);
+}
+
+void
+MRAcquisitionData::binary_op(
+    const DataContainer& a_x, const DataContainer& a_y,
+    complex_float_t(*f)(complex_float_t, complex_float_t))
+{
+	apply_binary_(a_x, a_y, f);
+}
+
+void
+MRAcquisitionData::semibinary_op(const DataContainer& a_x, complex_float_t y,
+    complex_float_t(*f)(complex_float_t, complex_float_t))
+{
+	apply_semibinary_(a_x, y, f);
+}
+
+void
+MRAcquisitionData::unary_op(const DataContainer& a_x,
+    complex_float_t(*f)(complex_float_t))
+{
+	apply_unary_(a_x, f);
+}
+
+void
+MRAcquisitionData::multiply(const DataContainer& a_x, const DataContainer& a_y)
+{
+	apply_binary_(a_x, a_y, kernels::Product());
 }
 
 void
 MRAcquisitionData::multiply(const DataContainer& a_x, const void* ptr_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, MRAcquisitionData::multiply);
+    apply_semibinary_(a_x, y, kernels::Product());
 }
 
 void
 MRAcquisitionData::add(const DataContainer& a_x, const void* ptr_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, MRAcquisitionData::add);
+    apply_semibinary_(a_x, y, kernels::Sum());
 }
 
 void
 MRAcquisitionData::divide(const DataContainer& a_x, const DataContainer& a_y)
 {
-	SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-	SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-	binary_op(x, y, MRAcquisitionData::divide);
+	apply_binary_(a_x, a_y, kernels::Ratio());
 }
 
 void
 MRAcquisitionData::maximum(const DataContainer& a_x, const DataContainer& a_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-    binary_op(x, y, MRAcquisitionData::maximum);
+    apply_binary_(a_x, a_y, kernels::MaxReal());
 }
 
 void
 MRAcquisitionData::maximum(const DataContainer& a_x, const void* ptr_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, MRAcquisitionData::maximum);
+    apply_semibinary_(a_x, y, kernels::MaxReal());
 }
 
 void
 MRAcquisitionData::minimum(const DataContainer& a_x, const DataContainer& a_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-    binary_op(x, y, MRAcquisitionData::minimum);
+    apply_binary_(a_x, a_y, kernels::MinReal());
 }
 
 void
 MRAcquisitionData::minimum(const DataContainer& a_x, const void* ptr_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, MRAcquisitionData::minimum);
+    apply_semibinary_(a_x, y, kernels::MinReal());
 }
 
 void
 MRAcquisitionData::power(const DataContainer& a_x, const DataContainer& a_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-    binary_op(x, y, MRAcquisitionData::power);
+    apply_binary_(a_x, a_y, kernels::Power());
 }
 
 void
 MRAcquisitionData::power(const DataContainer& a_x, const void* ptr_y)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, MRAcquisitionData::power);
+    apply_semibinary_(a_x, y, kernels::Power());
 }
 
 void
 MRAcquisitionData::exp(const DataContainer& a_x)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    unary_op(x, MRAcquisitionData::exp);
+    apply_unary_(a_x, kernels::Exp());
 }
 
 void
 MRAcquisitionData::log(const DataContainer& a_x)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    unary_op(x, MRAcquisitionData::log);
+    apply_unary_(a_x, kernels::Log());
 }
 
 void
 MRAcquisitionData::sqrt(const DataContainer& a_x)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    unary_op(x, MRAcquisitionData::sqrt);
+    apply_unary_(a_x, kernels::Sqrt());
 }
 
 void
 MRAcquisitionData::sign(const DataContainer& a_x)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    unary_op(x, MRAcquisitionData::sign);
+    apply_unary_(a_x, kernels::Sign());
 }
 
 void
 MRAcquisitionData::abs(const DataContainer& a_x)
 {
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    unary_op(x, MRAcquisitionData::abs);
-}
-
-void
-MRAcquisitionData::binary_op(
-    const DataContainer& a_x, const DataContainer& a_y,
-    void(*f)(const ISMRMRD::Acquisition&, ISMRMRD::Acquisition&))
-{
-	SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-	SIRF_DYNAMIC_CAST(const MRAcquisitionData, y, a_y);
-	if (!x.sorted() || !y.sorted())
-		THROW("binary algebraic operations cannot be applied to unsorted data");
-
-	int nx = x.number();
-	int ny = y.number();
-	ISMRMRD::Acquisition ax;
-	ISMRMRD::Acquisition ay;
-	ISMRMRD::Acquisition acq;
-	bool isempty = (number() < 1);
-    for (int ix = 0, iy = 0, k = 0; ix < nx && iy < ny;) {
-		if (!x.get_acquisition(ix, ax)) {
-			std::cout << ix << " ignored (ax)\n";
-			ix++;
-			continue;
-		}
-		if (!y.get_acquisition(iy, ay)) {
-			std::cout << iy << " ignored (ay)\n";
-			iy++;
-			continue;
-		}
-		if (!isempty) {
-			if (!get_acquisition(k, acq)) {
-				std::cout << k << " ignored (acq)\n";
-				k++;
-				continue;
-			}
-		}
-        f(ax, ay);
-		if (isempty)
-			append_acquisition(ay);
-		else
-			set_acquisition(k, ay);
-		ix++;
-		iy++;
-		k++;
-	}
-	this->set_sorted(true);
-	this->organise_kspace();
-}
-
-void
-MRAcquisitionData::semibinary_op(const DataContainer& a_x, complex_float_t y,
-    void(*f)(const ISMRMRD::Acquisition&, ISMRMRD::Acquisition&, complex_float_t y))
-{
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    if (!x.sorted())
-        THROW("binary algebraic operations cannot be applied to unsorted data");
-
-    int nx = x.number();
-    ISMRMRD::Acquisition ax;
-    ISMRMRD::Acquisition ay;
-    ISMRMRD::Acquisition acq;
-    bool isempty = (number() < 1);
-    for (int ix = 0, k = 0; ix < nx;) {
-        if (!x.get_acquisition(ix, ax)) {
-            std::cout << ix << " ignored (ax)\n";
-            ix++;
-            continue;
-        }
-        if (!isempty) {
-            if (!get_acquisition(k, acq)) {
-                std::cout << k << " ignored (acq)\n";
-                k++;
-                continue;
-            }
-        }
-        x.get_acquisition(ix, ay);
-        f(ax, ay, y);
-        if (isempty)
-            append_acquisition(ay);
-        else
-            set_acquisition(k, ay);
-        ix++;
-        k++;
-    }
-    this->set_sorted(true);
-    this->organise_kspace();
-}
-
-void
-MRAcquisitionData::unary_op(const DataContainer& a_x,
-    void(*f)(const ISMRMRD::Acquisition&, ISMRMRD::Acquisition&))
-{
-    SIRF_DYNAMIC_CAST(const MRAcquisitionData, x, a_x);
-    if (!x.sorted())
-        THROW("binary algebraic operations cannot be applied to unsorted data");
-
-    int nx = x.number();
-    ISMRMRD::Acquisition ax;
-    ISMRMRD::Acquisition ay;
-    ISMRMRD::Acquisition acq;
-    bool isempty = (number() < 1);
-    for (int ix = 0, k = 0; ix < nx;) {
-        if (!x.get_acquisition(ix, ax)) {
-            std::cout << ix << " ignored (ax)\n";
-            ix++;
-            continue;
-        }
-        if (!isempty) {
-            if (!get_acquisition(k, acq)) {
-                std::cout << k << " ignored (acq)\n";
-                k++;
-                continue;
-            }
-        }
-        x.get_acquisition(ix, ay);
-        f(ax, ay);
-        if (isempty)
-            append_acquisition(ay);
-        else
-            set_acquisition(k, ay);
-        ix++;
-        k++;
-    }
-    this->set_sorted(true);
-    this->organise_kspace();
+    apply_unary_(a_x, kernels::Abs());
 }
 
 float
 MRAcquisitionData::norm() const
 {
-	int n = number();
+	std::vector<int> ia = acquisitions_not_ignored();
+	int n = ia.size();
+	std::vector<float> ri(n);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < n; i++)
+		ri[i] = norm2_(acquisition_data(ia[i]));
 	float r = 0;
-	ISMRMRD::Acquisition a;
-	for (int i = 0; i < n; i++) {
-		if (!get_acquisition(i, a)) {
-			continue;
-		}
-		float s = MRAcquisitionData::norm(a);
-		r += s*s;
-	}
+	for (int i = 0; i < n; i++)
+		r += ri[i];
 	return std::sqrt(r);
 }
 
@@ -1164,23 +1582,32 @@ void
 MRAcquisitionData::sort_by_time()
 {
     size_t const N = this->number();
-    index_.resize(N);
     if (N == 0)
         std::cerr
         << "WARNING: cannot sort an empty container of acquisition data."
         << std::endl;
     else {
-        std::vector<uint32_t> a;
+        changed_();
+        // time stamps are sorted in the storage order, hence the numbers
+        // of stored acquisitions are found first
+        shared_ptr<const AcquisitionsHeaderIndex> sptr_index = header_index();
+        std::vector<int> num(N);
         for (size_t i = 0; i < N; i++)
-        {
-            ISMRMRD::Acquisition acq;
-            get_acquisition(i, acq);
-            a.push_back(acq.acquisition_time_stamp());
-        }
+            num[index(i)] = i;
+        std::vector<uint32_t> a(N);
+        for (size_t i = 0; i < N; i++)
+            a[i] = sptr_index->time_stamp[num[i]];
+        index_.resize(N);
         int* index = &index_[0];
         std::iota(index, index + N, 0);
         std::stable_sort
         (index, index + N, [&a](int i, int j) {return (a[i] < a[j]); });
+        // the header index follows the new order of acquisitions
+        std::vector<int> order(N);
+        for (size_t i = 0; i < N; i++)
+            order[i] = num[index_[i]];
+        header_index_.set(shared_ptr<const AcquisitionsHeaderIndex>
+            (new AcquisitionsHeaderIndex(sptr_index->permuted(order))));
     }
 
     this->organise_kspace();
@@ -1192,15 +1619,16 @@ std::vector<KSpaceSubset::SetType > MRAcquisitionData::get_kspace_order() const
 {
     if(this->is_empty())
         throw LocalisedException("Your acquisition data object contains no data, so no order is determined." , __FILE__, __LINE__);
-    else if(this->sorting_.size() == 0)
+    else if(!this->sptr_sorting_ || this->sptr_sorting_->subsets.size() == 0)
         throw LocalisedException("The kspace is not sorted yet. Please call organise_kspace(), sort() or sort_by_time() first." , __FILE__, __LINE__);
     
+    const std::vector<KSpaceSubset>& sorting = this->sptr_sorting_->subsets;
 
     std::vector<KSpaceSubset::SetType > output;
-    for(unsigned i = 0; i<sorting_.size(); ++i)
+    for(unsigned i = 0; i<sorting.size(); ++i)
     {
-        if(!sorting_.at(i).get_idx_set().empty())
-               output.push_back(sorting_.at(i).get_idx_set());
+        if(!sorting.at(i).get_idx_set().empty())
+               output.push_back(sorting.at(i).get_idx_set());
     }
     return output;
 }
@@ -1220,7 +1648,9 @@ static int get_num_enc_states( const ISMRMRD::Optional<ISMRMRD::Limit>& enc_lim)
 
 void MRAcquisitionData::organise_kspace()
 {
-    std::vector<KSpaceSubset>().swap(this->sorting_);
+    // a new sorting is built, the old one may be shared with other containers
+    shared_ptr<KSpaceSorting> sptr_sorting(new KSpaceSorting);
+    std::vector<KSpaceSubset>& subsets = sptr_sorting->subsets;
 
     const ISMRMRD::IsmrmrdHeader header = this->acquisitions_info().get_IsmrmrdHeader();
 
@@ -1253,21 +1683,24 @@ void MRAcquisitionData::organise_kspace()
             tag[i]=0; // ignore user ints so far
 
         KSpaceSubset sorting(tag);
-        this->sorting_.push_back(sorting);
+        subsets.push_back(sorting);
     }
 
-    ISMRMRD::Acquisition acq;
+    shared_ptr<const AcquisitionsHeaderIndex> sptr_index = this->header_index();
     for(int i=0; i<this->number(); ++i)
     {
-        this->get_acquisition(i, acq);
-
-        KSpaceSubset::TagType tag = KSpaceSubset::get_tag_from_acquisition(acq);
+        KSpaceSubset::TagType tag = KSpaceSubset::get_tag_from_counters(sptr_index->idx[i]);
         int access_idx = (((((tag[0] * NSlice + tag[1])*NCont + tag[2])*NPhase + tag[3])*NRep + tag[4])*NSet + tag[5])*NSegm + tag[6];
-        this->sorting_.at(access_idx).add_idx_to_set(i);
+        subsets.at(access_idx).add_idx_to_set(i);
     }
-    this->sorting_.erase(
-                std::remove_if(sorting_.begin(), sorting_.end(),[](const KSpaceSubset& s){return s.get_idx_set().empty();}),
-                sorting_.end());
+    subsets.erase(
+                std::remove_if(subsets.begin(), subsets.end(),[](const KSpaceSubset& s){return s.idx_set().empty();}),
+                subsets.end());
+
+    for(int i=0; i<subsets.size(); ++i)
+        sptr_sorting->subset_index[subsets[i].get_tag()] = i;
+
+    this->sptr_sorting_ = sptr_sorting;
 }
 
 
@@ -1278,145 +1711,1055 @@ std::vector<int> MRAcquisitionData::get_flagged_acquisitions_index(const std::ve
     if(flags.empty())
         return flags_true_index;
 
-    ISMRMRD::Acquisition acq;
+    uint64_t mask = 0;
+    for(auto it: flags)
+        mask |= (uint64_t)1 << (it - 1);
 
+    shared_ptr<const AcquisitionsHeaderIndex> sptr_index = this->header_index();
     for(int i=0; i<this->number(); ++i)
     {
-        this->get_acquisition(i, acq);
-        bool one_flag_is_set = false;
-        
-        for(auto it: flags)
-            one_flag_is_set = (one_flag_is_set || acq.isFlagSet(it));
-        
-        if(one_flag_is_set)
+        if(sptr_index->flags[i] & mask)
             flags_true_index.push_back(i);
     }
 
-    return flags_true_index;
+    return flags_true_index;
+}
+
+std::vector<int> MRAcquisitionData::get_slice_encoding_index(const unsigned kspace_encode_step_2) const
+{
+    std::vector<int> slice_encode_index;
+
+    shared_ptr<const AcquisitionsHeaderIndex> sptr_index = this->header_index();
+    for(int i=0; i<this->number(); ++i)
+    {
+        if( sptr_index->idx[i].kspace_encode_step_2 == kspace_encode_step_2)
+            slice_encode_index.push_back(i);
+    }
+
+    return slice_encode_index;
+}
+
+
+void MRAcquisitionData::get_subset(MRAcquisitionData& subset, const std::vector<int> subset_idx) const
+{
+    subset.set_acquisitions_info(this->acquisitions_info());
+
+    if(subset.number()>0)
+        throw LocalisedException("Please pass an empty MRAcquisitionnData container to store the subset in", __FUNCTION__, __LINE__);
+
+    ISMRMRD::Acquisition acq;
+    for(int i=0; i<subset_idx.size(); ++i)
+    {
+        this->get_acquisition(subset_idx[i], acq);
+        subset.append_acquisition(acq);
+    }
+}
+
+void MRAcquisitionData::set_subset(const MRAcquisitionData& subset, const std::vector<int> subset_idx)
+{
+    if(subset.number() != subset_idx.size())
+        throw LocalisedException("Number of subset positions and number of acquisitions in subset don't match.", __FILE__, __LINE__);
+
+    ISMRMRD::Acquisition acq;
+    for(int i=0; i<subset_idx.size(); ++i)
+    {
+        subset.get_acquisition(i, acq);
+        this->set_acquisition(subset_idx[i], acq);
+    }
+}
+
+AcquisitionsVector*
+AcquisitionsVector::clone_impl() const
+{
+	AcquisitionsVector* ptr_ad =
+		new AcquisitionsVector(this->acqs_info_, this->ignore_mask_);
+	for (int i = 0; i < number(); i++) {
+		ISMRMRD::Acquisition acq;
+		get_acquisition(i, acq);
+		ptr_ad->append_acquisition(acq);
+	}
+	// the clone stores the acquisitions in their order here
+	share_layout_(*ptr_ad);
+	return ptr_ad;
+}
+
+void
+AcquisitionsVector::append_acquisitions(size_t n,
+	const ISMRMRD::AcquisitionHeader* heads,
+	const complex_float_t* const* data, const float* const* traj)
+{
+	size_t na = acqs_.size();
+	acqs_.resize(na + n);
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < (int)n; i++) {
+		ISMRMRD::Acquisition* ptr_acq = new ISMRMRD::Acquisition;
+		ptr_acq->setHead(heads[i]);
+		std::copy(data[i], data[i] + acquisition_data_size(heads[i]),
+			ptr_acq->getDataPtr());
+		size_t nt = acquisition_traj_size(heads[i]);
+		if (nt)
+			std::copy(traj[i], traj[i] + nt, ptr_acq->getTrajPtr());
+		acqs_[na + i].reset(ptr_acq);
+	}
+	invalidate_header_index_();
+}
+
+void
+AcquisitionsVector::empty()
+{
+	acqs_.clear();
+    index_.clear();
+    invalidate_header_index_();
+}
+
+void
+AcquisitionsVector::conjugate_impl()
+{
+    int na = number();
+    for (int a = 0, i = 0; a < na; a++) {
+        int ia = index(a);
+        ISMRMRD::Acquisition& acq = *acqs_[ia];
+        unsigned int nc = acq.active_channels();
+        unsigned int ns = acq.number_of_samples();
+        for (int c = 0; c < nc; c++)
+            for (int s = 0; s < ns; s++, i++)
+                acq.data(s, c) = std::conj(acq.data(s, c));
+    }
+}
+
+void
+AcquisitionsVector::set_data(const complex_float_t* z, int all)
+{
+	int na = number();
+	for (int a = 0, i = 0; a < na; a++) {
+		int ia = index(a);
+		ISMRMRD::Acquisition& acq = *acqs_[ia];
+		IgnoreMask ignore_mask = this->ignore_mask();
+		if (!all && ignore_mask.ignored(acq.flags())) {
+			std::cout << "ignoring acquisition " << ia << '\n';
+			continue;
+		}
+		unsigned int nc = acq.active_channels();
+		unsigned int ns = acq.number_of_samples();
+		for (int c = 0; c < nc; c++)
+			for (int s = 0; s < ns; s++, i++)
+				acq.data(s, c) = z[i];
+	}
+}
+
+void
+AcquisitionsVector::copy_acquisitions_data(const MRAcquisitionData& ac)
+{
+	ISMRMRD::Acquisition acq_dst;
+	ISMRMRD::Acquisition acq_src;
+	int na = number();
+	ASSERT(na == ac.number(), "copy source and destination sizes differ");
+	for (int a = 0, i = 0; a < na; a++) {
+		ac.get_acquisition(a, acq_src);
+		ISMRMRD::Acquisition& acq_dst = *acqs_[a];
+		unsigned int nc = acq_dst.active_channels();
+		unsigned int ns = acq_dst.number_of_samples();
+		ASSERT(nc == acq_src.active_channels(), 
+			"copy source and destination coil numbers differ");
+		ASSERT(ns == acq_src.number_of_samples(), 
+			"copy source and destination samples numbers differ");
+		for (int c = 0; c < nc; c++)
+			for (int s = 0; s < ns; s++, i++)
+				acq_dst.data(s, c) = acq_src.data(s, c);
+	}
+}
+
+std::string
+MRAcquisitionData::storage_scheme()
+{
+	storage_template();
+	return storage_scheme_;
+}
+
+shared_ptr<MRAcquisitionData>
+MRAcquisitionData::storage_template()
+{
+	if (!acqs_templ_)
+		AcquisitionsVector::set_as_template();
+	return acqs_templ_;
+}
+
+AcquisitionsArray*
+AcquisitionsArray::clone_impl() const
+{
+	return new AcquisitionsArray(*this);
+}
+
+shared_ptr<ISMRMRD::Acquisition>
+MRAcquisitionData::write_back_copy_(unsigned int num)
+{
+	ISMRMRD::Acquisition* ptr_acq = new ISMRMRD::Acquisition;
+	get_acquisition(num, *ptr_acq);
+	MRAcquisitionData* ptr_ad = this;
+	std::weak_ptr<std::atomic<unsigned long> > alive = token_.sptr;
+	unsigned long changes = token_.sptr->load();
+	return shared_ptr<ISMRMRD::Acquisition>(ptr_acq,
+		[ptr_ad, alive, changes, num](ISMRMRD::Acquisition* ptr)
+	{
+		try {
+			shared_ptr<std::atomic<unsigned long> > sptr = alive.lock();
+			// the stored acquisition is what the copy was made from if
+			// the container has not changed since
+			if (sptr.get() && sptr->load() == changes && num < ptr_ad->number()) {
+				ISMRMRD::Acquisition acq;
+				ptr_ad->get_acquisition(num, acq);
+				const ISMRMRD::AcquisitionHeader& head = ptr->getHead();
+				const ISMRMRD::AcquisitionHeader& stored = acq.getHead();
+				size_t nd = acquisition_data_size(head);
+				size_t nt = acquisition_traj_size(head);
+				if (nd != acquisition_data_size(stored) || nt != acquisition_traj_size(stored))
+					std::cerr << "WARNING: acquisition " << num << " has changed "
+					<< "size and is not written back into the container" << std::endl;
+				else if (std::memcmp(&head, &stored, sizeof(head))
+					|| !std::equal(ptr->getDataPtr(), ptr->getDataPtr() + nd, acq.getDataPtr())
+					|| !std::equal(ptr->getTrajPtr(), ptr->getTrajPtr() + nt, acq.getTrajPtr()))
+					ptr_ad->set_acquisition(num, *ptr);
+			}
+		}
+		catch (const std::exception& e) {
+			std::cerr << "WARNING: acquisition " << num << " not written back: "
+				<< e.what() << std::endl;
+		}
+		delete ptr;
+	});
+}
+
+void
+AcquisitionsArray::empty()
+{
+	headers_.clear();
+	data_offset_.assign(1, 0);
+	traj_offset_.assign(1, 0);
+	DataBuffer().swap(data_);
+	std::vector<float>().swap(traj_);
+	data_garbage_ = 0;
+	traj_garbage_ = 0;
+	index_.clear();
+	invalidate_header_index_();
+	changed_();
+}
+
+void
+AcquisitionsArray::append_acquisition(ISMRMRD::Acquisition& acq)
+{
+	const ISMRMRD::AcquisitionHeader& head = acq.getHead();
+	size_t nd = acquisition_data_size(head);
+	size_t nt = acquisition_traj_size(head);
+	size_t od = data_offset_.back();
+	size_t ot = traj_offset_.back();
+	headers_.push_back(head);
+	data_.resize(od + nd);
+	std::copy(acq.getDataPtr(), acq.getDataPtr() + nd, data_.begin() + od);
+	data_offset_.push_back(od + nd);
+	if (nt) {
+		traj_.resize(ot + nt);
+		std::copy(acq.getTrajPtr(), acq.getTrajPtr() + nt, traj_.begin() + ot);
+	}
+	traj_offset_.push_back(ot + nt);
+	invalidate_header_index_();
+	changed_();
+}
+
+void
+AcquisitionsArray::append_acquisitions(size_t n,
+	const ISMRMRD::AcquisitionHeader* heads,
+	const complex_float_t* const* data, const float* const* traj)
+{
+	size_t na = headers_.size();
+	headers_.insert(headers_.end(), heads, heads + n);
+	data_offset_.resize(na + n + 1);
+	traj_offset_.resize(na + n + 1);
+	for (size_t i = 0; i < n; i++) {
+		data_offset_[na + i + 1] = data_offset_[na + i] + acquisition_data_size(heads[i]);
+		traj_offset_[na + i + 1] = traj_offset_[na + i] + acquisition_traj_size(heads[i]);
+	}
+	data_.resize(data_offset_.back());
+	traj_.resize(traj_offset_.back());
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < (int)n; i++) {
+		size_t ind = na + i;
+		std::copy(data[i], data[i] + acquisition_data_size(heads[i]),
+			data_.begin() + data_offset_[ind]);
+		size_t nt = acquisition_traj_size(heads[i]);
+		if (nt)
+			std::copy(traj[i], traj[i] + nt, traj_.begin() + traj_offset_[ind]);
+	}
+	invalidate_header_index_();
+	changed_();
+}
+
+int
+AcquisitionsArray::get_acquisition(unsigned int num,
+	ISMRMRD::Acquisition& acq) const
+{
+	int ind = index(num);
+	const ISMRMRD::AcquisitionHeader& head = headers_[ind];
+	acq.setHead(head);
+	std::copy(data_.begin() + data_offset_[ind],
+		data_.begin() + data_offset_[ind] + acquisition_data_size(head),
+		acq.getDataPtr());
+	size_t nt = acquisition_traj_size(head);
+	if (nt)
+		std::copy(traj_.begin() + traj_offset_[ind],
+			traj_.begin() + traj_offset_[ind] + nt, acq.getTrajPtr());
+	if (ignore_mask_.ignored(head.flags))
+		return 0;
+	return 1;
+}
+
+DataSpan<const complex_float_t>
+AcquisitionsArray::acquisition_data(unsigned int num) const
+{
+	int ind = index(num);
+	return DataSpan<const complex_float_t>(data_.data() + data_offset_[ind],
+		acquisition_data_size(headers_[ind]));
+}
+
+DataSpan<complex_float_t>
+AcquisitionsArray::acquisition_data(unsigned int num)
+{
+	int ind = index(num);
+	changed_();
+	return DataSpan<complex_float_t>(data_.data() + data_offset_[ind],
+		acquisition_data_size(headers_[ind]));
+}
+
+DataSpan<const float>
+AcquisitionsArray::acquisition_traj(unsigned int num) const
+{
+	int ind = index(num);
+	return DataSpan<const float>(traj_.data() + traj_offset_[ind],
+		acquisition_traj_size(headers_[ind]));
+}
+
+shared_ptr<ISMRMRD::Acquisition>
+AcquisitionsArray::get_acquisition_sptr(unsigned int num)
+{
+	return write_back_copy_(num);
+}
+
+void
+AcquisitionsArray::store_(unsigned int ind, const ISMRMRD::Acquisition& acq)
+{
+	const ISMRMRD::AcquisitionHeader& head = acq.getHead();
+	size_t nd = acquisition_data_size(head);
+	size_t nt = acquisition_traj_size(head);
+	size_t md = acquisition_data_size(headers_[ind]);
+	size_t mt = acquisition_traj_size(headers_[ind]);
+	changed_();
+	// a resized slot is moved to the end of the buffer, the old one is
+	// abandoned (shifting the slots that follow it would cost as much as
+	// copying the whole buffer)
+	if (nd != md) {
+		data_garbage_ += md;
+		data_offset_[ind] = data_offset_.back();
+		data_offset_.back() += nd;
+		data_.resize(data_offset_.back());
+	}
+	if (nt != mt) {
+		traj_garbage_ += mt;
+		traj_offset_[ind] = traj_offset_.back();
+		traj_offset_.back() += nt;
+		traj_.resize(traj_offset_.back());
+	}
+	update_header_index_(headers_[ind], head);
+	headers_[ind] = head;
+	std::copy(acq.getDataPtr(), acq.getDataPtr() + nd,
+		data_.begin() + data_offset_[ind]);
+	if (nt)
+		std::copy(acq.getTrajPtr(), acq.getTrajPtr() + nt,
+			traj_.begin() + traj_offset_[ind]);
+	if (2 * data_garbage_ > data_.size() || 2 * traj_garbage_ > traj_.size()) {
+		std::vector<int> order(headers_.size());
+		std::iota(order.begin(), order.end(), 0);
+		permute_(order);
+	}
+}
+
+void
+AcquisitionsArray::permute_(const std::vector<int>& order)
+{
+	// abandoned slots are dropped
+	size_t n = headers_.size();
+	std::vector<ISMRMRD::AcquisitionHeader> headers(n);
+	std::vector<size_t> data_offset(n + 1, 0);
+	std::vector<size_t> traj_offset(n + 1, 0);
+	DataBuffer data(data_.size() - data_garbage_);
+	std::vector<float> traj(traj_.size() - traj_garbage_);
+	for (size_t i = 0; i < n; i++) {
+		int j = order[i];
+		headers[i] = headers_[j];
+		data_offset[i + 1] = std::copy(data_.begin() + data_offset_[j],
+			data_.begin() + data_offset_[j] + acquisition_data_size(headers_[j]),
+			data.begin() + data_offset[i]) - data.begin();
+		traj_offset[i + 1] = std::copy(traj_.begin() + traj_offset_[j],
+			traj_.begin() + traj_offset_[j] + acquisition_traj_size(headers_[j]),
+			traj.begin() + traj_offset[i]) - traj.begin();
+	}
+	headers_.swap(headers);
+	data_offset_.swap(data_offset);
+	traj_offset_.swap(traj_offset);
+	data_.swap(data);
+	traj_.swap(traj);
+	data_garbage_ = 0;
+	traj_garbage_ = 0;
+}
+
+void
+AcquisitionsArray::sort_by_time()
+{
+	MRAcquisitionData::sort_by_time();
+	// store acquisitions in the sorted order: the acquisition numbers,
+	// and hence the k-space sorting, stay the same
+	if (!index_.empty()) {
+		permute_(index_);
+		index_.clear();
+	}
+}
+
+bool
+AcquisitionsArray::supports_array_view() const
+{
+	// the buffer can be viewed as a (na, nc, ns) array if acquisitions are
+	// stored one after another in their logical order, have same sizes
+	// and none is ignored
+	size_t n = headers_.size();
+	if (n == 0 || data_garbage_ > 0)
+		return false;
+	for (size_t i = 0; i < index_.size(); i++)
+		if (index_[i] != (int)i)
+			return false;
+	const ISMRMRD::AcquisitionHeader& head0 = headers_[0];
+	size_t const size0 = acquisition_data_size(head0);
+	for (size_t i = 0; i < n; i++) {
+		const ISMRMRD::AcquisitionHeader& head = headers_[i];
+		if (ignore_mask_.ignored(head.flags)
+			|| head.number_of_samples != head0.number_of_samples
+			|| head.active_channels != head0.active_channels
+			|| data_offset_[i] != i * size0)
+			return false;
+	}
+	return true;
+}
+
+size_t
+AcquisitionsArray::address() const
+{
+	if (!supports_array_view())
+		THROW("acquisition data cannot be viewed as a (na, nc, ns) array");
+	// the data may be changed via the view
+	changed_();
+	return reinterpret_cast<size_t>(data_.data());
+}
+
+void
+AcquisitionsArray::conjugate_impl()
+{
+	changed_();
+	for (size_t i = 0; i < data_.size(); i++)
+		data_[i] = std::conj(data_[i]);
+}
+
+void
+AcquisitionsArray::set_data(const complex_float_t* z, int all)
+{
+	int na = number();
+	changed_();
+	for (int a = 0; a < na; a++) {
+		int ia = index(a);
+		if (!all && ignore_mask_.ignored(headers_[ia].flags)) {
+			std::cout << "ignoring acquisition " << ia << '\n';
+			continue;
+		}
+		size_t n = acquisition_data_size(headers_[ia]);
+		std::copy(z, z + n, data_.begin() + data_offset_[ia]);
+		z += n;
+	}
+}
+
+void
+AcquisitionsArray::copy_acquisitions_data(const MRAcquisitionData& ac)
+{
+	ISMRMRD::Acquisition acq_src;
+	int na = number();
+	ASSERT(na == ac.number(), "copy source and destination sizes differ");
+	changed_();
+	for (int a = 0; a < na; a++) {
+		ac.get_acquisition(a, acq_src);
+		int ia = index(a);
+		const ISMRMRD::AcquisitionHeader& head = headers_[ia];
+		ASSERT(head.active_channels == acq_src.active_channels(),
+			"copy source and destination coil numbers differ");
+		ASSERT(head.number_of_samples == acq_src.number_of_samples(),
+			"copy source and destination samples numbers differ");
+		std::copy(acq_src.getDataPtr(),
+			acq_src.getDataPtr() + acquisition_data_size(head),
+			data_.begin() + data_offset_[ia]);
+	}
+}
+
+size_t AcquisitionsFile::cache_size_ = 1024 * 1024 * 1024;
+size_t AcquisitionsFile::block_size_ = 16 * 1024 * 1024;
+
+void
+AcquisitionsFile::set_cache_size(size_t bytes)
+{
+	cache_size_ = bytes;
+}
+
+size_t
+AcquisitionsFile::cache_size()
+{
+	return cache_size_;
+}
+
+void
+AcquisitionsFile::set_block_size(size_t bytes)
+{
+	if (bytes < sizeof(complex_float_t))
+		THROW("block size too small");
+	block_size_ = bytes;
+}
+
+size_t
+AcquisitionsFile::block_size()
+{
+	return block_size_;
+}
+
+AcquisitionsFile::AcquisitionsFile
+(const std::string& filename_with_ext, int all, IgnoreMask ignore_mask)
+{
+	open_();
+	this->set_ignore_mask(ignore_mask);
+	this->read(filename_with_ext, all);
+}
+
+AcquisitionsFile::AcquisitionsFile
+(const AcquisitionsInfo& info, IgnoreMask ignore_mask)
+{
+	open_();
+	this->set_ignore_mask(ignore_mask);
+	acqs_info_ = info;
+}
+
+AcquisitionsFile::AcquisitionsFile(const AcquisitionsFile& other) :
+	MRAcquisitionData(other)
+{
+	open_();
+	std::lock_guard<std::mutex> lock(other.mutex_);
+	other.flush_();
+	headers_ = other.headers_;
+	traj_ = other.traj_;
+	acq_block_ = other.acq_block_;
+	acq_offset_ = other.acq_offset_;
+	blocks_ = other.blocks_;
+	block_capacity_ = other.block_capacity_;
+	size_t bytes = blocks_.empty() ? 0 :
+		blocks_.back().offset + blocks_.back().size*sizeof(complex_float_t);
+	std::vector<char> buffer(std::min(bytes, block_size_));
+	other.file_.seekg(0);
+	file_.seekp(0);
+	for (size_t done = 0; done < bytes; done += buffer.size()) {
+		size_t n = std::min(buffer.size(), bytes - done);
+		other.file_.read(&buffer[0], n);
+		file_.write(&buffer[0], n);
+	}
+	if (!file_ || !other.file_)
+		THROW("copying acquisitions scratch file " + other.filename_ + " failed");
+}
+
+AcquisitionsFile::~AcquisitionsFile()
+{
+	file_.close();
+	std::remove(filename_.c_str());
+}
+
+AcquisitionsFile*
+AcquisitionsFile::clone_impl() const
+{
+	return new AcquisitionsFile(*this);
+}
+
+void
+AcquisitionsFile::open_()
+{
+	static std::atomic<int> calls(0);
+	std::stringstream name;
+	name << "tmp_acqs_" << ++calls << '_'
+		<< std::chrono::duration_cast<std::chrono::milliseconds>
+		(std::chrono::system_clock::now().time_since_epoch()).count() << ".bin";
+	filename_ = name.str();
+	file_.open(filename_.c_str(), std::ios::in | std::ios::out |
+		std::ios::binary | std::ios::trunc);
+	if (!file_.is_open())
+		THROW("cannot create acquisitions scratch file " + filename_);
+	block_capacity_ = std::max((size_t)1, block_size_ / sizeof(complex_float_t));
+	cached_bytes_ = 0;
+}
+
+void
+AcquisitionsFile::empty()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	headers_.clear();
+	traj_.clear();
+	acq_block_.clear();
+	acq_offset_.clear();
+	blocks_.clear();
+	cache_.clear();
+	lru_.clear();
+	cached_bytes_ = 0;
+	index_.clear();
+	invalidate_header_index_();
+	changed_();
+	file_.close();
+	file_.open(filename_.c_str(), std::ios::in | std::ios::out |
+		std::ios::binary | std::ios::trunc);
+	block_capacity_ = std::max((size_t)1, block_size_ / sizeof(complex_float_t));
+}
+
+void
+AcquisitionsFile::read_block_(int b, Block& block) const
+{
+	const BlockInfo& info = blocks_[b];
+	block.data.assign(info.size, complex_float_t(0));
+	file_.clear();
+	file_.seekg(info.offset);
+	file_.read((char*)block.data.data(), info.size*sizeof(complex_float_t));
+	// samples allocated but not written yet lie beyond the end of the file
+	if (file_.eof())
+		file_.clear();
+	if (!file_)
+		THROW("reading acquisitions scratch file " + filename_ + " failed");
+	block.dirty = false;
+}
+
+void
+AcquisitionsFile::write_block_(int b, const Block& block) const
+{
+	const BlockInfo& info = blocks_[b];
+	file_.clear();
+	file_.seekp(info.offset);
+	file_.write((const char*)block.data.data(), info.size*sizeof(complex_float_t));
+	if (!file_)
+		THROW("writing acquisitions scratch file " + filename_ + " failed");
+}
+
+void
+AcquisitionsFile::evict_() const
+{
+	// a block only referenced by the cache is not in use by anyone
+	LRUList::iterator i = lru_.end();
+	while (cached_bytes_ > cache_size_ && i != lru_.begin()) {
+		--i;
+		CacheEntry& entry = cache_[*i];
+		if (entry.sptr_block.use_count() > 1)
+			continue;
+		Block& block = *entry.sptr_block;
+		if (block.dirty)
+			write_block_(*i, block);
+		cached_bytes_ -= block.data.size()*sizeof(complex_float_t);
+		cache_.erase(*i);
+		i = lru_.erase(i);
+	}
+}
+
+void
+AcquisitionsFile::flush_() const
+{
+	for (std::map<int, CacheEntry>::iterator i = cache_.begin();
+		i != cache_.end(); ++i) {
+		Block& block = *i->second.sptr_block;
+		if (!block.dirty)
+			continue;
+		write_block_(i->first, block);
+		// a block in use may still be changed
+		if (i->second.sptr_block.use_count() == 1)
+			block.dirty = false;
+	}
+	file_.flush();
+}
+
+shared_ptr<AcquisitionsFile::Block>
+AcquisitionsFile::cached_block_(int b, bool modify) const
+{
+	std::map<int, CacheEntry>::iterator i = cache_.find(b);
+	shared_ptr<Block> sptr_block;
+	if (i != cache_.end()) {
+		sptr_block = i->second.sptr_block;
+		lru_.splice(lru_.begin(), lru_, i->second.lru_pos);
+	}
+	else {
+		sptr_block.reset(new Block);
+		read_block_(b, *sptr_block);
+		lru_.push_front(b);
+		CacheEntry& entry = cache_[b];
+		entry.sptr_block = sptr_block;
+		entry.lru_pos = lru_.begin();
+		cached_bytes_ += sptr_block->data.size()*sizeof(complex_float_t);
+		evict_();
+	}
+	if (modify) {
+		sptr_block->dirty = true;
+		changed_();
+	}
+	return sptr_block;
+}
+
+DataSpan<complex_float_t>
+AcquisitionsFile::span_(unsigned int ind, bool modify) const
+{
+	size_t n = acquisition_data_size(headers_[ind]);
+	if (n == 0)
+		return DataSpan<complex_float_t>();
+	std::lock_guard<std::mutex> lock(mutex_);
+	shared_ptr<Block> sptr_block = cached_block_(acq_block_[ind], modify);
+	return DataSpan<complex_float_t>(sptr_block->data.data() + acq_offset_[ind],
+		n, sptr_block);
+}
+
+int
+AcquisitionsFile::allocate_(size_t n, size_t& offset)
+{
+	// only the last block in the file can grow, and not while its samples
+	// are in use (growing may move them in memory)
+	bool grow = !blocks_.empty() &&
+		(blocks_.back().size == 0 || blocks_.back().size + n <= block_capacity_);
+	if (grow) {
+		std::map<int, CacheEntry>::iterator i = cache_.find((int)blocks_.size() - 1);
+		grow = (i == cache_.end() || i->second.sptr_block.use_count() == 1);
+	}
+	if (!grow) {
+		BlockInfo info;
+		info.offset = blocks_.empty() ? 0 :
+			blocks_.back().offset + blocks_.back().size*sizeof(complex_float_t);
+		info.size = 0;
+		blocks_.push_back(info);
+	}
+	int b = (int)blocks_.size() - 1;
+	BlockInfo& info = blocks_[b];
+	offset = info.size;
+	info.size += n;
+	std::map<int, CacheEntry>::iterator i = cache_.find(b);
+	if (i != cache_.end()) {
+		i->second.sptr_block->data.resize(info.size);
+		cached_bytes_ += n*sizeof(complex_float_t);
+	}
+	return b;
+}
+
+void
+AcquisitionsFile::append_(const ISMRMRD::AcquisitionHeader& head,
+	const complex_float_t* data, const float* traj)
+{
+	// the caller must hold the mutex
+	size_t nd = acquisition_data_size(head);
+	size_t nt = acquisition_traj_size(head);
+	size_t offset;
+	int b = allocate_(nd, offset);
+	invalidate_header_index_();
+	changed_();
+	headers_.push_back(head);
+	acq_block_.push_back(b);
+	acq_offset_.push_back(offset);
+	traj_.push_back(std::vector<float>(traj, traj + nt));
+	std::map<int, CacheEntry>::iterator i = cache_.find(b);
+	if (i != cache_.end()) {
+		Block& block = *i->second.sptr_block;
+		std::copy(data, data + nd, block.data.begin() + offset);
+		block.dirty = true;
+	}
+	else if (nd) {
+		file_.clear();
+		file_.seekp(blocks_[b].offset + offset*sizeof(complex_float_t));
+		file_.write((const char*)data, nd*sizeof(complex_float_t));
+		if (!file_)
+			THROW("writing acquisitions scratch file " + filename_ + " failed");
+	}
+}
+
+void
+AcquisitionsFile::append_acquisition(ISMRMRD::Acquisition& acq)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	append_(acq.getHead(), acq.getDataPtr(), acq.getTrajPtr());
+}
+
+void
+AcquisitionsFile::append_acquisitions(size_t n,
+	const ISMRMRD::AcquisitionHeader* heads,
+	const complex_float_t* const* data, const float* const* traj)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (size_t i = 0; i < n; i++)
+		append_(heads[i], data[i], traj[i]);
 }
 
-std::vector<int> MRAcquisitionData::get_slice_encoding_index(const unsigned kspace_encode_step_2) const
+int
+AcquisitionsFile::get_acquisition(unsigned int num,
+	ISMRMRD::Acquisition& acq) const
 {
-    std::vector<int> slice_encode_index;
+	int ind = index(num);
+	const ISMRMRD::AcquisitionHeader& head = headers_[ind];
+	acq.setHead(head);
+	DataSpan<complex_float_t> data = span_(ind, false);
+	std::copy(data.begin(), data.end(), acq.getDataPtr());
+	const std::vector<float>& traj = traj_[ind];
+	std::copy(traj.begin(), traj.end(), acq.getTrajPtr());
+	if (ignore_mask_.ignored(head.flags))
+		return 0;
+	return 1;
+}
 
-    ISMRMRD::Acquisition acq;
+shared_ptr<ISMRMRD::Acquisition>
+AcquisitionsFile::get_acquisition_sptr(unsigned int num)
+{
+	return write_back_copy_(num);
+}
 
-    for(int i=0; i<this->number(); ++i)
-    {
-        this->get_acquisition(i, acq);
-        if( acq.idx().kspace_encode_step_2 == kspace_encode_step_2)
-            slice_encode_index.push_back(i);
-    }
+void
+AcquisitionsFile::store_(unsigned int ind, const ISMRMRD::Acquisition& acq)
+{
+	const ISMRMRD::AcquisitionHeader& head = acq.getHead();
+	size_t nd = acquisition_data_size(head);
+	size_t nt = acquisition_traj_size(head);
+	changed_();
+	if (nd != acquisition_data_size(headers_[ind])) {
+		// the old slot is abandoned
+		std::lock_guard<std::mutex> lock(mutex_);
+		acq_block_[ind] = allocate_(nd, acq_offset_[ind]);
+	}
+	update_header_index_(headers_[ind], head);
+	headers_[ind] = head;
+	traj_[ind].assign(acq.getTrajPtr(), acq.getTrajPtr() + nt);
+	DataSpan<complex_float_t> data = span_(ind, true);
+	std::copy(acq.getDataPtr(), acq.getDataPtr() + nd, data.begin());
+}
 
-    return slice_encode_index;
+void
+AcquisitionsFile::conjugate_impl()
+{
+	for (int b = 0; b < (int)blocks_.size(); b++) {
+		shared_ptr<Block> sptr_block;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			sptr_block = cached_block_(b, true);
+		}
+		std::vector<complex_float_t>& data = sptr_block->data;
+		for (size_t i = 0; i < data.size(); i++)
+			data[i] = std::conj(data[i]);
+	}
 }
 
+void
+AcquisitionsFile::set_data(const complex_float_t* z, int all)
+{
+	int na = number();
+	for (int a = 0; a < na; a++) {
+		int ia = index(a);
+		if (!all && ignore_mask_.ignored(headers_[ia].flags)) {
+			std::cout << "ignoring acquisition " << ia << '\n';
+			continue;
+		}
+		DataSpan<complex_float_t> data = span_(ia, true);
+		std::copy(z, z + data.size(), data.begin());
+		z += data.size();
+	}
+}
 
-void MRAcquisitionData::get_subset(MRAcquisitionData& subset, const std::vector<int> subset_idx) const
+void
+AcquisitionsFile::copy_acquisitions_data(const MRAcquisitionData& ac)
 {
-    subset.set_acquisitions_info(this->acquisitions_info());
+	int na = number();
+	ASSERT(na == ac.number(), "copy source and destination sizes differ");
+	for (int a = 0; a < na; a++) {
+		int ia = index(a);
+		const ISMRMRD::AcquisitionHeader& head = headers_[ia];
+		const ISMRMRD::AcquisitionHeader& head_src = ac.acquisition_header(a);
+		ASSERT(head.active_channels == head_src.active_channels,
+			"copy source and destination coil numbers differ");
+		ASSERT(head.number_of_samples == head_src.number_of_samples,
+			"copy source and destination samples numbers differ");
+		DataSpan<const complex_float_t> src = ac.acquisition_data(a);
+		DataSpan<complex_float_t> dst = span_(ia, true);
+		std::copy(src.begin(), src.end(), dst.begin());
+	}
+}
 
-    if(subset.number()>0)
-        throw LocalisedException("Please pass an empty MRAcquisitionnData container to store the subset in", __FUNCTION__, __LINE__);
+AcquisitionsView::AcquisitionsView
+(MRAcquisitionData& parent, const std::vector<int>& num) :
+	parent_(&parent), parent_writable_(&parent)
+{
+	init_(num);
+}
 
-    ISMRMRD::Acquisition acq;
-    for(int i=0; i<subset_idx.size(); ++i)
-    {
-        this->get_acquisition(subset_idx[i], acq);
-        subset.append_acquisition(acq);
-    }
+AcquisitionsView::AcquisitionsView
+(const MRAcquisitionData& parent, const std::vector<int>& num) :
+	parent_(&parent), parent_writable_(0)
+{
+	init_(num);
 }
 
-void MRAcquisitionData::set_subset(const MRAcquisitionData& subset, const std::vector<int> subset_idx)
+AcquisitionsView::AcquisitionsView
+(shared_ptr<MRAcquisitionData> sptr_parent, const std::vector<int>& num) :
+	sptr_parent_(sptr_parent), parent_(sptr_parent.get()),
+	parent_writable_(sptr_parent.get())
 {
-    if(subset.number() != subset_idx.size())
-        throw LocalisedException("Number of subset positions and number of acquisitions in subset don't match.", __FILE__, __LINE__);
+	init_(num);
+}
 
-    ISMRMRD::Acquisition acq;
-    for(int i=0; i<subset_idx.size(); ++i)
-    {
-        subset.get_acquisition(i, acq);
-        this->set_acquisition(subset_idx[i], acq);
-    }
+void
+AcquisitionsView::init_(const std::vector<int>& num)
+{
+	int na = parent_->number();
+	for (size_t i = 0; i < num.size(); i++)
+		if (num[i] < 0 || num[i] >= na)
+			THROW("acquisition number out of range in a view of acquisition data");
+	num_ = num;
+	acqs_info_ = parent_->acquisitions_info();
+	ignore_mask_ = parent_->ignore_mask();
+	// the view is in the order of the parent if the numbers are ascending,
+	// its k-space sorting is built when first needed
+	set_sorted(parent_->sorted() && std::is_sorted(num_.begin(), num_.end()));
 }
 
-AcquisitionsVector*
-AcquisitionsVector::clone_impl() const
+MRAcquisitionData*
+AcquisitionsView::clone_impl() const
 {
-	AcquisitionsVector* ptr_ad =
-		new AcquisitionsVector(this->acqs_info_, this->ignore_mask_);
-	for (int i = 0; i < number(); i++) {
+	return materialise().release();
+}
+
+unique_ptr<MRAcquisitionData>
+AcquisitionsView::materialise() const
+{
+	unique_ptr<MRAcquisitionData> uptr_ad
+		(parent_->same_acquisitions_container(acqs_info_));
+	uptr_ad->set_ignore_mask(ignore_mask_);
+	int na = number();
+	shared_ptr<const AcquisitionsHeaderIndex> sptr_index = header_index();
+	const std::vector<uint16_t>& traj_dims = sptr_index->trajectory_dimensions;
+	if (std::find_if(traj_dims.begin(), traj_dims.end(),
+		[](uint16_t d) { return d > 0; }) == traj_dims.end()) {
+		// the samples are copied straight from the parent in blocks of
+		// acquisitions (few enough for a file-backed parent to keep in memory)
+		const int block = 1024;
+		std::vector<ISMRMRD::AcquisitionHeader> heads;
+		std::vector<DataSpan<const complex_float_t> > spans;
+		std::vector<const complex_float_t*> data;
+		std::vector<const float*> traj(block, (const float*)0);
+		for (int a = 0; a < na; a += block) {
+			int n = std::min(block, na - a);
+			heads.resize(n);
+			spans.resize(n);
+			data.resize(n);
+			for (int i = 0; i < n; i++) {
+				heads[i] = acquisition_header(a + i);
+				spans[i] = acquisition_data(a + i);
+				data[i] = spans[i].data();
+			}
+			uptr_ad->append_acquisitions(n, &heads[0], &data[0], &traj[0]);
+		}
+	}
+	else {
 		ISMRMRD::Acquisition acq;
-		get_acquisition(i, acq);
-		ptr_ad->append_acquisition(acq);
+		for (int a = 0; a < na; a++) {
+			parent_->get_acquisition(parent_number_(a), acq);
+			uptr_ad->append_acquisition(acq);
+		}
 	}
-	ptr_ad->set_sorted(sorted());
-	if (sorted())
-		ptr_ad->organise_kspace();
-	return ptr_ad;
+	share_layout_(*uptr_ad);
+	return uptr_ad;
 }
 
 void
-AcquisitionsVector::empty()
+AcquisitionsView::empty()
 {
-	acqs_.clear();
-    index_.clear();
+	num_.clear();
+	index_.clear();
+	invalidate_header_index_();
+	sptr_sorting_.reset();
+}
+
+int
+AcquisitionsView::get_acquisition(unsigned int num,
+	ISMRMRD::Acquisition& acq) const
+{
+	parent_->get_acquisition(parent_number_(num), acq);
+	if (ignore_mask_.ignored(acq.flags()))
+		return 0;
+	return 1;
+}
+
+shared_ptr<ISMRMRD::Acquisition>
+AcquisitionsView::get_acquisition_sptr(unsigned int num)
+{
+	// the header may be changed via the returned pointer
+	invalidate_header_index_();
+	return writable_parent_().get_acquisition_sptr(parent_number_(num));
 }
 
 void
-AcquisitionsVector::conjugate_impl()
+AcquisitionsView::set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq)
 {
-    int na = number();
-    for (int a = 0, i = 0; a < na; a++) {
-        int ia = index(a);
-        ISMRMRD::Acquisition& acq = *acqs_[ia];
-        unsigned int nc = acq.active_channels();
-        unsigned int ns = acq.number_of_samples();
-        for (int c = 0; c < nc; c++)
-            for (int s = 0; s < ns; s++, i++)
-                acq.data(s, c) = std::conj(acq.data(s, c));
-    }
+	MRAcquisitionData& parent = writable_parent_();
+	int pn = parent_number_(num);
+	update_header_index_(parent.acquisition_header(pn), acq.getHead());
+	parent.set_acquisition(pn, acq);
 }
 
 void
-AcquisitionsVector::set_data(const complex_float_t* z, int all)
+AcquisitionsView::conjugate_impl()
 {
+	MRAcquisitionData& parent = writable_parent_();
 	int na = number();
-	for (int a = 0, i = 0; a < na; a++) {
-		int ia = index(a);
-		ISMRMRD::Acquisition& acq = *acqs_[ia];
-		IgnoreMask ignore_mask = this->ignore_mask();
-		if (!all && ignore_mask.ignored(acq.flags())) {
-			std::cout << "ignoring acquisition " << ia << '\n';
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int a = 0; a < na; a++) {
+		DataSpan<complex_float_t> data = parent.acquisition_data(parent_number_(a));
+		for (size_t i = 0; i < data.size(); i++)
+			data[i] = std::conj(data[i]);
+	}
+}
+
+void
+AcquisitionsView::set_data(const complex_float_t* z, int all)
+{
+	MRAcquisitionData& parent = writable_parent_();
+	int na = number();
+	for (int a = 0; a < na; a++) {
+		int pa = parent_number_(a);
+		if (!all && ignore_mask_.ignored(parent.acquisition_header(pa).flags)) {
+			std::cout << "ignoring acquisition " << a << '\n';
 			continue;
 		}
-		unsigned int nc = acq.active_channels();
-		unsigned int ns = acq.number_of_samples();
-		for (int c = 0; c < nc; c++)
-			for (int s = 0; s < ns; s++, i++)
-				acq.data(s, c) = z[i];
+		DataSpan<complex_float_t> data = parent.acquisition_data(pa);
+		std::copy(z, z + data.size(), data.begin());
+		z += data.size();
 	}
 }
 
 void
-AcquisitionsVector::copy_acquisitions_data(const MRAcquisitionData& ac)
+AcquisitionsView::copy_acquisitions_data(const MRAcquisitionData& ac)
 {
-	ISMRMRD::Acquisition acq_dst;
-	ISMRMRD::Acquisition acq_src;
+	MRAcquisitionData& parent = writable_parent_();
 	int na = number();
 	ASSERT(na == ac.number(), "copy source and destination sizes differ");
-	for (int a = 0, i = 0; a < na; a++) {
-		ac.get_acquisition(a, acq_src);
-		ISMRMRD::Acquisition& acq_dst = *acqs_[a];
-		unsigned int nc = acq_dst.active_channels();
-		unsigned int ns = acq_dst.number_of_samples();
-		ASSERT(nc == acq_src.active_channels(), 
+	for (int a = 0; a < na; a++) {
+		int pa = parent_number_(a);
+		const ISMRMRD::AcquisitionHeader& head = parent.acquisition_header(pa);
+		const ISMRMRD::AcquisitionHeader& head_src = ac.acquisition_header(a);
+		ASSERT(head.active_channels == head_src.active_channels,
 			"copy source and destination coil numbers differ");
-		ASSERT(ns == acq_src.number_of_samples(), 
+		ASSERT(head.number_of_samples == head_src.number_of_samples,
 			"copy source and destination samples numbers differ");
-		for (int c = 0; c < nc; c++)
-			for (int s = 0; s < ns; s++, i++)
-				acq_dst.data(s, c) = acq_src.data(s, c);
+		DataSpan<const complex_float_t> src = ac.acquisition_data(a);
+		DataSpan<complex_float_t> dst = parent.acquisition_data(pa);
+		std::copy(src.begin(), src.end(), dst.begin());
 	}
 }
 
@@ -1440,18 +2783,23 @@ KSpaceSubset::TagType KSpaceSubset::get_tag_from_img(const CFImage& img)
 
 
 KSpaceSubset::TagType KSpaceSubset::get_tag_from_acquisition(ISMRMRD::Acquisition acq)
+{
+    return get_tag_from_counters(acq.idx());
+}
+
+KSpaceSubset::TagType KSpaceSubset::get_tag_from_counters(const ISMRMRD::EncodingCounters& idx)
 {
     TagType tag;
-    tag[0] = acq.idx().average;
-    tag[1] = acq.idx().slice;
-    tag[2] = acq.idx().contrast;
-    tag[3] = acq.idx().phase;
-    tag[4] = acq.idx().repetition;
-    tag[5] = acq.idx().set;
-    tag[6] = 0; //acq.idx().segment;
+    tag[0] = idx.average;
+    tag[1] = idx.slice;
+    tag[2] = idx.contrast;
+    tag[3] = idx.phase;
+    tag[4] = idx.repetition;
+    tag[5] = idx.set;
+    tag[6] = 0; //idx.segment;
 
     for(int i=7; i<tag.size(); ++i)
-        tag[i]= 0; //acq.idx().user[i];
+        tag[i]= 0; //idx.user[i];
 
     return tag;
 }
@@ -1563,10 +2911,10 @@ const void* ptr_b, const DataContainer& a_y)
 	this->set_meta_data(x.get_meta_data());
 }
 
+template<class F>
 void
-GadgetronImageData::binary_op(
-    const DataContainer& a_x, const DataContainer& a_y,
-    complex_float_t(*f)(complex_float_t, complex_float_t))
+GadgetronImageData::apply_binary_(
+    const DataContainer& a_x, const DataContainer& a_y, F f)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     SIRF_DYNAMIC_CAST(const GadgetronImageData, y, a_y);
@@ -1591,10 +2939,10 @@ GadgetronImageData::binary_op(
     this->set_meta_data(x.get_meta_data());
 }
 
+template<class F>
 void
-GadgetronImageData::semibinary_op(
-    const DataContainer& a_x, complex_float_t y,
-    complex_float_t(*f)(complex_float_t, complex_float_t))
+GadgetronImageData::apply_semibinary_(
+    const DataContainer& a_x, complex_float_t y, F f)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     unsigned int nx = x.number();
@@ -1615,9 +2963,9 @@ GadgetronImageData::semibinary_op(
     this->set_meta_data(x.get_meta_data());
 }
 
+template<class F>
 void
-GadgetronImageData::unary_op(const DataContainer& a_x,
-    complex_float_t(*f)(complex_float_t))
+GadgetronImageData::apply_unary_(const DataContainer& a_x, F f)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     unsigned int nx = x.number();
@@ -1638,12 +2986,35 @@ GadgetronImageData::unary_op(const DataContainer& a_x,
     this->set_meta_data(x.get_meta_data());
 }
 
+void
+GadgetronImageData::binary_op(
+    const DataContainer& a_x, const DataContainer& a_y,
+    complex_float_t(*f)(complex_float_t, complex_float_t))
+{
+    apply_binary_(a_x, a_y, f);
+}
+
+void
+GadgetronImageData::semibinary_op(
+    const DataContainer& a_x, complex_float_t y,
+    complex_float_t(*f)(complex_float_t, complex_float_t))
+{
+    apply_semibinary_(a_x, y, f);
+}
+
+void
+GadgetronImageData::unary_op(const DataContainer& a_x,
+    complex_float_t(*f)(complex_float_t))
+{
+    apply_unary_(a_x, f);
+}
+
 void
 GadgetronImageData::multiply(const DataContainer& a_x, const DataContainer& a_y)
 {
 	SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
 	SIRF_DYNAMIC_CAST(const GadgetronImageData, y, a_y);
-    binary_op(x, y, DataContainer::product<complex_float_t>);
+    apply_binary_(x, y, kernels::Product());
 }
 
 void
@@ -1651,7 +3022,7 @@ GadgetronImageData::multiply(const DataContainer& a_x, const void* ptr_y)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, DataContainer::product<complex_float_t>);
+    apply_semibinary_(x, y, kernels::Product());
 }
 
 void
@@ -1659,7 +3030,7 @@ GadgetronImageData::add(const DataContainer& a_x, const void* ptr_y)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, DataContainer::sum<complex_float_t>);
+    apply_semibinary_(x, y, kernels::Sum());
 }
 
 void
@@ -1667,7 +3038,7 @@ GadgetronImageData::divide(const DataContainer& a_x, const DataContainer& a_y)
 {
 	SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
 	SIRF_DYNAMIC_CAST(const GadgetronImageData, y, a_y);
-    binary_op(x, y, DataContainer::ratio<complex_float_t>);
+    apply_binary_(x, y, kernels::Ratio());
 }
 
 void
@@ -1677,7 +3048,7 @@ GadgetronImageData::maximum(
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     SIRF_DYNAMIC_CAST(const GadgetronImageData, y, a_y);
-    binary_op(x, y, DataContainer::maxreal<complex_float_t>);
+    apply_binary_(x, y, kernels::MaxReal());
 }
 
 void
@@ -1685,7 +3056,7 @@ GadgetronImageData::maximum(const DataContainer& a_x, const void* ptr_y)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, DataContainer::maxreal<complex_float_t>);
+    apply_semibinary_(x, y, kernels::MaxReal());
 }
 
 void
@@ -1695,7 +3066,7 @@ GadgetronImageData::minimum(
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     SIRF_DYNAMIC_CAST(const GadgetronImageData, y, a_y);
-    binary_op(x, y, DataContainer::minreal<complex_float_t>);
+    apply_binary_(x, y, kernels::MinReal());
 }
 
 void
@@ -1703,7 +3074,7 @@ GadgetronImageData::minimum(const DataContainer& a_x, const void* ptr_y)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, DataContainer::minreal<complex_float_t>);
+    apply_semibinary_(x, y, kernels::MinReal());
 }
 
 void
@@ -1713,7 +3084,7 @@ GadgetronImageData::power(
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     SIRF_DYNAMIC_CAST(const GadgetronImageData, y, a_y);
-    binary_op(x, y, DataContainer::power);
+    apply_binary_(x, y, kernels::Power());
 }
 
 void
@@ -1721,42 +3092,42 @@ GadgetronImageData::power(const DataContainer& a_x, const void* ptr_y)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
     complex_float_t y = *static_cast<const complex_float_t*>(ptr_y);
-    semibinary_op(x, y, DataContainer::power);
+    apply_semibinary_(x, y, kernels::Power());
 }
 
 void
 GadgetronImageData::exp(const DataContainer& a_x)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
-    unary_op(x, DataContainer::exp);
+    apply_unary_(x, kernels::Exp());
 }
 
 void
 GadgetronImageData::log(const DataContainer& a_x)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
-    unary_op(x, DataContainer::log);
+    apply_unary_(x, kernels::Log());
 }
 
 void
 GadgetronImageData::sqrt(const DataContainer& a_x)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
-    unary_op(x, DataContainer::sqrt);
+    apply_unary_(x, kernels::Sqrt());
 }
 
 void
 GadgetronImageData::sign(const DataContainer& a_x)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
-    unary_op(x, DataContainer::sign);
+    apply_unary_(x, kernels::Sign());
 }
 
 void
 GadgetronImageData::abs(const DataContainer& a_x)
 {
     SIRF_DYNAMIC_CAST(const GadgetronImageData, x, a_x);
-    unary_op(x, DataContainer::abs);
+    apply_unary_(x, kernels::Abs());
 }
 
 float
@@ -2082,10 +3453,8 @@ GadgetronImagesVector::GadgetronImagesVector(const MRAcquisitionData& ad, const
         CFImage img(rawdata_recon_matrix.x, rawdata_recon_matrix.y, rawdata_recon_matrix.z, num_coil_channels);
         img.setFieldOfView(rawdata_recon_FOV.x, rawdata_recon_FOV.y, rawdata_recon_FOV.z);
 
-        sirf::AcquisitionsVector subset; // subset container must be empty so it is created inside the loop scope
-        ad.get_subset(subset, sort_idx[i]);
         // all subsets are self-consistent and non-empty so it suffices to populate img header from the 0st acquisition
-        subset.get_acquisition(0, acq);
+        ad.get_acquisition(sort_idx[i][0], acq);
         match_img_header_to_acquisition(img, acq);
 
         for(auto it=img.begin(); it!=img.end(); ++it)
@@ -2172,48 +3541,151 @@ GadgetronImagesVector::set_image_type(int image_type)
 void
 GadgetronImagesVector::get_data(complex_float_t* data) const
 {
-	//std::copy(begin(), end(), data);
-	//std::cout << "trying new const image wrap iterator...\n";
-	GadgetronImagesVector::Iterator_const stop = end();
-	GadgetronImagesVector::Iterator_const iter = begin();
-	for (; iter != stop; ++iter, ++data)
-		*data = (*iter).complex_float();
+	for (unsigned int i = 0; i < images_.size(); i++) {
+		const ImageWrap& iw = *images_[i];
+		iw.get_complex_data(data);
+		data += iw.num_data_elm();
+	}
 }
 
 void
 GadgetronImagesVector::set_data(const complex_float_t* data)
 {
-	//int dim[4];
-	//size_t n = number();
-	//get_image_dimensions(0, dim);
-	//n *= dim[0];
-	//n *= dim[1];
-	//n *= dim[2];
-	//n *= dim[3];
-	//std::copy(data, data + n, begin());
-	//std::cout << "trying new image wrap iterator...\n";
-	GadgetronImagesVector::Iterator stop = end();
-	GadgetronImagesVector::Iterator iter = begin();
-	for (; iter != stop; ++iter, ++data)
-		*iter = *data;
+	for (unsigned int i = 0; i < images_.size(); i++) {
+		ImageWrap& iw = *images_[i];
+		iw.set_complex_data(data);
+		data += iw.num_data_elm();
+	}
 }
 
 void
 GadgetronImagesVector::get_real_data(float* data) const
 {
-	GadgetronImagesVector::Iterator_const stop = end();
-	GadgetronImagesVector::Iterator_const iter = begin();
-	for (; iter != stop; ++iter, ++data)
-		*data = *iter;
+	for (unsigned int i = 0; i < images_.size(); i++) {
+		const ImageWrap& iw = *images_[i];
+		iw.get_data(data);
+		data += iw.num_data_elm();
+	}
 }
 
 void
 GadgetronImagesVector::set_real_data(const float* data)
 {
-	GadgetronImagesVector::Iterator stop = end();
-	GadgetronImagesVector::Iterator iter = begin();
-	for (; iter != stop; ++iter, ++data)
-		*iter = *data;
+	for (unsigned int i = 0; i < images_.size(); i++) {
+		ImageWrap& iw = *images_[i];
+		iw.set_data(data);
+		data += iw.num_data_elm();
+	}
+}
+
+static bool
+same_image_sizes_(const std::vector<gadgetron::shared_ptr<ImageWrap> >& x,
+	const std::vector<gadgetron::shared_ptr<ImageWrap> >& y)
+{
+	if (x.size() != y.size())
+		return false;
+	for (size_t i = 0; i < x.size(); i++)
+		if (x[i]->num_data_elm() != y[i]->num_data_elm())
+			return false;
+	return true;
+}
+
+void
+GadgetronImagesVector::fill(const ImageData& im)
+{
+	// the iterators of ImageData traverse the images in the storage order,
+	// so image-by-image copying is equivalent to ImageData::fill
+	const GadgetronImagesVector* ptr_im =
+		dynamic_cast<const GadgetronImagesVector*>(&im);
+	if (!ptr_im || !same_image_sizes_(images_, ptr_im->images_)) {
+		ImageData::fill(im);
+		return;
+	}
+	if (ptr_im == this)
+		return;
+	for (unsigned int i = 0; i < images_.size(); i++)
+		images_[i]->copy_data(*ptr_im->images_[i]);
+}
+
+bool
+GadgetronImagesVector::operator==(const ImageData& id) const
+{
+	const GadgetronImagesVector* ptr_id =
+		dynamic_cast<const GadgetronImagesVector*>(&id);
+	if (!ptr_id || !same_image_sizes_(images_, ptr_id->images_))
+		return ImageData::operator==(id);
+	if (ptr_id == this)
+		return true;
+	GeometricalInfo<3, 3>& gi_self = (GeometricalInfo<3, 3>&)*get_geom_info_sptr();
+	GeometricalInfo<3, 3>& gi_other = (GeometricalInfo<3, 3>&)*id.get_geom_info_sptr();
+	if (gi_self != gi_other)
+		return false;
+	float s = 0.0f;
+	float sx = 0.0f;
+	float sy = 0.0f;
+	for (unsigned int i = 0; i < images_.size(); i++) {
+		float si, sxi, syi;
+		images_[i]->compare(*ptr_id->images_[i], &sxi, &syi, &si);
+		s += si;
+		sx += sxi;
+		sy += syi;
+	}
+	float t = std::max(sx, sy);
+	return s <= 1e-6*t;
+}
+
+bool
+GadgetronImagesVector::make_contiguous()
+{
+	size_t n = images_.size();
+	if (n < 1)
+		return false;
+	int type = images_[0]->type();
+	int dim0[4];
+	images_[0]->get_dim(dim0);
+	for (size_t i = 1; i < n; i++) {
+		int dim[4];
+		images_[i]->get_dim(dim);
+		if (images_[i]->type() != type || !std::equal(dim, dim + 4, dim0))
+			return false;
+	}
+	size_t size = images_[0]->size();
+	gadgetron::shared_ptr<std::vector<char, AlignedAllocator<char> > >
+		sptr_data(new std::vector<char, AlignedAllocator<char> >(n*size));
+	char* data = sptr_data->data();
+	for (size_t i = 0; i < n; i++)
+		images_[i]->set_data_storage(sptr_data, data + i*size);
+	sptr_data_ = sptr_data;
+	return true;
+}
+
+bool
+GadgetronImagesVector::supports_array_view() const
+{
+	// all images must still be stored in sptr_data_ in their storage order
+	size_t n = images_.size();
+	if (n < 1 || !sptr_data_)
+		return false;
+	int type = images_[0]->type();
+	if (type != ISMRMRD::ISMRMRD_FLOAT && type != ISMRMRD::ISMRMRD_CXFLOAT)
+		return false;
+	size_t size = images_[0]->size();
+	if (n*size != sptr_data_->size())
+		return false;
+	const char* data = sptr_data_->data();
+	for (size_t i = 0; i < n; i++)
+		if (images_[i]->type() != type
+			|| images_[i]->data_address() != data + i*size)
+			return false;
+	return true;
+}
+
+size_t
+GadgetronImagesVector::address() const
+{
+	if (!supports_array_view())
+		THROW("images data are not stored contiguously");
+	return reinterpret_cast<size_t>(sptr_data_->data());
 }
 
 void sirf::match_img_header_to_acquisition(CFImage& img, const ISMRMRD::Acquisition& acq) 
@@ -2585,8 +4057,7 @@ CoilImagesVector::calculate(const MRAcquisitionData& ad)
 
     for(int i=0; i<sort_idx.size(); ++i)
     {
-        sirf::AcquisitionsVector subset;
-        uptr_calib_data->get_subset(subset, sort_idx[i]);
+        sirf::AcquisitionsView subset(*uptr_calib_data, sort_idx[i]);
 
 		CFImage* img_ptr = new CFImage();
 		ImageWrap iw(ISMRMRD::ISMRMRD_DataTypes::ISMRMRD_CXFLOAT, img_ptr);
@@ -2605,20 +4076,19 @@ std::unique_ptr<MRAcquisitionData> CoilImagesVector::extract_calibration_data(co
                 calibration_flags{ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION,
                                   ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION_AND_IMAGING};
     
-    std::unique_ptr<MRAcquisitionData> uptr_calib_ad = ad.clone();
-
     if(ad.get_trajectory_type() == ISMRMRD::TrajectoryType::CARTESIAN)
     {   
         std::vector<int> idx_calib_acquisitions = ad.get_flagged_acquisitions_index(calibration_flags);
         
-        if(idx_calib_acquisitions.size() < 1)
+        if(idx_calib_acquisitions.size() > 0)
+        {
+            std::unique_ptr<MRAcquisitionData> uptr_calib_ad =
+                AcquisitionsView(ad, idx_calib_acquisitions).materialise();
+            uptr_calib_ad->sort_by_time();
             return uptr_calib_ad;
-
-        uptr_calib_ad->empty();
-        ad.get_subset(*(uptr_calib_ad), idx_calib_acquisitions);
-        uptr_calib_ad->sort_by_time();
+        }
     }
-    return uptr_calib_ad;
+    return ad.clone();
 }
 
 CFImage CoilSensitivitiesVector::get_csm_as_cfimage(size_t const i) const
@@ -2633,10 +4103,60 @@ CFImage CoilSensitivitiesVector::get_csm_as_cfimage(size_t const i) const
 
 CFImage CoilSensitivitiesVector::get_csm_as_cfimage(const KSpaceSubset::TagType tag, const int offset) const
 {
+    return get_csm_cfimage_ref(tag, offset);
+}
+
+void CoilSensitivitiesVector::index_csms_() const
+{
+    csm_index_.clear();
+    for(int i=0; i<this->items(); ++i)
+    {
+        const ImageWrap& iw = this->image_wrap(i);
+        if(iw.type() != ISMRMRD::ISMRMRD_CXFLOAT)
+            continue;
+        const CFImage& csm_img = *static_cast<const CFImage*>(iw.ptr_image());
+        csm_index_[std::make_pair((int)csm_img.getSlice(), (int)csm_img.getContrast())].push_back(i);
+    }
+    csm_index_size_ = this->items();
+}
+
+const CFImage& CoilSensitivitiesVector::get_csm_cfimage_ref(const KSpaceSubset::TagType& tag, const int offset) const
+{
+    int const num_csm = this->items();
+    if(num_csm < 1)
+        throw LocalisedException("No coilmap with this tag was in the coilsensitivity container.",   __FILE__, __LINE__);
+
+    // the first coilmap for the tag's slice (and contrast 0) at or cyclically
+    // after offset, found in the index of coilmaps by (slice, contrast)
+    int found = -1;
+    {
+        Mutex mtx;
+        std::lock_guard<std::mutex> lock(mtx());
+        if(csm_index_size_ != num_csm)
+            index_csms_();
+        auto it = csm_index_.find(std::make_pair(tag[1], 0)); //tag[1]=slice
+        if(it != csm_index_.end())
+        {
+            const std::vector<int>& csm_nums = it->second;
+            auto jt = std::lower_bound(csm_nums.begin(), csm_nums.end(), offset % num_csm);
+            found = (jt == csm_nums.end()) ? csm_nums.front() : *jt;
+        }
+    }
+    if(found >= 0)
+    {
+        const CFImage& csm_img = *static_cast<const CFImage*>(this->image_wrap(found).ptr_image());
+        if(csm_img.getSlice() == tag[1] && csm_img.getContrast() == 0)
+            return csm_img;
+    }
+
+    // the index is out of date (a header has been modified in place)
     for(int i=0; i<this->items();++i)
     {
         size_t const access_idx = ((offset + i) % this->items());
-        CFImage csm_img = get_csm_as_cfimage(access_idx);
+        const ImageWrap& iw = this->image_wrap(access_idx);
+        if(iw.type() != ISMRMRD::ISMRMRD_CXFLOAT)
+            throw LocalisedException("The coilmaps must be supplied as a complex float ismrmrd image, i.e. type = ISMRMRD::ISMRMRD_CXFLOAT." , __FILE__, __LINE__);
+        const CFImage& csm_img = *static_cast<const CFImage*>(iw.ptr_image());
         KSpaceSubset::TagType tag_csm = KSpaceSubset::get_tag_from_img(csm_img);
 
         if(tag_csm[1] == tag[1] && tag_csm[2]==0) //tag[1]=slice, tag[2]=contrast
@@ -2670,7 +4190,7 @@ void CoilSensitivitiesVector::coilchannels_from_combined_image(GadgetronImageDat
         const ImageWrap& iw_src = combined_img.image_wrap(i_img);
         const CFImage* ptr_src_img = static_cast<const CFImage*>(iw_src.ptr_image());
 
-        CFImage coilmap = get_csm_as_cfimage( KSpaceSubset::get_tag_from_img(*ptr_src_img), i_img);
+        const CFImage& coilmap = get_csm_cfimage_ref( KSpaceSubset::get_tag_from_img(*ptr_src_img), i_img);
 
         CFImage* ptr_dst_img = new CFImage(coilmap);
 		sirf::ImageWrap iw_dst(ISMRMRD::ISMRMRD_CXFLOAT, ptr_dst_img);
@@ -2690,7 +4210,7 @@ void CoilSensitivitiesVector::coilchannels_from_combined_image(GadgetronImageDat
         {
             (*ptr_dst_img)(nx, ny, nz, nc) =
             *(ptr_src_img->getDataPtr() + nx + Nx * (ny + Ny * nz))
-            * coilmap(nx, ny, nz, nc);
+            * coilmap.getDataPtr()[nx + Nx * (ny + Ny * (nz + Nz * nc))];
         }
 
         img.append(iw_dst);
@@ -2727,7 +4247,7 @@ void CoilSensitivitiesVector::combine_images_with_coilmaps(GadgetronImageData& c
 		// const void* vptr_src_img = iw_src.ptr_image();
         // const CFImage* ptr_src_img = static_cast<const CFImage*>(vptr_src_img);
 		
-        CFImage coilmap= get_csm_as_cfimage(KSpaceSubset::get_tag_from_img(*ptr_src_img), i_img);
+        const CFImage& coilmap = get_csm_cfimage_ref(KSpaceSubset::get_tag_from_img(*ptr_src_img), i_img);
 
         int const Nx = (int)coilmap.getMatrixSizeX();
         int const Ny = (int)coilmap.getMatrixSizeY();
@@ -2748,21 +4268,14 @@ void CoilSensitivitiesVector::combine_images_with_coilmaps(GadgetronImageData& c
 		for(auto it=ptr_dst_img->begin(); it!=ptr_dst_img->end(); ++it)	
 			*it = complex_float_t(0.f,0.f);
 		
-		// conjugate the coilmap
-		for(auto it=coilmap.begin(); it!=coilmap.end(); ++it)
-			*it = std::conj(*it);
-
-
-		// multiply with image
-		std::transform( coilmap.begin(), coilmap.end(),
-						ptr_src_img->getDataPtr(), coilmap.begin(), 
-						std::multiplies<complex_float_t>());
-
+		// multiply with the conjugated coilmap and sum over channels
+		size_t const vol = (size_t)Nx*Ny*Nz;
+		const complex_float_t* csm = coilmap.getDataPtr();
+		const complex_float_t* src = ptr_src_img->getDataPtr();
+		complex_float_t* dst = ptr_dst_img->getDataPtr();
         for( size_t nc=0;nc<Nc ; nc++)
-        for( size_t nz=0;nz<Nz ; nz++)
-        for( size_t ny=0;ny<Ny ; ny++)
-        for( size_t nx=0;nx<Nx ; nx++)
-	        ptr_dst_img->operator() (nx, ny, nz, 0) += coilmap(nx,ny,nz,nc);
+        for( size_t i=0;i<vol ; i++)
+	        dst[i] += std::conj(csm[nc*vol + i]) * src[nc*vol + i];
 
         combined_img.append(iw_dst);
     }
@@ -2795,6 +4308,8 @@ CoilSensitivitiesVector::calculate(CoilImagesVector& iv)
         iw_output.set_complex_data(csm.getDataPtr());
         this->append(iw_output);
     }
+
+    this->index_csms_();
 }
 
 void CoilSensitivitiesVector::calculate_csm
@@ -2828,37 +4343,25 @@ void CoilSensitivitiesVector::calculate_csm
         }
     }
 
-    ISMRMRD::NDArray<complex_float_t> w(cm0);
-
-    float* ptr_img = img.getDataPtr();
-    for (unsigned int z = 0; z < nz; z++) {
-        for (unsigned int y = 0; y < ny; y++) {
-            for (unsigned int x = 0; x < nx; x++) {
-                float r = 0.0;
-                for (unsigned int c = 0; c < nc; c++) {
-                    float s = std::abs(cm0(x, y, z, c));
-                    r += s*s;
-                }
-                img(x, y, z) = (float)std::sqrt(r);
-            }
-        }
+    if (csm_smoothness_ > 0) {
+        ISMRMRD::NDArray<complex_float_t> w(cm0_dims);
+        for (int i = 0; i < csm_smoothness_; i++)
+            smoothen_(nx, ny, nz, nc, cm0.getDataPtr(), w.getDataPtr(),
+            csm_conv_kernel_halfsize_, csm_conv_kernel_halfsize_z_);
     }
 
-    for (int i = 0; i < csm_smoothness_; i++)
-        smoothen_(nx, ny, nz, nc, cm0.getDataPtr(), w.getDataPtr(),
-        csm_conv_kernel_halfsize_);
-
-    for (unsigned int z = 0; z < nz; z++) {
-        for (unsigned int y = 0; y < ny; y++) {
-            for (unsigned int x = 0; x < nx; x++) {
-                float r = 0.0;
-                for (unsigned int c = 0; c < nc; c++) {
-                    float s = std::abs(cm0(x, y, z, c));
-                    r += s*s;
-                }
-                img(x, y, z) = (float)std::sqrt(r);
-            }
+    // root sum of squares of the smoothed coil images
+    const complex_float_t* ptr_cm0 = cm0.getDataPtr();
+    float* ptr_img = img.getDataPtr();
+    int const vol = (int)(nx*ny*nz);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < vol; i++) {
+        float r = 0.0;
+        for (unsigned int c = 0; c < nc; c++) {
+            float s = std::abs(ptr_cm0[i + c*vol]);
+            r += s*s;
         }
+        ptr_img[i] = (float)std::sqrt(r);
     }
 
     for (unsigned int z = 0, i = 0; z < nz; z++) {
@@ -2880,39 +4383,80 @@ void CoilSensitivitiesVector::calculate_csm
 
 }
 
+// sums of the values of a line of n values (stride apart) over the windows
+// [i - w, i + w] clipped to the line, computed in place via prefix sums
+static void box_sums_(int n, int stride, int w, complex_float_t* u,
+    std::vector<complex_double_t>& prefix)
+{
+    prefix.resize(n + 1);
+    prefix[0] = 0;
+    for (int i = 0; i < n; i++)
+        prefix[i + 1] = prefix[i] + complex_double_t(u[i*stride]);
+    for (int i = 0; i < n; i++) {
+        int first = std::max(0, i - w);
+        int last = std::min(n - 1, i + w);
+        u[i*stride] = complex_float_t(prefix[last + 1] - prefix[first]);
+    }
+}
+
+// number of points in the window [i - w, i + w] clipped to [0, n - 1]
+static inline int window_size_(int i, int n, int w)
+{
+    return std::min(n - 1, i + w) - std::max(0, i - w) + 1;
+}
+
 void
 CoilSensitivitiesVector::smoothen_
 (int nx, int ny, int nz, int nc,
-    complex_float_t* u, complex_float_t* v, int w)
+    complex_float_t* u, complex_float_t* v, int w, int wz)
 {
-    const complex_float_t ONE(1.0, 0.0);
-    const complex_float_t TWO(2.0, 0.0);
-    for (int ic = 0, i = 0; ic < nc; ic++)
-        for (int iz = 0, k = 0; iz < nz; iz++)
+    // replaces each value with the average of itself and the mean of its
+    // neighbours in the (2w+1) x (2w+1) x (2wz+1) box clipped to the volume;
+    // the box sums (in v) are computed separably along x, y and z
+    const size_t nxy = (size_t)nx*ny;
+    const size_t vol = nxy*nz;
+    if (wz < 1 || nz < 2)
+        wz = 0;
+
+    std::memcpy(v, u, vol*nc*sizeof(complex_float_t));
+
+#pragma omp parallel
+    {
+        std::vector<complex_double_t> prefix;
+#pragma omp for schedule(static)
+        for (int cz = 0; cz < nc*nz; cz++) {
+            complex_float_t* p = v + cz*nxy;
             for (int iy = 0; iy < ny; iy++)
-                for (int ix = 0; ix < nx; ix++, i++, k++) {
-                    int n = 0;
-                    complex_float_t r(0.0, 0.0);
-                    complex_float_t s(0.0, 0.0);
-                    for (int jy = -w; jy <= w; jy++)
-                        for (int jx = -w; jx <= w; jx++) {
-                            if (ix + jx < 0 || ix + jx >= nx)
-                                continue;
-                            if (iy + jy < 0 || iy + jy >= ny)
-                                continue;
-                            int j = i + jx + jy*nx;
-                            int l = k + jx + jy*nx;
-                            if (i != j) {
-                                n++;
-                                r += ONE;
-                                s += u[j];
-                            }
-                        }
-                    if (n > 0)
-                        v[i] = (u[i] + s / r) / TWO;
-                    else
-                        v[i] = u[i];
-                }
-    memcpy(u, v, nx*ny*nz*nc * sizeof(complex_float_t));
+                box_sums_(nx, 1, w, p + iy*nx, prefix);
+            for (int ix = 0; ix < nx; ix++)
+                box_sums_(ny, nx, w, p + ix, prefix);
+        }
+        if (wz > 0) {
+#pragma omp for schedule(static)
+            for (int cy = 0; cy < nc*ny; cy++) {
+                int ic = cy / ny;
+                int iy = cy % ny;
+                complex_float_t* p = v + ic*vol + iy*nx;
+                for (int ix = 0; ix < nx; ix++)
+                    box_sums_(nz, (int)nxy, wz, p + ix, prefix);
+            }
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int cz = 0; cz < nc*nz; cz++) {
+        int iz = cz % nz;
+        int nwz = window_size_(iz, nz, wz);
+        complex_float_t* p = u + cz*nxy;
+        const complex_float_t* s = v + cz*nxy;
+        for (int iy = 0, i = 0; iy < ny; iy++) {
+            int nwyz = window_size_(iy, ny, w)*nwz;
+            for (int ix = 0; ix < nx; ix++, i++) {
+                int n = window_size_(ix, nx, w)*nwyz - 1;
+                if (n > 0)
+                    p[i] = (p[i] + (s[i] - p[i]) / (float)n) * 0.5f;
+            }
+        }
+    }
 }
 
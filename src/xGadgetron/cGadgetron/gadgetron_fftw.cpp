@@ -32,9 +32,14 @@ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR
 IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include <algorithm>
+#include <cmath>
 #include <complex>
+#include <cstdlib>
 #include <iostream>
+#include <map>
 #include <mutex>
+#include <tuple>
 
 #include <ismrmrd/ismrmrd.h>
 #include <ismrmrd/dataset.h>
@@ -42,168 +47,327 @@ IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <ismrmrd/xml.h>
 
 #include <fftw3.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-typedef complex_float_t ComplexType;
-
-#define USE_OMP
+#include "sirf/common/iequals.h"
+#include "sirf/iUtilities/LocalisedException.h"
+#include "sirf/Gadgetron/gadgetron_fftw.h"
 
-namespace ISMRMRD {
+typedef complex_float_t ComplexType;
 
-	fftwf_plan fftw_plan_dft_3d_(int n0, int n1, int n2, ComplexType* in, ComplexType * out, int sign, unsigned int flags) {
-		return fftwf_plan_dft_3d(n0, n1, n2, (fftwf_complex*)in, (fftwf_complex*)out, sign, flags);
-	}
+namespace {
 
-	void fftw_execute_dft_(fftwf_plan_s * ptr, ComplexType* in, ComplexType* out) {
-		fftwf_execute_dft(ptr, (fftwf_complex*)in, (fftwf_complex*)out);
-	}
+	// everything FFTW needs to know to tell whether a plan can be reused:
+	// howmany rank-dimensional transforms of size n[0] x ... (n[0] slowest)
+	// of arrays with elements stride apart, the arrays being dist apart
+	struct PlanKey {
+		PlanKey(int r, int n0, int n1, int n2, int s, int h, int d,
+			int sgn, int nt) :
+			rank(r), stride(s), howmany(h), dist(d), sign(sgn), in_place(true),
+			align_in(0), align_out(0), threads(nt), flags(FFTW_ESTIMATE)
+		{
+			n[0] = n0;
+			n[1] = n1;
+			n[2] = n2;
+		}
+		int rank;
+		int n[3];
+		int stride;
+		int howmany;
+		int dist;
+		int sign;
+		bool in_place;
+		int align_in, align_out;
+		int threads;
+		unsigned int flags;
+		bool operator<(const PlanKey& k) const
+		{
+			return std::tie(rank, n[0], n[1], n[2], stride, howmany, dist, sign,
+				in_place, align_in, align_out, threads, flags) <
+				std::tie(k.rank, k.n[0], k.n[1], k.n[2], k.stride, k.howmany,
+				k.dist, k.sign, k.in_place, k.align_in, k.align_out, k.threads,
+				k.flags);
+		}
+	};
 
-	void fftw_destroy_plan_(fftwf_plan p) {
-		fftwf_destroy_plan(p);
+	// the FFTW planner is not thread-safe (unlike plan execution),
+	// hence all planner and wisdom calls are made under this lock
+	std::mutex& planner_mutex()
+	{
+		static std::mutex mutex;
+		return mutex;
 	}
 
-	void fftshiftPivot3D(ComplexType* a, size_t x, size_t y, size_t z, size_t n, size_t pivotx, size_t pivoty, size_t pivotz)
+	std::map<PlanKey, fftwf_plan>& plans()
 	{
-
-		if (a == NULL)
-			throw std::runtime_error("fftshiftPivot3D: void ptr provided");
-
-		long long tt;
-
-#pragma omp parallel private(tt) shared(a, x, y, z, n, pivotx, pivoty, pivotz) if (n>16)
-		{
-			//hoNDArray< ComplexType > aTmp(x*y*z);
-			std::vector<size_t> dims;
-			dims.push_back(x);
-			dims.push_back(y);
-			dims.push_back(z);
-			NDArray< ComplexType > aTmp(dims);
-			//ComplexType* tmp =
-				//(ComplexType*)fftwf_malloc(sizeof(ComplexType)*x*y*z);
-
-#pragma omp for
-			for (tt = 0; tt < (long long)n; tt++)
-			{
-				size_t ay, ry, az, rz;
-
-				for (az = pivotz; az < z; az++)
-				{
-					rz = az - pivotz;
-
-					const ComplexType* ac = a + tt*x*y*z + az*x*y;
-					//ComplexType* rc = tmp + rz*x*y;
-					ComplexType* rc = aTmp.begin() + rz*x*y;
-
-					for (ay = pivoty; ay < y; ay++)
-					{
-						ry = ay - pivoty;
-						memcpy(rc + ry*x, ac + ay*x + pivotx, sizeof(ComplexType)*(x - pivotx));
-						memcpy(rc + ry*x + x - pivotx, ac + ay*x, sizeof(ComplexType)*pivotx);
-					}
-
-					for (ay = 0; ay < pivoty; ay++)
-					{
-						ry = ay + y - pivoty;
-						memcpy(rc + ry*x, ac + ay*x + pivotx, sizeof(ComplexType)*(x - pivotx));
-						memcpy(rc + ry*x + x - pivotx, ac + ay*x, sizeof(ComplexType)*pivotx);
-					}
-				}
-
-				for (az = 0; az < pivotz; az++)
-				{
-					rz = az + z - pivotz;
-
-					const ComplexType* ac = a + tt*x*y*z + az*x*y;
-					//ComplexType* rc = tmp + rz*x*y;
-					ComplexType* rc = aTmp.begin() + rz*x*y;
-
-					for (ay = pivoty; ay < y; ay++)
-					{
-						ry = ay - pivoty;
-						memcpy(rc + ry*x, ac + ay*x + pivotx, sizeof(ComplexType)*(x - pivotx));
-						memcpy(rc + ry*x + x - pivotx, ac + ay*x, sizeof(ComplexType)*pivotx);
-					}
-
-					for (ay = 0; ay < pivoty; ay++)
-					{
-						ry = ay + y - pivoty;
-						memcpy(rc + ry*x, ac + ay*x + pivotx, sizeof(ComplexType)*(x - pivotx));
-						memcpy(rc + ry*x + x - pivotx, ac + ay*x, sizeof(ComplexType)*pivotx);
-					}
-				}
-
-				//memcpy(a + tt*x*y*z, tmp, sizeof(ComplexType)*x*y*z);
-				memcpy(a + tt*x*y*z, aTmp.begin(), sizeof(ComplexType)*x*y*z);
-			}
-		}
+		static std::map<PlanKey, fftwf_plan> cache;
+		return cache;
 	}
 
-	inline size_t fftshiftPivot(size_t x)
+	// exp(2 pi i k/n) with exact values for the multiples of pi/2
+	ComplexType unit_root_(int n, long long k)
 	{
-		return (size_t)(ceil(x*0.5));
+		k %= n;
+		if (k < 0)
+			k += n;
+		if (k == 0)
+			return ComplexType(1, 0);
+		if (2 * k == n)
+			return ComplexType(-1, 0);
+		if (4 * k == n)
+			return ComplexType(0, 1);
+		if (4 * k == 3 * n)
+			return ComplexType(0, -1);
+		double t = 2 * std::acos(-1.0) * double(k) / n;
+		return ComplexType((float)std::cos(t), (float)std::sin(t));
 	}
 
-	inline size_t ifftshiftPivot(size_t x)
+	unsigned int planner_flags_ = FFTW_ESTIMATE;
+	bool wisdom_checked_ = false;
+	// FFT thread budget, 0 meaning the maximal number of OpenMP threads
+	int num_threads_ = 0;
+#ifdef SIRF_FFTW_THREADS
+	bool threads_initialised_ = false;
+#endif
+
+	// plans are created on scratch arrays because planners other than
+	// FFTW_ESTIMATE overwrite the data
+	fftwf_plan create_plan_(const PlanKey& key)
 	{
-		return (size_t)(floor(x*0.5));
+		size_t size = 1;
+		for (int i = 0; i < key.rank; i++)
+			size *= key.n[i];
+		size = (size - 1) * key.stride + (size_t)(key.howmany - 1) * key.dist + 1;
+		size_t bytes = size * sizeof(ComplexType) + 16;
+		char* scratch_in = (char*)fftwf_malloc(bytes);
+		char* scratch_out = key.in_place ? 0 : (char*)fftwf_malloc(bytes);
+		fftwf_complex* in = (fftwf_complex*)(scratch_in + key.align_in);
+		fftwf_complex* out = key.in_place ? in :
+			(fftwf_complex*)(scratch_out + key.align_out);
+#ifdef SIRF_FFTW_THREADS
+		if (!threads_initialised_)
+			threads_initialised_ = fftwf_init_threads() != 0;
+		fftwf_plan_with_nthreads(threads_initialised_ ? key.threads : 1);
+#endif
+		fftwf_plan plan = fftwf_plan_many_dft(key.rank, key.n, key.howmany,
+			in, 0, key.stride, key.dist, out, 0, key.stride, key.dist,
+			key.sign, key.flags);
+		fftwf_free(scratch_in);
+		if (scratch_out)
+			fftwf_free(scratch_out);
+		if (!plan)
+			THROW("FFTW failed to create a plan");
+		return plan;
 	}
 
-	inline void fftshift3D(ComplexType* a, size_t x, size_t y, size_t z, size_t n)
+	// returns a cached plan for the transforms described by key
+	// applicable to the arrays in and out
+	fftwf_plan get_plan_(PlanKey key, ComplexType* in, ComplexType* out)
 	{
-		if (a == NULL)
-			throw std::runtime_error("fftshift3D: void ptr provided");
-		size_t pivotx = fftshiftPivot(x);
-		size_t pivoty = fftshiftPivot(y);
-		size_t pivotz = fftshiftPivot(z);
-		fftshiftPivot3D(a, x, y, z, n, pivotx, pivoty, pivotz);
+		key.in_place = (in == out);
+		key.align_in = fftwf_alignment_of((float*)in);
+		key.align_out = fftwf_alignment_of((float*)out);
+		std::lock_guard<std::mutex> guard(planner_mutex());
+		key.flags = planner_flags_;
+		if (!wisdom_checked_) {
+			wisdom_checked_ = true;
+			const char* filename = std::getenv("SIRF_FFTW_WISDOM");
+			if (filename && *filename)
+				fftwf_import_wisdom_from_filename(filename);
+		}
+		std::map<PlanKey, fftwf_plan>& cache = plans();
+		std::map<PlanKey, fftwf_plan>::iterator it = cache.find(key);
+		if (it != cache.end())
+			return it->second;
+		fftwf_plan plan = create_plan_(key);
+		cache[key] = plan;
+		return plan;
 	}
 
-	inline void ifftshift3D(ComplexType* a, size_t x, size_t y, size_t z, size_t n)
+}
+
+void
+sirf::FFTWPlanner::set_rigour(const std::string& rigour)
+{
+	unsigned int flags;
+	if (sirf::iequals(rigour, "estimate"))
+		flags = FFTW_ESTIMATE;
+	else if (sirf::iequals(rigour, "measure"))
+		flags = FFTW_MEASURE;
+	else if (sirf::iequals(rigour, "patient"))
+		flags = FFTW_PATIENT;
+	else if (sirf::iequals(rigour, "exhaustive"))
+		flags = FFTW_EXHAUSTIVE;
+	else
+		THROW("unknown FFTW planner rigour " + rigour);
+	std::lock_guard<std::mutex> guard(planner_mutex());
+	planner_flags_ = flags;
+}
+
+std::string
+sirf::FFTWPlanner::rigour()
+{
+	std::lock_guard<std::mutex> guard(planner_mutex());
+	switch (planner_flags_) {
+	case FFTW_MEASURE:
+		return "measure";
+	case FFTW_PATIENT:
+		return "patient";
+	case FFTW_EXHAUSTIVE:
+		return "exhaustive";
+	default:
+		return "estimate";
+	}
+}
+
+void
+sirf::FFTWPlanner::import_wisdom(const std::string& filename)
+{
+	std::lock_guard<std::mutex> guard(planner_mutex());
+	if (!fftwf_import_wisdom_from_filename(filename.c_str()))
+		THROW("failed to import FFTW wisdom from " + filename);
+}
+
+void
+sirf::FFTWPlanner::export_wisdom(const std::string& filename)
+{
+	std::lock_guard<std::mutex> guard(planner_mutex());
+	if (!fftwf_export_wisdom_to_filename(filename.c_str()))
+		THROW("failed to export FFTW wisdom to " + filename);
+}
+
+void
+sirf::FFTWPlanner::set_num_threads(int num_threads)
+{
+	std::lock_guard<std::mutex> guard(planner_mutex());
+	num_threads_ = std::max(0, num_threads);
+}
+
+int
+sirf::FFTWPlanner::num_threads()
+{
+	int nt;
 	{
-		if (a == NULL) throw std::runtime_error("hoNDFFT::ifftshift3D: void ptr provided");
+		std::lock_guard<std::mutex> guard(planner_mutex());
+		nt = num_threads_;
+	}
+#ifdef _OPENMP
+	if (nt < 1)
+		nt = omp_get_max_threads();
+#else
+	if (nt < 1)
+		nt = 1;
+#endif
+	return nt;
+}
+
+size_t
+sirf::FFTWPlanner::number_of_plans()
+{
+	std::lock_guard<std::mutex> guard(planner_mutex());
+	return plans().size();
+}
+
+void
+sirf::FFTWPlanner::clear()
+{
+	std::lock_guard<std::mutex> guard(planner_mutex());
+	std::map<PlanKey, fftwf_plan>& cache = plans();
+	for (std::map<PlanKey, fftwf_plan>::iterator it = cache.begin();
+		it != cache.end(); ++it)
+		fftwf_destroy_plan(it->second);
+	cache.clear();
+}
+
+void
+sirf::centred_fft_factors(int n, bool forward,
+	std::vector<complex_float_t>& pre, std::vector<complex_float_t>& post)
+{
+	long long p = n / 2;
+	long long q = n - p;
+	int sign = forward ? -1 : 1;
+	pre.resize(n);
+	post.resize(n);
+	for (int k = 0; k < n; k++) {
+		pre[k] = unit_root_(n, sign * q * k);
+		post[k] = unit_root_(n, -sign * p * (k + q));
+	}
+}
+
+void
+sirf::fft1(complex_float_t* data, int n, int stride, int howmany, int dist,
+	bool forward)
+{
+	PlanKey key(1, n, 1, 1, stride, howmany, dist,
+		forward ? FFTW_FORWARD : FFTW_BACKWARD, 1);
+	fftwf_plan p = get_plan_(key, data, data);
+	fftwf_execute_dft(p, (fftwf_complex*)data, (fftwf_complex*)data);
+}
 
-		size_t pivotx = ifftshiftPivot(x);
-		size_t pivoty = ifftshiftPivot(y);
-		size_t pivotz = ifftshiftPivot(z);
+namespace ISMRMRD {
 
-		fftshiftPivot3D(a, x, y, z, n, pivotx, pivoty, pivotz);
+	void fftw_execute_dft_(fftwf_plan_s * ptr, ComplexType* in, ComplexType* out) {
+		fftwf_execute_dft(ptr, (fftwf_complex*)in, (fftwf_complex*)out);
 	}
 
-	inline void fftshift3D(NDArray< ComplexType >& a)
-	{
-		const size_t* dims = a.getDims();
-		size_t n = a.getNumberOfElements() / (dims[0] * dims[1] * dims[2]);
-		return fftshift3D(a.begin(), dims[0], dims[1], dims[2], n);
-	}
+	// volumes of at least this many elements are worth splitting between
+	// several threads (if threaded FFTW is available)
+	const size_t MIN_VOLUME_PER_THREAD = 64*64*64;
 
-	inline void ifftshift3D(NDArray< ComplexType >& a)
+	// splits the thread budget between the volumes of a batch (num_thr threads)
+	// and the threads of FFTW plans for each volume (num_thr_plan threads):
+	// batch-level parallelism is cheaper, so it is preferred when there are
+	// enough volumes to keep all threads busy
+	inline void get_num_threads_fft3(size_t vol, int num,
+		int& num_thr, int& num_thr_plan)
 	{
-		const size_t* dims = a.getDims();
-		size_t n = a.getNumberOfElements() / (dims[0] * dims[1] * dims[2]);
-		return ifftshift3D(a.begin(), dims[0], dims[1], dims[2], n);
+		int max_thr = sirf::FFTWPlanner::num_threads();
+#ifdef _OPENMP
+		// the caller already runs several transforms concurrently
+		if (omp_in_parallel())
+			max_thr = 1;
+#endif
+		num_thr = std::max(1, std::min(num, max_thr));
+		num_thr_plan = 1;
+#ifdef SIRF_FFTW_THREADS
+		if (num < max_thr && vol >= 2 * MIN_VOLUME_PER_THREAD) {
+			num_thr_plan = max_thr / num_thr;
+			num_thr_plan = (int)std::min((size_t)num_thr_plan,
+				vol / MIN_VOLUME_PER_THREAD);
+		}
+#endif
 	}
 
-	inline int get_num_threads_fft3(size_t n0, size_t n1, size_t n2, size_t num)
+	// applies unnormalised 3D FFTs to all num volumes of size n0 x n1 x n2
+	// (n0 slowest) stored in a, placing the result in r (may be a itself)
+	void transform_(ComplexType* a, ComplexType* r,
+		int n0, int n1, int n2, int num, bool forward)
 	{
-		int num_of_max_threads_;
-#ifdef USE_OMP
-		num_of_max_threads_ = 8; //omp_get_num_procs();
-#else
-		num_of_max_threads_ = 1;
-#endif // USE_OMP
-		if (num_of_max_threads_ == 1)
-			return 1;
+		size_t vol = (size_t)n0*n1*n2;
+		int num_thr, num_thr_plan;
+		get_num_threads_fft3(vol, num, num_thr, num_thr_plan);
 
-		if (num >= num_of_max_threads_) {
-			return num_of_max_threads_;
-		}
+		long long n;
+
+		// volumes n and n + 2 are always equally aligned, volumes n and n + 1
+		// may not be, hence a plan for each parity of n
+		int sign = forward ? FFTW_FORWARD : FFTW_BACKWARD;
+		PlanKey key(3, n0, n1, n2, 1, 1, (int)vol, sign, num_thr_plan);
+		fftwf_plan p[2];
+		p[0] = get_plan_(key, a, r);
+		p[1] = num > 1 ? get_plan_(key, a + vol, r + vol) : p[0];
 
-		return 1;
+#pragma omp parallel for private(n) shared(num, p, a, vol, r) if (num_thr > 1) num_threads(num_thr)
+		for (n = 0; n < num; n++)
+		{
+			fftw_execute_dft_(p[n % 2], a + n*vol, r + n*vol);
+		}
 	}
 
 	void fft3(NDArray< ComplexType >& a, NDArray< ComplexType >& r, bool forward)
 	{
-		//r = a;
-
 		const size_t* dims = a.getDims();
 		int n2 = (int)dims[0];
 		int n1 = (int)dims[1];
@@ -212,46 +376,16 @@ namespace ISMRMRD {
 		float fftRatio = float(1.0 / std::sqrt(float(n0*n1*n2)));
 
 		int num = (int)(a.getNumberOfElements() / (n0*n1*n2));
-		int num_thr = get_num_threads_fft3(n0, n1, n2, num);
-
-		long long n;
-
-		std::mutex mutex_;
-		fftwf_plan p;
-		//typename fftw_types<T>::plan * p;
-
-		{
-			std::lock_guard<std::mutex> guard(mutex_);
-			p = fftw_plan_dft_3d_(n0, n1, n2,
-				a.getDataPtr(),
-				r.getDataPtr(),
-				forward ? FFTW_FORWARD : FFTW_BACKWARD, FFTW_ESTIMATE);
-
-		}
-
-#pragma omp parallel for private(n) shared(num, p, a, n0, n1, n2, r) if (num_thr > 1) num_threads(num_thr)
-		for (n = 0; n < num; n++)
-		{
-			fftw_execute_dft_(p, a.begin() + n*n0*n1*n2,
-				r.begin() + n*n0*n1*n2);
-		}
-
-		{
-			std::lock_guard<std::mutex> guard(mutex_);
-			fftw_destroy_plan_(p);
-		}
+		transform_(a.begin(), r.begin(), n0, n1, n2, num, forward);
 
 		for (size_t n = 0; n < a.getNumberOfElements(); n++) {
 			r.getDataPtr()[n] *= fftRatio;
 		}
-		//	r *= fftRatio;
-
 	}
 
 	void fft3(NDArray< ComplexType >& a, bool forward)
 	{
-		NDArray< ComplexType > res(a);
-		fft3(res, a, forward);
+		fft3(a, a, forward);
 	}
 
 	inline void fft3(NDArray< ComplexType >& a)
@@ -264,17 +398,66 @@ namespace ISMRMRD {
 		fft3(a, false);
 	}
 
+	/*
+	Centred transforms fftshift(fft(ifftshift(x))) without shifting data.
+
+	With w = exp(-2 pi i/N) (exp(2 pi i/N) for the inverse transform), the
+	ifftshift pivot p = floor(N/2) and the fftshift pivot q = ceil(N/2),
+	the centred transform of x is
+
+		X[k] = w^(-p*(k + q)) sum_m w^(m*k) (w^(q*m) x[m]),
+
+	i.e. the plain FFT of x premultiplied by w^(q*m) and postmultiplied by
+	w^(-p*(k + q)). For even N both factors are just +/-1 (checkerboard
+	modulation). In 3D the factors are products of the factors for each
+	dimension, and the normalisation is folded into the postmultiplier.
+	*/
+
+	// applies factor fx[i]*fy[j]*fz[l]*s to element (i, j, l) of all num
+	// volumes of size nx x ny x nz in a
+	void modulate_(ComplexType* a, size_t nx, size_t ny, size_t nz, size_t num,
+		const std::vector<ComplexType>& fx, const std::vector<ComplexType>& fy,
+		const std::vector<ComplexType>& fz, float s)
+	{
+		long long nrows = (long long)(ny*nz*num);
+		long long r;
+#pragma omp parallel for private(r) if (nrows > 16)
+		for (r = 0; r < nrows; r++) {
+			size_t j = r % ny;
+			size_t l = (r / ny) % nz;
+			ComplexType f = s * fy[j] * fz[l];
+			ComplexType* row = a + r*nx;
+			for (size_t i = 0; i < nx; i++)
+				row[i] *= f * fx[i];
+		}
+	}
+
+	void fft3c_(NDArray< ComplexType >& a, bool forward)
+	{
+		const size_t* dims = a.getDims();
+		int n2 = (int)dims[0];
+		int n1 = (int)dims[1];
+		int n0 = (int)dims[2];
+		int num = (int)(a.getNumberOfElements() / (n0*n1*n2));
+		float fftRatio = float(1.0 / std::sqrt(float(n0*n1*n2)));
+
+		std::vector<ComplexType> prex, postx, prey, posty, prez, postz;
+		sirf::centred_fft_factors(n2, forward, prex, postx);
+		sirf::centred_fft_factors(n1, forward, prey, posty);
+		sirf::centred_fft_factors(n0, forward, prez, postz);
+
+		modulate_(a.begin(), n2, n1, n0, num, prex, prey, prez, 1.0f);
+		transform_(a.begin(), a.begin(), n0, n1, n2, num, forward);
+		modulate_(a.begin(), n2, n1, n0, num, postx, posty, postz, fftRatio);
+	}
+
 	void fft3c(NDArray< ComplexType >& a)
 	{
-		ifftshift3D(a);
-		fft3(a);
-		fftshift3D(a);
+		fft3c_(a, true);
 	}
 
 	void ifft3c(NDArray< ComplexType >& a)
 	{
-		ifftshift3D(a);
-		ifft3(a);
-		fftshift3D(a);
+		fft3c_(a, false);
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,568 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2024 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup MR
+\brief Implementation file for the complex float kernels of MR algebra.
+
+\author Evgueni Ovtchinnikov
+\author SyneRBI
+*/
+
+#include <atomic>
+#include <cmath>
+#include <complex>
+
+#include "sirf/common/iequals.h"
+#include "sirf/iUtilities/LocalisedException.h"
+#include "sirf/Gadgetron/gadgetron_kernels.h"
+
+// vectorised kernels are compiled for x86 targets with GCC-compatible
+// compilers, which can compile functions for instruction sets not enabled
+// for the rest of the code
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIRF_X86_KERNELS
+#include <immintrin.h>
+#define SIRF_AVX2 __attribute__((target("avx2,fma")))
+#define SIRF_AVX512 __attribute__((target("avx512f")))
+#endif
+
+using namespace sirf;
+
+namespace {
+
+	typedef complex_float_t cf;
+
+	// scalar kernels, also used for the array tails left over by vector ones
+
+	void scalar_axpby(size_t n, cf a, const cf* x, cf b, const cf* y, cf* z)
+	{
+		if (b == cf(0))
+			for (size_t i = 0; i < n; i++)
+				z[i] = a * x[i];
+		else
+			for (size_t i = 0; i < n; i++)
+				z[i] = a * x[i] + b * y[i];
+	}
+
+	void scalar_xapyb(size_t n, const cf* x, const cf* a,
+		const cf* y, const cf* b, cf* z)
+	{
+		for (size_t i = 0; i < n; i++)
+			z[i] = a[i] * x[i] + b[i] * y[i];
+	}
+
+	void scalar_xapyb_s(size_t n, const cf* x, cf a,
+		const cf* y, const cf* b, cf* z)
+	{
+		for (size_t i = 0; i < n; i++)
+			z[i] = a * x[i] + b[i] * y[i];
+	}
+
+	cf scalar_cdot(size_t n, const cf* x, const cf* y)
+	{
+		cf s = 0;
+		for (size_t i = 0; i < n; i++)
+			s += std::conj(y[i]) * x[i];
+		return s;
+	}
+
+	float scalar_norm2(size_t n, const cf* x)
+	{
+		float s = 0;
+		for (size_t i = 0; i < n; i++)
+			s += std::norm(x[i]);
+		return s;
+	}
+
+	void scalar_multiply(size_t n, const cf* x, const cf* y, cf* z)
+	{
+		for (size_t i = 0; i < n; i++)
+			z[i] = x[i] * y[i];
+	}
+
+	void scalar_divide(size_t n, const cf* x, const cf* y, cf* z)
+	{
+		for (size_t i = 0; i < n; i++)
+			z[i] = x[i] / y[i];
+	}
+
+	void scalar_abs(size_t n, const cf* x, cf* z)
+	{
+		for (size_t i = 0; i < n; i++)
+			z[i] = std::abs(x[i]);
+	}
+
+	void scalar_sign(size_t n, const cf* x, cf* z)
+	{
+		kernels::Sign f;
+		for (size_t i = 0; i < n; i++)
+			z[i] = f(x[i]);
+	}
+
+#ifdef SIRF_X86_KERNELS
+
+	// AVX2 kernels: 4 complex numbers (interleaved real and imaginary
+	// parts) per 256-bit register
+
+	SIRF_AVX2 inline __m256 load4(const cf* x)
+	{
+		return _mm256_loadu_ps(reinterpret_cast<const float*>(x));
+	}
+
+	SIRF_AVX2 inline void store4(cf* z, __m256 v)
+	{
+		_mm256_storeu_ps(reinterpret_cast<float*>(z), v);
+	}
+
+	SIRF_AVX2 inline __m256 broadcast4(cf a)
+	{
+		float v[8];
+		for (int i = 0; i < 8; i += 2) {
+			v[i] = std::real(a);
+			v[i + 1] = std::imag(a);
+		}
+		return _mm256_loadu_ps(v);
+	}
+
+	// complex products (ar*br - ai*bi, ar*bi + ai*br)
+	SIRF_AVX2 inline __m256 cmul4(__m256 a, __m256 b)
+	{
+		__m256 b_swapped = _mm256_permute_ps(b, 0xB1);
+		return _mm256_fmaddsub_ps(_mm256_moveldup_ps(a), b,
+			_mm256_mul_ps(_mm256_movehdup_ps(a), b_swapped));
+	}
+
+	// |a|^2 in both real and imaginary slots
+	SIRF_AVX2 inline __m256 norm4(__m256 a)
+	{
+		__m256 a2 = _mm256_mul_ps(a, a);
+		return _mm256_add_ps(a2, _mm256_permute_ps(a2, 0xB1));
+	}
+
+	SIRF_AVX2 inline float hsum4(__m256 v)
+	{
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v),
+			_mm256_extractf128_ps(v, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+		return _mm_cvtss_f32(s);
+	}
+
+	SIRF_AVX2 void avx2_axpby(size_t n, cf a, const cf* x, cf b, const cf* y, cf* z)
+	{
+		__m256 va = broadcast4(a);
+		__m256 vb = broadcast4(b);
+		size_t i = 0;
+		if (b == cf(0))
+			for (; i + 4 <= n; i += 4)
+				store4(z + i, cmul4(va, load4(x + i)));
+		else
+			for (; i + 4 <= n; i += 4)
+				store4(z + i, _mm256_add_ps(cmul4(va, load4(x + i)),
+					cmul4(vb, load4(y + i))));
+		scalar_axpby(n - i, a, x + i, b, y + i, z + i);
+	}
+
+	SIRF_AVX2 void avx2_xapyb(size_t n, const cf* x, const cf* a,
+		const cf* y, const cf* b, cf* z)
+	{
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+			store4(z + i, _mm256_add_ps(cmul4(load4(a + i), load4(x + i)),
+				cmul4(load4(b + i), load4(y + i))));
+		scalar_xapyb(n - i, x + i, a + i, y + i, b + i, z + i);
+	}
+
+	SIRF_AVX2 void avx2_xapyb_s(size_t n, const cf* x, cf a,
+		const cf* y, const cf* b, cf* z)
+	{
+		__m256 va = broadcast4(a);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+			store4(z + i, _mm256_add_ps(cmul4(va, load4(x + i)),
+				cmul4(load4(b + i), load4(y + i))));
+		scalar_xapyb_s(n - i, x + i, a, y + i, b + i, z + i);
+	}
+
+	SIRF_AVX2 cf avx2_cdot(size_t n, const cf* x, const cf* y)
+	{
+		// real part: sum of xr*yr + xi*yi,
+		// imaginary part: sum of xi*yr - xr*yi
+		__m256 re = _mm256_setzero_ps();
+		__m256 im = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256 vx = load4(x + i);
+			__m256 vy = load4(y + i);
+			re = _mm256_fmadd_ps(vx, vy, re);
+			im = _mm256_fmadd_ps(vx, _mm256_permute_ps(vy, 0xB1), im);
+		}
+		im = _mm256_mul_ps(im, _mm256_setr_ps(-1, 1, -1, 1, -1, 1, -1, 1));
+		return cf(hsum4(re), hsum4(im)) + scalar_cdot(n - i, x + i, y + i);
+	}
+
+	SIRF_AVX2 float avx2_norm2(size_t n, const cf* x)
+	{
+		__m256 s = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256 vx = load4(x + i);
+			s = _mm256_fmadd_ps(vx, vx, s);
+		}
+		return hsum4(s) + scalar_norm2(n - i, x + i);
+	}
+
+	SIRF_AVX2 void avx2_multiply(size_t n, const cf* x, const cf* y, cf* z)
+	{
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+			store4(z + i, cmul4(load4(x + i), load4(y + i)));
+		scalar_multiply(n - i, x + i, y + i, z + i);
+	}
+
+	SIRF_AVX2 void avx2_divide(size_t n, const cf* x, const cf* y, cf* z)
+	{
+		// x/y = x*conj(y)/|y|^2
+		__m256 conj = _mm256_setr_ps(1, -1, 1, -1, 1, -1, 1, -1);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256 vy = load4(y + i);
+			__m256 num = cmul4(load4(x + i), _mm256_mul_ps(vy, conj));
+			store4(z + i, _mm256_div_ps(num, norm4(vy)));
+		}
+		scalar_divide(n - i, x + i, y + i, z + i);
+	}
+
+	SIRF_AVX2 void avx2_abs(size_t n, const cf* x, cf* z)
+	{
+		__m256 zero = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256 r = _mm256_sqrt_ps(norm4(load4(x + i)));
+			store4(z + i, _mm256_blend_ps(r, zero, 0xAA));
+		}
+		scalar_abs(n - i, x + i, z + i);
+	}
+
+	SIRF_AVX2 void avx2_sign(size_t n, const cf* x, cf* z)
+	{
+		__m256 zero = _mm256_setzero_ps();
+		__m256 one = _mm256_set1_ps(1.0f);
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			__m256 vx = load4(x + i);
+			__m256 pos = _mm256_and_ps(_mm256_cmp_ps(vx, zero, _CMP_GT_OQ), one);
+			__m256 neg = _mm256_and_ps(_mm256_cmp_ps(vx, zero, _CMP_LT_OQ), one);
+			store4(z + i, _mm256_blend_ps(_mm256_sub_ps(pos, neg), zero, 0xAA));
+		}
+		scalar_sign(n - i, x + i, z + i);
+	}
+
+	// AVX-512 kernels: 8 complex numbers per 512-bit register
+
+	SIRF_AVX512 inline __m512 load8(const cf* x)
+	{
+		return _mm512_loadu_ps(reinterpret_cast<const float*>(x));
+	}
+
+	SIRF_AVX512 inline void store8(cf* z, __m512 v)
+	{
+		_mm512_storeu_ps(reinterpret_cast<float*>(z), v);
+	}
+
+	SIRF_AVX512 inline __m512 broadcast8(cf a)
+	{
+		float v[16];
+		for (int i = 0; i < 16; i += 2) {
+			v[i] = std::real(a);
+			v[i + 1] = std::imag(a);
+		}
+		return _mm512_loadu_ps(v);
+	}
+
+	SIRF_AVX512 inline __m512 alternating8(float even, float odd)
+	{
+		float v[16];
+		for (int i = 0; i < 16; i += 2) {
+			v[i] = even;
+			v[i + 1] = odd;
+		}
+		return _mm512_loadu_ps(v);
+	}
+
+	SIRF_AVX512 inline __m512 cmul8(__m512 a, __m512 b)
+	{
+		__m512 b_swapped = _mm512_permute_ps(b, 0xB1);
+		return _mm512_fmaddsub_ps(_mm512_moveldup_ps(a), b,
+			_mm512_mul_ps(_mm512_movehdup_ps(a), b_swapped));
+	}
+
+	SIRF_AVX512 inline __m512 norm8(__m512 a)
+	{
+		__m512 a2 = _mm512_mul_ps(a, a);
+		return _mm512_add_ps(a2, _mm512_permute_ps(a2, 0xB1));
+	}
+
+	// odd (imaginary) slots of masked operations
+	const __mmask16 IM_SLOTS = 0xAAAA;
+
+	SIRF_AVX512 void avx512_axpby(size_t n, cf a, const cf* x, cf b, const cf* y, cf* z)
+	{
+		__m512 va = broadcast8(a);
+		__m512 vb = broadcast8(b);
+		size_t i = 0;
+		if (b == cf(0))
+			for (; i + 8 <= n; i += 8)
+				store8(z + i, cmul8(va, load8(x + i)));
+		else
+			for (; i + 8 <= n; i += 8)
+				store8(z + i, _mm512_add_ps(cmul8(va, load8(x + i)),
+					cmul8(vb, load8(y + i))));
+		scalar_axpby(n - i, a, x + i, b, y + i, z + i);
+	}
+
+	SIRF_AVX512 void avx512_xapyb(size_t n, const cf* x, const cf* a,
+		const cf* y, const cf* b, cf* z)
+	{
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+			store8(z + i, _mm512_add_ps(cmul8(load8(a + i), load8(x + i)),
+				cmul8(load8(b + i), load8(y + i))));
+		scalar_xapyb(n - i, x + i, a + i, y + i, b + i, z + i);
+	}
+
+	SIRF_AVX512 void avx512_xapyb_s(size_t n, const cf* x, cf a,
+		const cf* y, const cf* b, cf* z)
+	{
+		__m512 va = broadcast8(a);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+			store8(z + i, _mm512_add_ps(cmul8(va, load8(x + i)),
+				cmul8(load8(b + i), load8(y + i))));
+		scalar_xapyb_s(n - i, x + i, a, y + i, b + i, z + i);
+	}
+
+	SIRF_AVX512 cf avx512_cdot(size_t n, const cf* x, const cf* y)
+	{
+		__m512 re = _mm512_setzero_ps();
+		__m512 im = _mm512_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m512 vx = load8(x + i);
+			__m512 vy = load8(y + i);
+			re = _mm512_fmadd_ps(vx, vy, re);
+			im = _mm512_fmadd_ps(vx, _mm512_permute_ps(vy, 0xB1), im);
+		}
+		im = _mm512_mul_ps(im, alternating8(-1, 1));
+		return cf(_mm512_reduce_add_ps(re), _mm512_reduce_add_ps(im))
+			+ scalar_cdot(n - i, x + i, y + i);
+	}
+
+	SIRF_AVX512 float avx512_norm2(size_t n, const cf* x)
+	{
+		__m512 s = _mm512_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m512 vx = load8(x + i);
+			s = _mm512_fmadd_ps(vx, vx, s);
+		}
+		return _mm512_reduce_add_ps(s) + scalar_norm2(n - i, x + i);
+	}
+
+	SIRF_AVX512 void avx512_multiply(size_t n, const cf* x, const cf* y, cf* z)
+	{
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8)
+			store8(z + i, cmul8(load8(x + i), load8(y + i)));
+		scalar_multiply(n - i, x + i, y + i, z + i);
+	}
+
+	SIRF_AVX512 void avx512_divide(size_t n, const cf* x, const cf* y, cf* z)
+	{
+		__m512 conj = alternating8(1, -1);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m512 vy = load8(y + i);
+			__m512 num = cmul8(load8(x + i), _mm512_mul_ps(vy, conj));
+			store8(z + i, _mm512_div_ps(num, norm8(vy)));
+		}
+		scalar_divide(n - i, x + i, y + i, z + i);
+	}
+
+	SIRF_AVX512 void avx512_abs(size_t n, const cf* x, cf* z)
+	{
+		__m512 zero = _mm512_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m512 r = _mm512_sqrt_ps(norm8(load8(x + i)));
+			store8(z + i, _mm512_mask_blend_ps(IM_SLOTS, r, zero));
+		}
+		scalar_abs(n - i, x + i, z + i);
+	}
+
+	SIRF_AVX512 void avx512_sign(size_t n, const cf* x, cf* z)
+	{
+		__m512 zero = _mm512_setzero_ps();
+		__m512 one = _mm512_set1_ps(1.0f);
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			__m512 vx = load8(x + i);
+			// real slots only, imaginary ones are zeroed
+			__mmask16 gt = _mm512_cmp_ps_mask(vx, zero, _CMP_GT_OQ) & ~IM_SLOTS;
+			__mmask16 lt = _mm512_cmp_ps_mask(vx, zero, _CMP_LT_OQ) & ~IM_SLOTS;
+			store8(z + i, _mm512_sub_ps(_mm512_maskz_mov_ps(gt, one),
+				_mm512_maskz_mov_ps(lt, one)));
+		}
+		scalar_sign(n - i, x + i, z + i);
+	}
+
+#endif // SIRF_X86_KERNELS
+
+	struct Kernels {
+		const char* isa;
+		void(*axpby)(size_t, cf, const cf*, cf, const cf*, cf*);
+		void(*xapyb)(size_t, const cf*, const cf*, const cf*, const cf*, cf*);
+		void(*xapyb_s)(size_t, const cf*, cf, const cf*, const cf*, cf*);
+		cf(*cdot)(size_t, const cf*, const cf*);
+		float(*norm2)(size_t, const cf*);
+		void(*multiply)(size_t, const cf*, const cf*, cf*);
+		void(*divide)(size_t, const cf*, const cf*, cf*);
+		void(*abs)(size_t, const cf*, cf*);
+		void(*sign)(size_t, const cf*, cf*);
+	};
+
+	const Kernels SCALAR_KERNELS = { "scalar",
+		scalar_axpby, scalar_xapyb, scalar_xapyb_s, scalar_cdot, scalar_norm2,
+		scalar_multiply, scalar_divide, scalar_abs, scalar_sign };
+#ifdef SIRF_X86_KERNELS
+	const Kernels AVX2_KERNELS = { "avx2",
+		avx2_axpby, avx2_xapyb, avx2_xapyb_s, avx2_cdot, avx2_norm2,
+		avx2_multiply, avx2_divide, avx2_abs, avx2_sign };
+	const Kernels AVX512_KERNELS = { "avx512",
+		avx512_axpby, avx512_xapyb, avx512_xapyb_s, avx512_cdot, avx512_norm2,
+		avx512_multiply, avx512_divide, avx512_abs, avx512_sign };
+#endif
+
+	// the kernels for the given instruction set, 0 if not supported
+	const Kernels* supported_kernels(const std::string& isa)
+	{
+		bool any = sirf::iequals(isa, "auto");
+#ifdef SIRF_X86_KERNELS
+		__builtin_cpu_init();
+		if ((any || sirf::iequals(isa, "avx512"))
+			&& __builtin_cpu_supports("avx512f"))
+			return &AVX512_KERNELS;
+		if ((any || sirf::iequals(isa, "avx2"))
+			&& __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+			return &AVX2_KERNELS;
+#endif
+		if (any || sirf::iequals(isa, "scalar"))
+			return &SCALAR_KERNELS;
+		return 0;
+	}
+
+	std::atomic<const Kernels*>& current_kernels()
+	{
+		static std::atomic<const Kernels*> kernels(supported_kernels("auto"));
+		return kernels;
+	}
+
+	inline const Kernels& k()
+	{
+		return *current_kernels().load(std::memory_order_relaxed);
+	}
+
+}
+
+void
+kernels::axpby(size_t n, complex_float_t a, const complex_float_t* x,
+	complex_float_t b, const complex_float_t* y, complex_float_t* z)
+{
+	k().axpby(n, a, x, b, y, z);
+}
+
+void
+kernels::xapyb(size_t n, const complex_float_t* x, const complex_float_t* a,
+	const complex_float_t* y, const complex_float_t* b, complex_float_t* z)
+{
+	k().xapyb(n, x, a, y, b, z);
+}
+
+void
+kernels::xapyb(size_t n, const complex_float_t* x, complex_float_t a,
+	const complex_float_t* y, const complex_float_t* b, complex_float_t* z)
+{
+	k().xapyb_s(n, x, a, y, b, z);
+}
+
+complex_float_t
+kernels::cdot(size_t n, const complex_float_t* x, const complex_float_t* y)
+{
+	return k().cdot(n, x, y);
+}
+
+float
+kernels::norm2(size_t n, const complex_float_t* x)
+{
+	return k().norm2(n, x);
+}
+
+void
+kernels::multiply(size_t n, const complex_float_t* x,
+	const complex_float_t* y, complex_float_t* z)
+{
+	k().multiply(n, x, y, z);
+}
+
+void
+kernels::divide(size_t n, const complex_float_t* x,
+	const complex_float_t* y, complex_float_t* z)
+{
+	k().divide(n, x, y, z);
+}
+
+void
+kernels::abs(size_t n, const complex_float_t* x, complex_float_t* z)
+{
+	k().abs(n, x, z);
+}
+
+void
+kernels::sign(size_t n, const complex_float_t* x, complex_float_t* z)
+{
+	k().sign(n, x, z);
+}
+
+std::string
+kernels::isa()
+{
+	return k().isa;
+}
+
+void
+kernels::set_isa(const std::string& isa)
+{
+	const Kernels* ptr = supported_kernels(isa);
+	if (!ptr)
+		THROW("instruction set " + isa + " is unknown or not supported");
+	current_kernels().store(ptr);
+}
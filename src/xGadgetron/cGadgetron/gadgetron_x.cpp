@@ -27,6 +27,8 @@ limitations under the License.
 \author Evgueni Ovtchinnikov
 \author SyneRBI
 */
+#include <numeric>
+
 #include "sirf/iUtilities/DataHandle.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
@@ -391,6 +393,25 @@ void MRAcquisitionModel::check_data_role(const GadgetronImageData& ic)
 	}
 }
 
+void
+MRAcquisitionModel::set_cartesian_encoding(const std::string& encoding)
+{
+	if (sirf::iequals(encoding, "dense"))
+		pruned_cartesian_ = false;
+	else if (sirf::iequals(encoding, "pruned"))
+		pruned_cartesian_ = true;
+	else
+		THROW("unknown Cartesian encoding " + encoding
+			+ " (expected dense or pruned)");
+	if (sptr_acqs_.get() &&
+		sptr_acqs_->get_trajectory_type() == ISMRMRD::TrajectoryType::CARTESIAN) {
+		if (pruned_cartesian_)
+			sptr_enc_ = std::make_shared<sirf::PrunedCartesianFourierEncoding>();
+		else
+			sptr_enc_ = std::make_shared<sirf::CartesianFourierEncoding>();
+	}
+}
+
 void 
 MRAcquisitionModel::set_up(shared_ptr<MRAcquisitionData> sptr_ac,
 			shared_ptr<GadgetronImageData> sptr_ic)
@@ -398,8 +419,12 @@ MRAcquisitionModel::set_up(shared_ptr<MRAcquisitionData> sptr_ac,
 	if( sptr_ac->number() ==0 )
 		throw LocalisedException("Please dont use an empty acquisition template.", __FILE__, __LINE__);
 
-	if(sptr_ac->get_trajectory_type() == ISMRMRD::TrajectoryType::CARTESIAN)
-		this->sptr_enc_ = std::make_shared<sirf::CartesianFourierEncoding>();
+	if(sptr_ac->get_trajectory_type() == ISMRMRD::TrajectoryType::CARTESIAN) {
+		if (pruned_cartesian_)
+			this->sptr_enc_ = std::make_shared<sirf::PrunedCartesianFourierEncoding>();
+		else
+			this->sptr_enc_ = std::make_shared<sirf::CartesianFourierEncoding>();
+	}
 	else if(sptr_ac->get_trajectory_type() == ISMRMRD::TrajectoryType::OTHER)
 	{
 		ASSERT(sptr_ac->get_trajectory_dimensions()>0, "You should set a type ISMRMRD::TrajectoryType::OTHER trajectory before calling the calculate method with dimension > 0.");
@@ -427,68 +452,163 @@ MRAcquisitionModel::set_up(shared_ptr<MRAcquisitionData> sptr_ac,
 	set_image_template(sptr_ic);
 }
 
+void
+MRAcquisitionModel::get_sense_subsets_(const GadgetronImageData& ic, const CoilSensitivitiesVector& cc,
+	const MRAcquisitionData& ac, std::vector<const CFImage*>& images,
+	std::vector<const CFImage*>& csms,
+	std::vector<const KSpaceSubset::SetType*>& subsets) const
+{
+    int const num_img = ic.items();
+    images.resize(num_img);
+    csms.resize(num_img);
+    subsets.resize(num_img);
+    for( int i=0; i<num_img; ++i)
+    {
+        const ImageWrap& iw = ic.image_wrap(i);
+        if (iw.type() != ISMRMRD::ISMRMRD_CXFLOAT)
+            throw LocalisedException("MRAcquisitionModel can only be applied to complex float images.", __FILE__, __LINE__);
+        images[i] = static_cast<const CFImage*>(iw.ptr_image());
+        KSpaceSubset::TagType tag_img = KSpaceSubset::get_tag_from_img(*images[i]);
+        csms[i] = &cc.get_csm_cfimage_ref(tag_img, i);
+        subsets[i] = ac.get_kspace_subset(tag_img);
+        if(!subsets[i])
+            throw LocalisedException("You didn't find rawdata corresponding to your image in the acquisition data.", __FILE__, __LINE__);
+    }
+}
+
+gadgetron::shared_ptr<const MRAcquisitionData>
+MRAcquisitionModel::sorted_acquisitions_() const
+{
+	if (sptr_acqs_->sorted() && sptr_acqs_->get_kspace_order_size() > 0)
+		return sptr_acqs_;
+	// sorting a view rearranges its numbering only, no samples are copied,
+	// and it is made anew for each call, so that it follows the template
+	std::vector<int> num(sptr_acqs_->number());
+	std::iota(num.begin(), num.end(), 0);
+	gadgetron::shared_ptr<MRAcquisitionData> sptr_view
+		(new AcquisitionsView(sptr_acqs_, num));
+	sptr_view->sort();
+	return sptr_view;
+}
+
 void
 MRAcquisitionModel::fwd(const GadgetronImageData& ic, CoilSensitivitiesVector& cc,
 	MRAcquisitionData& ac)
 {
-    GadgetronImagesVector images_channelresolved;
-    cc.forward(images_channelresolved, ic);
+    if(ic.items() != cc.items() )
+        throw LocalisedException("The number of coilmaps does not equal the number of images to which they should be applied to.",   __FILE__, __LINE__);
 
-    ac.sort();
-    std::vector<KSpaceSubset> kspace_sorting = ac.get_kspace_sorting();
+    if (!ac.sorted() || ac.get_kspace_order_size() == 0)
+        ac.sort();
 
-    if( kspace_sorting.size() != images_channelresolved.number() )
+    int const num_img = ic.items();
+    if( ac.get_kspace_order_size() != num_img )
         throw LocalisedException("Number of images does not match number of acquisition data bins  ", __FILE__, __LINE__);
 
-    for( unsigned int i=0; i<images_channelresolved.number(); ++i)
-    {
-        ImageWrap iw = images_channelresolved.image_wrap(i);
-        CFImage* ptr_img = static_cast<CFImage*>(iw.ptr_image());
-
-        auto tag_img = KSpaceSubset::get_tag_from_img(*ptr_img);
-
-        sirf::AcquisitionsVector subset;
-        KSpaceSubset::SetType idx_set;
-        for(int j=0; j<kspace_sorting.size(); ++j)
-        {
-            if(tag_img == kspace_sorting[j].get_tag())
-            {
-                idx_set = kspace_sorting[j].get_idx_set();
-                ac.get_subset(subset, idx_set);
-                break;
-            }
-        }
-
-        if(subset.number() == 0)
-            throw LocalisedException("You didn't find rawdata corresponding to your image in the acquisition data.", __FILE__, __LINE__);
+    // each image, multiplied by its coil maps, is encoded into its own
+    // subset of acquisitions, with no coil-resolved images stored;
+    // the encoder transforms all images in one batch
+    std::vector<const CFImage*> images;
+    std::vector<const CFImage*> csms;
+    std::vector<const KSpaceSubset::SetType*> subsets;
+    get_sense_subsets_(ic, cc, ac, images, csms, subsets);
 
-        this->sptr_enc_->forward(subset, *ptr_img);
-        ac.set_subset(subset, idx_set); //assume forward does not reorder the acquisitions
-    }
-    ac.sort();
+    this->sptr_enc_->forward_sense_batch(ac, subsets, images, csms);
 }
 
 void 
 MRAcquisitionModel::bwd(GadgetronImageData& ic, const CoilSensitivitiesVector& cc,
     const MRAcquisitionData& ac)
 {
-    GadgetronImagesVector iv;
-    iv.set_meta_data(ac.acquisitions_info());
-
     auto sort_idx = ac.get_kspace_order();
+    int const num_img = sort_idx.size();
+
+    if(num_img != cc.items() )
+        throw LocalisedException("The number of coilmaps does not equal the number of images to be combined.",   __FILE__, __LINE__);
 
-    for(int i=0; i<sort_idx.size(); ++i)
+    // the coil images of each subset are combined as they come out of
+    // the inverse FFT
+    std::vector<const CFImage*> csms(num_img);
+    std::vector<const KSpaceSubset::SetType*> subsets(num_img);
+    for(int i=0; i<num_img; ++i)
     {
-        sirf::AcquisitionsVector subset;
-        ac.get_subset(subset, sort_idx[i]);
-        
-		CFImage* img_ptr = new CFImage();
-		ImageWrap iw(ISMRMRD::ISMRMRD_DataTypes::ISMRMRD_CXFLOAT, img_ptr);// God I trust this!
-		this->sptr_enc_->backward(*img_ptr, subset);
-
-        iv.append(iw);
-	}
+        const ISMRMRD::AcquisitionHeader& head = ac.acquisition_header(sort_idx[i].back());
+        csms[i] = &cc.get_csm_cfimage_ref(KSpaceSubset::get_tag_from_counters(head.idx), i);
+        subsets[i] = &sort_idx[i];
+    }
+
+    std::vector<CFImage*> images(num_img);
+    for(int i=0; i<num_img; ++i)
+        images[i] = new CFImage();
+
+    // on failure ic is left as it was
+    try {
+        this->sptr_enc_->backward_sense_batch(images, ac, subsets, csms);
+    }
+    catch (...) {
+        for(int i=0; i<num_img; ++i)
+            delete images[i];
+        throw;
+    }
+
+    // the container takes over the images
+    ic.set_meta_data(ac.acquisitions_info());
+    ic.clear_data();
+    for(int i=0; i<num_img; ++i)
+        ic.append(ISMRMRD::ISMRMRD_DataTypes::ISMRMRD_CXFLOAT, images[i]);
 
-    cc.backward(ic, iv);
     ic.set_up_geom_info();
 }
+
+void
+MRAcquisitionModel::normal(GadgetronImageData& ic_out, const GadgetronImageData& ic,
+    const CoilSensitivitiesVector& cc)
+{
+    if(ic.items() != cc.items() )
+        throw LocalisedException("The number of coilmaps does not equal the number of images to which they should be applied to.",   __FILE__, __LINE__);
+
+    // only the headers and trajectories of the template are used
+    gadgetron::shared_ptr<const MRAcquisitionData> sptr_ac = sorted_acquisitions_();
+    const MRAcquisitionData& ac = *sptr_ac;
+
+    int const num_img = ic.items();
+    if( ac.get_kspace_order_size() != num_img )
+        throw LocalisedException("Number of images does not match number of acquisition data bins  ", __FILE__, __LINE__);
+
+    std::vector<const CFImage*> images;
+    std::vector<const CFImage*> csms;
+    std::vector<const KSpaceSubset::SetType*> subsets;
+    get_sense_subsets_(ic, cc, ac, images, csms, subsets);
+
+    std::vector<CFImage*> images_out(num_img);
+    for(int i=0; i<num_img; ++i)
+        images_out[i] = new CFImage();
+
+    std::string err;
+#pragma omp parallel for schedule(dynamic) if(num_img > 1 && sptr_enc_->thread_safe())
+    for(int i=0; i<num_img; ++i)
+    {
+        try {
+            this->sptr_enc_->normal_sense(*images_out[i], ac, *subsets[i], *images[i], *csms[i]);
+        }
+        catch (const std::exception& e) {
+#pragma omp critical(MRAcquisitionModel_normal)
+            err = e.what();
+        }
+    }
+
+    // on failure ic_out is left as it was
+    if (!err.empty()) {
+        for(int i=0; i<num_img; ++i)
+            delete images_out[i];
+        THROW(err);
+    }
+
+    // the container takes over the images
+    ic_out.set_meta_data(ac.acquisitions_info());
+    ic_out.clear_data();
+    for(int i=0; i<num_img; ++i)
+        ic_out.append(ISMRMRD::ISMRMRD_DataTypes::ISMRMRD_CXFLOAT, images_out[i]);
+
+    ic_out.set_up_geom_info();
+}
@@ -55,8 +55,35 @@ public:
 
     virtual void forward(MRAcquisitionData& ac, const CFImage& img) const =0;
     virtual void backward(CFImage& img, const MRAcquisitionData& ac) const =0;
+
+    // transforms restricted to the acquisitions ac[idx[i]], the forward one
+    // writing directly into them; by default these work on a copy of the subset
+    virtual void forward_subset(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img) const;
+    virtual void backward_subset(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx) const;
+
+    // SENSE transforms of a subset: the forward one encodes the coil images
+    // img*csm[c], the backward one combines the coil images as sum_c conj(csm[c])*img_c;
+    // by default these go through the coil-resolved image
+    virtual void forward_sense(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const;
+    virtual void backward_sense(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& csm) const;
+    // the normal operator of the SENSE transforms of a subset: img_out = E^H E img,
+    // E being forward_sense; by default the forward transform writes into a copy
+    // of the subset, which the backward one then reads
+    virtual void normal_sense(CFImage& img_out, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const;
+
+    // SENSE transforms of a batch of images, the image img[i] with the coil maps
+    // csm[i] corresponding to the subset idx[i]; by default the images are
+    // transformed one by one, concurrently if thread_safe()
+    virtual void forward_sense_batch(MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& img, const std::vector<const CFImage*>& csm) const;
+    virtual void backward_sense_batch(const std::vector<CFImage*>& img, const MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& csm) const;
+
+    // whether the transforms of different subsets may run concurrently
+    virtual bool thread_safe() const { return false; }
     
     void match_img_header_to_acquisition(CFImage& img, const ISMRMRD::Acquisition& acq) const;
+
+protected:
+    void check_csm_dimensions_(const CFImage& img, const CFImage& csm) const;
 };
 
 /*!
@@ -77,8 +104,60 @@ public:
 
     virtual void forward(MRAcquisitionData& ac, const CFImage& img) const;
     virtual void backward(CFImage& img, const MRAcquisitionData& ac) const;
+    virtual void forward_subset(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img) const;
+    virtual void backward_subset(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx) const;
+    virtual void forward_sense(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const;
+    virtual void backward_sense(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& csm) const;
+    // applies ifft3c(W fft3c(img*csm[c])) combined with the coil maps, W being
+    // the sampling mask (the number of acquisitions of each k-space line),
+    // without going through acquisitions
+    virtual void normal_sense(CFImage& img_out, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const;
+    // images of the same shape are transformed together: the coil images of
+    // all of them form one batch of FFT volumes and the header is parsed once
+    virtual void forward_sense_batch(MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& img, const std::vector<const CFImage*>& csm) const;
+    virtual void backward_sense_batch(const std::vector<CFImage*>& img, const MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& csm) const;
+    virtual bool thread_safe() const { return true; }
+
+protected:
+    // transforms of the acquisitions ac[idx[i]] going through blocks of
+    // coil channels; the coil images are img or, if csm is not null,
+    // img*csm[c] (forward) and are combined with the coil maps (backward)
+    virtual void forward_(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage* csm) const;
+    virtual void backward_(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage* csm) const;
     
 };
 
+/*!
+\ingroup Gadgetron Extensions
+\brief Class to perform a cartesian FFT restricted to the sampled k-space
+
+* Produces the same result as CartesianFourierEncoding without creating
+* the dense k-space matrix: the partition transforms are followed by the
+* phase transforms only on the acquired partitions, and the readout
+* transforms are performed only on the acquired lines, directly in the
+* acquisitions' data. The saving grows with the undersampling factor.
+*/
+
+class PrunedCartesianFourierEncoding : public CartesianFourierEncoding
+{
+public:
+    PrunedCartesianFourierEncoding() : CartesianFourierEncoding() {}
+
+    // the pruned transforms are applied image by image
+    virtual void forward_sense_batch(MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& img, const std::vector<const CFImage*>& csm) const
+    {
+        FourierEncoding::forward_sense_batch(ac, idx, img, csm);
+    }
+    virtual void backward_sense_batch(const std::vector<CFImage*>& img, const MRAcquisitionData& ac, const std::vector<const KSpaceSubset::SetType*>& idx, const std::vector<const CFImage*>& csm) const
+    {
+        FourierEncoding::backward_sense_batch(img, ac, idx, csm);
+    }
+
+protected:
+    virtual void forward_(MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage* csm) const;
+    virtual void backward_(CFImage& img, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage* csm) const;
+
+};
+
 } // namespace sirf
 #endif // FOURIERENCODING_H
\ No newline at end of file
@@ -63,6 +63,14 @@ IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef NONCARTESIAN_ENCODING_H
 #define NONCARTESIAN_ENCODING_H
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <sirf/Gadgetron/FourierEncoding.h>
 
 #include <gadgetron/hoNDArray.h>
@@ -104,28 +112,25 @@ public:
         traj.get_dimensions(this->trajdims_);
         this->output_dims_ = img_output_dims;
         this->nufft_operator_.preprocess(traj);
+
+        this->unit_dcw_.create(this->trajdims_);
+        this->unit_dcw_.fill(1.f);
     }
 
+    // a Gridder object must not be used by several threads concurrently
     void ifft(CFGThoNDArr& img, const CFGThoNDArr& kdata) const
     {
-        auto sptr_const_dcw = std::make_shared<Gadgetron::hoNDArray<float> >( this->trajdims_);
-        float const normed_dcw_value = 1.0;
-
-        sptr_const_dcw ->fill(normed_dcw_value);
-
         img.create(this->output_dims_);
         img.fill(std::complex<float>(0.f, 0.f));
 
-        this->nufft_operator_.compute(kdata, img, sptr_const_dcw.get(), Gadgetron::NFFT_comp_mode::BACKWARDS_NC2C);
+        this->nufft_operator_.compute(kdata, img, &this->unit_dcw_, Gadgetron::NFFT_comp_mode::BACKWARDS_NC2C);
     }
 
     void fft(CFGThoNDArr& kdata, const CFGThoNDArr& img) const
     {
-        auto sptr_unit_dcw = std::make_shared<Gadgetron::hoNDArray<float> >( this->trajdims_);
-        sptr_unit_dcw ->fill(1.f);
         kdata.create(this->trajdims_);
 
-        this->nufft_operator_.compute(img, kdata, sptr_unit_dcw.get(), Gadgetron::NFFT_comp_mode::FORWARDS_C2NC);
+        this->nufft_operator_.compute(img, kdata, &this->unit_dcw_, Gadgetron::NFFT_comp_mode::FORWARDS_C2NC);
     }
 
 protected:
@@ -136,10 +141,192 @@ protected:
     std::vector<size_t> output_dims_;
 
     mutable Gadgetron::hoNFFT_plan<float, D> nufft_operator_;
+    mutable Gadgetron::hoNDArray<float> unit_dcw_;
 };
 
 typedef Gridder<2> Gridder2D;
 
+/*!
+\ingroup Gadgetron Extensions
+\brief Cache of gridders set up for the trajectories seen by an encoder.
+*
+* Setting up a gridder preprocesses the trajectory, which for a fixed
+* trajectory is the same at every forward or backward call and may cost
+* more than the gridding itself. The gridders are looked up by a hash of
+* the image dimensions and trajectory points, and the trajectories are
+* compared to rule out hash collisions. Several gridders may be kept for
+* the same trajectory for use by concurrent threads. The least recently used
+* trajectory is dropped when the cache is full. Encoders that cycle through
+* several trajectories per transform reserve room for all of them, as
+* otherwise each would be dropped before it is used again.
+*
+* Other objects set up from the image dimensions and a trajectory, such as
+* the Toeplitz kernels below, are cached in the same way.
+*/
+
+template <unsigned int D, class G = Gridder<D> >
+class GridderCache
+{
+public:
+    typedef typename Gridder<D>::TrajectoryArrayType TrajectoryArrayType;
+
+    GridderCache(size_t max_size = 64) : max_size_(max_size) {}
+    // copies start empty
+    GridderCache(const GridderCache& other) : max_size_(other.max_size_) {}
+    GridderCache& operator=(const GridderCache& other)
+    {
+        if(this != &other)
+        {
+            clear();
+            max_size_ = other.max_size_;
+        }
+        return *this;
+    }
+
+    std::shared_ptr<const G> get(const std::vector<size_t>& img_output_dims, const TrajectoryArrayType& traj)
+    {
+        return get(img_output_dims, traj, 1)[0];
+    }
+
+    // returns the given number of gridders for the same trajectory
+    std::vector<std::shared_ptr<const G> > get(const std::vector<size_t>& img_output_dims, const TrajectoryArrayType& traj, size_t copies)
+    {
+        std::uint64_t const key = hash(img_output_dims, traj);
+        std::vector<std::shared_ptr<const G> > gridders;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = find(key, img_output_dims, traj);
+            if(it != entries_.end())
+            {
+                entries_.splice(entries_.begin(), entries_, it);
+                gridders = it->gridders;
+            }
+        }
+        if(gridders.size() >= copies)
+        {
+            gridders.resize(copies);
+            return gridders;
+        }
+        // set up outside the lock, this is the expensive part
+        while(gridders.size() < copies)
+            gridders.push_back(std::make_shared<G>(img_output_dims, traj));
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = find(key, img_output_dims, traj);
+        if(it == entries_.end())
+        {
+            entries_.push_front(Entry{key, img_output_dims, traj, gridders});
+            if(entries_.size() > max_size_)
+                entries_.pop_back();
+        }
+        else if(it->gridders.size() < copies)
+            it->gridders = gridders;
+        return gridders;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+    // makes room for at least n trajectories
+    void reserve(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_size_ = std::max(max_size_, n);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+
+    // FNV-1a hash of the dimensions and trajectory points
+    static std::uint64_t hash(const std::vector<size_t>& img_output_dims, const TrajectoryArrayType& traj)
+    {
+        std::uint64_t h = 14695981039346656037ULL;
+        auto add = [&h](const void* data, size_t size)
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for(size_t i=0; i<size; ++i)
+            {
+                h ^= bytes[i];
+                h *= 1099511628211ULL;
+            }
+        };
+        add(img_output_dims.data(), img_output_dims.size()*sizeof(size_t));
+        add(traj.get_data_ptr(), traj.get_number_of_elements()*sizeof(Gadgetron::vector_td<float, D>));
+        return h;
+    }
+
+private:
+    struct Entry
+    {
+        std::uint64_t key;
+        std::vector<size_t> img_output_dims;
+        TrajectoryArrayType traj;
+        std::vector<std::shared_ptr<const G> > gridders;
+    };
+
+    typename std::list<Entry>::iterator find(std::uint64_t key, const std::vector<size_t>& img_output_dims, const TrajectoryArrayType& traj)
+    {
+        for(auto it = entries_.begin(); it != entries_.end(); ++it)
+            if(it->key == key && it->img_output_dims == img_output_dims && same(it->traj, traj))
+                return it;
+        return entries_.end();
+    }
+
+    static bool same(const TrajectoryArrayType& traj1, const TrajectoryArrayType& traj2)
+    {
+        size_t const n = traj1.get_number_of_elements();
+        return n == traj2.get_number_of_elements() &&
+            std::memcmp(traj1.get_data_ptr(), traj2.get_data_ptr(), n*sizeof(Gadgetron::vector_td<float, D>)) == 0;
+    }
+
+    size_t max_size_;
+    std::list<Entry> entries_;
+    mutable std::mutex mutex_;
+};
+
+typedef GridderCache<2> GridderCache2D;
+
+/*!
+\ingroup Gadgetron Extensions
+\brief Toeplitz embedding of the normal operator of a 2D NUFFT.
+*
+* For the NUFFT N of a trajectory, N^H N is a convolution with the point
+* spread function of the trajectory, which is computed once on a twice
+* larger grid by gridding unit k-space data. The convolution is then applied
+* by zero-padded FFTs, with no gridding at all. The kernel is scaled so that
+* its central value matches that of N^H N applied by a Gridder.
+*/
+
+class ToeplitzKernel2D
+{
+public:
+    typedef Gridder2D::TrajectoryArrayType TrajectoryArrayType;
+
+    ToeplitzKernel2D(const std::vector<size_t>& img_dims, const TrajectoryArrayType& traj);
+
+    /*!
+    Applies N^H N to the 2D images (of the dimensions given to the
+    constructor) in[ix + nx*(iy + ny*iz)], ix = 0, ..., nx - 1, and stores
+    the result multiplied by scale in out, which may coincide with in.
+    */
+    void apply(const complex_float_t* in, complex_float_t* out, size_t nx, complex_float_t scale) const;
+
+private:
+    size_t ny_;
+    size_t nz_;
+    // FFT of the point spread function on the 2ny x 2nz grid,
+    // divided by the grid size
+    std::vector<complex_float_t> kernel_;
+};
+
+typedef GridderCache<2, ToeplitzKernel2D> ToeplitzKernelCache2D;
+
 
 /*!
 \ingroup Gadgetron Extensions
@@ -159,9 +346,13 @@ public:
 
     virtual void forward(MRAcquisitionData& ac, const CFImage& img) const;
     virtual void backward(CFImage& img, const MRAcquisitionData& ac) const;
+    // applied via the Toeplitz embedding of the 2D NUFFTs
+    virtual void normal_sense(CFImage& img_out, const MRAcquisitionData& ac, const KSpaceSubset::SetType& idx, const CFImage& img, const CFImage& csm) const;
 protected:
     Gridder2D::TrajectoryArrayType get_trajectory(const MRAcquisitionData& ac) const;
 
+    mutable GridderCache2D gridders_;
+    mutable ToeplitzKernelCache2D toeplitz_kernels_;
 };
 
 class NonCartesian2DEncoding : public FourierEncoding
@@ -175,6 +366,7 @@ protected:
     Gridder2D::TrajectoryArrayType get_trajectory(const MRAcquisitionData& ac) const;
     std::vector<int> get_slice_encoding_subset_indices(const MRAcquisitionData& full_dataset, unsigned int kspace_enc_step_2) const;
 
+    mutable GridderCache2D gridders_;
 };    
 
 
@@ -62,10 +62,21 @@ extern "C" {
 	void* cGT_acquisitionModelNorm(void* ptr_am, int num_iter, int verb);
 	void* cGT_AcquisitionModelForward(void* ptr_am, const void* ptr_imgs);
 	void* cGT_AcquisitionModelBackward(void* ptr_am, const void* ptr_acqs);
+	void* cGT_AcquisitionModelNormal(void* ptr_am, const void* ptr_imgs);
+
+	// FFT settings
+	void* cGT_setFFTWPlannerRigour(const char* rigour);
+	void* cGT_FFTWPlannerRigour();
+	void* cGT_importFFTWWisdom(const char* file);
+	void* cGT_exportFFTWWisdom(const char* file);
+	void* cGT_setFFTThreads(int threads);
+	void* cGT_FFTThreads();
 
 	// acquisition data methods
 	void* cGT_ISMRMRDAcquisitionsFromFile(const char* file, int all, size_t ptr);
 	void* cGT_ISMRMRDAcquisitionsFile(const char* file);
+	void* cGT_setAcquisitionDataStorageScheme(const char* scheme);
+	void* cGT_getAcquisitionDataStorageScheme();
 	void* cGT_setAcquisitionsIgnoreMask(void* ptr_acqs, size_t ptr_im);
 	void* cGT_acquisitionsIgnoreMask(void* ptr_acqs, size_t ptr_im);
 	void* cGT_processAcquisitions(void* ptr_proc, void* ptr_input);
@@ -73,6 +84,7 @@ extern "C" {
 	void* cGT_appendAcquisition(void* ptr_acqs, void* ptr_acq);
 	void* cGT_createEmptyAcquisitionData(void* ptr_ad);
     void* cGT_getAcquisitionsSubset(void* ptr_acqs, PTR_INT const ptr_idx, PTR_INT const num_elem_subset);
+	void* cGT_getAcquisitionsView(void* ptr_acqs, PTR_INT const ptr_idx, PTR_INT const num_elem_subset);
 
 	void* cGT_cloneAcquisitions(void* ptr_input);
 	void* cGT_sortAcquisitions(void* ptr_acqs);
@@ -120,6 +132,7 @@ extern "C" {
 	void* cGT_setImageDataFromCmplxArray(void* ptr_imgs, PTR_FLOAT ptr_z);
     void* cGT_print_header(const void* ptr_imgs, const int im_idx);
 	void* cGT_realImageData(void* ptr_imgs, const char* way);
+	void* cGT_makeImagesContiguous(void* ptr_imgs);
 
 	// gadget chain methods
 	void* cGT_setHost(void* ptr_gc, const char* host);
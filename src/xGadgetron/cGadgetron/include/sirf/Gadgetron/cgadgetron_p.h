@@ -32,6 +32,9 @@ namespace sirf {
 	extern "C"
 		void* cGT_imageParameter(void* ptr_im, const char* name);
 
+	extern "C"
+		void* cGT_imagesParameter(void* ptr_imgs, const char* name);
+
 	extern "C"
 		void* cGT_AcquisitionModelParameter(void* ptr_am, const char* name);
 
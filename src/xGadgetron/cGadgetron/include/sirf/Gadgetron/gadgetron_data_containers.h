@@ -33,6 +33,13 @@ limitations under the License.
 #ifndef GADGETRON_DATA_CONTAINERS
 #define GADGETRON_DATA_CONTAINERS
 
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <new>
 #include <string>
 #include <vector>
 #include <tuple>
@@ -225,6 +232,7 @@ namespace sirf {
 
         TagType get_tag(void) const {return tag_;}
         SetType get_idx_set(void) const {return idx_set_;}
+        const SetType& idx_set(void) const {return idx_set_;}
         void add_idx_to_set(size_t const idx){this->idx_set_.push_back(idx);}
 
         bool is_first_set() const {
@@ -246,6 +254,9 @@ namespace sirf {
         */
         static TagType get_tag_from_acquisition(ISMRMRD::Acquisition acq);
 
+        //! Function to get k-space dimension tag from the encoding counters of an acquisition header
+        static TagType get_tag_from_counters(const ISMRMRD::EncodingCounters& idx);
+
         //! Function to get k-space dimension tag from an ISMRMRD::Image
         /*!
         * This allows to find out which k-space dimension the image belongs to.
@@ -268,6 +279,89 @@ namespace sirf {
         SetType idx_set_;
     };
 
+    /*!
+    \ingroup MR
+    \brief Assignment of the acquisitions of a container to k-space subsets.
+
+    Built by MRAcquisitionData::organise_kspace() and not changed afterwards,
+    so that containers with the same acquisitions (copies of a container and
+    results of algebraic operations on it) share it instead of rebuilding it.
+    */
+    struct KSpaceSorting
+    {
+        //! Non-empty subsets of k-space
+        std::vector<KSpaceSubset> subsets;
+        //! Position in subsets of the subset with a given tag
+        std::map<KSpaceSubset::TagType, int> subset_index;
+    };
+
+	/*!
+	\ingroup MR
+	\brief Non-owning view of a contiguous array of elements of type T.
+
+	Used for accessing the samples of acquisitions stored in MRAcquisitionData
+	containers without copying them.
+
+	Containers that keep only part of their data in memory (AcquisitionsFile)
+	attach an owner to the span that keeps the viewed elements in memory,
+	so the pointer returned by data() must not be used after the span
+	(and all its copies) have been destroyed.
+	*/
+	template <typename T>
+	class DataSpan {
+	public:
+		DataSpan() : ptr_(0), size_(0) {}
+		DataSpan(T* ptr, size_t size,
+			gadgetron::shared_ptr<void> owner = gadgetron::shared_ptr<void>()) :
+			ptr_(ptr), size_(size), owner_(owner) {}
+		// allows passing a mutable span where a const one is expected
+		template <typename U>
+		DataSpan(const DataSpan<U>& span) :
+			ptr_(span.data()), size_(span.size()), owner_(span.owner()) {}
+		T* data() const { return ptr_; }
+		size_t size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+		T* begin() const { return ptr_; }
+		T* end() const { return ptr_ + size_; }
+		T& operator[](size_t i) const { return ptr_[i]; }
+		const gadgetron::shared_ptr<void>& owner() const { return owner_; }
+	private:
+		T* ptr_;
+		size_t size_;
+		gadgetron::shared_ptr<void> owner_;
+	};
+
+	/*!
+	\ingroup MR
+	\brief Columnar index of the headers of the acquisitions in a container.
+
+	Holds the header fields needed for sorting, filtering and getting the
+	dimensions of acquisition data, one array per field, in the order of
+	acquisition numbers. Obtained from MRAcquisitionData::header_index(),
+	which builds it from the acquisition headers only (no samples are
+	copied) and caches it until the headers or their order change.
+	*/
+	class AcquisitionsHeaderIndex {
+	public:
+		AcquisitionsHeaderIndex(size_t n = 0) { resize(n); }
+		size_t size() const { return time_stamp.size(); }
+		void resize(size_t n);
+		void set(size_t i, const ISMRMRD::AcquisitionHeader& head);
+		// the index of acquisitions order[0], order[1], ...
+		AcquisitionsHeaderIndex permuted(const std::vector<int>& order) const;
+		bool ignored(size_t i, const IgnoreMask& mask) const
+		{
+			return mask.ignored(flags[i]);
+		}
+
+		std::vector<uint32_t> time_stamp;
+		std::vector<uint64_t> flags;
+		std::vector<uint16_t> number_of_samples;
+		std::vector<uint16_t> active_channels;
+		std::vector<uint16_t> trajectory_dimensions;
+		std::vector<ISMRMRD::EncodingCounters> idx;
+	};
+
 	/*!
 	\ingroup MR
 	\brief Abstract MR acquisition data container class.
@@ -579,6 +673,25 @@ namespace sirf {
 		virtual void set_acquisition(unsigned int,
 			ISMRMRD::Acquisition&) = 0;
 		virtual void append_acquisition(ISMRMRD::Acquisition& acq) = 0;
+		// appends n acquisitions with headers heads[i], samples data[i]
+		// and trajectories traj[i] (unused if trajectory_dimensions is 0)
+		virtual void append_acquisitions(size_t n,
+			const ISMRMRD::AcquisitionHeader* heads,
+			const complex_float_t* const* data, const float* const* traj);
+
+		// zero-copy access to the header and samples of an acquisition
+		// (the ignore mask is not applied, see ignored());
+		// may be called concurrently from several threads
+		virtual const ISMRMRD::AcquisitionHeader&
+			acquisition_header(unsigned int num) const = 0;
+		virtual DataSpan<const complex_float_t>
+			acquisition_data(unsigned int num) const = 0;
+		virtual DataSpan<complex_float_t>
+			acquisition_data(unsigned int num) = 0;
+		// zero-copy read access to the trajectory of an acquisition,
+		// trajectory_dimensions values per sample
+		virtual DataSpan<const float>
+			acquisition_traj(unsigned int num) const = 0;
 
 		virtual void copy_acquisitions_info(const MRAcquisitionData& ac) = 0;
 		virtual void copy_acquisitions_data(const MRAcquisitionData& ac) = 0;
@@ -646,11 +759,18 @@ namespace sirf {
 
 		// regular methods
 		void binary_op(const DataContainer& a_x, const DataContainer& a_y,
-			void(*f)(const ISMRMRD::Acquisition&, ISMRMRD::Acquisition&));
+			complex_float_t(*f)(complex_float_t, complex_float_t));
 		void semibinary_op(const DataContainer& a_x, complex_float_t y,
-			void(*f)(const ISMRMRD::Acquisition&, ISMRMRD::Acquisition&, complex_float_t));
+			complex_float_t(*f)(complex_float_t, complex_float_t));
 		void unary_op(const DataContainer& a_x,
-			void(*f)(const ISMRMRD::Acquisition&, ISMRMRD::Acquisition&));
+			complex_float_t(*f)(complex_float_t));
+
+		bool ignored(unsigned int num) const
+		{
+			return ignore_mask_.ignored(acquisition_header(num).flags);
+		}
+		// the numbers of the acquisitions not ignored
+		std::vector<int> acquisitions_not_ignored() const;
 
 		AcquisitionsInfo acquisitions_info() const { return acqs_info_; }
 		void set_acquisitions_info(std::string info) { acqs_info_ = info; }
@@ -686,9 +806,20 @@ namespace sirf {
 		int get_acquisitions_dimensions(size_t ptr_dim) const;
 		void get_kspace_dimensions(std::vector<size_t>& dims) const;
 		uint16_t get_trajectory_dimensions(void) const;
+
+		//! Function to get the columnar index of the acquisition headers
+		/*!
+		 * The index is built on the first call and cached until the headers of
+		 * the acquisitions or their order change. Sorting, filtering and getting
+		 * dimensions use it instead of copying the acquisitions. Changes to the
+		 * headers of AcquisitionsVector made via a shared pointer obtained from
+		 * get_acquisition_sptr() are only accounted for if made before the next
+		 * call to this function.
+		 */
+		gadgetron::shared_ptr<const AcquisitionsHeaderIndex> header_index() const;
 	
 		void sort();
-		void sort_by_time();
+		virtual void sort_by_time();
 		bool sorted() const { return sorted_; }
 		void set_sorted(bool sorted) { sorted_ = sorted; }
 
@@ -699,8 +830,35 @@ namespace sirf {
 		 */
 		std::vector<KSpaceSubset::SetType > get_kspace_order() const;
 
+		//! Function to get the number of non-empty k-space subsets
+		unsigned int get_kspace_order_size() const
+		{
+			return sptr_sorting_ ? (unsigned int)sptr_sorting_->subsets.size() : 0;
+		}
+
 		//! Function to get the all KSpaceSubset's of the MRAcquisitionData
-		std::vector<KSpaceSubset> get_kspace_sorting() const { return this->sorting_; }
+		std::vector<KSpaceSubset> get_kspace_sorting() const
+		{
+			return sptr_sorting_ ? sptr_sorting_->subsets : std::vector<KSpaceSubset>();
+		}
+
+		//! Function to get the k-space sorting shared with other containers, null if not organised
+		gadgetron::shared_ptr<const KSpaceSorting> kspace_sorting() const { return sptr_sorting_; }
+
+		//! Function to look up the acquisitions of the k-space subset with a given tag
+		/*!
+		 * Returns a pointer to the indices of the acquisitions in the subset, or a null pointer
+		 * if there are none. Uses the map from tags to subsets built by organise_kspace().
+		 */
+		const KSpaceSubset::SetType* get_kspace_subset(const KSpaceSubset::TagType& tag) const
+		{
+			if (!sptr_sorting_)
+				return 0;
+			auto it = sptr_sorting_->subset_index.find(tag);
+			if (it == sptr_sorting_->subset_index.end())
+				return 0;
+			return &sptr_sorting_->subsets[it->second].idx_set();
+		}
 
 		//! Function to go through Acquisitions and assign them to their k-space dimension
 		/*!
@@ -708,6 +866,8 @@ namespace sirf {
 		 * all acquisitions in the container, extracts their subset (i.e. which slice contrast etc.) and stores
 		 * this information s.t. consisten subsets (i.e. all acquisitions belonging to the same slice) can be
 		 * extracted.
+		 * Results of algebraic operations inherit the sorting of their operands, hence this function needs
+		 * to be called again only if the encoding counters of acquisitions have been changed.
 		 */
 		void organise_kspace();
 
@@ -743,13 +903,37 @@ namespace sirf {
 
 		* filename_ismrmrd_with_ext: filename of ISMRMRD rawdata file with .h5 extension.
 		* all: overrider of the ignore mask - non-zero value forces reading all acquisitions.
+
+		* Acquisitions are read from the file in large blocks (the next block is read
+		* while the previous one is being stored) and appended to the container
+		* with append_acquisitions(). If the acquisitions dataset cannot be accessed
+		* directly, they are read one by one via ISMRMRD::Dataset.
 		*/
 		void read(const std::string& filename_ismrmrd_with_ext, int all = 0);
 
+		virtual size_t address() const
+		{
+			THROW("data address defined only for contiguous acquisition data");
+		}
+
+		/*!
+		\brief Storage scheme for acquisition data created by SIRF.
+
+		"memory": acquisitions stored as separate ISMRMRD::Acquisition objects
+		(AcquisitionsVector, default);
+		"array": samples of all acquisitions stored in one contiguous buffer
+		(AcquisitionsArray);
+		"file": samples of all acquisitions stored in a scratch file and
+		cached in memory block by block (AcquisitionsFile).
+		*/
+		static std::string storage_scheme();
+		static gadgetron::shared_ptr<MRAcquisitionData> storage_template();
+
 	protected:
 		bool sorted_ = false;
 		std::vector<int> index_;
-		std::vector<KSpaceSubset> sorting_;
+		// k-space sorting, shared by copies; replaced, never modified
+		gadgetron::shared_ptr<const KSpaceSorting> sptr_sorting_;
 		AcquisitionsInfo acqs_info_;
 
 		mutable IgnoreMask ignore_mask_; //= IgnoreMask();
@@ -757,9 +941,99 @@ namespace sirf {
 		// new MRAcquisitionData objects will be created from this template
 		// using same_acquisitions_container()
 		static gadgetron::shared_ptr<MRAcquisitionData> acqs_templ_;
+		static std::string storage_scheme_;
+
+		// liveness token and change counter for the write-back of acquisitions
+		// handed out by get_acquisition_sptr(), not shared between copies of
+		// the container
+		struct Token {
+			Token() : sptr(new std::atomic<unsigned long>(0)) {}
+			Token(const Token&) : sptr(new std::atomic<unsigned long>(0)) {}
+			Token& operator=(const Token&) { return *this; }
+			gadgetron::shared_ptr<std::atomic<unsigned long> > sptr;
+		};
+		Token token_;
+
+		// to be called by the methods that change the stored acquisitions or
+		// their numbering: cancels the write-back of acquisitions handed out
+		// before the change
+		void changed_() const
+		{
+			token_.sptr->fetch_add(1, std::memory_order_relaxed);
+		}
+		// a copy of acquisition num that is written back into the container
+		// (by set_acquisition()) when the last shared pointer to it is
+		// released, if it has been modified, its size has not changed and the
+		// container has not changed since the copy was made
+		gadgetron::shared_ptr<ISMRMRD::Acquisition>
+			write_back_copy_(unsigned int num);
+
+		// cached header index, copied along with the container; empty when
+		// it is to be rebuilt
+		struct HeaderIndexCache {
+			HeaderIndexCache() {}
+			HeaderIndexCache(const HeaderIndexCache& other) : sptr(other.get()) {}
+			HeaderIndexCache& operator=(const HeaderIndexCache& other)
+			{
+				set(other.get());
+				return *this;
+			}
+			gadgetron::shared_ptr<const AcquisitionsHeaderIndex> get() const
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				return sptr;
+			}
+			void set(gadgetron::shared_ptr<const AcquisitionsHeaderIndex> s)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				sptr = s;
+			}
+			gadgetron::shared_ptr<const AcquisitionsHeaderIndex> sptr;
+			mutable std::mutex mutex;
+		};
+		mutable HeaderIndexCache header_index_;
+
+		// to be called by the methods that change acquisition headers
+		void invalidate_header_index_()
+		{
+			header_index_.set(gadgetron::shared_ptr<const AcquisitionsHeaderIndex>());
+		}
+		// to be called before a stored acquisition header is replaced by head
+		void update_header_index_(const ISMRMRD::AcquisitionHeader& stored,
+			const ISMRMRD::AcquisitionHeader& head)
+		{
+			if (std::memcmp(&stored, &head, sizeof(head)))
+				invalidate_header_index_();
+		}
+
+		// makes ad, which holds copies of the acquisitions of this container
+		// in the same order, share the header index and k-space sorting
+		void share_layout_(MRAcquisitionData& ad) const
+		{
+			ad.header_index_ = header_index_;
+			ad.sptr_sorting_ = sptr_sorting_;
+			ad.set_sorted(sorted());
+		}
 
 		virtual MRAcquisitionData* clone_impl() const = 0;
 
+		// the numbers of n acquisitions of this container that are to receive
+		// the results of algebraic operations on the acquisitions src_num of src
+		// (an empty container is first filled with copies of the latter and
+		// takes over the k-space sorting of src if all of them are copied,
+		// a non-empty one keeps its sorting only if it is that of src)
+		std::vector<int> output_acquisitions_
+			(const MRAcquisitionData& src, const std::vector<int>& src_num, size_t& n);
+
+		// elementwise algebra with operations f passed by value, so that
+		// functors from sirf::kernels are inlined or vectorised
+		template<class F>
+		void apply_binary_(const DataContainer& a_x, const DataContainer& a_y, F f);
+		template<class F>
+		void apply_semibinary_(const DataContainer& a_x, complex_float_t y, F f);
+		template<class F>
+		void apply_unary_(const DataContainer& a_x, F f);
+
 	private:
 
 	};
@@ -785,6 +1059,11 @@ namespace sirf {
 			this->set_ignore_mask(ignore_mask);
 			acqs_info_ = info;
 		}
+		static void set_as_template()
+		{
+			storage_scheme_ = "memory";
+			acqs_templ_.reset(new AcquisitionsVector);
+		}
 		virtual void empty();
 		virtual void take_over(MRAcquisitionData& ad) {}
 		virtual unsigned int number() const { return (unsigned int)acqs_.size(); }
@@ -793,11 +1072,17 @@ namespace sirf {
 		{
 			acqs_.push_back(gadgetron::shared_ptr<ISMRMRD::Acquisition>
 				(new ISMRMRD::Acquisition(acq)));
+			invalidate_header_index_();
 		}
+		virtual void append_acquisitions(size_t n,
+			const ISMRMRD::AcquisitionHeader* heads,
+			const complex_float_t* const* data, const float* const* traj);
 		virtual gadgetron::shared_ptr<ISMRMRD::Acquisition> 
 			get_acquisition_sptr(unsigned int num)
 		{
 			int ind = index(num);
+			// the header may be changed via the returned pointer
+			invalidate_header_index_();
 			return acqs_[ind];
 		}
 		virtual int get_acquisition(unsigned int num,
@@ -813,8 +1098,35 @@ namespace sirf {
 		virtual void set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq)
 		{
 			int ind = index(num);
+			update_header_index_(acqs_[ind]->getHead(), acq.getHead());
 			*acqs_[ind] = acq;
 		}
+		virtual const ISMRMRD::AcquisitionHeader&
+			acquisition_header(unsigned int num) const
+		{
+			return acqs_[index(num)]->getHead();
+		}
+		virtual DataSpan<const complex_float_t>
+			acquisition_data(unsigned int num) const
+		{
+			const ISMRMRD::Acquisition& acq = *acqs_[index(num)];
+			return DataSpan<const complex_float_t>
+				(acq.getDataPtr(), acq.getNumberOfDataElements());
+		}
+		virtual DataSpan<complex_float_t>
+			acquisition_data(unsigned int num)
+		{
+			ISMRMRD::Acquisition& acq = *acqs_[index(num)];
+			return DataSpan<complex_float_t>
+				(acq.getDataPtr(), acq.getNumberOfDataElements());
+		}
+		virtual DataSpan<const float>
+			acquisition_traj(unsigned int num) const
+		{
+			const ISMRMRD::Acquisition& acq = *acqs_[index(num)];
+			return DataSpan<const float>
+				(acq.getTrajPtr(), acq.getNumberOfTrajElements());
+		}
 		virtual void copy_acquisitions_info(const MRAcquisitionData& ac)
 		{
 			acqs_info_ = ac.acquisitions_info();
@@ -846,6 +1158,449 @@ namespace sirf {
 		virtual void conjugate_impl();
 	};
 
+	/*!
+	\ingroup MR
+	\brief Allocator returning memory aligned to a given boundary.
+
+	Used for the samples buffer of AcquisitionsArray, so that the buffer
+	starts at a cache line (and SIMD register) boundary.
+	*/
+	template <typename T, std::size_t Alignment = 64>
+	class AlignedAllocator {
+	public:
+		typedef T value_type;
+		template <class U>
+		struct rebind {
+			typedef AlignedAllocator<U, Alignment> other;
+		};
+		AlignedAllocator() noexcept {}
+		template <class U>
+		AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+		T* allocate(std::size_t n)
+		{
+			return static_cast<T*>(::operator new
+				(n * sizeof(T), std::align_val_t(Alignment)));
+		}
+		void deallocate(T* p, std::size_t) noexcept
+		{
+			::operator delete(p, std::align_val_t(Alignment));
+		}
+	};
+	template <class T, class U, std::size_t A>
+	bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&)
+	{
+		return true;
+	}
+	template <class T, class U, std::size_t A>
+	bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&)
+	{
+		return false;
+	}
+
+	/*!
+	\ingroup MR
+	\brief A contiguous (structure-of-arrays) implementation of the abstract
+	MR acquisition data container class.
+
+	The samples of all acquisitions are stored one after another in a single
+	aligned buffer, the acquisition headers and trajectories in separate
+	arrays. The samples of acquisition i start at element data_offset_[i] of
+	the samples buffer (coil-major, same layout as ISMRMRD::Acquisition),
+	their number being given by its header; data_offset_.back() is the end
+	of the used part of the buffer, and similarly for the trajectories.
+	An acquisition whose size is changed by set_acquisition() is moved to
+	the end of the buffers and its old slot abandoned; the buffers are
+	compacted when the abandoned slots take more space than the rest.
+	Sorting rearranges the stored acquisitions, so that the buffer can be
+	viewed as a (na, nc, ns) array.
+
+	Acquisitions returned by get_acquisition_sptr() are copies that are
+	written back into the container when the last shared pointer to them
+	is released, provided that they have been modified and the container
+	has not been changed (including by the write-back of another copy) or
+	sorted since they were made. Copies whose size has changed are not
+	written back.
+	*/
+	class AcquisitionsArray : public MRAcquisitionData {
+	public:
+		typedef std::vector<complex_float_t, AlignedAllocator<complex_float_t> >
+			DataBuffer;
+
+		AcquisitionsArray(const std::string& filename_with_ext, int all = 0, IgnoreMask ignore_mask = IgnoreMask()) :
+			data_offset_(1, 0), traj_offset_(1, 0),
+			data_garbage_(0), traj_garbage_(0)
+		{
+			this->set_ignore_mask(ignore_mask);
+			this->read(filename_with_ext, all);
+		}
+
+		AcquisitionsArray(const AcquisitionsInfo& info = AcquisitionsInfo(), IgnoreMask ignore_mask = IgnoreMask()) :
+			data_offset_(1, 0), traj_offset_(1, 0),
+			data_garbage_(0), traj_garbage_(0)
+		{
+			this->set_ignore_mask(ignore_mask);
+			acqs_info_ = info;
+		}
+		static void set_as_template()
+		{
+			storage_scheme_ = "array";
+			acqs_templ_.reset(new AcquisitionsArray);
+		}
+		virtual void empty();
+		virtual void take_over(MRAcquisitionData& ad) {}
+		virtual unsigned int number() const { return (unsigned int)headers_.size(); }
+		virtual unsigned int items() const { return (unsigned int)headers_.size(); }
+		virtual void append_acquisition(ISMRMRD::Acquisition& acq);
+		virtual void append_acquisitions(size_t n,
+			const ISMRMRD::AcquisitionHeader* heads,
+			const complex_float_t* const* data, const float* const* traj);
+		virtual gadgetron::shared_ptr<ISMRMRD::Acquisition>
+			get_acquisition_sptr(unsigned int num);
+		virtual int get_acquisition(unsigned int num,
+			ISMRMRD::Acquisition& acq) const;
+		virtual void set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq)
+		{
+			store_(index(num), acq);
+		}
+		virtual const ISMRMRD::AcquisitionHeader&
+			acquisition_header(unsigned int num) const
+		{
+			return headers_[index(num)];
+		}
+		virtual DataSpan<const complex_float_t>
+			acquisition_data(unsigned int num) const;
+		virtual DataSpan<complex_float_t>
+			acquisition_data(unsigned int num);
+		virtual DataSpan<const float>
+			acquisition_traj(unsigned int num) const;
+		virtual void copy_acquisitions_info(const MRAcquisitionData& ac)
+		{
+			acqs_info_ = ac.acquisitions_info();
+		}
+		virtual void copy_acquisitions_data(const MRAcquisitionData& ac);
+		virtual void set_data(const complex_float_t* z, int all = 1);
+		virtual void sort_by_time();
+
+		virtual bool supports_array_view() const;
+		virtual size_t address() const;
+
+		virtual AcquisitionsArray* same_acquisitions_container
+			(const AcquisitionsInfo& info) const
+		{
+			return new AcquisitionsArray(info, ignore_mask_);
+		}
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			DataContainer* ptr = new AcquisitionsArray(acqs_info_, ignore_mask_);
+			return new ObjectHandle<DataContainer>
+				(gadgetron::shared_ptr<DataContainer>(ptr));
+		}
+		virtual gadgetron::unique_ptr<MRAcquisitionData>
+			new_acquisitions_container()
+		{
+			return gadgetron::unique_ptr<MRAcquisitionData>
+				(new AcquisitionsArray(acqs_info_, ignore_mask_));
+		}
+
+	private:
+		std::vector<ISMRMRD::AcquisitionHeader> headers_;
+		std::vector<size_t> data_offset_;
+		std::vector<size_t> traj_offset_;
+		DataBuffer data_;
+		std::vector<float> traj_;
+		// numbers of elements in abandoned slots
+		size_t data_garbage_;
+		size_t traj_garbage_;
+
+		// copies acq into the storage slot ind, moving the slot to the end
+		// of the buffers if its size changes
+		void store_(unsigned int ind, const ISMRMRD::Acquisition& acq);
+		// rearranges the stored acquisitions: new slot i gets old slot order[i]
+		void permute_(const std::vector<int>& order);
+
+		virtual AcquisitionsArray* clone_impl() const;
+		virtual void conjugate_impl();
+	};
+
+	/*!
+	\ingroup MR
+	\brief A file-backed implementation of the abstract MR acquisition data
+	container class for acquisition data that do not fit into memory.
+
+	Acquisition headers and trajectories are kept in memory, the samples are
+	stored in a scratch file in the current directory, which is deleted
+	together with the container. The samples of consecutive acquisitions are
+	grouped into blocks of about block_size() bytes. Blocks are read into an
+	LRU cache of about cache_size() bytes when accessed, and changed blocks
+	are written back to the file when evicted from it.
+
+	A block is not evicted while a DataSpan returned by acquisition_data()
+	refers to it, so algebraic operations and acquisition models, which
+	access the samples via acquisition_data(), stream over the data block
+	by block.
+
+	Acquisitions returned by get_acquisition_sptr() are written back as
+	described for AcquisitionsArray.
+	*/
+	class AcquisitionsFile : public MRAcquisitionData {
+	public:
+		AcquisitionsFile(const std::string& filename_with_ext, int all = 0, IgnoreMask ignore_mask = IgnoreMask());
+		AcquisitionsFile(const AcquisitionsInfo& info = AcquisitionsInfo(), IgnoreMask ignore_mask = IgnoreMask());
+		AcquisitionsFile(const AcquisitionsFile& other);
+		AcquisitionsFile& operator=(const AcquisitionsFile&) = delete;
+		~AcquisitionsFile();
+
+		static void set_as_template()
+		{
+			storage_scheme_ = "file";
+			acqs_templ_.reset(new AcquisitionsFile);
+		}
+		//! sets the size in bytes of the cache of sample blocks
+		static void set_cache_size(size_t bytes);
+		static size_t cache_size();
+		//! sets the size in bytes of sample blocks of containers created from now on
+		static void set_block_size(size_t bytes);
+		static size_t block_size();
+
+		virtual void empty();
+		virtual void take_over(MRAcquisitionData& ad) {}
+		virtual unsigned int number() const { return (unsigned int)headers_.size(); }
+		virtual unsigned int items() const { return (unsigned int)headers_.size(); }
+		virtual void append_acquisition(ISMRMRD::Acquisition& acq);
+		virtual void append_acquisitions(size_t n,
+			const ISMRMRD::AcquisitionHeader* heads,
+			const complex_float_t* const* data, const float* const* traj);
+		virtual gadgetron::shared_ptr<ISMRMRD::Acquisition>
+			get_acquisition_sptr(unsigned int num);
+		virtual int get_acquisition(unsigned int num,
+			ISMRMRD::Acquisition& acq) const;
+		virtual void set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq)
+		{
+			store_(index(num), acq);
+		}
+		virtual const ISMRMRD::AcquisitionHeader&
+			acquisition_header(unsigned int num) const
+		{
+			return headers_[index(num)];
+		}
+		virtual DataSpan<const complex_float_t>
+			acquisition_data(unsigned int num) const
+		{
+			return span_(index(num), false);
+		}
+		virtual DataSpan<complex_float_t>
+			acquisition_data(unsigned int num)
+		{
+			return span_(index(num), true);
+		}
+		virtual DataSpan<const float>
+			acquisition_traj(unsigned int num) const
+		{
+			const std::vector<float>& traj = traj_[index(num)];
+			return DataSpan<const float>(traj.data(), traj.size());
+		}
+		virtual void copy_acquisitions_info(const MRAcquisitionData& ac)
+		{
+			acqs_info_ = ac.acquisitions_info();
+		}
+		virtual void copy_acquisitions_data(const MRAcquisitionData& ac);
+		virtual void set_data(const complex_float_t* z, int all = 1);
+
+		virtual AcquisitionsFile* same_acquisitions_container
+			(const AcquisitionsInfo& info) const
+		{
+			return new AcquisitionsFile(info, ignore_mask_);
+		}
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			DataContainer* ptr = new AcquisitionsFile(acqs_info_, ignore_mask_);
+			return new ObjectHandle<DataContainer>
+				(gadgetron::shared_ptr<DataContainer>(ptr));
+		}
+		virtual gadgetron::unique_ptr<MRAcquisitionData>
+			new_acquisitions_container()
+		{
+			return gadgetron::unique_ptr<MRAcquisitionData>
+				(new AcquisitionsFile(acqs_info_, ignore_mask_));
+		}
+
+	private:
+		// samples of a block of acquisitions in memory
+		struct Block {
+			std::vector<complex_float_t> data;
+			bool dirty = false;
+		};
+		// location of a block in the scratch file
+		struct BlockInfo {
+			size_t offset; // in bytes
+			size_t size; // in samples
+		};
+		typedef std::list<int> LRUList;
+		struct CacheEntry {
+			gadgetron::shared_ptr<Block> sptr_block;
+			LRUList::iterator lru_pos;
+		};
+
+		static size_t cache_size_;
+		static size_t block_size_;
+
+		std::vector<ISMRMRD::AcquisitionHeader> headers_;
+		std::vector<std::vector<float> > traj_;
+		// block of each stored acquisition and offset of its samples in it
+		std::vector<int> acq_block_;
+		std::vector<size_t> acq_offset_;
+		std::vector<BlockInfo> blocks_;
+		size_t block_capacity_; // in samples
+		std::string filename_;
+		mutable std::fstream file_;
+		mutable std::mutex mutex_;
+		mutable std::map<int, CacheEntry> cache_;
+		mutable LRUList lru_; // most recently used first
+		mutable size_t cached_bytes_;
+
+		void open_();
+		// span of the samples of the stored acquisition ind
+		DataSpan<complex_float_t> span_(unsigned int ind, bool modify) const;
+		// block b in the cache (the caller must hold the mutex)
+		gadgetron::shared_ptr<Block> cached_block_(int b, bool modify) const;
+		// evicts least recently used blocks not in use
+		void evict_() const;
+		void read_block_(int b, Block& block) const;
+		void write_block_(int b, const Block& block) const;
+		// writes all changed blocks to the file
+		void flush_() const;
+		// appends storage for n samples, returns the block it is in
+		int allocate_(size_t n, size_t& offset);
+		// copies acq into the storage slot ind, moving the slot if needed
+		void store_(unsigned int ind, const ISMRMRD::Acquisition& acq);
+		void append_(const ISMRMRD::AcquisitionHeader& head,
+			const complex_float_t* data, const float* traj);
+
+		virtual AcquisitionsFile* clone_impl() const;
+		virtual void conjugate_impl();
+	};
+
+	/*!
+	\ingroup MR
+	\brief A view of a subset of the acquisitions of another MR acquisition
+	data container.
+
+	Acquisition i of the view is acquisition num[i] of the parent container.
+	Nothing is copied: headers and samples are accessed in the parent, and
+	changes made via the view (set_acquisition(), set_data(), algebraic
+	operations with the view as the output, acquisition models' forward
+	projections) are made to the acquisitions of the parent. A view of a
+	const container is read-only.
+
+	A view created from a reference to the parent does not keep it alive, one
+	created from a shared pointer does. The parent must not be emptied,
+	appended to or re-sorted while a view of it is in use, and acquisition
+	headers shared with a view must be changed via the view.
+
+	Acquisitions cannot be appended to a view. Copies of it (clone(),
+	materialise()) and new containers created from it are containers of the
+	same kind as the parent.
+	*/
+	class AcquisitionsView : public MRAcquisitionData {
+	public:
+		AcquisitionsView(MRAcquisitionData& parent, const std::vector<int>& num);
+		AcquisitionsView(const MRAcquisitionData& parent, const std::vector<int>& num);
+		AcquisitionsView(gadgetron::shared_ptr<MRAcquisitionData> sptr_parent,
+			const std::vector<int>& num);
+
+		//! the numbers in the parent container of the acquisitions in the view
+		const std::vector<int>& parent_numbers() const { return num_; }
+		bool read_only() const { return !parent_writable_; }
+
+		//! copies the acquisitions in the view into a new container
+		gadgetron::unique_ptr<MRAcquisitionData> materialise() const;
+
+		virtual void empty();
+		virtual void take_over(MRAcquisitionData& ad) {}
+		virtual unsigned int number() const { return (unsigned int)num_.size(); }
+		virtual unsigned int items() const { return (unsigned int)num_.size(); }
+		virtual void append_acquisition(ISMRMRD::Acquisition& acq)
+		{
+			THROW("acquisitions cannot be appended to a view of acquisition data");
+		}
+		virtual void append_acquisitions(size_t n,
+			const ISMRMRD::AcquisitionHeader* heads,
+			const complex_float_t* const* data, const float* const* traj)
+		{
+			THROW("acquisitions cannot be appended to a view of acquisition data");
+		}
+		virtual gadgetron::shared_ptr<ISMRMRD::Acquisition>
+			get_acquisition_sptr(unsigned int num);
+		virtual int get_acquisition(unsigned int num,
+			ISMRMRD::Acquisition& acq) const;
+		virtual void set_acquisition(unsigned int num, ISMRMRD::Acquisition& acq);
+		virtual const ISMRMRD::AcquisitionHeader&
+			acquisition_header(unsigned int num) const
+		{
+			return parent_->acquisition_header(parent_number_(num));
+		}
+		virtual DataSpan<const complex_float_t>
+			acquisition_data(unsigned int num) const
+		{
+			return parent_->acquisition_data(parent_number_(num));
+		}
+		virtual DataSpan<complex_float_t>
+			acquisition_data(unsigned int num)
+		{
+			return writable_parent_().acquisition_data(parent_number_(num));
+		}
+		virtual DataSpan<const float>
+			acquisition_traj(unsigned int num) const
+		{
+			return parent_->acquisition_traj(parent_number_(num));
+		}
+		virtual void copy_acquisitions_info(const MRAcquisitionData& ac)
+		{
+			acqs_info_ = ac.acquisitions_info();
+		}
+		virtual void copy_acquisitions_data(const MRAcquisitionData& ac);
+		virtual void set_data(const complex_float_t* z, int all = 1);
+
+		virtual MRAcquisitionData* same_acquisitions_container
+			(const AcquisitionsInfo& info) const
+		{
+			return parent_->same_acquisitions_container(info);
+		}
+		virtual ObjectHandle<DataContainer>* new_data_container_handle() const
+		{
+			DataContainer* ptr = parent_->same_acquisitions_container(acqs_info_);
+			return new ObjectHandle<DataContainer>
+				(gadgetron::shared_ptr<DataContainer>(ptr));
+		}
+		virtual gadgetron::unique_ptr<MRAcquisitionData>
+			new_acquisitions_container()
+		{
+			return gadgetron::unique_ptr<MRAcquisitionData>
+				(parent_->same_acquisitions_container(acqs_info_));
+		}
+
+	private:
+		gadgetron::shared_ptr<MRAcquisitionData> sptr_parent_;
+		const MRAcquisitionData* parent_;
+		MRAcquisitionData* parent_writable_; // null for read-only views
+		std::vector<int> num_;
+
+		void init_(const std::vector<int>& num);
+		int parent_number_(unsigned int num) const
+		{
+			return num_[index(num)];
+		}
+		MRAcquisitionData& writable_parent_() const
+		{
+			if (!parent_writable_)
+				THROW("acquisitions of a read-only view cannot be changed");
+			return *parent_writable_;
+		}
+
+		virtual MRAcquisitionData* clone_impl() const;
+		virtual void conjugate_impl();
+	};
+
 	/*!
 	\ingroup MR
 	\brief Abstract Gadgetron image data container class.
@@ -1083,6 +1838,15 @@ namespace sirf {
 		virtual ISMRMRDImageData* clone_impl() const = 0;
 		virtual void conjugate_impl();
 
+		// elementwise algebra with operations f passed by value, so that
+		// functors from sirf::kernels are inlined or vectorised
+		template<class F>
+		void apply_binary_(const DataContainer& a_x, const DataContainer& a_y, F f);
+		template<class F>
+		void apply_semibinary_(const DataContainer& a_x, complex_float_t y, F f);
+		template<class F>
+		void apply_unary_(const DataContainer& a_x, F f);
+
 	private:
 		class ComplexFloat_ {
 		public:
@@ -1330,6 +2094,7 @@ namespace sirf {
 		virtual void empty()
 		{
 			images_.clear();
+			sptr_data_.reset();
 		}
 		virtual unsigned int items() const
 		{ 
@@ -1363,6 +2128,7 @@ namespace sirf {
         {
             std::vector<gadgetron::shared_ptr<ImageWrap> > empty_data;
             images_.swap(empty_data);
+            sptr_data_.reset();
         }
 		virtual void sort();
 		virtual gadgetron::shared_ptr<ImageWrap> sptr_image_wrap
@@ -1445,6 +2211,25 @@ namespace sirf {
 		virtual void set_data(const complex_float_t* data);
 		virtual void get_real_data(float* data) const;
 		virtual void set_real_data(const float* data);
+		using GadgetronImageData::fill;
+		/// Copies the data of im, image by image if im is a GadgetronImagesVector
+		virtual void fill(const ImageData& im);
+		virtual bool operator==(const ImageData& id) const;
+
+		/*!
+		\brief Moves the data of all images into one contiguous block of memory.
+
+		Possible if all images have the same data type and dimensions, returns
+		false otherwise. The data are stored in the storage order of images
+		(that of the iterators and get_data()), and the images must not be
+		resized afterwards. Images appended or replaced later are not stored
+		in the block.
+		*/
+		bool make_contiguous();
+		/// Float and complex float images stored contiguously can be viewed as an array
+		virtual bool supports_array_view() const;
+		/// Address of the contiguously stored data
+		virtual size_t address() const;
 
         /// Clone and return as unique pointer.
         std::unique_ptr<GadgetronImagesVector> clone() const
@@ -1472,6 +2257,8 @@ namespace sirf {
         }
 
         std::vector<gadgetron::shared_ptr<ImageWrap> > images_;
+        // contiguous storage of images data (see make_contiguous())
+        gadgetron::shared_ptr<std::vector<char, AlignedAllocator<char> > > sptr_data_;
         mutable gadgetron::shared_ptr<Iterator> begin_;
         mutable gadgetron::shared_ptr<Iterator> end_;
         mutable gadgetron::shared_ptr<Iterator_const> begin_const_;
@@ -1528,6 +2315,11 @@ namespace sirf {
         {
             csm_conv_kernel_halfsize_ = w;
         }
+        //! sets the smoothing kernel half-size in z (0: slice-by-slice smoothing)
+        void set_csm_conv_kernel_size_z(int w)
+        {
+            csm_conv_kernel_halfsize_z_ = w;
+        }
 
         void calculate(CoilImagesVector& iv);
         void calculate(const MRAcquisitionData& acq)
@@ -1539,6 +2331,12 @@ namespace sirf {
 
         CFImage get_csm_as_cfimage(size_t const i) const;
         CFImage get_csm_as_cfimage(const KSpaceSubset::TagType tag, const int offset) const;
+        //! Returns the coil maps for the given k-space subset tag without copying them
+        /*!
+        * The coil maps are looked up in an index by (slice, contrast) built when they are
+        * calculated or when the number of coil maps changes.
+        */
+        const CFImage& get_csm_cfimage_ref(const KSpaceSubset::TagType& tag, const int offset) const;
 
 
         void get_dim(size_t const num_csm, int* dim) const
@@ -1556,12 +2354,21 @@ namespace sirf {
 
         void calculate_csm(ISMRMRD::NDArray<complex_float_t>& cm, ISMRMRD::NDArray<float>& img, ISMRMRD::NDArray<complex_float_t>& csm);
 
+        // replaces each value of the nc volumes u with the average of itself
+        // and the mean of its neighbours in the (2w+1) x (2w+1) x (2wz+1) box
+        // clipped to the volume (v is workspace of the same size as u)
+        static void smoothen_(int nx, int ny, int nz, int nc, complex_float_t* u, complex_float_t* v, 
+        //int* obj_mask, 
+        int w, int wz = 0);
+
     private:
         int csm_smoothness_ = 0;
         int csm_conv_kernel_halfsize_ = 1;
-        void smoothen_(int nx, int ny, int nz, int nc, complex_float_t* u, complex_float_t* v, 
-        //int* obj_mask, 
-        int w);
+        int csm_conv_kernel_halfsize_z_ = 0;
+        // coilmap numbers by (slice, contrast), in ascending order
+        mutable std::map<std::pair<int, int>, std::vector<int> > csm_index_;
+        mutable int csm_index_size_ = -1;
+        void index_csms_() const;
         void mask_noise_(int nx, int ny, int nz, float* u, float noise, int* mask);
         float max_diff_(int nx, int ny, int nz, int nc, float small_grad, complex_float_t* u, complex_float_t* v);
         float max_(int nx, int ny, int nz, float* u);
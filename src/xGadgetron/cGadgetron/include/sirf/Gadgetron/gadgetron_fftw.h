@@ -0,0 +1,102 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2024 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup MR
+\brief Specification file for the FFTW-based Fourier transforms.
+
+\author Evgueni Ovtchinnikov
+\author SyneRBI
+*/
+
+#ifndef GADGETRON_FFTW_H
+#define GADGETRON_FFTW_H
+
+#include <string>
+#include <vector>
+
+#include <ismrmrd/ismrmrd.h>
+
+namespace ISMRMRD {
+	// centred 3D FFTs of all volumes stored in a (dimensions x, y, z, ...)
+	void fft3c(NDArray<complex_float_t>& a);
+	void ifft3c(NDArray<complex_float_t>& a);
+}
+
+namespace sirf {
+
+	/*!
+	\ingroup MR
+	\brief In-place unnormalised 1D FFTs of howmany arrays of length n.
+
+	Elements of each array are stride apart, the arrays are dist apart.
+	Uses a cached FFTW plan; safe to call concurrently from several threads.
+	*/
+	void fft1(complex_float_t* data, int n, int stride, int howmany, int dist,
+		bool forward);
+
+	/*!
+	\ingroup MR
+	\brief Factors turning an unnormalised FFT of size n into a centred one.
+
+	The centred transform of x (zero frequency and origin in the middle)
+	equals post[k] * FFT(pre[m] * x[m])[k] (without normalisation).
+	*/
+	void centred_fft_factors(int n, bool forward,
+		std::vector<complex_float_t>& pre, std::vector<complex_float_t>& post);
+
+	/*!
+	\ingroup MR
+	\brief Settings of the process-wide cache of FFTW plans.
+
+	FFTW plans used by fft3c and ifft3c are created once for each combination
+	of transform dimensions, batch size, direction, data alignment and number
+	of threads, and are then reused by all subsequent transforms.
+
+	A more rigorous planner ("measure", "patient" or "exhaustive" instead of
+	the default "estimate") produces faster plans at the cost of a longer
+	planning time, which pays off in iterative reconstructions. The wisdom
+	accumulated by the planner can be saved to a file and imported in later
+	runs. If the environment variable SIRF_FFTW_WISDOM is set, wisdom is
+	imported from the file it names before the first plan is created.
+
+	The thread budget of FFTs is spent on transforming several volumes
+	(e.g. coil images) concurrently when there are enough of them, and
+	otherwise, for large volumes, on multithreaded FFTW plans (provided
+	SIRF was built with the FFTW threads library).
+	*/
+	class FFTWPlanner {
+	public:
+		static void set_rigour(const std::string& rigour);
+		static std::string rigour();
+		static void import_wisdom(const std::string& filename);
+		static void export_wisdom(const std::string& filename);
+		//! sets the number of threads used by FFTs (0: all OpenMP threads)
+		static void set_num_threads(int num_threads);
+		static int num_threads();
+		static size_t number_of_plans();
+		//! destroys all cached plans (not to be called while FFTs are running)
+		static void clear();
+	};
+
+}
+
+#endif
@@ -31,6 +31,9 @@ limitations under the License.
 #ifndef GADGETRON_IMAGE_WRAP_TYPE
 #define GADGETRON_IMAGE_WRAP_TYPE
 
+#include <cstdlib>
+#include <cstring>
+
 #include <ismrmrd/ismrmrd.h>
 #include <ismrmrd/dataset.h>
 #include <ismrmrd/meta.h>
@@ -39,6 +42,7 @@ limitations under the License.
 #include "sirf/common/ANumRef.h"
 #include "sirf/common/iequals.h"
 #include "sirf/Gadgetron/cgadgetron_shared_ptr.h"
+#include "sirf/Gadgetron/gadgetron_kernels.h"
 #include "sirf/Gadgetron/xgadgetron_utilities.h"
 
 #define IMAGE_PROCESSING_SWITCH(Type, Operation, Arguments, ...)\
@@ -98,6 +102,20 @@ typedef ISMRMRD::Image<complex_double_t> CDImage;
 
 namespace sirf {
 
+	/**
+	\brief Access to the data pointer of ISMRMRD::Image.
+
+	The pointer is a protected member of ISMRMRD::Image, hence the derived class.
+	*/
+	template<typename T>
+	class ImageDataPointer : public ISMRMRD::Image<T> {
+	public:
+		static void*& get(ISMRMRD::Image<T>& im)
+		{
+			return (im.*(&ImageDataPointer::im)).data;
+		}
+	};
+
 	/**
 	\brief Wrapper for ISMRMRD::Image.
 
@@ -266,6 +284,9 @@ namespace sirf {
 		~ImageWrap() noexcept
 		{
                 	try {
+				if (sptr_mem_) {
+					IMAGE_PROCESSING_SWITCH(type_, release_data_storage_, ptr_);
+				}
 				IMAGE_PROCESSING_SWITCH(type_, delete, ptr_);
                         }
                         catch(...)
@@ -336,6 +357,23 @@ namespace sirf {
 		{
 			IMAGE_PROCESSING_SWITCH_CONST(type_, return num_data_elm_, ptr_);
 		}
+		const void* data_address() const
+		{
+			IMAGE_PROCESSING_SWITCH_CONST(type_, return data_address_, ptr_);
+		}
+		/*!
+		\brief Moves the image data to the memory at data, which sptr_mem keeps
+		alive.
+
+		Used for storing the data of several images contiguously. The image
+		must not be resized afterwards, as ISMRMRD would then reallocate
+		memory it does not own.
+		*/
+		void set_data_storage(gadgetron::shared_ptr<void> sptr_mem, void* data)
+		{
+			IMAGE_PROCESSING_SWITCH(type_, set_data_storage_, ptr_, data);
+			sptr_mem_ = sptr_mem;
+		}
 		ISMRMRD::ImageHeader& head()
 		{
 			IMAGE_PROCESSING_SWITCH(type_, return get_head_ref_, ptr_);
@@ -371,56 +409,47 @@ namespace sirf {
 			n *= dim[3];
 			return n;
 		}
+		// the data access and copying methods below are dispatched once per
+		// image to loops over the typed image data and convert values in the
+		// same way as NumRef (complex values stored in real images and read
+		// as real values are replaced by their moduli)
 		void get_data(float* data) const
 		{
-			//std::cout << "in get_data\n";
-			//std::cout << "trying new image wrap iterator...\n";
-			ImageWrap::Iterator_const i = begin_const();
-			ImageWrap::Iterator_const stop = end_const();
-			for (; i != stop; ++data, ++i) {
-				*data = *i;
-			}
-			//IMAGE_PROCESSING_SWITCH_CONST(type_, get_data_, ptr_, data);
+			IMAGE_PROCESSING_SWITCH_CONST(type_, get_data_, ptr_, data);
 		}
 		void set_data(const float* data)
 		{
-			//std::cout << "in set_data\n";
-			for (ImageWrap::Iterator i = begin(); i != end(); ++i, ++data)
-				*i = *data;
-			//IMAGE_PROCESSING_SWITCH(type_, set_data_, ptr_, data);
+			IMAGE_PROCESSING_SWITCH(type_, set_data_, ptr_, data);
 		}
 		void fill(float s)
 		{
-			for (ImageWrap::Iterator i = begin(); i != end(); ++i)
-				*i = s;
+			IMAGE_PROCESSING_SWITCH(type_, fill_, ptr_, s);
 		}
 		void scale(float s)
 		{
-			for (ImageWrap::Iterator i = begin(); i != end(); ++i)
-				*i /= s;
+			IMAGE_PROCESSING_SWITCH(type_, scale_, ptr_, s);
 		}
 		void get_complex_data(complex_float_t* data) const
 		{
-			//std::cout << "in get_complex_data\n";
-			//std::cout << "trying new const image wrap iterator...\n";
-			ImageWrap::Iterator_const i = begin_const();
-			ImageWrap::Iterator_const stop = end_const();
-			for (; i != stop; ++data, ++i) {
-				*data = (*i).complex_float();
-			}
-			//IMAGE_PROCESSING_SWITCH_CONST(type_, get_complex_data_, ptr_, data);
+			IMAGE_PROCESSING_SWITCH_CONST(type_, get_complex_data_, ptr_, data);
 		}
-
 		void set_complex_data(const complex_float_t* data)
 		{
-			//std::cout << "in set_complex_data\n";
-			//std::cout << "trying new image wrap iterator...\n";
-			ImageWrap::Iterator i = begin();
-			ImageWrap::Iterator stop = end();
-			for (; i != stop; ++i, ++data) {
-				*i = *data;
-			}
-			//IMAGE_PROCESSING_SWITCH(type_, set_complex_data_, ptr_, data);
+			IMAGE_PROCESSING_SWITCH(type_, set_complex_data_, ptr_, data);
+		}
+		//! copies the data of iw, which must have the same number of elements
+		void copy_data(const ImageWrap& iw)
+		{
+			IMAGE_PROCESSING_SWITCH(type_, copy_data_, ptr_, iw);
+		}
+		/*!
+		\brief Computes the squared norms of this image, of iw and of their
+		difference, which are used for comparing images.
+		*/
+		void compare(const ImageWrap& iw, float* sx, float* sy, float* sd) const
+		{
+			*sx = *sy = *sd = 0;
+			IMAGE_PROCESSING_SWITCH_CONST(type_, compare_, ptr_, iw, sx, sy, sd);
 		}
 
 		gadgetron::shared_ptr<ImageWrap> abs() const
@@ -443,17 +472,13 @@ namespace sirf {
 
 			im.setAttributeString(attributes());
 
-			ImageWrap::Iterator_const i = begin_const();
-			ImageWrap::Iterator_const stop = end_const();
 			float* data = im.getDataPtr();
-			if (sirf::iequals(way, "abs"))
-				for (; i != stop; ++data, ++i) {
-					*data = std::abs((*i).complex_float());
-				}
-			else if (sirf::iequals(way, "real"))
-				for (; i != stop; ++data, ++i) {
-					*data = std::real((*i).complex_float());
-				}
+			if (sirf::iequals(way, "abs")) {
+				IMAGE_PROCESSING_SWITCH_CONST(type_, get_real_, ptr_, data, true);
+			}
+			else if (sirf::iequals(way, "real")) {
+				IMAGE_PROCESSING_SWITCH_CONST(type_, get_real_, ptr_, data, false);
+			}
 			else
 				THROW("unknown conversion to real specified in ImageWrap::real");
 
@@ -521,15 +546,19 @@ namespace sirf {
 			IMAGE_PROCESSING_SWITCH(type_, xapyb_, x.ptr_image(), a.ptr_image(),
 				y.ptr_image(), b.ptr_image(), 1, 1);
 		}
-		void binary_op(const ImageWrap& x, const ImageWrap& y, complex_float_t(*f)(complex_float_t, complex_float_t))
+		// f is a functor from sirf::kernels or a function pointer
+		template<class F>
+		void binary_op(const ImageWrap& x, const ImageWrap& y, F f)
 		{
 			IMAGE_PROCESSING_SWITCH(type_, binary_op_, x.ptr_image(), y.ptr_image(), f);
 		}
-		void semibinary_op(const ImageWrap& x, complex_float_t y, complex_float_t(*f)(complex_float_t, complex_float_t))
+		template<class F>
+		void semibinary_op(const ImageWrap& x, complex_float_t y, F f)
 		{
 			IMAGE_PROCESSING_SWITCH(type_, semibinary_op_, x.ptr_image(), y, f);
 		}
-		void unary_op(const ImageWrap& x, complex_float_t(*f)(complex_float_t))
+		template<class F>
+		void unary_op(const ImageWrap& x, F f)
 		{
 			IMAGE_PROCESSING_SWITCH(type_, unary_op_, x.ptr_image(), f);
 		}
@@ -581,6 +610,8 @@ namespace sirf {
 		mutable gadgetron::shared_ptr<Iterator> end_;
 		mutable gadgetron::shared_ptr<Iterator_const> begin_const_;
 		mutable gadgetron::shared_ptr<Iterator_const> end_const_;
+		// memory storing the image data if not owned by the image
+		gadgetron::shared_ptr<void> sptr_mem_;
 
 		ImageWrap& operator=(const ImageWrap& iw)
 		{
@@ -615,6 +646,30 @@ namespace sirf {
 			return ptr->getNumberOfDataElements();
 		}
 
+		template<typename T>
+		const void* data_address_(const ISMRMRD::Image<T>* ptr) const
+		{
+			return ptr->getDataPtr();
+		}
+
+		template<typename T>
+		void set_data_storage_(ISMRMRD::Image<T>* ptr_im, void* data)
+		{
+			void*& ptr = ImageDataPointer<T>::get(*ptr_im);
+			if (ptr == data)
+				return;
+			std::memcpy(data, ptr, ptr_im->getDataSize());
+			if (!sptr_mem_)
+				free(ptr);
+			ptr = data;
+		}
+
+		template<typename T>
+		void release_data_storage_(ISMRMRD::Image<T>* ptr_im)
+		{
+			ImageDataPointer<T>::get(*ptr_im) = 0;
+		}
+
 		template<typename T>
 		void copy_(const ISMRMRD::Image<T>* ptr_im)
 		{
@@ -730,51 +785,155 @@ namespace sirf {
 			*data_type_ptr = im.getDataType();
 		}
 
+		// conversions of image values consistent with NumRef
+		template<typename T>
+		static complex_float_t to_complex_(T v)
+		{
+			return complex_float_t((float)v);
+		}
+		template<typename T>
+		static complex_float_t to_complex_(std::complex<T> v)
+		{
+			return complex_float_t(v);
+		}
+		template<typename T>
+		static float to_real_(T v)
+		{
+			return (float)v;
+		}
+		template<typename T>
+		static float to_real_(std::complex<T> v)
+		{
+			return (float)std::abs(v);
+		}
+		template<typename S, typename T>
+		static void convert_(S v, T& t)
+		{
+			t = (T)to_real_(v);
+		}
+		template<typename S, typename T>
+		static void convert_(S v, std::complex<T>& t)
+		{
+			t = std::complex<T>(to_complex_(v));
+		}
+
 		template<typename T>
 		void get_data_(const ISMRMRD::Image<T>* ptr_im, float* data) const
 		{
-			const ISMRMRD::Image<T>& im = *ptr_im;
-			const T* ptr = im.getDataPtr();
-			size_t n = im.getNumberOfDataElements();
+			const T* ptr = ptr_im->getDataPtr();
+			size_t n = ptr_im->getNumberOfDataElements();
 			for (size_t i = 0; i < n; i++)
-				data[i] = std::real(ptr[i]);
+				data[i] = to_real_(ptr[i]);
 		}
 
 		template<typename T>
 		void set_data_(ISMRMRD::Image<T>* ptr_im, const float* data)
 		{
-			ISMRMRD::Image<T>& im = *ptr_im;
-			T* ptr = im.getDataPtr();
-			size_t n = im.getNumberOfDataElements();
+			T* ptr = ptr_im->getDataPtr();
+			size_t n = ptr_im->getNumberOfDataElements();
 			for (size_t i = 0; i < n; i++)
 				ptr[i] = (T)data[i];
 		}
 
+		template<typename T>
+		void fill_(ISMRMRD::Image<T>* ptr_im, float s)
+		{
+			T* ptr = ptr_im->getDataPtr();
+			std::fill(ptr, ptr + ptr_im->getNumberOfDataElements(), (T)s);
+		}
+
+		template<typename T>
+		void scale_(ISMRMRD::Image<T>* ptr_im, float s)
+		{
+			T* ptr = ptr_im->getDataPtr();
+			size_t n = ptr_im->getNumberOfDataElements();
+			for (size_t i = 0; i < n; i++)
+				ptr[i] /= s;
+		}
+
+		template<typename T>
+		void get_real_(const ISMRMRD::Image<T>* ptr_im, float* data, bool abs) const
+		{
+			const T* ptr = ptr_im->getDataPtr();
+			size_t n = ptr_im->getNumberOfDataElements();
+			if (abs)
+				for (size_t i = 0; i < n; i++)
+					data[i] = std::abs(to_complex_(ptr[i]));
+			else
+				for (size_t i = 0; i < n; i++)
+					data[i] = std::real(to_complex_(ptr[i]));
+		}
+
 		template<typename T>
 		void get_complex_data_
 			(const ISMRMRD::Image<T>* ptr_im, complex_float_t* data) const
 		{
-			const ISMRMRD::Image<T>& im = *ptr_im;
-			const T* ptr = im.getDataPtr();
-			size_t n = im.getNumberOfDataElements();
+			const T* ptr = ptr_im->getDataPtr();
+			size_t n = ptr_im->getNumberOfDataElements();
 			for (size_t i = 0; i < n; i++)
-				data[i] = complex_float_t(ptr[i]);
+				data[i] = to_complex_(ptr[i]);
 		}
 
 		template<typename T>
 		void set_complex_data_
 			(ISMRMRD::Image<T>* ptr_im, const complex_float_t* data)
 		{
-			ISMRMRD::Image<T>& im = *ptr_im;
-			ISMRMRD::ISMRMRD_DataTypes type = im.getDataType();
-			T* ptr = im.getDataPtr();
-			size_t n = im.getNumberOfDataElements();
-			if (type == ISMRMRD::ISMRMRD_CXFLOAT || type == ISMRMRD::ISMRMRD_CXDOUBLE)
-				for (size_t i = 0; i < n; i++)
-					xGadgetronUtilities::convert_complex(data[i], ptr[i]);
-			else
-				for (size_t i = 0; i < n; i++)
-					xGadgetronUtilities::convert_complex(data[i], ptr[i]);
+			T* ptr = ptr_im->getDataPtr();
+			size_t n = ptr_im->getNumberOfDataElements();
+			for (size_t i = 0; i < n; i++)
+				convert_(data[i], ptr[i]);
+		}
+
+		template<typename T>
+		void copy_data_(ISMRMRD::Image<T>* ptr_im, const ImageWrap& iw)
+		{
+			size_t n = ptr_im->getNumberOfDataElements();
+			if (iw.num_data_elm() != n)
+				THROW("sizes mismatch in ImageWrap::copy_data");
+			T* ptr = ptr_im->getDataPtr();
+			if (iw.type() == type_) {
+				const ISMRMRD::Image<T>* ptr_src =
+					static_cast<const ISMRMRD::Image<T>*>(iw.ptr_image());
+				std::copy(ptr_src->getDataPtr(), ptr_src->getDataPtr() + n, ptr);
+			}
+			else {
+				IMAGE_PROCESSING_SWITCH_CONST(iw.type(), convert_data_,
+					iw.ptr_image(), ptr);
+			}
+		}
+
+		template<typename S, typename T>
+		static void convert_data_(const ISMRMRD::Image<S>* ptr_src, T* ptr)
+		{
+			const S* src = ptr_src->getDataPtr();
+			size_t n = ptr_src->getNumberOfDataElements();
+			for (size_t i = 0; i < n; i++)
+				convert_(src[i], ptr[i]);
+		}
+
+		template<typename T>
+		void compare_(const ISMRMRD::Image<T>* ptr_im, const ImageWrap& iw,
+			float* sx, float* sy, float* sd) const
+		{
+			if (iw.num_data_elm() != ptr_im->getNumberOfDataElements())
+				THROW("sizes mismatch in ImageWrap::compare");
+			IMAGE_PROCESSING_SWITCH_CONST(iw.type(), compare_data_,
+				iw.ptr_image(), ptr_im->getDataPtr(), sx, sy, sd);
+		}
+
+		template<typename S, typename T>
+		static void compare_data_(const ISMRMRD::Image<S>* ptr_y, const T* x,
+			float* sx, float* sy, float* sd)
+		{
+			const S* y = ptr_y->getDataPtr();
+			size_t n = ptr_y->getNumberOfDataElements();
+			for (size_t i = 0; i < n; i++) {
+				complex_float_t zx = to_complex_(x[i]);
+				complex_float_t zy = to_complex_(y[i]);
+				*sx += std::norm(zx);
+				*sy += std::norm(zy);
+				*sd += std::norm(zx - zy);
+			}
 		}
 
 		template<typename T>
@@ -855,19 +1014,41 @@ namespace sirf {
 				ib = ptr_b->getDataPtr();
 				jb = 1;
 			}
-			for (size_t ii = 0; ii < n; ix++, ia += ja, iy++, ib += jb, i++, ii++) {
-				complex_float_t vx = (complex_float_t)*ix;
-				complex_float_t va = (complex_float_t)*ia;
-				complex_float_t vy = (complex_float_t)*iy;
-				complex_float_t vb = (complex_float_t)*ib;
+			xapyb_(n, ix, ia, ja, iy, ib, jb, i);
+		}
+
+		// z = a*x + b*y, a and b being arrays if ja, jb are 1 or scalars
+		// if they are 0
+		template<typename T>
+		static void xapyb_(size_t n, const T* x, const T* a, size_t ja,
+			const T* y, const T* b, size_t jb, T* z)
+		{
+			for (size_t i = 0; i < n; x++, a += ja, y++, b += jb, z++, i++) {
+				complex_float_t vx = (complex_float_t)*x;
+				complex_float_t va = (complex_float_t)*a;
+				complex_float_t vy = (complex_float_t)*y;
+				complex_float_t vb = (complex_float_t)*b;
 				complex_float_t v = vx * va + vy * vb;
-				xGadgetronUtilities::convert_complex(v, *i);
+				xGadgetronUtilities::convert_complex(v, *z);
 			}
 		}
+		static void xapyb_(size_t n, const complex_float_t* x,
+			const complex_float_t* a, size_t ja,
+			const complex_float_t* y, const complex_float_t* b, size_t jb,
+			complex_float_t* z)
+		{
+			if (ja && jb)
+				sirf::kernels::xapyb(n, x, a, y, b, z);
+			else if (jb)
+				sirf::kernels::xapyb(n, x, *a, y, b, z);
+			else if (ja)
+				sirf::kernels::xapyb(n, y, *b, x, a, z);
+			else
+				sirf::kernels::axpby(n, *a, x, *b, y, z);
+		}
 
-		template<typename T>
-		void binary_op_(const ISMRMRD::Image<T>* ptr_x, const void* vptr_y,
-			complex_float_t(*f)(complex_float_t, complex_float_t))
+		template<typename T, class F>
+		void binary_op_(const ISMRMRD::Image<T>* ptr_x, const void* vptr_y, F f)
 		{
 			ISMRMRD::Image<T>* ptr = (ISMRMRD::Image<T>*)ptr_;
 			ISMRMRD::Image<T>* ptr_y = (ISMRMRD::Image<T>*)vptr_y;
@@ -876,82 +1057,126 @@ namespace sirf {
 			size_t n = ptr->getNumberOfDataElements();
 			if (!(n == nx && n == ny))
 				THROW("sizes mismatch in ImageWrap binary_op_");
-			const T* i = ptr_x->getDataPtr();
-			const T* j = ptr_y->getDataPtr();
-			T* k = ptr->getDataPtr();
-			size_t ii = 0;
-			for (; ii < n; i++, j++, k++, ii++) {
-				complex_float_t u = (complex_float_t)*i;
-				complex_float_t v = (complex_float_t)*j;
-				xGadgetronUtilities::convert_complex(f(u, v), *k);
-			}
+			binary_(n, ptr_x->getDataPtr(), ptr_y->getDataPtr(),
+				ptr->getDataPtr(), f);
 		}
 
-		template<typename T>
-		void semibinary_op_(const ISMRMRD::Image<T>* ptr_x, complex_float_t y,
-			complex_float_t(*f)(complex_float_t, complex_float_t))
+		template<typename T, class F>
+		void semibinary_op_(const ISMRMRD::Image<T>* ptr_x, complex_float_t y, F f)
 		{
 			ISMRMRD::Image<T>* ptr = (ISMRMRD::Image<T>*)ptr_;
 			size_t nx = ptr_x->getNumberOfDataElements();
 			size_t n = ptr->getNumberOfDataElements();
 			if (n != nx)
 				THROW("sizes mismatch in ImageWrap semibinary_op_");
-			const T* i = ptr_x->getDataPtr();
-			T* k = ptr->getDataPtr();
-			size_t ii = 0;
-			for (; ii < n; i++, k++, ii++) {
-				complex_float_t x = (complex_float_t)*i;
-				xGadgetronUtilities::convert_complex(f(x, y), *k);
-			}
+			semibinary_(n, ptr_x->getDataPtr(), y, ptr->getDataPtr(), f);
 		}
 
-		template<typename T>
-		void unary_op_(const ISMRMRD::Image<T>* ptr_x,
-			complex_float_t(*f)(complex_float_t))
+		template<typename T, class F>
+		void unary_op_(const ISMRMRD::Image<T>* ptr_x, F f)
 		{
 			ISMRMRD::Image<T>* ptr = (ISMRMRD::Image<T>*)ptr_;
 			size_t nx = ptr_x->getNumberOfDataElements();
 			size_t n = ptr->getNumberOfDataElements();
 			if (n != nx)
 				THROW("sizes mismatch in ImageWrap semibinary_op_");
-			const T* i = ptr_x->getDataPtr();
-			T* k = ptr->getDataPtr();
-			size_t ii = 0;
-			for (; ii < n; i++, k++, ii++) {
-				complex_float_t x = (complex_float_t)*i;
-				xGadgetronUtilities::convert_complex(f(x), *k);
+			unary_(n, ptr_x->getDataPtr(), ptr->getDataPtr(), f);
+		}
+
+		// elementwise loops of the above: generic ones convert image values
+		// to complex_float_t and back, complex float images are processed
+		// by sirf::kernels directly
+		template<typename T, class F>
+		static void binary_(size_t n, const T* x, const T* y, T* z, F f)
+		{
+			for (size_t i = 0; i < n; i++) {
+				complex_float_t u = (complex_float_t)x[i];
+				complex_float_t v = (complex_float_t)y[i];
+				xGadgetronUtilities::convert_complex(f(u, v), z[i]);
+			}
+		}
+		template<class F>
+		static void binary_(size_t n, const complex_float_t* x,
+			const complex_float_t* y, complex_float_t* z, F f)
+		{
+			sirf::kernels::binary(n, x, y, z, f);
+		}
+		template<typename T, class F>
+		static void semibinary_(size_t n, const T* x, complex_float_t y, T* z, F f)
+		{
+			for (size_t i = 0; i < n; i++) {
+				complex_float_t u = (complex_float_t)x[i];
+				xGadgetronUtilities::convert_complex(f(u, y), z[i]);
 			}
 		}
+		template<class F>
+		static void semibinary_(size_t n, const complex_float_t* x,
+			complex_float_t y, complex_float_t* z, F f)
+		{
+			sirf::kernels::semibinary(n, x, y, z, f);
+		}
+		template<typename T, class F>
+		static void unary_(size_t n, const T* x, T* z, F f)
+		{
+			for (size_t i = 0; i < n; i++) {
+				complex_float_t u = (complex_float_t)x[i];
+				xGadgetronUtilities::convert_complex(f(u), z[i]);
+			}
+		}
+		template<class F>
+		static void unary_(size_t n, const complex_float_t* x,
+			complex_float_t* z, F f)
+		{
+			sirf::kernels::unary(n, x, z, f);
+		}
 
 		template<typename T>
 		void dot_(const ISMRMRD::Image<T>* ptr_im, complex_float_t *z) const
 		{
 			const ISMRMRD::Image<T>* ptr = (const ISMRMRD::Image<T>*)ptr_;
-			const T* i;
-			const T* j;
-			*z = 0;
-			size_t ii = 0;
 			size_t n = ptr_im->getNumberOfDataElements();
-			for (i = ptr->getDataPtr(), j = ptr_im->getDataPtr(); ii < n;
-				i++, j++, ii++) {
-				complex_float_t u = (complex_float_t)*i;
-				complex_float_t v = (complex_float_t)*j;
-				*z += std::conj(v) * u;
+			*z = cdot_(n, ptr->getDataPtr(), ptr_im->getDataPtr());
+		}
+
+		// the sum of conj(y[i])*x[i]
+		template<typename T>
+		static complex_float_t cdot_(size_t n, const T* x, const T* y)
+		{
+			complex_float_t z = 0;
+			for (size_t i = 0; i < n; i++) {
+				complex_float_t u = (complex_float_t)x[i];
+				complex_float_t v = (complex_float_t)y[i];
+				z += std::conj(v) * u;
 			}
+			return z;
+		}
+		static complex_float_t cdot_(size_t n, const complex_float_t* x,
+			const complex_float_t* y)
+		{
+			return sirf::kernels::cdot(n, x, y);
 		}
 
 		template<typename T>
 		void norm_(const ISMRMRD::Image<T>* ptr, float *r) const
 		{
-			const T* i;
-			*r = 0;
-			size_t ii = 0;
 			size_t n = ptr->getNumberOfDataElements();
-			for (i = ptr->getDataPtr(); ii < n; i++, ii++) {
-				complex_float_t a = (complex_float_t)*i;
-				*r += std::abs(std::conj(a) * a);
+			*r = std::sqrt(norm2_(n, ptr->getDataPtr()));
+		}
+
+		// the sum of |x[i]|^2
+		template<typename T>
+		static float norm2_(size_t n, const T* x)
+		{
+			float r = 0;
+			for (size_t i = 0; i < n; i++) {
+				complex_float_t a = (complex_float_t)x[i];
+				r += std::abs(std::conj(a) * a);
 			}
-			*r = std::sqrt(*r);
+			return r;
+		}
+		static float norm2_(size_t n, const complex_float_t* x)
+		{
+			return sirf::kernels::norm2(n, x);
 		}
 
 		template<typename T>
@@ -0,0 +1,193 @@
+/*
+SyneRBI Synergistic Image Reconstruction Framework (SIRF)
+Copyright 2024 Rutherford Appleton Laboratory STFC
+
+This is software developed for the Collaborative Computational
+Project in Synergistic Reconstruction for Biomedical Imaging (formerly CCP PETMR)
+(http://www.ccpsynerbi.ac.uk/).
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+/*!
+\file
+\ingroup MR
+\brief Specification file for the complex float kernels of MR algebra.
+
+\author Evgueni Ovtchinnikov
+\author SyneRBI
+*/
+
+#ifndef GADGETRON_KERNELS_H
+#define GADGETRON_KERNELS_H
+
+#include <cmath>
+#include <complex>
+#include <string>
+
+#include <ismrmrd/ismrmrd.h>
+
+namespace sirf {
+
+	/*!
+	\ingroup MR
+	\brief Vectorised kernels operating on arrays of complex floats.
+
+	On x86 processors the kernels use AVX-512 or AVX2 instructions if the
+	processor supports them (checked at run time), and plain C++ loops
+	otherwise. The output array z may coincide with any of the input arrays.
+
+	Division and absolute values are computed from the squared moduli of
+	the operands, hence may differ from std::complex ones in the last bits
+	and overflow for moduli beyond 1e19.
+	*/
+	namespace kernels {
+
+		//! z = a*x + b*y (y is not accessed if b is zero)
+		void axpby(size_t n, complex_float_t a, const complex_float_t* x,
+			complex_float_t b, const complex_float_t* y, complex_float_t* z);
+		//! z = a*x + b*y elementwise
+		void xapyb(size_t n, const complex_float_t* x, const complex_float_t* a,
+			const complex_float_t* y, const complex_float_t* b, complex_float_t* z);
+		//! z = a*x + b*y elementwise, a scalar
+		void xapyb(size_t n, const complex_float_t* x, complex_float_t a,
+			const complex_float_t* y, const complex_float_t* b, complex_float_t* z);
+		//! the sum of conj(y[i])*x[i]
+		complex_float_t cdot(size_t n, const complex_float_t* x,
+			const complex_float_t* y);
+		//! the sum of |x[i]|^2
+		float norm2(size_t n, const complex_float_t* x);
+		//! z = x*y elementwise
+		void multiply(size_t n, const complex_float_t* x,
+			const complex_float_t* y, complex_float_t* z);
+		//! z = x/y elementwise
+		void divide(size_t n, const complex_float_t* x,
+			const complex_float_t* y, complex_float_t* z);
+		//! z = |x| elementwise
+		void abs(size_t n, const complex_float_t* x, complex_float_t* z);
+		//! z = sign of the real part of x elementwise
+		void sign(size_t n, const complex_float_t* x, complex_float_t* z);
+
+		//! the instruction set used: "avx512", "avx2" or "scalar"
+		std::string isa();
+		/*!
+		\brief Selects the instruction set ("auto" selects the best supported).
+
+		Throws if the processor does not support it. Not to be called while
+		kernels are running.
+		*/
+		void set_isa(const std::string& isa);
+
+		// elementwise operations, to be passed by value to the templates below,
+		// which inline them
+
+		struct Product {
+			complex_float_t operator()(complex_float_t x, complex_float_t y) const
+			{ return x * y; }
+		};
+		struct Ratio {
+			complex_float_t operator()(complex_float_t x, complex_float_t y) const
+			{ return x / y; }
+		};
+		struct Sum {
+			complex_float_t operator()(complex_float_t x, complex_float_t y) const
+			{ return x + y; }
+		};
+		struct MaxReal {
+			complex_float_t operator()(complex_float_t x, complex_float_t y) const
+			{ return std::real(x) > std::real(y) ? x : y; }
+		};
+		struct MinReal {
+			complex_float_t operator()(complex_float_t x, complex_float_t y) const
+			{ return std::real(x) < std::real(y) ? x : y; }
+		};
+		struct Power {
+			complex_float_t operator()(complex_float_t x, complex_float_t y) const
+			{ return std::pow(x, y); }
+		};
+		struct Exp {
+			complex_float_t operator()(complex_float_t x) const
+			{ return std::exp(x); }
+		};
+		struct Log {
+			complex_float_t operator()(complex_float_t x) const
+			{ return std::log(x); }
+		};
+		struct Sqrt {
+			complex_float_t operator()(complex_float_t x) const
+			{ return std::sqrt(x); }
+		};
+		struct Sign {
+			complex_float_t operator()(complex_float_t x) const
+			{ return complex_float_t((float)((std::real(x) > 0) - (std::real(x) < 0))); }
+		};
+		struct Abs {
+			complex_float_t operator()(complex_float_t x) const
+			{ return complex_float_t(std::abs(x)); }
+		};
+
+		//! z = f(x, y) elementwise
+		template<class F>
+		void binary(size_t n, const complex_float_t* x, const complex_float_t* y,
+			complex_float_t* z, F f)
+		{
+			for (size_t i = 0; i < n; i++)
+				z[i] = f(x[i], y[i]);
+		}
+		inline void binary(size_t n, const complex_float_t* x,
+			const complex_float_t* y, complex_float_t* z, Product)
+		{
+			multiply(n, x, y, z);
+		}
+		inline void binary(size_t n, const complex_float_t* x,
+			const complex_float_t* y, complex_float_t* z, Ratio)
+		{
+			divide(n, x, y, z);
+		}
+
+		//! z = f(x, y) elementwise, y scalar
+		template<class F>
+		void semibinary(size_t n, const complex_float_t* x, complex_float_t y,
+			complex_float_t* z, F f)
+		{
+			for (size_t i = 0; i < n; i++)
+				z[i] = f(x[i], y);
+		}
+		inline void semibinary(size_t n, const complex_float_t* x,
+			complex_float_t y, complex_float_t* z, Product)
+		{
+			axpby(n, y, x, complex_float_t(0), x, z);
+		}
+
+		//! z = f(x) elementwise
+		template<class F>
+		void unary(size_t n, const complex_float_t* x, complex_float_t* z, F f)
+		{
+			for (size_t i = 0; i < n; i++)
+				z[i] = f(x[i]);
+		}
+		inline void unary(size_t n, const complex_float_t* x,
+			complex_float_t* z, Abs)
+		{
+			abs(n, x, z);
+		}
+		inline void unary(size_t n, const complex_float_t* x,
+			complex_float_t* z, Sign)
+		{
+			sign(n, x, z);
+		}
+
+	}
+
+}
+
+#endif
@@ -370,7 +370,7 @@ namespace sirf {
 		\brief Class for the product of backward and forward projectors of the MR acquisition model.
 
 		For a given GadgetronImageData object x, computes A' A x (see the above comments on the
-		MR acquisition model operator A).
+		MR acquisition model operator A) by the normal operator method below.
 		*/
 		class BFOperator : public Operator<GadgetronImageData> {
 		public:
@@ -378,11 +378,7 @@ namespace sirf {
 			virtual gadgetron::shared_ptr<GadgetronImageData>
 				apply(const GadgetronImageData& image_data)
 			{
-				gadgetron::shared_ptr<MRAcquisitionData> sptr_fwd =
-					sptr_am_->fwd(image_data);
-				gadgetron::shared_ptr<GadgetronImageData> sptr_bwd =
-					sptr_am_->bwd(*sptr_fwd);
-				return sptr_bwd;
+				return sptr_am_->normal(image_data);
 			}
 		private:
 			gadgetron::shared_ptr<MRAcquisitionModel> sptr_am_;
@@ -423,6 +419,8 @@ namespace sirf {
 		{
 			gadgetron::shared_ptr<MRAcquisitionModel> sptr_am
 				(new MRAcquisitionModel(sptr_acqs_, sptr_imgs_, sptr_csms_, acqs_info_));
+			if (pruned_cartesian_)
+				sptr_am->set_cartesian_encoding("pruned");
 
 			BFOperator bf(sptr_am);
 			JacobiCG<complex_float_t> jcg;
@@ -471,6 +469,16 @@ namespace sirf {
             sptr_enc_ = sptr_enc;
         }
 
+		/*!
+		\ingroup MR
+		\brief Selects the Fourier encoding used for Cartesian data.
+
+		"dense" (default) transforms the full k-space matrix, "pruned" restricts
+		the transforms to the acquired k-space lines, which is faster for
+		undersampled data.
+		*/
+		void set_cartesian_encoding(const std::string& encoding);
+
 		// Records templates
 		void set_up(gadgetron::shared_ptr<MRAcquisitionData> sptr_ac, 
 			gadgetron::shared_ptr<GadgetronImageData> sptr_ic);
@@ -505,6 +513,35 @@ namespace sirf {
             return gadgetron::shared_ptr<MRAcquisitionData>(std::move(uptr_acqs));
 		}
 
+		/*!
+		\ingroup MR
+		\brief Applies the normal operator A' A to the whole ImageContainer.
+
+		Uses coil sensitivity maps in the third argument. Encoders may apply
+		A' A without simulating the acquisitions, e.g. the radial phase encoding
+		one uses the Toeplitz embedding of its NUFFTs, which replaces gridding
+		with zero-padded FFTs. The output images are in the order of ic.
+		*/
+		void normal(GadgetronImageData& ic_out, const GadgetronImageData& ic,
+			const CoilSensitivitiesVector& cc);
+
+		// Applies A' A to the whole ImageContainer using
+		// coil sensitivity maps referred to by sptr_csms_.
+		gadgetron::shared_ptr<GadgetronImageData> normal(const GadgetronImageData& ic)
+		{
+			if (!sptr_acqs_.get())
+				throw LocalisedException
+				("Acquisition data template not set", __FILE__, __LINE__);
+			if (!sptr_csms_.get() || sptr_csms_->items() < 1)
+				throw LocalisedException
+				("Coil sensitivity maps not found", __FILE__, __LINE__);
+			check_data_role(ic);
+			gadgetron::shared_ptr<GadgetronImageData> sptr_imgs =
+				ic.new_images_container();
+			normal(*sptr_imgs, ic, *sptr_csms_);
+			return sptr_imgs;
+		}
+
 		// Backprojects the whole AcquisitionContainer using
 		// coil sensitivity maps referred to by sptr_csms_.
         gadgetron::shared_ptr<GadgetronImageData> bwd(const MRAcquisitionData& ac)
@@ -522,11 +559,21 @@ namespace sirf {
 		}
 
 	private:
+		// the images ic[i], their coil maps and the subsets of ac they are encoded into
+		void get_sense_subsets_(const GadgetronImageData& ic, const CoilSensitivitiesVector& cc,
+			const MRAcquisitionData& ac, std::vector<const CFImage*>& images,
+			std::vector<const CFImage*>& csms,
+			std::vector<const KSpaceSubset::SetType*>& subsets) const;
+		// the acquisition template sorted into k-space subsets: the template
+		// itself if sorted, otherwise a sorted view of it
+		gadgetron::shared_ptr<const MRAcquisitionData> sorted_acquisitions_() const;
+
 		std::string acqs_info_;
 		gadgetron::shared_ptr<MRAcquisitionData> sptr_acqs_;
 		gadgetron::shared_ptr<GadgetronImageData> sptr_imgs_;
         gadgetron::shared_ptr<CoilSensitivitiesVector> sptr_csms_;
         gadgetron::shared_ptr<FourierEncoding> sptr_enc_;
+		bool pruned_cartesian_ = false;
 	};
 
 }
@@ -29,6 +29,7 @@ limitations under the License.
 \author SyneRBI
 */
 
+#include <algorithm>
 #include <iostream>
 #include <cstdlib>
 #include <numeric>
@@ -42,6 +43,8 @@ limitations under the License.
 
 #include "sirf/Gadgetron/chain_lib.h"
 #include "sirf/Gadgetron/gadgetron_data_containers.h"
+#include "sirf/Gadgetron/gadgetron_fftw.h"
+#include "sirf/Gadgetron/gadgetron_kernels.h"
 #include "sirf/Gadgetron/gadgetron_x.h"
 #include "sirf/Gadgetron/FourierEncoding.h"
 #include "sirf/Gadgetron/TrajectoryPreparation.h"
@@ -72,6 +75,48 @@ bool test_get_kspace_order(const MRAcquisitionData& av)
     }
 }
 
+bool test_kspace_sorting_after_algebra(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        complex_float_t one(1, 0);
+        std::vector<KSpaceSubset::SetType> order = av.get_kspace_order();
+
+        // an empty output takes over the sorting of the operand
+        shared_ptr<MRAcquisitionData> sptr_sum
+            (av.same_acquisitions_container(av.acquisitions_info()));
+        sptr_sum->axpby(&one, av, &one, av);
+        bool test_successful = sptr_sum->sorted();
+        test_successful *= (sptr_sum->get_kspace_order_size() == av.get_kspace_order_size());
+        if (sptr_sum->number() == av.number())
+            test_successful *= (sptr_sum->kspace_sorting() == av.kspace_sorting());
+
+        // a copy of the operand shares its sorting and keeps it
+        shared_ptr<MRAcquisitionData> sptr_copy = av.clone();
+        sptr_copy->axpby(&one, av, &one, av);
+        test_successful *= (sptr_copy->kspace_sorting() == av.kspace_sorting());
+
+        // an output with a sorting of its own is sorted again
+        sptr_copy->organise_kspace();
+        shared_ptr<const KSpaceSorting> sptr_own = sptr_copy->kspace_sorting();
+        sptr_copy->axpby(&one, av, &one, av);
+        test_successful *= sptr_copy->sorted();
+        test_successful *= (sptr_copy->kspace_sorting() != sptr_own);
+        test_successful *= (sptr_copy->get_kspace_order() == order);
+
+        return test_successful;
+
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 bool test_get_subset(const MRAcquisitionData& av)
 {
     try
@@ -96,6 +141,383 @@ bool test_get_subset(const MRAcquisitionData& av)
     }
 }
 
+bool test_AcquisitionsView(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        std::vector<int> subset_idx;
+        for(int i=0; i<av.number(); i+=3)
+            subset_idx.push_back(i);
+
+        // a view agrees with the copy made by get_subset
+        sirf::AcquisitionsVector subset;
+        av.get_subset(subset, subset_idx);
+        sirf::AcquisitionsView view(av, subset_idx);
+
+        bool test_successful = view.read_only();
+        test_successful *= (view.number() == subset.number());
+        test_successful *= (std::abs(view.norm() - subset.norm()) <= 1e-5 * subset.norm());
+        auto uptr_copy = view.materialise();
+        test_successful *= (uptr_copy->number() == view.number());
+        test_successful *= (std::abs(uptr_copy->norm() - view.norm()) <= 1e-5 * view.norm());
+
+        // changes made via a view are made to its parent
+        std::shared_ptr<MRAcquisitionData> sptr_ad = av.clone();
+        sirf::AcquisitionsView wview(*sptr_ad, subset_idx);
+        complex_float_t two(2, 0), zero(0, 0);
+        wview.axpby(&two, wview, &zero, wview);
+        std::vector<int> rest;
+        for(int i=0; i<av.number(); ++i)
+            if (i % 3)
+                rest.push_back(i);
+        sirf::AcquisitionsView rview(*sptr_ad, rest);
+        float n_view = wview.norm();
+        float n_rest = rview.norm();
+        test_successful *= (std::abs(n_view - 2*view.norm()) <= 1e-4 * n_view);
+        test_successful *= (std::abs(n_view*n_view + n_rest*n_rest - std::pow(sptr_ad->norm(), 2))
+            <= 1e-4 * std::pow(sptr_ad->norm(), 2));
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_header_index(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        bool test_successful = true;
+
+        // the index agrees with the acquisition headers and is cached
+        auto sptr_index = av.header_index();
+        test_successful *= (sptr_index->size() == av.number());
+        for(int i=0; i<av.number(); ++i)
+        {
+            const ISMRMRD::AcquisitionHeader& head = av.acquisition_header(i);
+            test_successful *= (sptr_index->time_stamp[i] == head.acquisition_time_stamp);
+            test_successful *= (sptr_index->flags[i] == head.flags);
+            test_successful *= (sptr_index->idx[i].kspace_encode_step_1 == head.idx.kspace_encode_step_1);
+        }
+        test_successful *= (sptr_index == av.header_index());
+
+        // changing a header invalidates it, sorting keeps it up to date
+        shared_ptr<MRAcquisitionData> sptr_ad = av.clone();
+        ISMRMRD::Acquisition acq;
+        sptr_ad->get_acquisition(0, acq);
+        acq.acquisition_time_stamp() = sptr_index->time_stamp[av.number() - 1] + 1;
+        acq.setFlag(ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION);
+        sptr_ad->set_acquisition(0, acq);
+        sptr_ad->sort_by_time();
+        sptr_index = sptr_ad->header_index();
+        int last = sptr_ad->number() - 1;
+        test_successful *= (sptr_index->time_stamp[last] == acq.acquisition_time_stamp());
+        test_successful *= (sptr_ad->acquisition_header(last).acquisition_time_stamp == acq.acquisition_time_stamp());
+        std::vector<int> flagged = sptr_ad->get_flagged_acquisitions_index
+            ({ISMRMRD::ISMRMRD_ACQ_IS_PARALLEL_CALIBRATION});
+        test_successful *= (flagged.size() >= 1 && flagged.back() == last);
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_algebra_kernels(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        bool test_successful = true;
+
+        // the results of vectorised kernels agree with the scalar ones
+        const std::string isa = kernels::isa();
+        kernels::set_isa("scalar");
+        float norm_ref = av.norm();
+        shared_ptr<MRAcquisitionData> sptr_ref
+            (av.same_acquisitions_container(av.acquisitions_info()));
+        sptr_ref->multiply(av, av);
+        complex_float_t dot_ref = sptr_ref->dot(av);
+
+        for (const char* vector_isa : {"avx2", "avx512"})
+        {
+            try
+            {
+                kernels::set_isa(vector_isa);
+            }
+            catch (...)
+            {
+                continue; // not supported by this processor
+            }
+            test_successful *= (std::abs(av.norm() - norm_ref) <= 1e-4 * norm_ref);
+            shared_ptr<MRAcquisitionData> sptr_ad
+                (av.same_acquisitions_container(av.acquisitions_info()));
+            sptr_ad->multiply(av, av);
+            complex_float_t dot = sptr_ad->dot(av);
+            test_successful *= (std::abs(dot - dot_ref) <= 1e-4 * std::abs(dot_ref));
+            // |x| has the same norm as x
+            sptr_ad->abs(av);
+            test_successful *= (std::abs(sptr_ad->norm() - norm_ref) <= 1e-4 * norm_ref);
+        }
+        kernels::set_isa(isa);
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_AcquisitionsArray(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        sirf::AcquisitionsArray aa(av.acquisitions_info(), av.ignore_mask());
+        ISMRMRD::Acquisition acq;
+        for(int i=0; i<av.number(); ++i)
+        {
+            av.get_acquisition(i, acq);
+            aa.append_acquisition(acq);
+        }
+        aa.sort();
+
+        bool test_successful = true;
+        test_successful *= (aa.number() == av.number());
+        test_successful *= (std::abs(aa.norm() - av.norm()) <= 1e-5 * av.norm());
+        test_successful *= aa.supports_array_view();
+
+        // the array view must agree with the copy returned by get_data
+        int dim[3];
+        aa.get_acquisitions_dimensions((size_t)dim);
+        std::vector<complex_float_t> data((size_t)dim[0] * dim[1] * dim[2]);
+        aa.get_data(&data[0], -1);
+        const complex_float_t* ptr = reinterpret_cast<const complex_float_t*>(aa.address());
+        test_successful *= std::equal(data.begin(), data.end(), ptr);
+
+        // changes made through get_acquisition_sptr are written back
+        {
+            auto sptr_acq = aa.get_acquisition_sptr(0);
+            sptr_acq->data(0, 0) = complex_float_t(7, 7);
+            sptr_acq->idx().kspace_encode_step_1 += 1;
+        }
+        aa.get_acquisition(0, acq);
+        test_successful *= (acq.data(0, 0) == complex_float_t(7, 7));
+        av.get_acquisition(0, acq);
+        unsigned short step_1 = acq.idx().kspace_encode_step_1;
+        aa.get_acquisition(0, acq);
+        test_successful *= (acq.idx().kspace_encode_step_1 == step_1 + 1);
+
+        // an acquisition resized by set_acquisition leaves the others intact
+        int const last = aa.number() - 1;
+        ISMRMRD::Acquisition acq_last;
+        aa.get_acquisition(last, acq_last);
+        aa.get_acquisition(0, acq);
+        acq.resize(acq.number_of_samples() / 2, acq.active_channels(), acq.trajectory_dimensions());
+        acq.data(0, 0) = complex_float_t(3, 3);
+        aa.set_acquisition(0, acq);
+        ISMRMRD::Acquisition acq_read;
+        aa.get_acquisition(0, acq_read);
+        test_successful *= (acq_read.getNumberOfDataElements() == acq.getNumberOfDataElements());
+        test_successful *= (acq_read.data(0, 0) == complex_float_t(3, 3));
+        test_successful *= (aa.acquisition_data(0).size() == acq.getNumberOfDataElements());
+        aa.get_acquisition(last, acq_read);
+        test_successful *= std::equal(acq_last.getDataPtr(),
+            acq_last.getDataPtr() + acq_last.getNumberOfDataElements(), acq_read.getDataPtr());
+        test_successful *= !aa.supports_array_view();
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_AcquisitionsFile(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        // small blocks and cache to make the container go to the file
+        size_t const cache_size = sirf::AcquisitionsFile::cache_size();
+        size_t const block_size = sirf::AcquisitionsFile::block_size();
+        sirf::AcquisitionsFile::set_cache_size(1024 * 1024);
+        sirf::AcquisitionsFile::set_block_size(64 * 1024);
+
+        sirf::AcquisitionsFile af(av.acquisitions_info(), av.ignore_mask());
+        ISMRMRD::Acquisition acq;
+        for(int i=0; i<av.number(); ++i)
+        {
+            av.get_acquisition(i, acq);
+            af.append_acquisition(acq);
+        }
+        af.sort();
+
+        bool test_successful = true;
+        test_successful *= (af.number() == av.number());
+        test_successful *= (std::abs(af.norm() - av.norm()) <= 1e-5 * av.norm());
+
+        // algebra streaming over the file
+        complex_float_t a(2.0, 1.0), b(-1.0, 0.5);
+        sirf::AcquisitionsFile rf(av.acquisitions_info(), av.ignore_mask());
+        rf.axpby(&a, af, &b, af);
+        shared_ptr<MRAcquisitionData> sptr_rv = av.clone();
+        sptr_rv->axpby(&a, av, &b, av);
+        shared_ptr<MRAcquisitionData> sptr_diff = sptr_rv->clone();
+        complex_float_t one(1.0), minus_one(-1.0);
+        sptr_diff->axpby(&one, *sptr_rv, &minus_one, rf);
+        test_successful *= (sptr_diff->norm() <= 1e-5 * sptr_rv->norm());
+
+        // changes made through get_acquisition_sptr are written back
+        {
+            auto sptr_acq = af.get_acquisition_sptr(0);
+            sptr_acq->data(0, 0) = complex_float_t(7, 7);
+        }
+        af.get_acquisition(0, acq);
+        test_successful *= (acq.data(0, 0) == complex_float_t(7, 7));
+
+        sirf::AcquisitionsFile::set_cache_size(cache_size);
+        sirf::AcquisitionsFile::set_block_size(block_size);
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_acquisition_write_back(const MRAcquisitionData& av, shared_ptr<MRAcquisitionData> sptr_ad)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        MRAcquisitionData& ad = *sptr_ad;
+        ISMRMRD::Acquisition acq;
+        for(int i=0; i<av.number(); ++i)
+        {
+            av.get_acquisition(i, acq);
+            ad.append_acquisition(acq);
+        }
+        ad.sort();
+
+        bool test_successful = true;
+        complex_float_t const marker(7, 7);
+
+        // a copy is not written back if the container has changed since
+        // it was made
+        ad.get_acquisition(0, acq);
+        complex_float_t const value = acq.data(0, 0);
+        complex_float_t two(2.0), zero(0.0);
+        {
+            auto sptr_acq = ad.get_acquisition_sptr(0);
+            sptr_acq->data(0, 0) = marker;
+            ad.axpby(&two, ad, &zero, ad);
+        }
+        ad.get_acquisition(0, acq);
+        test_successful *= (acq.data(0, 0) == two * value);
+
+        // nor if the container has been sorted
+        float const norm = ad.norm();
+        {
+            auto sptr_acq = ad.get_acquisition_sptr(0);
+            sptr_acq->data(0, 0) = marker;
+            ad.sort_by_time();
+        }
+        for(int i=0; i<ad.number(); ++i)
+        {
+            ad.get_acquisition(i, acq);
+            test_successful *= (acq.data(0, 0) != marker);
+        }
+        test_successful *= (ad.norm() == norm);
+
+        // nor if its size has changed
+        unsigned short const ns = ad.acquisition_header(0).number_of_samples;
+        {
+            auto sptr_acq = ad.get_acquisition_sptr(0);
+            sptr_acq->resize(ns / 2, sptr_acq->active_channels());
+        }
+        ad.get_acquisition(0, acq);
+        test_successful *= (acq.number_of_samples() == ns);
+
+        // otherwise modified copies are written back
+        {
+            auto sptr_acq = ad.get_acquisition_sptr(0);
+            sptr_acq->data(0, 0) = marker;
+        }
+        ad.get_acquisition(0, acq);
+        test_successful *= (acq.data(0, 0) == marker);
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_write_read_acquisitions(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        std::string const fname = std::string(__FUNCTION__) + ".h5";
+        av.write(fname);
+
+        sirf::AcquisitionsArray aa(fname, 1);
+        aa.sort();
+
+        bool test_successful = true;
+        test_successful *= (aa.number() == av.number());
+        test_successful *= (std::abs(aa.norm() - av.norm()) <= 1e-5 * av.norm());
+
+        ISMRMRD::Acquisition acq_v, acq_a;
+        for(int i=0; i<av.number(); ++i)
+        {
+            av.get_acquisition(i, acq_v);
+            aa.get_acquisition(i, acq_a);
+            test_successful *= (acq_v.acquisition_time_stamp() == acq_a.acquisition_time_stamp());
+            test_successful *= std::equal(acq_v.data_begin(), acq_v.data_end(), acq_a.data_begin());
+        }
+        std::remove(fname.c_str());
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 bool test_set_encoding_limits(AcquisitionsVector ad)
 {
     try{
@@ -239,6 +661,96 @@ bool test_ISMRMRDImageData_from_MRAcquisitionData(MRAcquisitionData& av)
     }
 }
 
+bool test_ISMRMRDImageData_data_access(MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        GadgetronImagesVector iv(av);
+        bool test_successful = true;
+
+        size_t n = 0;
+        for (unsigned int i = 0; i < iv.number(); i++)
+            n += iv.image_wrap(i).num_data_elm();
+        std::vector<complex_float_t> data(n);
+        for (size_t i = 0; i < n; i++)
+            data[i] = complex_float_t(i % 7, -float(i % 3));
+        iv.set_data(data.data());
+
+        // the typed data access agrees with the iterators
+        std::vector<complex_float_t> data_out(n);
+        iv.get_data(data_out.data());
+        const GadgetronImagesVector& civ = iv;
+        GadgetronImagesVector::Iterator_const& stop = civ.end();
+        GadgetronImagesVector::Iterator_const& iter = civ.begin();
+        for (size_t i = 0; iter != stop; ++iter, i++)
+            test_successful *= (data_out[i] == data[i]
+                && (*iter).complex_float() == data[i]);
+
+        // image-by-image copying and comparison
+        GadgetronImagesVector iv_copy(iv);
+        iv_copy.fill(0.0f);
+        test_successful *= !(iv_copy == iv);
+        ImageData& id_copy = iv_copy;
+        id_copy.fill(iv);
+        test_successful *= (iv_copy == iv);
+        test_successful *= iv_copy.ImageData::operator==(iv);
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_GadgetronImagesVector_contiguous(MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        GadgetronImagesVector iv(av);
+        bool test_successful = true;
+
+        size_t n = 0;
+        for (unsigned int i = 0; i < iv.number(); i++)
+            n += iv.image_wrap(i).num_data_elm();
+        std::vector<complex_float_t> data(n);
+        for (size_t i = 0; i < n; i++)
+            data[i] = complex_float_t(i % 5, float(i % 11));
+        iv.set_data(data.data());
+
+        test_successful *= iv.make_contiguous();
+        test_successful *= iv.supports_array_view();
+
+        // the array view shows the data of images in the storage order
+        complex_float_t* ptr = reinterpret_cast<complex_float_t*>(iv.address());
+        for (size_t i = 0; i < n; i++)
+            test_successful *= (ptr[i] == data[i]);
+
+        // and the images see the changes made via the view
+        ptr[0] = complex_float_t(-1);
+        iv.get_data(data.data());
+        test_successful *= (data[0] == complex_float_t(-1));
+
+        // copies own their data
+        GadgetronImagesVector iv_copy(iv);
+        test_successful *= !iv_copy.supports_array_view();
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 bool test_ISMRMRDImageData_reorienting(MRAcquisitionData& av)
 {
     try
@@ -358,6 +870,71 @@ bool test_CoilSensitivitiesVector_get_csm_as_cfimage(MRAcquisitionData& av)
     }
 }
 
+// exposes the coil maps smoothing for testing
+class CoilSensitivitiesSmoothing : public CoilSensitivitiesVector {
+public:
+    using CoilSensitivitiesVector::smoothen_;
+};
+
+bool test_CoilSensitivitiesVector_smoothen( void )
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        int const nx = 7, ny = 6, nz = 4, nc = 2;
+        size_t const vol = (size_t)nx*ny*nz;
+        std::mt19937 gen(0);
+        std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+        std::vector<complex_float_t> u(vol*nc);
+        for(size_t i=0; i<u.size(); ++i)
+            u[i] = complex_float_t(uniform(gen), uniform(gen));
+
+        bool test_successful = true;
+
+        // slice-by-slice smoothing, and boxes clipped at all edges in z
+        int const halfsizes[3][2] = {{1, 0}, {1, 1}, {2, 3}};
+        for(int k=0; k<3; ++k)
+        {
+            int const w = halfsizes[k][0];
+            int const wz = halfsizes[k][1];
+            std::vector<complex_float_t> v(u), ws(u.size());
+            CoilSensitivitiesSmoothing::smoothen_(nx, ny, nz, nc, &v[0], &ws[0], w, wz);
+
+            // direct average over the box clipped to the volume
+            float diff = 0, norm = 0;
+            for(int c=0; c<nc; ++c)
+            for(int z=0; z<nz; ++z)
+            for(int y=0; y<ny; ++y)
+            for(int x=0; x<nx; ++x)
+            {
+                complex_double_t sum = 0;
+                int n = 0;
+                for(int jz=std::max(0, z - wz); jz<=std::min(nz - 1, z + wz); ++jz)
+                for(int jy=std::max(0, y - w); jy<=std::min(ny - 1, y + w); ++jy)
+                for(int jx=std::max(0, x - w); jx<=std::min(nx - 1, x + w); ++jx, ++n)
+                    sum += complex_double_t(u[c*vol + (jz*ny + jy)*nx + jx]);
+                size_t const i = c*vol + (z*ny + y)*nx + x;
+                complex_double_t const ui(u[i]);
+                complex_double_t const expected = (ui + (sum - ui) / double(n - 1)) * 0.5;
+                diff += std::norm(complex_double_t(v[i]) - expected);
+                norm += std::norm(expected);
+            }
+            std::cout << "relative difference from the direct box average (w = " << w
+                << ", wz = " << wz << "): " << std::sqrt(diff / norm) << std::endl;
+            test_successful *= (diff <= 1e-10f * norm);
+        }
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 bool test_acq_mod_adjointness(MRAcquisitionData& ad)
 {
     try
@@ -424,6 +1001,47 @@ bool test_acq_mod_adjointness(MRAcquisitionData& ad)
     }
 }
 
+bool test_acq_mod_normal(MRAcquisitionData& ad)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        sirf::MRAcquisitionModel AM = sirf::get_prepared_MRAcquisitionModel(ad);
+
+        auto sptr_img = AM.bwd(ad);
+        auto sptr_normal = AM.normal(*sptr_img);
+        auto sptr_bf = AM.bwd(*AM.fwd(*sptr_img));
+
+        size_t n = 0;
+        for (int i = 0; i < sptr_img->number(); i++)
+            n += sptr_img->image_wrap(i).num_data_elm();
+        bool test_successful = (sptr_normal->number() == sptr_img->number() && sptr_bf->number() == sptr_img->number());
+        if (!test_successful)
+            return false;
+
+        std::vector<complex_float_t> normal_data(n), bf_data(n);
+        sptr_normal->get_data(&normal_data[0]);
+        sptr_bf->get_data(&bf_data[0]);
+
+        float diff = 0, norm = 0;
+        for (size_t i = 0; i < n; i++) {
+            diff += std::norm(normal_data[i] - bf_data[i]);
+            norm += std::norm(bf_data[i]);
+        }
+        std::cout << "relative difference between normal and bwd(fwd): " << std::sqrt(diff / norm) << std::endl;
+        test_successful *= (diff <= 1e-4f * norm);
+
+        return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 bool test_acq_mod_norm(shared_ptr<MRAcquisitionData> sptr_ad)
 {
 
@@ -501,6 +1119,114 @@ bool test_bwd(MRAcquisitionData& av)
     }
 }
 
+bool test_pruned_cartesian_encoding(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        // undersample the phase encoding by 2
+        shared_ptr<MRAcquisitionData> sptr_us(new AcquisitionsVector(av.acquisitions_info()));
+        ISMRMRD::Acquisition acq;
+        for(int i=0; i<av.number(); ++i)
+        {
+            av.get_acquisition(i, acq);
+            if(acq.idx().kspace_encode_step_1 % 2 == 0)
+                sptr_us->append_acquisition(acq);
+        }
+        sptr_us->sort();
+
+        sirf::MRAcquisitionModel AM = sirf::get_prepared_MRAcquisitionModel(*sptr_us);
+        auto sptr_bwd_dense = AM.bwd(*sptr_us);
+        auto sptr_fwd_dense = AM.fwd(*sptr_bwd_dense);
+
+        AM.set_cartesian_encoding("pruned");
+        auto sptr_bwd_pruned = AM.bwd(*sptr_us);
+        auto sptr_fwd_pruned = AM.fwd(*sptr_bwd_dense);
+
+        complex_float_t one(1.0), minus_one(-1.0);
+        float const tolerance = 1e-5;
+
+        shared_ptr<GadgetronImageData> sptr_img_diff = sptr_bwd_dense->clone();
+        sptr_img_diff->axpby(&one, *sptr_bwd_dense, &minus_one, *sptr_bwd_pruned);
+        float const img_err = sptr_img_diff->norm() / sptr_bwd_dense->norm();
+
+        shared_ptr<MRAcquisitionData> sptr_acq_diff = sptr_fwd_dense->clone();
+        sptr_acq_diff->axpby(&one, *sptr_fwd_dense, &minus_one, *sptr_fwd_pruned);
+        float const acq_err = sptr_acq_diff->norm() / sptr_fwd_dense->norm();
+
+        std::cout << "relative difference between dense and pruned encoding: "
+            << img_err << " (backward), " << acq_err << " (forward)" << std::endl;
+
+        return img_err < tolerance && acq_err < tolerance;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+
+bool test_cartesian_sense_batch(const MRAcquisitionData& av)
+{
+    try
+    {
+        std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+        // two repetitions make a dynamic acquisition, the Cartesian encoder
+        // transforms both images in one batch
+        shared_ptr<AcquisitionsVector> sptr_dyn(new AcquisitionsVector(av.acquisitions_info()));
+        sptr_dyn->set_encoding_limits("repetition", std::make_tuple((unsigned short)0, (unsigned short)1, (unsigned short)0));
+        ISMRMRD::Acquisition acq;
+        for(int r=0; r<2; ++r)
+            for(int i=0; i<av.number(); ++i)
+            {
+                av.get_acquisition(i, acq);
+                acq.idx().repetition = r;
+                complex_float_t* data = acq.getDataPtr();
+                for(size_t k=0; k<acq.getNumberOfDataElements(); ++k)
+                    data[k] *= float(1 + r);
+                sptr_dyn->append_acquisition(acq);
+            }
+        sptr_dyn->sort();
+
+        // the pruned encoder transforms the images one by one
+        sirf::MRAcquisitionModel AM = sirf::get_prepared_MRAcquisitionModel(*sptr_dyn);
+        auto sptr_bwd_batch = AM.bwd(*sptr_dyn);
+        auto sptr_fwd_batch = AM.fwd(*sptr_bwd_batch);
+
+        AM.set_cartesian_encoding("pruned");
+        auto sptr_bwd_single = AM.bwd(*sptr_dyn);
+        auto sptr_fwd_single = AM.fwd(*sptr_bwd_batch);
+
+        if(sptr_bwd_batch->number() != 2 || sptr_bwd_single->number() != 2)
+            return false;
+
+        complex_float_t one(1.0), minus_one(-1.0);
+        float const tolerance = 1e-5;
+
+        shared_ptr<GadgetronImageData> sptr_img_diff = sptr_bwd_batch->clone();
+        sptr_img_diff->axpby(&one, *sptr_bwd_batch, &minus_one, *sptr_bwd_single);
+        float const img_err = sptr_img_diff->norm() / sptr_bwd_batch->norm();
+
+        shared_ptr<MRAcquisitionData> sptr_acq_diff = sptr_fwd_batch->clone();
+        sptr_acq_diff->axpby(&one, *sptr_fwd_batch, &minus_one, *sptr_fwd_single);
+        float const acq_err = sptr_acq_diff->norm() / sptr_fwd_batch->norm();
+
+        std::cout << "relative difference between batched and single-image encoding: "
+            << img_err << " (backward), " << acq_err << " (forward)" << std::endl;
+
+        return img_err < tolerance && acq_err < tolerance;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
 
 bool test_TrajectoryPreparation_constructors( void )
 {
@@ -631,6 +1357,163 @@ bool test_rpe_bwd(MRAcquisitionData& av)
     }
 }
 
+bool test_rpe_gridder_cache(MRAcquisitionData& av)
+{
+    try
+    {
+       std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+       sirf::GRPETrajectoryPrep rpe_tp;
+       rpe_tp.set_trajectory(av);
+
+       if(!av.sorted())
+           av.sort();
+
+       auto sort_idx = av.get_kspace_order();
+       sirf::AcquisitionsVector subset;
+       av.get_subset(subset, sort_idx[0]);
+
+       // the second transform reuses the gridder set up by the first one
+       RPEFourierEncoding enc;
+       CFImage img1, img2;
+       enc.backward(img1, subset);
+       enc.backward(img2, subset);
+
+       bool test_successful = (img1.getNumberOfDataElements() == img2.getNumberOfDataElements());
+       test_successful *= std::equal(img1.getDataPtr(), img1.getDataPtr() + img1.getNumberOfDataElements(), img2.getDataPtr());
+
+       // the encoders read the trajectories in place
+       ISMRMRD::Acquisition acq;
+       for(int ia=0; ia<subset.number(); ++ia)
+       {
+           subset.get_acquisition(ia, acq);
+           DataSpan<const float> traj = subset.acquisition_traj(ia);
+           test_successful *= (traj.size() == acq.getNumberOfTrajElements());
+           test_successful *= std::equal(traj.begin(), traj.end(), acq.getTrajPtr());
+       }
+
+       GridderCache2D cache;
+       Gridder2D::TrajectoryArrayType traj(4);
+       traj.fill(Gadgetron::floatd2(0.1f, -0.2f));
+       std::vector<size_t> img_dims{8, 8};
+       test_successful *= (cache.get(img_dims, traj) == cache.get(img_dims, traj));
+       test_successful *= (cache.size() == 1);
+
+       // a cache with room for all trajectories used in turn keeps them all
+       GridderCache2D small_cache(1);
+       small_cache.reserve(2);
+       Gridder2D::TrajectoryArrayType other_traj(4);
+       other_traj.fill(Gadgetron::floatd2(-0.1f, 0.2f));
+       std::shared_ptr<const Gridder2D> sptr_gridder = small_cache.get(img_dims, traj);
+       small_cache.get(img_dims, other_traj);
+       test_successful *= (small_cache.get(img_dims, traj) == sptr_gridder);
+       test_successful *= (small_cache.size() == 2);
+
+       return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_rpe_threads(MRAcquisitionData& av)
+{
+    try
+    {
+       std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+       sirf::GRPETrajectoryPrep rpe_tp;
+       rpe_tp.set_trajectory(av);
+
+       if(!av.sorted())
+           av.sort();
+
+       auto sort_idx = av.get_kspace_order();
+       sirf::AcquisitionsVector subset;
+       av.get_subset(subset, sort_idx[0]);
+
+       // slices transformed concurrently must give the serial result
+       int const num_threads = sirf::FFTWPlanner::num_threads();
+       RPEFourierEncoding enc;
+       CFImage img_serial, img_parallel;
+       sirf::FFTWPlanner::set_num_threads(1);
+       enc.backward(img_serial, subset);
+       sirf::FFTWPlanner::set_num_threads(0);
+       enc.backward(img_parallel, subset);
+       sirf::FFTWPlanner::set_num_threads(num_threads);
+
+       size_t const n = img_serial.getNumberOfDataElements();
+       bool test_successful = (n == img_parallel.getNumberOfDataElements());
+       float diff = 0, norm = 0;
+       for(size_t i=0; test_successful && i<n; ++i)
+       {
+           diff += std::norm(img_serial.getDataPtr()[i] - img_parallel.getDataPtr()[i]);
+           norm += std::norm(img_serial.getDataPtr()[i]);
+       }
+       test_successful *= (diff <= 1e-8f * norm);
+
+       return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
+bool test_rpe_normal(MRAcquisitionData& av)
+{
+    try
+    {
+       std::cout << "Running test " << __FUNCTION__ << std::endl;
+
+       sirf::GRPETrajectoryPrep rpe_tp;
+       rpe_tp.set_trajectory(av);
+
+       if(!av.sorted())
+           av.sort();
+
+       auto sort_idx = av.get_kspace_order();
+       RPEFourierEncoding enc;
+
+       // the coil images serve as coil maps for a constant image
+       CFImage csm;
+       enc.backward_subset(csm, av, sort_idx[0]);
+       CFImage img(csm.getMatrixSizeX(), csm.getMatrixSizeY(), csm.getMatrixSizeZ(), 1);
+       img.setHead(csm.getHead());
+       img.setNumberOfChannels(1);
+       std::fill(img.getDataPtr(), img.getDataPtr() + img.getNumberOfDataElements(), complex_float_t(1.f, 0.f));
+
+       // the Toeplitz embedding against forward followed by backward
+       CFImage img_toeplitz, img_fb;
+       enc.normal_sense(img_toeplitz, av, sort_idx[0], img, csm);
+       enc.FourierEncoding::normal_sense(img_fb, av, sort_idx[0], img, csm);
+
+       size_t const n = img.getNumberOfDataElements();
+       bool test_successful = (img_toeplitz.getNumberOfDataElements() == n && img_fb.getNumberOfDataElements() == n);
+       float diff = 0, norm = 0;
+       for(size_t i=0; test_successful && i<n; ++i)
+       {
+           diff += std::norm(img_toeplitz.getDataPtr()[i] - img_fb.getDataPtr()[i]);
+           norm += std::norm(img_fb.getDataPtr()[i]);
+       }
+       std::cout << "relative difference: " << std::sqrt(diff/norm) << std::endl;
+       test_successful *= (diff <= 1e-4f * norm);
+
+       return test_successful;
+    }
+    catch( std::runtime_error const &e)
+    {
+        std::cout << "Exception caught " <<__FUNCTION__ <<" .!" <<std::endl;
+        std::cout << e.what() << std::endl;
+        throw;
+    }
+}
+
 bool test_rpe_fwd(MRAcquisitionData& av)
 {
     try
@@ -743,19 +1626,34 @@ bool run_cartesian_tests(const std::string& filename_testdata)
 
     ok *= test_set_encoding_limits(av);
     ok *= test_get_kspace_order(av);
+    ok *= test_kspace_sorting_after_algebra(av);
     ok *= test_get_subset(av);
+    ok *= test_AcquisitionsView(av);
+    ok *= test_header_index(av);
+    ok *= test_algebra_kernels(av);
+    ok *= test_AcquisitionsArray(av);
+    ok *= test_AcquisitionsFile(av);
+    ok *= test_acquisition_write_back(av, std::make_shared<sirf::AcquisitionsArray>(av.acquisitions_info(), av.ignore_mask()));
+    ok *= test_acquisition_write_back(av, std::make_shared<sirf::AcquisitionsFile>(av.acquisitions_info(), av.ignore_mask()));
+    ok *= test_write_read_acquisitions(av);
     ok *= test_set_trajectory_type(av);
     ok *= test_set_trajectory(av);
 
     ok *= test_ISMRMRDImageData_from_MRAcquisitionData(av);
+    ok *= test_ISMRMRDImageData_data_access(av);
+    ok *= test_GadgetronImagesVector_contiguous(av);
     ok *= test_ISMRMRDImageData_reorienting(av);
 
     ok *= test_CoilSensitivitiesVector_calculate(av);
     ok *= test_CoilSensitivitiesVector_get_csm_as_cfimage(av);
+    ok *= test_CoilSensitivitiesVector_smoothen();
 
     ok *= test_bwd(av);
+    ok *= test_pruned_cartesian_encoding(av);
+    ok *= test_cartesian_sense_batch(av);
 
     ok *= test_acq_mod_adjointness(av);
+    ok *= test_acq_mod_normal(av);
     ok *= test_acq_mod_norm(sptr_ad);
 
     return ok;
@@ -777,11 +1675,15 @@ bool run_rpe_tests(const std::string& filename_testdata)
     ok *= test_set_rpe_trajectory(rpe_av);
     ok *= test_rpe_bwd(rpe_av);
     ok *= test_rpe_fwd(rpe_av);
+    ok *= test_rpe_gridder_cache(rpe_av);
+    ok *= test_rpe_threads(rpe_av);
+    ok *= test_rpe_normal(rpe_av);
 
     ok *= test_rpe_csm(rpe_av);
 
     ok *= test_mracquisition_model_rpe_bwd(rpe_av);
     ok *= test_acq_mod_adjointness(rpe_av);
+    ok *= test_acq_mod_normal(rpe_av);
 
     auto sptr_rpe_av = std::make_shared<AcquisitionsVector>(rpe_av);
     sirf::GRPETrajectoryPrep rpe_tp;
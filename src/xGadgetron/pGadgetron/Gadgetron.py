@@ -42,7 +42,7 @@ from sirf.Utilities import show_2D_array, show_3D_array, error, check_status, \
      pTest, RE_PYEXT
 import sirf
 from sirf import SIRF
-from sirf.SIRF import DataContainer
+from sirf.SIRF import ContiguousError, DataContainer
 import sirf.pyiutilities as pyiutil
 import sirf.pygadgetron as pygadgetron
 import sirf.pysirf as pysirf
@@ -148,6 +148,61 @@ def mr_data_path():
     '''
     return examples_data_path('MR')
 
+
+# FFT settings
+def set_fftw_planner_rigour(rigour):
+    '''Sets the rigour of FFTW planner used for plans created from now on.
+
+    rigour: 'estimate' (default), 'measure', 'patient' or 'exhaustive';
+    more rigorous planners take longer to create a plan for a new problem
+    size, but the plans they create are faster (plans are cached and
+    reused, so this pays off in iterative reconstructions).
+    '''
+    try_calling(pygadgetron.cGT_setFFTWPlannerRigour(rigour))
+
+
+def get_fftw_planner_rigour():
+    '''Returns the rigour of FFTW planner.
+    '''
+    handle = pygadgetron.cGT_FFTWPlannerRigour()
+    check_status(handle)
+    rigour = pyiutil.charDataFromHandle(handle)
+    pyiutil.deleteDataHandle(handle)
+    return rigour
+
+
+def import_fftw_wisdom(filename):
+    '''Imports FFTW wisdom from a file.
+
+    Wisdom is also imported automatically from the file named by
+    the environment variable SIRF_FFTW_WISDOM if it is set.
+    '''
+    try_calling(pygadgetron.cGT_importFFTWWisdom(filename))
+
+
+def export_fftw_wisdom(filename):
+    '''Exports the wisdom accumulated by FFTW planner to a file.
+    '''
+    try_calling(pygadgetron.cGT_exportFFTWWisdom(filename))
+
+
+def set_max_fft_threads(threads):
+    '''Sets the maximum number of threads used by FFTs.
+
+    threads = 0 (default) means the maximum number of OpenMP threads.
+    '''
+    try_calling(pygadgetron.cGT_setFFTThreads(int(threads)))
+
+
+def get_max_fft_threads():
+    '''Returns the maximum number of threads used by FFTs.
+    '''
+    handle = pygadgetron.cGT_FFTThreads()
+    check_status(handle)
+    value = pyiutil.intDataFromHandle(handle)
+    pyiutil.deleteDataHandle(handle)
+    return value
+
 ### low-level client functionality
 ### likely to be obsolete - not used for a long time
 ##class ClientConnector:
@@ -572,10 +627,43 @@ class ImageData(SIRF.ImageData):
         """Print the header of one of the images. zero based."""
         try_calling(pygadgetron.cGT_print_header(self.handle, im_num))
 
+    def make_contiguous(self):
+        '''
+        Stores the data of all images in one contiguous block of memory, so
+        that they can be viewed as a Numpy array without copying (see asarray).
+        Returns False if not possible (images of different types or shapes).
+        Images appended or replaced later are not stored in the block.
+        '''
+        assert self.handle is not None
+        handle = pygadgetron.cGT_makeImagesContiguous(self.handle)
+        check_status(handle)
+        i = pyiutil.intDataFromHandle(handle)
+        pyiutil.deleteDataHandle(handle)
+        return i != 0
+
     @property
     def shape(self):
         return self.dimensions()
-        
+
+    @property
+    def __array_interface__(self):
+        '''As per https://numpy.org/doc/stable/reference/arrays.interface.html'''
+        if not self.supports_array_view:
+            raise ContiguousError("please make an array-copy first with `asarray(copy=True)` or `as_array()`, or call `make_contiguous()`")
+        dims = tuple(int(n) for n in self.dimensions())
+        itemsize = 4 if self.is_real() else 8
+        strides = None
+        if len(dims) == 4:
+            # the images are stored as (nc, nz, ny, nx) arrays one after another,
+            # which is a (nc, number()*nz, ny, nx) array only if nz is 1
+            nc, nz, ny, nx = dims
+            if nz != self.number():
+                raise ContiguousError("multi-channel 3D images cannot be viewed as a 4D array, please use `as_array()`")
+            strides = (ny*nx*itemsize, nc*ny*nx*itemsize, nx*itemsize, itemsize)
+        return {'shape': dims, 'typestr': '<f4' if itemsize == 4 else '<c8',
+                'version': 3, 'strides': strides,
+                'data': (parms.size_t_par(self.handle, 'images', 'address'), False)}
+
 SIRF.ImageData.register(ImageData)
 
 
@@ -611,6 +699,8 @@ class CoilSensitivityData(ImageData):
         self.handle = None
         self.smoothing_iterations = 0
         self.conv_kernel_halfsize = 1
+        # kernel half-size in z-direction (0: smoothing slice by slice)
+        self.conv_kernel_halfsize_z = 0
     def __del__(self):
         if self.handle is not None:
             pyiutil.deleteDataHandle(self.handle)
@@ -638,6 +728,7 @@ class CoilSensitivityData(ImageData):
         check_status(self.handle)
         nit = self.smoothing_iterations
         w = self.conv_kernel_halfsize # convolution kernel size is (2w+1)-by-(2w+1) pixels
+        wz = self.conv_kernel_halfsize_z # and (2wz+1) pixels in z-direction
         
         if method is not None:
             method_name, parm_list = name_and_parameters(method)
@@ -650,6 +741,7 @@ class CoilSensitivityData(ImageData):
         
         parms.set_int_par(self.handle, 'coil_sensitivity', 'smoothing_iterations', nit)
         parms.set_int_par(self.handle, 'coil_sensitivity', 'conv_kernel_size', w)
+        parms.set_int_par(self.handle, 'coil_sensitivity', 'conv_kernel_size_z', wz)
 
         if isinstance(data, AcquisitionData):
             self.__calc_from_acquisitions(data, method_name)
@@ -899,16 +991,29 @@ class AcquisitionData(DataContainer):
             pyiutil.deleteDataHandle(self.handle)
     @staticmethod
     def set_storage_scheme(scheme):
-        '''Sets acquisition data storage scheme.'''
-        if scheme != 'memory':
-            msg = 'WARNING: storage scheme ' + repr(scheme) + ' not supported,'
-            msg += ' using memory storage scheme instead'
-            print(msg)
+        '''Sets acquisition data storage scheme.
+
+        scheme = 'memory' (default):
+            each acquisition read from now on is kept in RAM as a separate
+            ISMRMRD acquisition object
+        scheme = 'array':
+            samples of all acquisitions read from now on are kept in RAM
+            in one contiguous array (supports array view)
+        scheme = 'file':
+            samples of all acquisitions read from now on are kept in a
+            scratch file, only recently used blocks of them stay in RAM
+            (for data that do not fit into RAM)
+        '''
+        try_calling(pygadgetron.cGT_setAcquisitionDataStorageScheme(scheme))
     @staticmethod
     def get_storage_scheme():
         '''Returns acquisition data storage scheme.
         '''
-        return 'memory'
+        handle = pygadgetron.cGT_getAcquisitionDataStorageScheme()
+        check_status(handle)
+        scheme = pyiutil.charDataFromHandle(handle)
+        pyiutil.deleteDataHandle(handle)
+        return scheme
     def same_object(self):
         return AcquisitionData()
     def new_acquisition_data(self, empty=True):
@@ -1015,14 +1120,22 @@ class AcquisitionData(DataContainer):
         assert self.handle is not None
         try_calling( pygadgetron.cGT_appendAcquisition(self.handle, acq.handle))
     
-    def get_subset(self, idx):
+    def get_subset(self, idx, view=False):
         '''
-        Returns AcquisitionData object with subset of acquisitions defined by idx
+        Returns AcquisitionData object with subset of acquisitions defined by idx.
+        If view is True, the acquisitions are not copied: the returned object
+        refers to the acquisitions of self, and changes to its data are made
+        to the data of self (use clone() to obtain a copy).
         '''
         assert self.handle is not None
         subset = AcquisitionData()
         idx = numpy.array(idx, dtype = cpp_int_dtype())
-        subset.handle = pygadgetron.cGT_getAcquisitionsSubset(self.handle, idx.ctypes.data, idx.size)
+        if view:
+            subset.handle = pygadgetron.cGT_getAcquisitionsView \
+                (self.handle, idx.ctypes.data, idx.size)
+        else:
+            subset.handle = pygadgetron.cGT_getAcquisitionsSubset \
+                (self.handle, idx.ctypes.data, idx.size)
         check_status(subset.handle)
         
         return subset
@@ -1230,6 +1343,14 @@ class AcquisitionData(DataContainer):
     def shape(self):
         return self.dimensions()
 
+    @property
+    def __array_interface__(self):
+        '''As per https://numpy.org/doc/stable/reference/arrays.interface.html'''
+        if not self.supports_array_view:
+            raise ContiguousError("please make an array-copy first with `asarray(copy=True)` or `as_array()`")
+        return {'shape': self.shape, 'typestr': '<c8', 'version': 3,
+                'data': (parms.size_t_par(self.handle, 'acquisitions', 'address'), False)}
+
     
 DataContainer.register(AcquisitionData)
 
@@ -1264,6 +1385,17 @@ class AcquisitionModel(object):
         assert_validity(csm, CoilSensitivityData)
         try_calling(pygadgetron.cGT_setAcquisitionModelParameter \
             (self.handle, 'coil_sensitivity_maps', csm.handle))
+    def set_cartesian_encoding(self, encoding):
+        '''
+        Selects the Fourier encoding used for Cartesian data.
+        encoding: 'dense' (default) transforms the whole k-space matrix,
+                  'pruned' transforms only the acquired k-space lines,
+                  which is faster for undersampled data
+        '''
+        h = pyiutil.charDataHandle(encoding)
+        try_calling(pygadgetron.cGT_setAcquisitionModelParameter \
+            (self.handle, 'cartesian_encoding', h))
+        pyiutil.deleteDataHandle(h)
     def norm(self, num_iter=2, verb=0):
         '''Computes the norm of the forward projection operator.
         '''
@@ -1298,6 +1430,20 @@ class AcquisitionModel(object):
             (self.handle, ad.handle)
         check_status(image.handle)
         return image
+    def normal(self, image):
+        '''
+        Applies the normal operator (backward of forward) to an image
+        without simulating the acquisitions where the Fourier encoding
+        allows it (e.g. via the Toeplitz embedding for radial phase
+        encoding data).
+        image: ImageData
+        '''
+        assert_validity(image, ImageData)
+        out = ImageData()
+        out.handle = pygadgetron.cGT_AcquisitionModelNormal\
+            (self.handle, image.handle)
+        check_status(out.handle)
+        return out
     def inverse(self, ad, dcw=None):
         '''
         Weights acquisition data with k-space density prior to back-projection